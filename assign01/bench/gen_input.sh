@@ -0,0 +1,68 @@
+#!/bin/sh
+# Writes an input file for the lexer benchmark to standard output, by
+# repeating a generated chunk of about 10 MB until the output is at
+# least the given size.
+#
+#   gen_input.sh short MB
+#       short identifiers and numbers, fully parenthesized
+#       (e.g., "a = ( 8271 + x1 / 1 ) ;"), some lines indented by a tab
+#
+#   gen_input.sh long MB
+#       long identifiers and 11 to 18 digit numbers, every line
+#       indented by 8 spaces
+
+usage() {
+  echo "Usage: gen_input.sh short|long MB" >&2
+  exit 1
+}
+
+[ $# -eq 2 ] || usage
+case "$1" in
+  short|long) ;;
+  *) usage ;;
+esac
+
+chunk=$(mktemp) || exit 1
+trap 'rm -f "$chunk"' EXIT
+
+awk -v kind="$1" 'BEGIN {
+  srand(1)
+  ops = "+-*/^"
+  if (kind == "short") {
+    nv = split("a b count x1 total", v, " ")
+  } else {
+    nv = split("totalcountofitems accumulatorValue x1y2z3w4v5u6t7s8 averageLatencyMicros n", v, " ")
+  }
+  size = 0
+  while (size < 10000000) {
+    n = 1 + int(rand() * (kind == "short" ? 8 : 6))
+    e = ""
+    for (i = 0; i < n; i++) {
+      if (rand() < 0.5) {
+        operand = v[1 + int(rand() * nv)]
+      } else if (kind == "short") {
+        operand = int(rand() * 100000)
+      } else {
+        operand = (1 + int(rand() * 9)) sprintf("%09d", int(rand() * 1000000000)) int(rand() * 100000000)
+      }
+      e = e operand " " substr(ops, 1 + int(rand() * (kind == "short" ? 5 : 4)), 1) " "
+    }
+    if (kind == "short") {
+      line = v[1 + int(rand() * nv)] " = ( " e "1 ) ;"
+      if (rand() < 0.1) {
+        line = "\t" line
+      }
+    } else {
+      line = "        " v[1 + int(rand() * nv)] " = " e "1;"
+    }
+    print line
+    size += length(line) + 1
+  }
+}' > "$chunk" || exit 1
+
+chunk_size=$(wc -c < "$chunk")
+total=0
+while [ $total -lt $(($2 * 1000000)) ]; do
+  cat "$chunk"
+  total=$((total + chunk_size))
+done
@@ -0,0 +1,43 @@
+/*
+ * Benchmark driver: reads every token of a file (e.g., one written by
+ * gen_input.sh) with lexer_next, destroying each one, and reports the
+ * number of tokens, the time taken and the throughput.
+ *
+ * Usage: lexbench <filename>
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include "util.h"
+#include "lexer.h"
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    err_fatal("Usage: lexbench <filename>\n");
+  }
+
+  const char *filename = argv[1];
+  FILE *in = fopen(filename, "r");
+  if (!in) {
+    err_fatal("Could not open input file '%s'\n", filename);
+  }
+  struct Lexer *lexer = lexer_create(in, filename);
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  unsigned long num_tokens = 0;
+  struct Node *tok;
+  while ((tok = lexer_next(lexer)) != NULL) {
+    node_destroy(tok);
+    num_tokens++;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  double mb = ftell(in) / 1e6;
+  printf("%lu tokens, %.0f MB, %.2f s, %.1f MB/s\n", num_tokens, mb, secs, mb / secs);
+
+  lexer_destroy(lexer);
+  fclose(in);
+  return 0;
+}
@@ -0,0 +1,18 @@
+#!/bin/sh
+# Lexer throughput on generated files of short and of long tokens (see
+# gen_input.sh), of the given size in MB (1000 by default).  The files
+# are written to a temporary directory, so it needs room for one of them.
+#
+# Run from the directory of the Makefile ("make benchmark").
+
+size=${1:-1000}
+
+out=$(mktemp -d) || exit 1
+trap 'rm -rf "$out"' EXIT
+
+for kind in short long; do
+  ./bench/gen_input.sh $kind $size > "$out/$kind.in" || exit 1
+  printf "%s tokens: " $kind
+  ./bench/lexbench "$out/$kind.in" || exit 1
+  rm -f "$out/$kind.in"
+done
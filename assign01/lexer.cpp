@@ -1,22 +1,168 @@
-#include <cctype>
+#include <cstring>
 #include <string>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "cpputil.h"
+#include "util.h"
 #include "token.h"
 #include "error.h"
 #include "lexer.h"
 
+////////////////////////////////////////////////////////////////////////
+// Character scanning
+////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// Character classes (as in the C locale)
+inline bool is_space(unsigned char c) {
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+inline bool is_digit(unsigned char c) {
+  return c >= '0' && c <= '9';
+}
+
+inline bool is_alpha(unsigned char c) {
+  return (c | 0x20) >= 'a' && (c | 0x20) <= 'z';
+}
+
+inline bool is_alnum(unsigned char c) {
+  return is_digit(c) || is_alpha(c);
+}
+
+#ifdef __SSE2__
+// Bitmasks of the characters of a 16-character block (bit i is set if
+// character i is in the class).  The comparisons are signed, so characters
+// above 127 are in none of the classes.
+inline unsigned in_range_mask(__m128i block, char lo, char hi) {
+  __m128i ge_lo = _mm_cmpgt_epi8(block, _mm_set1_epi8(char(lo - 1)));
+  __m128i le_hi = _mm_cmplt_epi8(block, _mm_set1_epi8(char(hi + 1)));
+  return unsigned(_mm_movemask_epi8(_mm_and_si128(ge_lo, le_hi)));
+}
+
+inline unsigned space_mask(__m128i block) {
+  unsigned spaces = unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8(' '))));
+  return spaces | in_range_mask(block, '\t', '\r');
+}
+
+inline unsigned digit_mask(__m128i block) {
+  return in_range_mask(block, '0', '9');
+}
+
+inline unsigned alnum_mask(__m128i block) {
+  return digit_mask(block) | in_range_mask(_mm_or_si128(block, _mm_set1_epi8(0x20)), 'a', 'z');
+}
+#endif // __SSE2__
+
+// Count the newlines at the positions (relative to p) in a bitmask, and
+// note the position after the last one
+inline void count_newlines(unsigned newlines, const char *p, int &num_newlines, const char *&line_start) {
+  if (newlines != 0) {
+    num_newlines += __builtin_popcount(newlines);
+    line_start = p + (31 - __builtin_clz(newlines)) + 1;
+  }
+}
+
+// Find the first character in [p, end) which isn't whitespace, counting
+// the newlines before it, and noting the position after the last one.
+const char *skip_spaces(const char *p, const char *end, int &num_newlines, const char *&line_start) {
+  // most tokens are separated by a single space, if any, which isn't
+  // worth a vector comparison
+  if (p < end && *p == ' ') {
+    p++;
+  }
+#ifdef __SSE2__
+  while (p + 16 <= end && is_space(*p)) {
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    unsigned spaces = space_mask(block);
+    unsigned newlines = unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8('\n'))));
+    if (spaces != 0xFFFF) {
+      unsigned n = unsigned(__builtin_ctz(~spaces));
+      count_newlines(newlines & ((1U << n) - 1), p, num_newlines, line_start);
+      return p + n;
+    }
+    count_newlines(newlines, p, num_newlines, line_start);
+    p += 16;
+  }
+#endif // __SSE2__
+  for (; p < end && is_space(*p); p++) {
+    if (*p == '\n') {
+      num_newlines++;
+      line_start = p + 1;
+    }
+  }
+  return p;
+}
+
+// Find the first character in [p, end) which isn't a digit.  (The first
+// is checked on its own, since many tokens are only one character long.)
+const char *skip_digits(const char *p, const char *end) {
+  if (p < end && !is_digit(*p)) {
+    return p;
+  }
+#ifdef __SSE2__
+  while (p + 16 <= end) {
+    unsigned digits = digit_mask(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+    if (digits != 0xFFFF) {
+      return p + __builtin_ctz(~digits);
+    }
+    p += 16;
+  }
+#endif // __SSE2__
+  while (p < end && is_digit(*p)) {
+    p++;
+  }
+  return p;
+}
+
+// Find the first character in [p, end) which isn't a letter or digit
+const char *skip_alnums(const char *p, const char *end) {
+  if (p < end && !is_alnum(*p)) {
+    return p;
+  }
+#ifdef __SSE2__
+  while (p + 16 <= end) {
+    unsigned alnums = alnum_mask(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+    if (alnums != 0xFFFF) {
+      return p + __builtin_ctz(~alnums);
+    }
+    p += 16;
+  }
+#endif // __SSE2__
+  while (p < end && is_alnum(*p)) {
+    p++;
+  }
+  return p;
+}
+
+}
+
 ////////////////////////////////////////////////////////////////////////
 // Lexer implementation
 ////////////////////////////////////////////////////////////////////////
 
+// The input is read in blocks of BLOCK_SIZE characters, and scanned in the
+// buffer, so that whitespace, identifiers and integer literals are each
+// found by one scan (16 characters at a time, with SSE2) rather than
+// character by character.
 struct Lexer {
 private:
+  static const size_t BLOCK_SIZE = 1 << 20;
+
   FILE *m_in;
   struct Node *m_next;
   std::string m_filename;
   int m_line, m_col;
   bool m_eof;
 
+  // the characters read but not yet scanned are [m_pos, m_end) in m_buf
+  std::vector<char> m_buf;
+  const char *m_pos, *m_end;
+  bool m_input_eof;
+
 public:
   Lexer(FILE *in, const std::string &filename);
   ~Lexer();
@@ -27,12 +173,12 @@ public:
   struct SourceInfo get_current_pos() const;
 
 private:
-  int read();
-  void unread(int c);
+  bool refill();
+  bool skip_whitespace();
   void fill();
   struct Node *read_token();
-  struct Node *read_continued_token(enum TokenKind kind, const std::string &lexeme_start, int line, int col);
-  struct Node *token_create(enum TokenKind kind, const std::string &lexeme, int line, int col);
+  struct Node *read_continued_token(enum TokenKind kind, int line, int col);
+  struct Node *token_create(enum TokenKind kind, const char *lexeme, size_t len, int line, int col);
 };
 
 Lexer::Lexer(FILE *in, const std::string &filename)
@@ -41,7 +187,11 @@ Lexer::Lexer(FILE *in, const std::string &filename)
   , m_filename(filename)
   , m_line(1)
   , m_col(1)
-  , m_eof(false) {
+  , m_eof(false)
+  , m_buf(BLOCK_SIZE)
+  , m_pos(m_buf.data())
+  , m_end(m_buf.data())
+  , m_input_eof(false) {
 }
 
 Lexer::~Lexer() {
@@ -68,131 +218,144 @@ struct SourceInfo Lexer::get_current_pos() const {
   return source_pos;
 }
 
-// Read the next character of input, returning -1 (and setting m_eof to true)
-// if the end of input has been reached.
-int Lexer::read() {
-  if (m_eof) {
-    return -1;
+// Read more input, keeping the characters not yet scanned (which move to
+// the start of the buffer).  Returns false if the end of input has been
+// reached.
+bool Lexer::refill() {
+  if (m_input_eof) {
+    return false;
+  }
+  size_t remaining = size_t(m_end - m_pos);
+  memmove(m_buf.data(), m_pos, remaining);
+  if (remaining == m_buf.size()) {
+    // a token as long as the buffer
+    m_buf.resize(2 * m_buf.size());
   }
-  int c = fgetc(m_in);
-  if (c < 0) {
-    m_eof = true;
-  } else if (c == '\n') {
-    m_col = 1;
-    m_line++;
-  } else {
-    m_col++;
+  size_t n = fread(m_buf.data() + remaining, 1, m_buf.size() - remaining, m_in);
+  m_pos = m_buf.data();
+  m_end = m_pos + remaining + n;
+  if (n == 0) {
+    m_input_eof = true;
+    return false;
   }
-  return c;
+  return true;
 }
 
-// "Unread" a character.  Useful for when reading a character indicates
-// that the current token has ended and the next one has begun.
-void Lexer::unread(int c) {
-  ungetc(c, m_in);
-  m_col--;
+// Skip whitespace, keeping track of the line and column.  Returns false
+// if the end of input has been reached.
+bool Lexer::skip_whitespace() {
+  for (;;) {
+    int num_newlines = 0;
+    const char *line_start = nullptr;
+    const char *p = skip_spaces(m_pos, m_end, num_newlines, line_start);
+    if (num_newlines > 0) {
+      m_line += num_newlines;
+      m_col = 1 + int(p - line_start);
+    } else {
+      m_col += int(p - m_pos);
+    }
+    m_pos = p;
+    if (m_pos < m_end) {
+      return true;
+    }
+    if (!refill()) {
+      return false;
+    }
+  }
 }
 
 void Lexer::fill() {
   if (!m_eof && !m_next) {
     m_next = read_token();
+    m_eof = (m_next == nullptr);
   }
 }
 
 struct Node *Lexer::read_token() {
-  int c, line = -1, col = -1;
-
-  // skip whitespace characters until a non-whitespace character is read
-  for (;;) {
-    line = m_line;
-    col = m_col;
-    c = read();
-    if (c < 0 || !isspace(c)) {
-      break;
-    }
-  }
-
-  if (c < 0) {
+  if (!skip_whitespace()) {
     // reached end of file
     return nullptr;
   }
 
-  std::string lexeme;
-  lexeme.push_back(char(c));
-
-  if (isalpha(c)) {
-    return read_continued_token(TOK_IDENTIFIER, lexeme, line, col);
-  } else if (isdigit(c)) {
-    return read_continued_token(TOK_INTEGER_LITERAL, lexeme, line, col);
-  } else {
-    switch (c) {
-    case '+':
-      return token_create(TOK_PLUS, lexeme, line, col);
-    case '-':
-      return token_create(TOK_MINUS, lexeme, line, col);
-    case '*':
-      return token_create(TOK_TIMES, lexeme, line, col);
-    case '/':
-      return token_create(TOK_DIVIDE, lexeme, line, col);
-    case '^':
-      return token_create(TOK_POWER, lexeme, line, col);
-    case ';':
-      return token_create(TOK_SEMICOLON, lexeme, line, col);
-    case '=':
-      return token_create(TOK_ASSIGN, lexeme, line, col);
-    case '(':
-      return token_create(TOK_LPAREN, lexeme, line, col);
-    case ')':
-      return token_create(TOK_RPAREN, lexeme, line, col);
-    default:
-      {
-        struct SourceInfo pos = {
-          .filename = m_filename.c_str(),
-          .line = line,
-          .col = col,
-        };
-        std::string errmsg = cpputil::format("Unrecognized character '%c'", c).c_str();
-        error_at_pos(pos, errmsg.c_str());
-        return nullptr;
-      }
+  int line = m_line, col = m_col;
+  unsigned char c = (unsigned char) *m_pos;
+  if (is_alpha(c)) {
+    return read_continued_token(TOK_IDENTIFIER, line, col);
+  } else if (is_digit(c)) {
+    return read_continued_token(TOK_INTEGER_LITERAL, line, col);
+  }
+
+  enum TokenKind kind;
+  switch (c) {
+  case '+':
+    kind = TOK_PLUS;
+    break;
+  case '-':
+    kind = TOK_MINUS;
+    break;
+  case '*':
+    kind = TOK_TIMES;
+    break;
+  case '/':
+    kind = TOK_DIVIDE;
+    break;
+  case '^':
+    kind = TOK_POWER;
+    break;
+  case ';':
+    kind = TOK_SEMICOLON;
+    break;
+  case '=':
+    kind = TOK_ASSIGN;
+    break;
+  case '(':
+    kind = TOK_LPAREN;
+    break;
+  case ')':
+    kind = TOK_RPAREN;
+    break;
+  default:
+    {
+      struct SourceInfo pos = {
+        .filename = m_filename.c_str(),
+        .line = line,
+        .col = col,
+      };
+      std::string errmsg = cpputil::format("Unrecognized character '%c'", c).c_str();
+      error_at_pos(pos, errmsg.c_str());
+      return nullptr;
     }
-  } 
+  }
+  struct Node *tok = token_create(kind, m_pos, 1, line, col);
+  m_pos++;
+  m_col++;
+  return tok;
 }
 
-// Read the continuation of a (possibly) multi-character token, such as
-// an identifier or integer literal.  pred is a pointer to a predicate
-// function to determine which characters are valid continuations.
-struct Node *Lexer::read_continued_token(enum TokenKind kind, const std::string &lexeme_start, int line, int col) {
-  std::string lexeme(lexeme_start);
+// Read a (possibly) multi-character token, such as an identifier or
+// integer literal, which starts at the current position.
+struct Node *Lexer::read_continued_token(enum TokenKind kind, int line, int col) {
+  size_t len = 1;
   for (;;) {
-    int c = read();
-    if (kind == TOK_INTEGER_LITERAL) {
-      if (c >= 0 && isdigit(c)) {
-        // token has finished
-        lexeme.push_back(char(c));
-      } else {
-        if (c >= 0) {
-          unread(c);
-        }
-        return token_create(kind, lexeme, line, col);
-      }
-    } else if (kind == TOK_IDENTIFIER) {
-      if (c >= 0 && (isdigit(c) || isalpha(c))) {
-        // token has finished
-        lexeme.push_back(char(c));
-      } else {
-        if (c >= 0) {
-          unread(c);
-        }
-        return token_create(kind, lexeme, line, col);
-      }
+    const char *p = (kind == TOK_IDENTIFIER) ? skip_alnums(m_pos + len, m_end) : skip_digits(m_pos + len, m_end);
+    len = size_t(p - m_pos);
+    // the token may continue in the next block
+    if (p < m_end || !refill()) {
+      break;
     }
   }
+  struct Node *tok = token_create(kind, m_pos, len, line, col);
+  m_pos += len;
+  m_col += int(len);
+  return tok;
 }
 
 // Helper function to create a Node object to represent a token.
-struct Node *Lexer::token_create(enum TokenKind kind, const std::string &lexeme, int line, int col) {
-  struct Node *token = node_alloc_str_copy(kind, lexeme.c_str());
+struct Node *Lexer::token_create(enum TokenKind kind, const char *lexeme, size_t len, int line, int col) {
+  char *str = static_cast<char *>(xmalloc(len + 1));
+  memcpy(str, lexeme, len);
+  str[len] = '\0';
+  struct Node *token = node_alloc_str_adopt(kind, str);
   struct SourceInfo source_info = {
     .filename = m_filename.c_str(),
     .line = line,
@@ -0,0 +1,117 @@
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include "util.h"
+#include "arena.h"
+
+////////////////////////////////////////////////////////////////////////
+// Arena implementation
+////////////////////////////////////////////////////////////////////////
+
+Arena::Arena()
+    : m_pos(nullptr)
+    , m_end(nullptr)
+    , m_num_bytes(0) {
+}
+
+Arena::~Arena() {
+    for (auto i = m_finalizers.rbegin(); i != m_finalizers.rend(); i++) {
+        i->destroy(i->obj);
+    }
+    for (auto i = m_chunks.begin(); i != m_chunks.end(); i++) {
+        free(*i);
+    }
+}
+
+void *Arena::allocate(size_t size, size_t align) {
+    assert(align != 0 && (align & (align - 1)) == 0);
+    uintptr_t pos = (uintptr_t(m_pos) + align - 1) & ~uintptr_t(align - 1);
+    if (m_pos == nullptr || pos + size > uintptr_t(m_end)) {
+        // an allocation bigger than a quarter chunk gets its own chunk,
+        // so that little of the current chunk is wasted
+        if (size + align > CHUNK_SIZE / 4) {
+            char *chunk = static_cast<char *>(xmalloc(size + align));
+            m_chunks.push_back(chunk);
+            m_num_bytes += size + align;
+            return reinterpret_cast<void *>((uintptr_t(chunk) + align - 1) & ~uintptr_t(align - 1));
+        }
+        add_chunk(CHUNK_SIZE);
+        pos = (uintptr_t(m_pos) + align - 1) & ~uintptr_t(align - 1);
+    }
+    m_pos = reinterpret_cast<char *>(pos + size);
+    return reinterpret_cast<void *>(pos);
+}
+
+void Arena::add_chunk(size_t size) {
+    char *chunk = static_cast<char *>(xmalloc(size));
+    m_chunks.push_back(chunk);
+    m_num_bytes += size;
+    m_pos = chunk;
+    m_end = chunk + size;
+}
+
+////////////////////////////////////////////////////////////////////////
+// StringPool implementation
+////////////////////////////////////////////////////////////////////////
+
+StringPool::StringPool()
+    : m_slots(256, Slot { nullptr, 0, 0 })
+    , m_count(0) {
+}
+
+StringPool::~StringPool() {
+}
+
+const char *StringPool::intern(const char *str) {
+    return intern(str, strlen(str));
+}
+
+const char *StringPool::intern(const char *str, size_t len) {
+    const unsigned h = hash(str, len);
+    const size_t mask = m_slots.size() - 1;
+    size_t i = h & mask;
+    while (m_slots[i].str != nullptr) {
+        const Slot &slot = m_slots[i];
+        if (slot.hash == h && slot.len == len && memcmp(slot.str, str, len) == 0) {
+            return slot.str;
+        }
+        i = (i + 1) & mask;
+    }
+
+    char *copy = m_arena.allocate_array<char>(len + 1);
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    m_slots[i] = Slot { copy, len, h };
+    m_count++;
+
+    // keep the table at most half full
+    if (m_count * 2 > m_slots.size()) {
+        grow();
+    }
+    return copy;
+}
+
+unsigned StringPool::hash(const char *str, size_t len) {
+    unsigned h = 2166136261U;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char) str[i]) * 16777619U;
+    }
+    return h;
+}
+
+void StringPool::grow() {
+    std::vector<Slot> old(m_slots.size() * 2, Slot { nullptr, 0, 0 });
+    old.swap(m_slots);
+    const size_t mask = m_slots.size() - 1;
+    for (auto j = old.cbegin(); j != old.cend(); j++) {
+        if (j->str == nullptr) {
+            continue;
+        }
+        size_t i = j->hash & mask;
+        while (m_slots[i].str != nullptr) {
+            i = (i + 1) & mask;
+        }
+        m_slots[i] = *j;
+    }
+}
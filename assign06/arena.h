@@ -0,0 +1,108 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+#include <type_traits>
+
+// Memory from which objects are allocated by bumping a pointer, and
+// which is freed all at once when the Arena is destroyed.  Memory comes
+// from chunks of CHUNK_SIZE bytes; a large allocation gets a chunk of
+// its own.  Objects created with create() are destroyed (in reverse
+// order of creation) along with the Arena, if they need to be.
+class Arena {
+public:
+    static const size_t CHUNK_SIZE = 64 * 1024;
+
+private:
+    struct Finalizer {
+        void (*destroy)(void *);
+        void *obj;
+    };
+
+    std::vector<char *> m_chunks;
+    char *m_pos, *m_end;
+    size_t m_num_bytes;                 // total size of the chunks
+    std::vector<Finalizer> m_finalizers;
+
+    // copy ctor and assignment operator disallowed
+    Arena(const Arena &);
+    Arena &operator=(const Arena &);
+
+public:
+    Arena();
+    ~Arena();
+
+    // allocate uninitialized memory
+    void *allocate(size_t size, size_t align = alignof(std::max_align_t));
+
+    template<typename T>
+    T *allocate_array(size_t n) {
+        return static_cast<T *>(allocate(n * sizeof(T), alignof(T)));
+    }
+
+    // construct an object in the Arena
+    template<typename T, typename... Args>
+    T *create(Args&&... args) {
+        T *obj = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        if (!std::is_trivially_destructible<T>::value) {
+            m_finalizers.push_back({ &destroy<T>, obj });
+        }
+        return obj;
+    }
+
+    // number of bytes obtained from the system
+    size_t get_num_bytes() const { return m_num_bytes; }
+
+private:
+    template<typename T>
+    static void destroy(void *obj) {
+        static_cast<T *>(obj)->~T();
+    }
+
+    void add_chunk(size_t size);
+};
+
+// Interned strings: intern() returns the same pointer for equal strings,
+// so that interned strings can be compared (and hashed) by address.  The
+// strings are kept in an Arena, and found by an open-addressing hash
+// table with linear probing.
+class StringPool {
+private:
+    struct Slot {
+        const char *str;    // null if the slot is empty
+        size_t len;
+        unsigned hash;
+    };
+
+    Arena m_arena;
+    std::vector<Slot> m_slots;          // the number of slots is a power of 2
+    unsigned m_count;
+
+    // copy ctor and assignment operator disallowed
+    StringPool(const StringPool &);
+    StringPool &operator=(const StringPool &);
+
+public:
+    StringPool();
+    ~StringPool();
+
+    const char *intern(const char *str);
+    const char *intern(const char *str, size_t len);
+
+    // number of distinct strings
+    unsigned get_count() const { return m_count; }
+
+    // number of bytes used by the strings and the table
+    size_t get_num_bytes() const { return m_arena.get_num_bytes() + m_slots.size() * sizeof(Slot); }
+
+    // FNV-1a
+    static unsigned hash(const char *str, size_t len);
+
+private:
+    void grow();
+};
+
+#endif // ARENA_H
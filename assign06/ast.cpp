@@ -51,6 +51,11 @@ const char *ast_get_tag_name(int ast_tag) {
   case AST_FIELD_REF: return "field_ref";
   case AST_IDENTIFIER_LIST: return "identifier_list";
   case AST_EXPRESSION_LIST: return "expression_list";
+  case AST_PROCEDURE: return "procedure";
+  case AST_FUNCTION: return "function";
+  case AST_PARAMETERS: return "parameters";
+  case AST_CALL: return "call";
+  case AST_RETURN: return "return";
   default:
     err_fatal("Unknown AST node type %d\n", ast_tag);
     return "<<unknown>>";
@@ -49,6 +49,12 @@ enum ASTKind {
 
   AST_IDENTIFIER_LIST,
   AST_EXPRESSION_LIST,
+
+  AST_PROCEDURE,
+  AST_FUNCTION,
+  AST_PARAMETERS,
+  AST_CALL,
+  AST_RETURN,
 };
 
 const char *ast_get_tag_name(int ast_tag);
@@ -124,6 +124,21 @@ void ASTVisitor::visit(struct Node *ast) {
   case AST_EXPRESSION_LIST:
     visit_expression_list(ast);
     break;
+  case AST_PROCEDURE:
+    visit_procedure(ast);
+    break;
+  case AST_FUNCTION:
+    visit_function(ast);
+    break;
+  case AST_PARAMETERS:
+    visit_parameters(ast);
+    break;
+  case AST_CALL:
+    visit_call(ast);
+    break;
+  case AST_RETURN:
+    visit_return(ast);
+    break;
   case NODE_TOK_IDENT:
     visit_identifier(ast);
     break;
@@ -287,6 +302,26 @@ void ASTVisitor::visit_identifier(struct Node *ast) {
   recur_on_children(ast); // default behavior
 }
 
+void ASTVisitor::visit_procedure(struct Node *ast) {
+  recur_on_children(ast); // default behavior
+}
+
+void ASTVisitor::visit_function(struct Node *ast) {
+  recur_on_children(ast); // default behavior
+}
+
+void ASTVisitor::visit_parameters(struct Node *ast) {
+  recur_on_children(ast); // default behavior
+}
+
+void ASTVisitor::visit_call(struct Node *ast) {
+  recur_on_children(ast); // default behavior
+}
+
+void ASTVisitor::visit_return(struct Node *ast) {
+  recur_on_children(ast); // default behavior
+}
+
 void ASTVisitor::recur_on_children(struct Node *ast) {
   int num_kids = node_get_num_kids(ast);
   for (int i = 0; i < num_kids; i++) {
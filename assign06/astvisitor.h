@@ -46,6 +46,11 @@ public:
   virtual void visit_identifier_list(struct Node *ast);
   virtual void visit_expression_list(struct Node *ast);
   virtual void visit_identifier(struct Node *ast);
+  virtual void visit_procedure(struct Node *ast);
+  virtual void visit_function(struct Node *ast);
+  virtual void visit_parameters(struct Node *ast);
+  virtual void visit_call(struct Node *ast);
+  virtual void visit_return(struct Node *ast);
 
   virtual void recur_on_children(struct Node *ast);
 };
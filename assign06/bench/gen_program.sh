@@ -0,0 +1,47 @@
+#!/bin/sh
+# Writes a generated source program for the benchmarks to standard output.
+#
+#   gen_program.sh statements N
+#       a program of 2N statements: N copies of an assignment of an
+#       arithmetic expression followed by an IF (about 40 bytes per
+#       statement)
+#
+#   gen_program.sh declarations N
+#       a program declaring N variables, one VAR declaration each,
+#       whose body uses the first, middle and last of them
+
+usage() {
+  echo "Usage: gen_program.sh statements|declarations N" >&2
+  exit 1
+}
+
+[ $# -eq 2 ] || usage
+
+case "$1" in
+  statements)
+    awk -v n="$2" 'BEGIN {
+      print "PROGRAM statements;"
+      print "VAR a, b, c, d, x, counter_variable: INTEGER;"
+      print "BEGIN"
+      for (i = 0; i < n; i++) {
+        print "  x := (a + b) * c - d DIV 3 + counter_variable;"
+        print "  IF x < 10 THEN a := a + 1; END;"
+      }
+      print "END."
+    }'
+    ;;
+  declarations)
+    awk -v n="$2" 'BEGIN {
+      print "PROGRAM declarations;"
+      for (i = 0; i < n; i++) {
+        print "VAR v" i ": INTEGER;"
+      }
+      print "BEGIN"
+      print "  v0 := v" (n - 1) " + v" int(n / 2) ";"
+      print "END."
+    }'
+    ;;
+  *)
+    usage
+    ;;
+esac
@@ -0,0 +1,64 @@
+// Benchmark driver: parses a source program (e.g., one written by
+// gen_program.sh), and reports the time taken and the peak memory use
+// of the process (which is mostly the AST).  With -s, it then builds
+// the symbol table, and reports the time that took as well.
+//
+// Usage: parsebench [-s] <filename>
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <sys/resource.h>
+#include "util.h"
+#include "context.h"
+
+extern "C" {
+int yyparse(void);
+void lexer_set_source_file(const char *filename);
+int lexer_map_source_file(const char *filename);
+}
+
+namespace {
+  double elapsed(const timespec &start, const timespec &end) {
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  }
+}
+
+int main(int argc, char **argv) {
+  extern FILE *yyin;
+  extern struct Node *g_program;
+
+  bool build_symtab = (argc == 3 && strcmp(argv[1], "-s") == 0);
+  if (argc != (build_symtab ? 3 : 2)) {
+    err_fatal("Usage: parsebench [-s] <filename>\n");
+  }
+  const char *filename = argv[argc - 1];
+
+  // read the source the way the compiler does
+  if (!lexer_map_source_file(filename)) {
+    yyin = fopen(filename, "r");
+    if (!yyin) {
+      err_fatal("Could not open input file \"%s\"\n", filename);
+    }
+  }
+  lexer_set_source_file(filename);
+
+  timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  yyparse();
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  printf("parse: %.3f s, peak RSS %ld MB\n", elapsed(start, end), usage.ru_maxrss / 1024);
+
+  if (build_symtab) {
+    struct Context *ctx = context_create(g_program);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    context_build_symtab(ctx);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("symbol table: %.3f s\n", elapsed(start, end));
+  }
+
+  return 0;
+}
@@ -0,0 +1,22 @@
+#!/bin/sh
+# Benchmarks, each run three times:
+#   - parsing a generated program of 300,000 statements (about 12 MB),
+#     reporting the time and the peak memory use
+#   - building the symbol table of a program declaring 100,000 variables
+#
+# Run from the directory of the compiler ("make benchmark").
+
+out=$(mktemp -d) || exit 1
+trap 'rm -rf "$out"' EXIT
+
+./bench/gen_program.sh statements 150000 > "$out/statements.in" || exit 1
+echo "300,000 statements ($(wc -c < "$out/statements.in") bytes):"
+for i in 1 2 3; do
+  ./bench/parsebench "$out/statements.in" || exit 1
+done
+
+./bench/gen_program.sh declarations 100000 > "$out/declarations.in" || exit 1
+echo "100,000 declarations:"
+for i in 1 2 3; do
+  ./bench/parsebench -s "$out/declarations.in" || exit 1
+done
@@ -0,0 +1,209 @@
+#include <cassert>
+#include <algorithm>
+#include <iterator>
+#include "bitvector.h"
+
+const unsigned BitVector::NPOS;
+const unsigned BitVector::SPARSE_MIN_SIZE;
+
+BitVector::BitVector(unsigned size)
+        : m_size(size)
+        , m_sparse(size >= SPARSE_MIN_SIZE) {
+    if (!m_sparse) {
+        m_words.assign(num_words(size), 0);
+    }
+}
+
+bool BitVector::test(unsigned i) const {
+    if (i >= m_size) {
+        return false;
+    }
+    if (m_sparse) {
+        return std::binary_search(m_members.begin(), m_members.end(), i);
+    }
+    return (m_words[i / 64] & (uint64_t(1) << (i % 64))) != 0;
+}
+
+void BitVector::set(unsigned i) {
+    assert(i < m_size);
+    if (m_sparse) {
+        auto pos = std::lower_bound(m_members.begin(), m_members.end(), i);
+        if (pos == m_members.end() || *pos != i) {
+            m_members.insert(pos, i);
+            check_density();
+        }
+    } else {
+        m_words[i / 64] |= uint64_t(1) << (i % 64);
+    }
+}
+
+void BitVector::reset(unsigned i) {
+    if (i >= m_size) {
+        return;
+    }
+    if (m_sparse) {
+        auto pos = std::lower_bound(m_members.begin(), m_members.end(), i);
+        if (pos != m_members.end() && *pos == i) {
+            m_members.erase(pos);
+        }
+    } else {
+        m_words[i / 64] &= ~(uint64_t(1) << (i % 64));
+    }
+}
+
+void BitVector::clear() {
+    m_members.clear();
+    std::fill(m_words.begin(), m_words.end(), 0);
+}
+
+unsigned BitVector::count() const {
+    if (m_sparse) {
+        return unsigned(m_members.size());
+    }
+    unsigned n = 0;
+    for (auto w : m_words) {
+        n += unsigned(__builtin_popcountll(w));
+    }
+    return n;
+}
+
+bool BitVector::any() const {
+    if (m_sparse) {
+        return !m_members.empty();
+    }
+    for (auto w : m_words) {
+        if (w != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+unsigned BitVector::find_next(unsigned i) const {
+    if (i >= m_size) {
+        return NPOS;
+    }
+    if (m_sparse) {
+        auto pos = std::lower_bound(m_members.begin(), m_members.end(), i);
+        return pos == m_members.end() ? NPOS : *pos;
+    }
+
+    unsigned w = i / 64;
+    uint64_t bits = m_words[w] & (~uint64_t(0) << (i % 64));
+    while (bits == 0) {
+        if (++w == m_words.size()) {
+            return NPOS;
+        }
+        bits = m_words[w];
+    }
+    return w * 64 + unsigned(__builtin_ctzll(bits));
+}
+
+BitVector &BitVector::operator|=(const BitVector &other) {
+    assert(m_size == other.m_size);
+    if (m_sparse && other.m_sparse) {
+        std::vector<unsigned> merged;
+        merged.reserve(m_members.size() + other.m_members.size());
+        std::set_union(m_members.begin(), m_members.end(),
+                       other.m_members.begin(), other.m_members.end(),
+                       std::back_inserter(merged));
+        m_members.swap(merged);
+        check_density();
+    } else if (other.m_sparse) {
+        for (auto i : other.m_members) {
+            m_words[i / 64] |= uint64_t(1) << (i % 64);
+        }
+    } else {
+        make_dense();
+        for (unsigned w = 0; w < m_words.size(); w++) {
+            m_words[w] |= other.m_words[w];
+        }
+    }
+    return *this;
+}
+
+BitVector &BitVector::operator&=(const BitVector &other) {
+    assert(m_size == other.m_size);
+    if (m_sparse) {
+        // the result is no larger than this set, so it stays sparse
+        auto keep = std::remove_if(m_members.begin(), m_members.end(),
+                                   [&other](unsigned i) { return !other.test(i); });
+        m_members.erase(keep, m_members.end());
+    } else if (other.m_sparse) {
+        std::vector<unsigned> members;
+        for (auto i : other.m_members) {
+            if (test(i)) {
+                members.push_back(i);
+            }
+        }
+        m_words.clear();
+        m_members.swap(members);
+        m_sparse = true;
+    } else {
+        for (unsigned w = 0; w < m_words.size(); w++) {
+            m_words[w] &= other.m_words[w];
+        }
+    }
+    return *this;
+}
+
+BitVector &BitVector::operator-=(const BitVector &other) {
+    assert(m_size == other.m_size);
+    if (m_sparse) {
+        auto keep = std::remove_if(m_members.begin(), m_members.end(),
+                                   [&other](unsigned i) { return other.test(i); });
+        m_members.erase(keep, m_members.end());
+    } else if (other.m_sparse) {
+        for (auto i : other.m_members) {
+            m_words[i / 64] &= ~(uint64_t(1) << (i % 64));
+        }
+    } else {
+        for (unsigned w = 0; w < m_words.size(); w++) {
+            m_words[w] &= ~other.m_words[w];
+        }
+    }
+    return *this;
+}
+
+bool BitVector::operator==(const BitVector &other) const {
+    if (m_size != other.m_size) {
+        return false;
+    }
+    if (m_sparse && other.m_sparse) {
+        return m_members == other.m_members;
+    }
+    if (!m_sparse && !other.m_sparse) {
+        return m_words == other.m_words;
+    }
+
+    // mixed representations: every member of the sparse set must be
+    // in the dense set, and the dense set can have no other members
+    const BitVector &sparse = m_sparse ? *this : other;
+    const BitVector &dense = m_sparse ? other : *this;
+    for (auto i : sparse.m_members) {
+        if (!dense.test(i)) {
+            return false;
+        }
+    }
+    return dense.count() == sparse.count();
+}
+
+void BitVector::make_dense() {
+    if (!m_sparse) {
+        return;
+    }
+    m_words.assign(num_words(m_size), 0);
+    for (auto i : m_members) {
+        m_words[i / 64] |= uint64_t(1) << (i % 64);
+    }
+    std::vector<unsigned>().swap(m_members);
+    m_sparse = false;
+}
+
+void BitVector::check_density() {
+    // a member takes 32 bits in the sparse representation, and the
+    // packed representation takes one bit per element of the universe
+    if (m_members.size() > m_size / 32) {
+        make_dense();
+    }
+}
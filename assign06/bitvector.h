@@ -0,0 +1,64 @@
+#ifndef BITVECTOR_H
+#define BITVECTOR_H
+
+#include <cstdint>
+#include <vector>
+
+// Set of small nonnegative integers (e.g., vreg numbers) with a size
+// fixed when it is created.
+//
+// Sets over a small universe are stored as packed 64-bit words, so that
+// union, intersection and difference are simple loops over contiguous
+// words (which the compiler can vectorize).  Sets over a large universe
+// start out as a sorted vector of their members, and switch to the
+// packed representation once that would take less memory; this keeps
+// per-block dataflow facts from using memory proportional to
+// (number of blocks) * (number of vregs) when most sets are small.
+class BitVector {
+public:
+    // returned by find_next when there are no more members
+    static const unsigned NPOS = ~0U;
+
+    // universes at least this large start out sparse
+    static const unsigned SPARSE_MIN_SIZE = 1U << 14;
+
+private:
+    unsigned m_size;
+    bool m_sparse;
+    std::vector<uint64_t> m_words;      // packed representation
+    std::vector<unsigned> m_members;    // sparse representation (sorted)
+
+public:
+    explicit BitVector(unsigned size = 0);
+
+    // number of elements in the universe (not the number of members)
+    unsigned size() const { return m_size; }
+
+    bool test(unsigned i) const;
+    void set(unsigned i);
+    void reset(unsigned i);
+    void clear();
+
+    // number of members
+    unsigned count() const;
+    bool any() const;
+
+    // get the smallest member >= i, or NPOS if there is none
+    unsigned find_next(unsigned i) const;
+    unsigned find_first() const { return find_next(0); }
+
+    // union, intersection, and difference
+    BitVector &operator|=(const BitVector &other);
+    BitVector &operator&=(const BitVector &other);
+    BitVector &operator-=(const BitVector &other);
+
+    bool operator==(const BitVector &other) const;
+    bool operator!=(const BitVector &other) const { return !(*this == other); }
+
+private:
+    static unsigned num_words(unsigned size) { return (size + 63) / 64; }
+    void make_dense();
+    void check_density();
+};
+
+#endif // BITVECTOR_H
@@ -3,6 +3,7 @@
 #include <algorithm>
 #include "cpputil.h"
 #include "cfg.h"
+#include "loops.h"
 
 ////////////////////////////////////////////////////////////////////////
 // Operand implementation
@@ -12,9 +13,12 @@ Operand::Operand()
         : m_kind(OPERAND_NONE)
         , m_basereg(0)
         , m_indexreg(0)
+        , m_scale(1)
         , m_ival(0)
         , m_is_scalar(false)
         , m_maps_mreg(false)
+        , m_index_is_scalar(false)
+        , m_index_maps_mreg(false)
 {
 }
 
@@ -22,9 +26,12 @@ Operand::Operand(OperandKind kind, long ival)
         : m_kind(kind)
         , m_basereg(0)
         , m_indexreg(0)
+        , m_scale(1)
         , m_ival(0)
         , m_is_scalar(false)
-        , m_maps_mreg(false) {
+        , m_maps_mreg(false)
+        , m_index_is_scalar(false)
+        , m_index_maps_mreg(false) {
     assert(kind == OPERAND_VREG || kind == OPERAND_MREG ||
            kind == OPERAND_VREG_MEMREF || kind == OPERAND_MREG_MEMREF ||
            kind == OPERAND_INT_LITERAL);
@@ -40,9 +47,12 @@ Operand::Operand(OperandKind kind, int basereg, int offset_or_index)
         : m_kind(kind)
         , m_basereg(basereg)
         , m_indexreg(0)
+        , m_scale(1)
         , m_ival(0)
         , m_is_scalar(false)
-        , m_maps_mreg(false) {
+        , m_maps_mreg(false)
+        , m_index_is_scalar(false)
+        , m_index_maps_mreg(false) {
     assert(kind == OPERAND_VREG_MEMREF_OFFSET || kind == OPERAND_VREG_MEMREF_INDEX ||
            kind == OPERAND_MREG_MEMREF_OFFSET || kind == OPERAND_MREG_MEMREF_INDEX);
 
@@ -53,24 +63,30 @@ Operand::Operand(OperandKind kind, int basereg, int offset_or_index)
     }
 }
 
-Operand::Operand(OperandKind kind, int basereg, int indexreg, int offset)
+Operand::Operand(OperandKind kind, int basereg, int indexreg, int offset, int scale)
         : m_kind(kind)
         , m_basereg(basereg)
         , m_indexreg(indexreg)
+        , m_scale(scale)
         , m_ival(offset)
         , m_is_scalar(false)
-        , m_maps_mreg(false) {
-    // currently there is only one kind of reg+reg+offset operand
-    assert(m_kind == OPERAND_MREG_MEMREF_OFFSET_INDEX);
+        , m_maps_mreg(false)
+        , m_index_is_scalar(false)
+        , m_index_maps_mreg(false) {
+    assert(m_kind == OPERAND_VREG_MEMREF_OFFSET_INDEX || m_kind == OPERAND_MREG_MEMREF_OFFSET_INDEX);
+    assert(scale == 1 || scale == 2 || scale == 4 || scale == 8);
 }
 
 Operand::Operand(const std::string &target_label, bool is_immediate)
         : m_kind(is_immediate ? OPERAND_LABEL_IMMEDIATE : OPERAND_LABEL)
         , m_basereg(0)
         , m_indexreg(0)
+        , m_scale(1)
         , m_ival(0)
         , m_is_scalar(false)
         , m_maps_mreg(false)
+        , m_index_is_scalar(false)
+        , m_index_maps_mreg(false)
         , m_target_label(target_label) {
 }
 
@@ -92,6 +108,29 @@ int Operand::get_index_reg() const {
     return m_indexreg;
 }
 
+void Operand::set_base_reg(int basereg) {
+    assert(has_base_reg());
+    m_basereg = basereg;
+}
+
+void Operand::set_index_reg(int indexreg) {
+    assert(has_index_reg());
+    m_indexreg = indexreg;
+}
+
+Operand Operand::get_index_operand() const {
+    assert(has_index_reg());
+    bool is_vreg = (m_kind == OPERAND_VREG_MEMREF_INDEX || m_kind == OPERAND_VREG_MEMREF_OFFSET_INDEX);
+    Operand index(is_vreg ? OPERAND_VREG : OPERAND_MREG, m_indexreg);
+    index.m_is_scalar = m_index_is_scalar;
+    index.m_maps_mreg = m_index_maps_mreg;
+    return index;
+}
+
+int Operand::get_scale() const {
+    return m_scale;
+}
+
 long Operand::get_int_value() const {
     assert(m_kind == OPERAND_INT_LITERAL);
     return m_ival;
@@ -123,6 +162,22 @@ void Operand::set_does_map_mreg(bool maps_mreg) {
     m_maps_mreg = maps_mreg;
 }
 
+bool Operand::get_index_is_scalar() {
+    return m_index_is_scalar;
+}
+
+void Operand::set_index_is_scalar(bool is_scalar) {
+    m_index_is_scalar = is_scalar;
+}
+
+bool Operand::get_index_does_map_mreg() {
+    return m_index_maps_mreg;
+}
+
+void Operand::set_index_does_map_mreg(bool maps_mreg) {
+    m_index_maps_mreg = maps_mreg;
+}
+
 
 ////////////////////////////////////////////////////////////////////////
 // Instruction implementation
@@ -161,7 +216,16 @@ unsigned Instruction::get_num_operands() const {
 Operand Instruction::get_operand(unsigned index) const {
     assert(index >= 0);
     assert(index < m_num_operands);
-    return m_operands[index];
+    return index < 3 ? m_operands[index] : m_extra_operands[index - 3];
+}
+
+void Instruction::add_operand(const Operand &op) {
+    if (m_num_operands < 3) {
+        m_operands[m_num_operands] = op;
+    } else {
+        m_extra_operands.push_back(op);
+    }
+    m_num_operands++;
 }
 
 void Instruction::set_comment(const std::string &comment) {
@@ -330,6 +394,13 @@ std::string PrintInstructionSequence::format_operand(const Operand &operand) {
             return cpputil::format("%d(vr%d)", operand.get_offset(), operand.get_base_reg());
         case OPERAND_VREG_MEMREF_INDEX:
             return cpputil::format("(vr%d,vr%d)", operand.get_base_reg(), operand.get_index_reg());
+        case OPERAND_VREG_MEMREF_OFFSET_INDEX:
+            if (operand.get_scale() != 1) {
+                return cpputil::format("%d(vr%d,vr%d,%d)", operand.get_offset(), operand.get_base_reg(),
+                                       operand.get_index_reg(), operand.get_scale());
+            }
+            return cpputil::format("%d(vr%d,vr%d)", operand.get_offset(), operand.get_base_reg(),
+                                   operand.get_index_reg());
         case OPERAND_MREG:
             return get_mreg_name(operand.get_base_reg());
         case OPERAND_MREG_MEMREF:
@@ -341,6 +412,13 @@ std::string PrintInstructionSequence::format_operand(const Operand &operand) {
                                    get_mreg_name(operand.get_base_reg()).c_str(),
                                    get_mreg_name(operand.get_index_reg()).c_str());
         case OPERAND_MREG_MEMREF_OFFSET_INDEX:
+            if (operand.get_scale() != 1) {
+                return cpputil::format("%d(%s,%s,%d)",
+                                       operand.get_offset(),
+                                       get_mreg_name(operand.get_base_reg()).c_str(),
+                                       get_mreg_name(operand.get_index_reg()).c_str(),
+                                       operand.get_scale());
+            }
             return cpputil::format("%d(%s, %s)",
                                    operand.get_offset(),
                                    get_mreg_name(operand.get_base_reg()).c_str(),
@@ -410,10 +488,13 @@ Edge::~Edge() {
 
 ControlFlowGraph::ControlFlowGraph()
         : m_entry(nullptr)
-        , m_exit(nullptr) {
+        , m_exit(nullptr)
+        , m_dominator_tree(nullptr)
+        , m_loop_forest(nullptr) {
 }
 
 ControlFlowGraph::~ControlFlowGraph() {
+    invalidate_analyses();
 }
 
 BasicBlock *ControlFlowGraph::get_entry_block() const {
@@ -430,6 +511,7 @@ BasicBlock *ControlFlowGraph::get_block(unsigned i) const {
 }
 
 BasicBlock *ControlFlowGraph::create_basic_block(BasicBlockKind kind, const std::string &label) {
+    invalidate_analyses();
     BasicBlock *bb = new BasicBlock(kind, unsigned(m_basic_blocks.size()), label);
     m_basic_blocks.push_back(bb);
     if (bb->get_kind() == BASICBLOCK_ENTRY) {
@@ -445,12 +527,14 @@ BasicBlock *ControlFlowGraph::create_basic_block(BasicBlockKind kind, const std:
 
 Edge *ControlFlowGraph::create_edge(BasicBlock *source, BasicBlock *target, EdgeKind kind) {
     // make sure BasicBlocks belong to this ControlFlowGraph
-    assert(std::find(m_basic_blocks.begin(), m_basic_blocks.end(), source) != m_basic_blocks.end());
-    assert(std::find(m_basic_blocks.begin(), m_basic_blocks.end(), target) != m_basic_blocks.end());
+    assert(source->get_id() < m_basic_blocks.size() && m_basic_blocks[source->get_id()] == source);
+    assert(target->get_id() < m_basic_blocks.size() && m_basic_blocks[target->get_id()] == target);
 
     // make sure this Edge doesn't already exist
     assert(lookup_edge(source, target) == nullptr);
 
+    invalidate_analyses();
+
     // create the edge, add it to outgoing/incoming edge maps
     Edge *e = new Edge(source, target, kind);
     m_outgoing_edges[source].push_back(e);
@@ -485,67 +569,72 @@ const ControlFlowGraph::EdgeList &ControlFlowGraph::get_incoming_edges(BasicBloc
     return i == m_incoming_edges.end() ? m_empty_edge_list : i->second;
 }
 
-InstructionSequence *ControlFlowGraph::create_instruction_sequence() const {
+const DominatorTree &ControlFlowGraph::get_dominator_tree() {
+    if (m_dominator_tree == nullptr) {
+        m_dominator_tree = new DominatorTree(this);
+        m_dominator_tree->execute();
+    }
+    return *m_dominator_tree;
+}
+
+const LoopForest &ControlFlowGraph::get_loop_forest() {
+    if (m_loop_forest == nullptr) {
+        m_loop_forest = new LoopForest(this);
+        m_loop_forest->execute();
+    }
+    return *m_loop_forest;
+}
+
+unsigned ControlFlowGraph::get_loop_depth(BasicBlock *bb) {
+    return get_loop_forest().get_loop_depth(bb);
+}
+
+InstructionSequence *ControlFlowGraph::create_instruction_sequence(BlockList *block_order) const {
+    BlockList order = get_block_order();
+
+    InstructionSequence *result = new InstructionSequence();
+    for (auto i = order.cbegin(); i != order.cend(); i++) {
+        append_basic_block(result, *i);
+    }
+
+    if (block_order != nullptr) {
+        block_order->insert(block_order->end(), order.cbegin(), order.cend());
+    }
+    return result;
+}
+
+ControlFlowGraph::BlockList ControlFlowGraph::get_block_order() const {
     assert(m_entry != nullptr);
     assert(m_exit != nullptr);
     assert(m_outgoing_edges.size() == m_incoming_edges.size());
 
-    // Find all Chunks (groups of basic blocks connected via fall-through)
-    typedef std::map<BasicBlock *, Chunk *> ChunkMap;
-    ChunkMap chunk_map;
-    for (auto i = m_outgoing_edges.cbegin(); i != m_outgoing_edges.cend(); i++) {
-        const EdgeList &outgoing_edges = i->second;
-        for (auto j = outgoing_edges.cbegin(); j != outgoing_edges.cend(); j++) {
-            Edge *e = *j;
-
-            if (e->get_kind() != EDGE_FALLTHROUGH) {
-                continue;
-            }
+    // Find all Chunks (groups of basic blocks connected via fall-through):
+    // each one is found by following the fall-through edges from a block
+    // which isn't the target of one
+    const unsigned num_blocks = get_num_blocks();
+    std::vector<Chunk *> chunks(num_blocks, nullptr);
+    std::vector<Chunk *> all_chunks;
+    for (auto i = m_basic_blocks.cbegin(); i != m_basic_blocks.cend(); i++) {
+        BasicBlock *bb = *i;
+        if (get_fallthrough_target(bb) == nullptr || has_fallthrough_source(bb)) {
+            continue;
+        }
 
-            BasicBlock *pred = e->get_source();
-            BasicBlock *succ = e->get_target();
-
-            Chunk *pred_chunk = (chunk_map.find(pred) == chunk_map.end()) ? nullptr : chunk_map[pred];
-            Chunk *succ_chunk = (chunk_map.find(succ) == chunk_map.end()) ? nullptr : chunk_map[succ];
-
-            if (pred_chunk == nullptr && succ_chunk == nullptr) {
-                // create a new chunk
-                Chunk *chunk = new Chunk();
-                chunk->append(pred);
-                chunk->append(succ);
-                chunk_map[pred] = chunk;
-                chunk_map[succ] = chunk;
-            } else if (pred_chunk == nullptr) {
-                // prepend predecessor to successor's chunk (successor should be the first block)
-                assert(succ_chunk->is_first(succ));
-                succ_chunk->prepend(pred);
-                chunk_map[pred] = succ_chunk;
-            } else if (succ_chunk == nullptr) {
-                // append successor to predecessor's chunk (predecessor should be the last block)
-                assert(pred_chunk->is_last(pred));
-                pred_chunk->append(succ);
-                chunk_map[succ] = pred_chunk;
-            } else {
-                // merge the chunks
-                Chunk *merged = pred_chunk->merge_with(succ_chunk);
-                // update every basic block to point to the merged chunk
-                for (auto i = merged->blocks.begin(); i != merged->blocks.end(); i++) {
-                    BasicBlock *bb = *i;
-                    chunk_map[bb] = merged;
-                }
-                // delete old Chunks
-                delete pred_chunk;
-                delete succ_chunk;
-            }
+        Chunk *chunk = new Chunk();
+        all_chunks.push_back(chunk);
+        for (BasicBlock *b = bb; b != nullptr; b = get_fallthrough_target(b)) {
+            assert(chunks[b->get_id()] == nullptr);
+            chunk->append(b);
+            chunks[b->get_id()] = chunk;
         }
     }
 
-    InstructionSequence *result = new InstructionSequence();
-    std::vector<bool> finished_blocks(get_num_blocks(), false);
+    BlockList order;
+    std::vector<bool> finished_blocks(num_blocks, false);
     Chunk *exit_chunk = nullptr;
 
-    // Traverse the CFG, appending basic blocks to the generated InstructionSequence.
-    // If we find a block that is part of a Chunk, the entire Chunk is emitted.
+    // Traverse the CFG, appending basic blocks to the order.
+    // If we find a block that is part of a Chunk, the entire Chunk is appended.
     // (This allows fall through to work.)
     std::deque<BasicBlock *> work_list;
     work_list.push_back(m_entry);
@@ -560,14 +649,13 @@ InstructionSequence *ControlFlowGraph::create_instruction_sequence() const {
             continue;
         }
 
-        ChunkMap::iterator i = chunk_map.find(bb);
-        if (i != chunk_map.end()) {
+        Chunk *chunk = chunks[block_id];
+        if (chunk != nullptr) {
             // This basic block is part of a Chunk: append all of its blocks
-            Chunk *chunk = i->second;
 
             // If this chunk contains the exit block, it needs to be at the end
-            // of the generated InstructionSequence, so defer appending any of
-            // its blocks.  (But, *do* find its control successors.)
+            // of the order, so defer appending any of its blocks.
+            // (But, *do* find its control successors.)
             bool is_exit_chunk = false;
             if (chunk->contains_exit_block()) {
                 exit_chunk = chunk;
@@ -576,11 +664,9 @@ InstructionSequence *ControlFlowGraph::create_instruction_sequence() const {
 
             for (auto j = chunk->blocks.begin(); j != chunk->blocks.end(); j++) {
                 BasicBlock *b = *j;
-                if (is_exit_chunk) {
-                    // mark the block as finished, but don't append its instructions yet
-                    finished_blocks[b->get_id()] = true;
-                } else {
-                    append_basic_block(result, b, finished_blocks);
+                finished_blocks[b->get_id()] = true;
+                if (!is_exit_chunk) {
+                    order.push_back(b);
                 }
 
                 // Visit control successors
@@ -588,7 +674,8 @@ InstructionSequence *ControlFlowGraph::create_instruction_sequence() const {
             }
         } else {
             // This basic block is not part of a Chunk
-            append_basic_block(result, bb, finished_blocks);
+            finished_blocks[block_id] = true;
+            order.push_back(bb);
 
             // Visit control successors
             visit_successors(bb, work_list);
@@ -597,26 +684,51 @@ InstructionSequence *ControlFlowGraph::create_instruction_sequence() const {
 
     // append exit chunk
     if (exit_chunk != nullptr) {
-        append_chunk(result, exit_chunk, finished_blocks);
+        order.insert(order.end(), exit_chunk->blocks.begin(), exit_chunk->blocks.end());
     }
 
-    return result;
+    for (auto i = all_chunks.begin(); i != all_chunks.end(); i++) {
+        delete *i;
+    }
+
+    return order;
+}
+
+BasicBlock *ControlFlowGraph::get_fallthrough_target(BasicBlock *bb) const {
+    const EdgeList &outgoing_edges = get_outgoing_edges(bb);
+    for (auto i = outgoing_edges.cbegin(); i != outgoing_edges.cend(); i++) {
+        if ((*i)->get_kind() == EDGE_FALLTHROUGH) {
+            return (*i)->get_target();
+        }
+    }
+    return nullptr;
 }
 
-void ControlFlowGraph::append_basic_block(InstructionSequence *iseq, const BasicBlock *bb, std::vector<bool> &finished_blocks) const {
+bool ControlFlowGraph::has_fallthrough_source(BasicBlock *bb) const {
+    const EdgeList &incoming_edges = get_incoming_edges(bb);
+    for (auto i = incoming_edges.cbegin(); i != incoming_edges.cend(); i++) {
+        if ((*i)->get_kind() == EDGE_FALLTHROUGH) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ControlFlowGraph::invalidate_analyses() {
+    // the loops depend on the dominator tree
+    delete m_loop_forest;
+    m_loop_forest = nullptr;
+    delete m_dominator_tree;
+    m_dominator_tree = nullptr;
+}
+
+void ControlFlowGraph::append_basic_block(InstructionSequence *iseq, const BasicBlock *bb) const {
     if (bb->has_label()) {
         iseq->define_label(bb->get_label());
     }
     for (auto i = bb->cbegin(); i != bb->cend(); i++) {
         iseq->add_instruction((*i)->duplicate());
     }
-    finished_blocks[bb->get_id()] = true;
-}
-
-void ControlFlowGraph::append_chunk(InstructionSequence *iseq, Chunk *chunk, std::vector<bool> &finished_blocks) const {
-    for (auto i = chunk->blocks.begin(); i != chunk->blocks.end(); i++) {
-        append_basic_block(iseq, *i, finished_blocks);
-    }
 }
 
 void ControlFlowGraph::visit_successors(BasicBlock *bb, std::deque<BasicBlock *> &work_list) const {
@@ -716,6 +828,13 @@ ControlFlowGraph *ControlFlowGraphBuilder::build() {
             work_list.push_back({ ins_index: target_index, pred: bb, edge_kind: EDGE_BRANCH, label: target_label });
         }
 
+        // a basic block which neither branches nor falls through leaves the
+        // function (e.g., by jumping to another function): its successor is
+        // the exit block
+        if (!ends_in_branch(bb) && !falls_through(bb)) {
+            work_list.push_back({ ins_index: num_instructions, pred: bb, edge_kind: EDGE_BRANCH });
+        }
+
         // if this basic block falls through, prepare to create an edge
         // to the BasicBlock for successor instruction (creating it if it doesn't
         // exist yet)
@@ -733,8 +852,12 @@ ControlFlowGraph *ControlFlowGraphBuilder::build() {
         }
     }
 
-    assert(last != nullptr);
-    m_cfg->create_edge(last, exit, EDGE_FALLTHROUGH);
+    // (if the code ends with a block that leaves the function, e.g. a tail
+    // call, nothing falls through to the exit block: its edge to the exit
+    // block has already been created)
+    if (last != nullptr) {
+        m_cfg->create_edge(last, exit, EDGE_FALLTHROUGH);
+    }
 
     return m_cfg;
 }
@@ -752,7 +875,7 @@ BasicBlock *ControlFlowGraphBuilder::scan_basic_block(const WorkItem &item, cons
     BasicBlock *bb = m_cfg->create_basic_block(BASICBLOCK_INTERIOR, label);
 
     // keep adding instructions until we
-    // - reach an instruction that is a branch
+    // - reach an instruction that is a branch, or doesn't fall through
     // - reach an instruction that is a target of a branch
     // - reach the end of the overall instruction sequence
     while (index < m_iseq->get_length()) {
@@ -767,7 +890,7 @@ BasicBlock *ControlFlowGraphBuilder::scan_basic_block(const WorkItem &item, cons
             // instruction at index is a control target
             break;
         }
-        if (is_branch(ins)) {
+        if (is_branch(ins) || !falls_through(ins)) {
             // this is a branch instruction
             break;
         }
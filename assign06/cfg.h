@@ -33,13 +33,15 @@ enum OperandKind {
     OPERAND_VREG_MEMREF_OFFSET      = (OPROP_HAS_BASEREG|OPROP_HAS_INTVAL|OPROP_IS_MEMREF) + 5,
     // memory reference with address specified by vreg+vref
     OPERAND_VREG_MEMREF_INDEX       = (OPROP_HAS_BASEREG|OPROP_HAS_INDEXREG|OPROP_IS_MEMREF) + 6,
+    // memory reference with address specified by vreg+(vreg*scale)+offset
+    OPERAND_VREG_MEMREF_OFFSET_INDEX = (OPROP_HAS_BASEREG|OPROP_HAS_INDEXREG|OPROP_HAS_INTVAL|OPROP_IS_MEMREF) + 14,
     // memory reference with address specified by mreg
     OPERAND_MREG_MEMREF             = (OPROP_HAS_BASEREG|OPROP_IS_MEMREF) + 7,
     // memory reference with address specified by mreg+offset
     OPERAND_MREG_MEMREF_OFFSET      = (OPROP_HAS_BASEREG|OPROP_HAS_INTVAL|OPROP_IS_MEMREF) + 8,
     // memory reference with address specified by mreg+mreg
     OPERAND_MREG_MEMREF_INDEX       = (OPROP_HAS_BASEREG|OPROP_HAS_INDEXREG|OPROP_IS_MEMREF) + 9,
-    // memory reference with address specified by mreg+mreg+offset
+    // memory reference with address specified by mreg+(mreg*scale)+offset
     OPERAND_MREG_MEMREF_OFFSET_INDEX = (OPROP_HAS_BASEREG|OPROP_HAS_INDEXREG|OPROP_HAS_INTVAL|OPROP_IS_MEMREF) + 10,
     // integer literal
     OPERAND_INT_LITERAL             = (OPROP_HAS_INTVAL|OPROP_IS_IMMEDIATE) + 11,
@@ -54,9 +56,12 @@ private:
     enum OperandKind m_kind;    // kind of operand
     int m_basereg;              // base register number
     int m_indexreg;             // index register number
+    int m_scale;                // multiplier of index register (1, 2, 4, or 8)
     long m_ival;                // literal integer value or offset value
     bool m_is_scalar;             // this operand represents a scalar variable in the program
     bool m_maps_mreg;             // this Operand wants to be mapped to a mreg when converting from vreg
+    bool m_index_is_scalar;       // same as m_is_scalar, for the index register
+    bool m_index_maps_mreg;       // same as m_maps_mreg, for the index register
     std::string m_target_label;
 
 public:
@@ -79,14 +84,15 @@ public:
     //   - offset_or_index: either the integer offset value or index register number
     Operand(OperandKind kind, int basereg, int offset_or_index);
 
-    // ctor for Operand with reg+reg+integer
-    // (e.g., OPERAND_MREG_MEMREF_OFFSET_INDEX)
+    // ctor for Operand with reg+(reg*scale)+integer
+    // (e.g., OPERAND_VREG_MEMREF_OFFSET_INDEX, OPERAND_MREG_MEMREF_OFFSET_INDEX)
     // Parameters:
     //   - kind: the OperandKind
     //   - basereg: base register number
     //   - indexreg: index register number
     //   - offset: offset value
-    Operand(OperandKind kind, int basereg, int indexreg, int offset);
+    //   - scale: multiplier of the index register (1, 2, 4, or 8)
+    Operand(OperandKind kind, int basereg, int indexreg, int offset, int scale = 1);
 
     // ctor for label
     // (e.g., OPERAND_LABEL, OPERAND_LABEL_IMMEDIATE)
@@ -118,6 +124,19 @@ public:
     // get index register number
     int get_index_reg() const;
 
+    // change base register number (e.g., when renaming vregs)
+    void set_base_reg(int basereg);
+
+    // change index register number
+    void set_index_reg(int indexreg);
+
+    // get the index register as a register Operand (OPERAND_VREG or
+    // OPERAND_MREG), with the index register's scalar/mreg flags
+    Operand get_index_operand() const;
+
+    // get multiplier of index register (1 unless the Operand is scaled)
+    int get_scale() const;
+
     // get literal integer value
     long get_int_value() const;
 
@@ -134,6 +153,14 @@ public:
     bool get_does_map_mreg();
 
     void set_does_map_mreg(bool maps_mreg);
+
+    bool get_index_is_scalar();
+
+    void set_index_is_scalar(bool is_scalar);
+
+    bool get_index_does_map_mreg();
+
+    void set_index_does_map_mreg(bool maps_mreg);
 };
 
 class Instruction {
@@ -141,6 +168,7 @@ private:
     int m_opcode;
     unsigned m_num_operands;
     Operand m_operands[3];
+    std::vector<Operand> m_extra_operands; // operands after the third (only phis have them)
     std::string m_comment;
 
 public:
@@ -157,7 +185,7 @@ public:
     // more convenient notation for referring to operand
     Operand operator[](unsigned index) const {
         assert(index < m_num_operands);
-        return m_operands[index];
+        return index < 3 ? m_operands[index] : m_extra_operands[index - 3];
     }
 
     // this operator can be used for changing an operand in place;
@@ -165,9 +193,13 @@ public:
     // a different target
     Operand &operator[](unsigned index) {
         assert(index < m_num_operands);
-        return m_operands[index];
+        return index < 3 ? m_operands[index] : m_extra_operands[index - 3];
     }
 
+    // append an operand (an instruction may have any number of operands,
+    // e.g., a phi has one per predecessor of its block)
+    void add_operand(const Operand &op);
+
     void set_comment(const std::string &comment);
     bool has_comment() const;
     const std::string &get_comment() const;
@@ -326,6 +358,9 @@ public:
 
 // ControlFlowGraph: graph of BasicBlocks connected by Edges.
 // There are dedicated empty entry and exit blocks.
+class DominatorTree;
+class LoopForest;
+
 class ControlFlowGraph {
 public:
     typedef std::vector<BasicBlock *> BlockList;
@@ -339,6 +374,10 @@ private:
     EdgeMap m_outgoing_edges;
     EdgeList m_empty_edge_list;
 
+    // cached analyses (nullptr until requested, and after the graph changes)
+    DominatorTree *m_dominator_tree;
+    LoopForest *m_loop_forest;
+
     // A "Chunk" is a collection of BasicBlocks
     // connected by fall-through edges.  All of the blocks
     // in a Chunk must be emitted contiguously in the
@@ -351,29 +390,6 @@ private:
             blocks.push_back(bb);
             if (bb->get_kind() == BASICBLOCK_EXIT) { is_exit = true; }
         }
-        void prepend(BasicBlock *bb) {
-            blocks.insert(blocks.begin(), bb);
-            if (bb->get_kind() == BASICBLOCK_EXIT) { is_exit = true; }
-        }
-
-        Chunk *merge_with(Chunk *other) {
-            Chunk *merged = new Chunk();
-            for (auto i = blocks.begin(); i != blocks.end(); i++) {
-                merged->append(*i);
-            }
-            for (auto i = other->blocks.begin(); i != other->blocks.end(); i++) {
-                merged->append(*i);
-            }
-            return merged;
-        }
-
-        bool is_first(BasicBlock *bb) const {
-            return !blocks.empty() && blocks.front() == bb;
-        }
-
-        bool is_last(BasicBlock *bb) const {
-            return !blocks.empty() && blocks.back() == bb;
-        }
 
         bool contains_exit_block() const { return is_exit; }
     };
@@ -416,14 +432,34 @@ public:
     // Get vector of all incoming edges to given block
     const EdgeList &get_incoming_edges(BasicBlock *bb) const;
 
+    // Get the dominator tree (and dominance frontiers) of this ControlFlowGraph:
+    // it's computed the first time it's requested, and recomputed after
+    // a block or edge is added
+    const DominatorTree &get_dominator_tree();
+
+    // Get the natural loops of this ControlFlowGraph: like the dominator
+    // tree, they're cached until a block or edge is added
+    const LoopForest &get_loop_forest();
+
+    // Get the number of loops containing given block (0 if it isn't in a loop)
+    unsigned get_loop_depth(BasicBlock *bb);
+
     // Return a "flat" InstructionSequence created from this ControlFlowGraph;
-    // this is useful for optimization passes which create a transformed ControlFlowGraph
-    InstructionSequence *create_instruction_sequence() const;
+    // this is useful for optimization passes which create a transformed ControlFlowGraph.
+    // If block_order is non-null, the BasicBlocks are appended to it in the order
+    // their instructions appear in the result.
+    InstructionSequence *create_instruction_sequence(BlockList *block_order = nullptr) const;
+
+    // Get the BasicBlocks in the order their instructions appear in the
+    // result of create_instruction_sequence(), without creating it
+    BlockList get_block_order() const;
 
 private:
-    void append_basic_block(InstructionSequence *iseq, const BasicBlock *bb, std::vector<bool> &finished_blocks) const;
-    void append_chunk(InstructionSequence *iseq, Chunk *chunk, std::vector<bool> &finished_blocks) const;
+    void invalidate_analyses();
+    void append_basic_block(InstructionSequence *iseq, const BasicBlock *bb) const;
     void visit_successors(BasicBlock *bb, std::deque<BasicBlock *> &work_list) const;
+    BasicBlock *get_fallthrough_target(BasicBlock *bb) const;
+    bool has_fallthrough_source(BasicBlock *bb) const;
 };
 
 class ControlFlowGraphBuilder {
@@ -55,3 +55,8 @@ ControlFlowGraph *ControlFlowGraphTransform::transform_cfg() {
     return result;
 }
 
+void ControlFlowGraphTransform::keep_nonempty(InstructionSequence *out, const InstructionSequence *orig, int nop_opcode) {
+    if (out->get_length() == 0 && orig->get_length() > 0) {
+        out->add_instruction(new Instruction(nop_opcode));
+    }
+}
@@ -12,9 +12,15 @@ public:
     virtual ~ControlFlowGraphTransform();
 
     ControlFlowGraph *get_orig_cfg();
-    ControlFlowGraph *transform_cfg();
+    virtual ControlFlowGraph *transform_cfg();
 
     virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq) = 0;
+
+protected:
+    // Add an instruction with the given no-op opcode to out if it is empty
+    // but orig (the block it replaces) wasn't: a labeled block (which may be
+    // the target of a jump) can't be left empty.
+    static void keep_nonempty(InstructionSequence *out, const InstructionSequence *orig, int nop_opcode);
 };
 
 #endif // CFG_TRANSFORM_H
\ No newline at end of file
@@ -0,0 +1,512 @@
+#include <cassert>
+#include <climits>
+#include <map>
+#include "cfg.h"
+#include "highlevel.h"
+#include "live_vregs.h"
+#include "constprop.h"
+
+namespace {
+    bool is_conditional_branch(Instruction *ins) {
+        switch (ins->get_opcode()) {
+            case HINS_JE: case HINS_JNE: case HINS_JLT:
+            case HINS_JLTE: case HINS_JGT: case HINS_JGTE:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // Removes ldci instructions whose destination vreg is not live
+    // (after constant propagation, most of them are.)
+    class DeadConstantElimination : public ControlFlowGraphTransform {
+    private:
+        LiveVregs m_live_vregs;
+
+    public:
+        DeadConstantElimination(ControlFlowGraph *cfg)
+                : ControlFlowGraphTransform(cfg)
+                , m_live_vregs(cfg) {
+            m_live_vregs.execute();
+        }
+
+        virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq) {
+            BasicBlock *bb = static_cast<BasicBlock *>(iseq);
+            LiveVregs::LiveSet live = m_live_vregs.get_fact_at_end_of_block(bb);
+
+            std::vector<Instruction *> kept;
+            for (auto i = bb->crbegin(); i != bb->crend(); i++) {
+                Instruction *ins = *i;
+                if (ins->get_opcode() == HINS_LOAD_ICONST && !live.test(ins->get_operand(0).get_base_reg())) {
+                    continue;
+                }
+                kept.push_back(ins);
+                m_live_vregs.model_instruction(ins, live);
+            }
+
+            auto out = new InstructionSequence();
+            for (auto i = kept.rbegin(); i != kept.rend(); i++) {
+                out->add_instruction((*i)->duplicate());
+            }
+
+            keep_nonempty(out, bb, HINS_NOP);
+
+            return out;
+        }
+    };
+}
+
+////////////////////////////////////////////////////////////////////////
+// ConditionalConstantPropagation::LatticeValue implementation
+////////////////////////////////////////////////////////////////////////
+
+ConditionalConstantPropagation::LatticeValue
+ConditionalConstantPropagation::LatticeValue::meet(const LatticeValue &other) const {
+    if (kind == TOP) {
+        return other;
+    }
+    if (other.kind == TOP) {
+        return *this;
+    }
+    if (kind == CONSTANT && other.kind == CONSTANT && value == other.value) {
+        return *this;
+    }
+    return LatticeValue(BOTTOM);
+}
+
+////////////////////////////////////////////////////////////////////////
+// ConditionalConstantPropagation implementation
+////////////////////////////////////////////////////////////////////////
+
+ConditionalConstantPropagation::ConditionalConstantPropagation(ControlFlowGraph *cfg)
+        : ControlFlowGraphTransform(cfg)
+        , m_ssa_cfg(nullptr)
+        , m_def_use(nullptr)
+        , m_executed(false) {
+}
+
+ConditionalConstantPropagation::~ConditionalConstantPropagation() {
+    delete m_def_use;
+    delete m_ssa_cfg;
+}
+
+void ConditionalConstantPropagation::execute() {
+    SSAConstruction ssa(get_orig_cfg());
+    ssa.execute();
+    m_ssa_cfg = ssa.transform_cfg();
+
+    m_def_use = new DefUseChains(m_ssa_cfg);
+    m_def_use->execute();
+
+    // Every vreg starts as TOP, except those which are never defined
+    // (such as a variable which is never assigned), whose values are
+    // unknown.  Nothing is executable until it's reached from the entry.
+    const unsigned num_vregs = HighLevel::get_num_vregs(m_ssa_cfg);
+    m_values.assign(num_vregs, LatticeValue());
+    for (unsigned v = 0; v < num_vregs; v++) {
+        if (m_def_use->get_def(int(v)) == nullptr) {
+            m_values[v] = LatticeValue(LatticeValue::BOTTOM);
+        }
+    }
+    const unsigned num_blocks = m_ssa_cfg->get_num_blocks();
+    m_reachable.assign(num_blocks, false);
+    m_executable.clear();
+
+    visit_block(m_ssa_cfg->get_entry_block());
+
+    // An edge which becomes executable adds to the phis of its target (and
+    // makes the target reachable, if it wasn't).  A vreg whose value is
+    // lowered affects the instructions using it.
+    while (!m_edge_work_list.empty() || !m_vreg_work_list.empty()) {
+        if (!m_edge_work_list.empty()) {
+            Edge *e = m_edge_work_list.back();
+            m_edge_work_list.pop_back();
+            BasicBlock *target = e->get_target();
+            if (!m_reachable[target->get_id()]) {
+                visit_block(target);
+            } else {
+                for (auto i = target->cbegin(); i != target->cend() && (*i)->get_opcode() == HINS_PHI; i++) {
+                    visit_phi(target, *i);
+                }
+            }
+        } else {
+            int vreg = m_vreg_work_list.back();
+            m_vreg_work_list.pop_back();
+            const std::vector<DefUseChains::Use> &uses = m_def_use->get_uses(vreg);
+            for (auto i = uses.cbegin(); i != uses.cend(); i++) {
+                if (m_reachable[i->bb->get_id()]) {
+                    visit_instruction(i->bb, i->ins);
+                }
+            }
+        }
+    }
+
+    m_outcomes.assign(num_blocks, BRANCH_UNKNOWN);
+    for (unsigned b = 0; b < num_blocks; b++) {
+        if (m_reachable[b]) {
+            m_outcomes[b] = get_outcome(m_ssa_cfg->get_block(b));
+        }
+    }
+
+    m_executed = true;
+}
+
+bool ConditionalConstantPropagation::is_reachable(BasicBlock *bb) const {
+    return m_reachable[bb->get_id()];
+}
+
+ControlFlowGraph *ConditionalConstantPropagation::transform_cfg() {
+    if (!m_executed) {
+        execute();
+    }
+
+    ControlFlowGraph *cfg = get_orig_cfg();
+    ControlFlowGraph *result = new ControlFlowGraph();
+
+    // map of basic blocks of original CFG to basic blocks in transformed CFG
+    std::map<BasicBlock *, BasicBlock *> block_map;
+
+    // unreachable blocks are dropped (the entry and exit blocks always remain)
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *orig = *i;
+        if (!is_reachable(orig) && orig->get_kind() == BASICBLOCK_INTERIOR) {
+            continue;
+        }
+
+        InstructionSequence *result_iseq = transform_basic_block(orig);
+        BasicBlock *result_bb = result->create_basic_block(orig->get_kind(), orig->get_label());
+        block_map[orig] = result_bb;
+        for (auto j = result_iseq->cbegin(); j != result_iseq->cend(); j++) {
+            result_bb->add_instruction((*j)->duplicate());
+        }
+        delete result_iseq;
+    }
+
+    // only executable edges are kept (the outgoing edges of a block of
+    // the SSA form are in the same order as those of the original block)
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *orig = *i;
+        const ControlFlowGraph::EdgeList &outgoing = cfg->get_outgoing_edges(orig);
+        const ControlFlowGraph::EdgeList &ssa_outgoing = m_ssa_cfg->get_outgoing_edges(m_ssa_cfg->get_block(orig->get_id()));
+        assert(outgoing.size() == ssa_outgoing.size());
+        for (unsigned j = 0; j < outgoing.size(); j++) {
+            if (m_executable.count(ssa_outgoing[j]) > 0) {
+                Edge *e = outgoing[j];
+                result->create_edge(block_map[e->get_source()], block_map[e->get_target()], e->get_kind());
+            }
+        }
+    }
+
+    DeadConstantElimination dce(result);
+    ControlFlowGraph *pruned = dce.transform_cfg();
+    delete result;
+
+    return pruned;
+}
+
+InstructionSequence *ConditionalConstantPropagation::transform_basic_block(InstructionSequence *iseq) {
+    BasicBlock *bb = static_cast<BasicBlock *>(iseq);
+    auto out = new InstructionSequence();
+
+    // instruction i of the block is instruction num_phis + i of its SSA form,
+    // which has the same operands, with the vregs renamed
+    BasicBlock *ssa_bb = m_ssa_cfg->get_block(bb->get_id());
+    unsigned num_phis = 0;
+    while (num_phis < ssa_bb->get_length() && ssa_bb->get_instruction(num_phis)->get_opcode() == HINS_PHI) {
+        num_phis++;
+    }
+    BranchOutcome outcome = m_outcomes[bb->get_id()];
+    const unsigned num_ins = bb->get_length();
+    assert(ssa_bb->get_length() == num_phis + num_ins);
+
+    for (unsigned i = 0; i < num_ins; i++) {
+        Instruction *ins = bb->get_instruction(i);
+        Instruction *ssa_ins = ssa_bb->get_instruction(num_phis + i);
+
+        if (outcome != BRANCH_UNKNOWN && i == num_ins - 2) {
+            // the cmpi feeding a folded branch is no longer needed
+            assert(ins->get_opcode() == HINS_INT_COMPARE);
+            continue;
+        }
+        if (outcome != BRANCH_UNKNOWN && i == num_ins - 1) {
+            if (outcome == BRANCH_TAKEN) {
+                Instruction *jump = new Instruction(HINS_JUMP, ins->get_operand(0));
+                if (ins->has_comment()) {
+                    jump->set_comment(ins->get_comment());
+                }
+                out->add_instruction(jump);
+            }
+            continue;
+        }
+
+        Instruction *hin;
+        LatticeValue result = HighLevel::is_def(ssa_ins) ? m_values[ssa_ins->get_operand(0).get_base_reg()] : LatticeValue(LatticeValue::BOTTOM);
+        if (result.is_constant() && fits_immediate(result.value)) {
+            // the def is replaced by loading the constant value
+            hin = new Instruction(HINS_LOAD_ICONST, ins->get_operand(0),
+                                  Operand(OPERAND_INT_LITERAL, result.value));
+            if (ins->has_comment()) {
+                hin->set_comment(ins->get_comment());
+            }
+        } else {
+            hin = ins->duplicate();
+            for (unsigned j = 0; j < hin->get_num_operands(); j++) {
+                if (!HighLevel::is_use(ins, j) || !can_use_literal(ins, j)) {
+                    continue;
+                }
+                LatticeValue val = get_value(ssa_ins->get_operand(j));
+                if (val.is_constant() && (fits_immediate(val.value) || is_divisor(ins, j))) {
+                    (*hin)[j] = Operand(OPERAND_INT_LITERAL, val.value);
+                }
+            }
+            for (unsigned j = 0; j < hin->get_num_operands(); j++) {
+                // a constant index of a memory reference becomes part of its offset
+                Operand ref = ins->get_operand(j);
+                if (ref.get_kind() != OPERAND_VREG_MEMREF_OFFSET_INDEX) {
+                    continue;
+                }
+                LatticeValue val = get_value(ssa_ins->get_operand(j).get_index_operand());
+                if (val.is_constant() && fits_immediate(val.value)) {
+                    long offset = ref.get_offset() + val.value * ref.get_scale();
+                    if (fits_immediate(offset)) {
+                        (*hin)[j] = Operand(OPERAND_VREG_MEMREF_OFFSET, ref.get_base_reg(), int(offset));
+                    }
+                }
+            }
+        }
+        out->add_instruction(hin);
+    }
+
+    keep_nonempty(out, bb, HINS_NOP);
+
+    return out;
+}
+
+void ConditionalConstantPropagation::visit_block(BasicBlock *bb) {
+    m_reachable[bb->get_id()] = true;
+    for (auto i = bb->cbegin(); i != bb->cend(); i++) {
+        visit_instruction(bb, *i);
+    }
+    visit_branch(bb);
+}
+
+void ConditionalConstantPropagation::visit_instruction(BasicBlock *bb, Instruction *ins) {
+    if (ins->get_opcode() == HINS_PHI) {
+        visit_phi(bb, ins);
+    } else if (HighLevel::is_def(ins)) {
+        lower_value(ins->get_operand(0).get_base_reg(), evaluate(ins));
+    } else if (ins->get_opcode() == HINS_INT_COMPARE) {
+        visit_branch(bb);
+    }
+}
+
+void ConditionalConstantPropagation::visit_phi(BasicBlock *bb, Instruction *phi) {
+    // combine the values arriving along executable edges
+    ControlFlowGraph::BlockList preds = SSA::get_predecessors(m_ssa_cfg, bb);
+    LatticeValue value;
+    for (unsigned k = 0; k < preds.size(); k++) {
+        const ControlFlowGraph::EdgeList &outgoing = m_ssa_cfg->get_outgoing_edges(preds[k]);
+        for (auto i = outgoing.cbegin(); i != outgoing.cend(); i++) {
+            if ((*i)->get_target() == bb && m_executable.count(*i) > 0) {
+                value = value.meet(get_value(phi->get_operand(k + 1)));
+                break;
+            }
+        }
+    }
+    lower_value(phi->get_operand(0).get_base_reg(), value);
+}
+
+void ConditionalConstantPropagation::visit_branch(BasicBlock *bb) {
+    // A conditional branch is only known to go one way once the values
+    // it compares are; until then (while either is TOP), neither way is
+    // known to be executable.
+    const unsigned num_ins = bb->get_length();
+    bool conditional = num_ins >= 2 && is_conditional_branch(bb->get_last()) &&
+                       bb->get_instruction(num_ins - 2)->get_opcode() == HINS_INT_COMPARE;
+    if (conditional) {
+        Instruction *compare = bb->get_instruction(num_ins - 2);
+        if (get_value(compare->get_operand(0)).kind == LatticeValue::TOP ||
+            get_value(compare->get_operand(1)).kind == LatticeValue::TOP) {
+            return;
+        }
+    }
+
+    BranchOutcome outcome = conditional ? get_outcome(bb) : BRANCH_UNKNOWN;
+    const ControlFlowGraph::EdgeList &outgoing = m_ssa_cfg->get_outgoing_edges(bb);
+    for (auto i = outgoing.cbegin(); i != outgoing.cend(); i++) {
+        Edge *e = *i;
+        if ((outcome == BRANCH_TAKEN && e->get_kind() == EDGE_FALLTHROUGH) ||
+            (outcome == BRANCH_NOT_TAKEN && e->get_kind() == EDGE_BRANCH)) {
+            continue;
+        }
+        mark_executable(e);
+    }
+}
+
+void ConditionalConstantPropagation::lower_value(int vreg, const LatticeValue &value) {
+    // values only move down the lattice, so that the analysis terminates
+    LatticeValue lowered = m_values[vreg].meet(value);
+    if (lowered != m_values[vreg]) {
+        m_values[vreg] = lowered;
+        m_vreg_work_list.push_back(vreg);
+    }
+}
+
+void ConditionalConstantPropagation::mark_executable(Edge *e) {
+    if (m_executable.insert(e).second) {
+        m_edge_work_list.push_back(e);
+    }
+}
+
+ConditionalConstantPropagation::LatticeValue
+ConditionalConstantPropagation::evaluate(Instruction *ins) const {
+    int opcode = ins->get_opcode();
+
+    switch (opcode) {
+        case HINS_LOAD_ICONST:
+        case HINS_MOV:
+            return get_value(ins->get_operand(1));
+
+        case HINS_INT_NEGATE: {
+            LatticeValue a = get_value(ins->get_operand(1));
+            if (a.is_constant()) {
+                return LatticeValue(LatticeValue::CONSTANT, long(0UL - (unsigned long) a.value));
+            }
+            return a;
+        }
+
+        case HINS_INT_ADD:
+        case HINS_INT_SUB:
+        case HINS_INT_MUL:
+        case HINS_INT_DIV:
+        case HINS_INT_MOD:
+        case HINS_INT_SHL:
+        case HINS_INT_SHR:
+        case HINS_INT_SAR:
+        case HINS_INT_AND: {
+            LatticeValue a = get_value(ins->get_operand(1));
+            LatticeValue b = get_value(ins->get_operand(2));
+            // multiplying (or masking) by zero gives zero, whatever the other operand is
+            if ((opcode == HINS_INT_MUL || opcode == HINS_INT_AND) &&
+                ((a.is_constant() && a.value == 0) || (b.is_constant() && b.value == 0))) {
+                return LatticeValue(LatticeValue::CONSTANT, 0);
+            }
+            if (a.kind == LatticeValue::TOP || b.kind == LatticeValue::TOP) {
+                return LatticeValue(LatticeValue::TOP);
+            }
+            if (!a.is_constant() || !b.is_constant()) {
+                return LatticeValue(LatticeValue::BOTTOM);
+            }
+
+            // arithmetic wraps (as it does in the generated code)
+            unsigned long ua = (unsigned long) a.value, ub = (unsigned long) b.value;
+            switch (opcode) {
+                case HINS_INT_ADD: return LatticeValue(LatticeValue::CONSTANT, long(ua + ub));
+                case HINS_INT_SUB: return LatticeValue(LatticeValue::CONSTANT, long(ua - ub));
+                case HINS_INT_MUL: return LatticeValue(LatticeValue::CONSTANT, long(ua * ub));
+                case HINS_INT_AND: return LatticeValue(LatticeValue::CONSTANT, long(ua & ub));
+                case HINS_INT_SHL: return LatticeValue(LatticeValue::CONSTANT, long(ua << (ub & 63)));
+                case HINS_INT_SHR: return LatticeValue(LatticeValue::CONSTANT, long(ua >> (ub & 63)));
+                case HINS_INT_SAR: return LatticeValue(LatticeValue::CONSTANT, a.value >> (ub & 63));
+                default: break;
+            }
+
+            // leave division by zero (and overflowing division) to happen at runtime
+            if (b.value == 0 || (a.value == LONG_MIN && b.value == -1)) {
+                return LatticeValue(LatticeValue::BOTTOM);
+            }
+            return LatticeValue(LatticeValue::CONSTANT, opcode == HINS_INT_DIV ? a.value / b.value : a.value % b.value);
+        }
+
+        default:
+            // loads, reads, and addresses are not constant
+            return LatticeValue(LatticeValue::BOTTOM);
+    }
+}
+
+ConditionalConstantPropagation::LatticeValue
+ConditionalConstantPropagation::get_value(const Operand &operand) const {
+    switch (operand.get_kind()) {
+        case OPERAND_INT_LITERAL:
+            return LatticeValue(LatticeValue::CONSTANT, operand.get_int_value());
+        case OPERAND_VREG:
+            return m_values[operand.get_base_reg()];
+        default:
+            return LatticeValue(LatticeValue::BOTTOM);
+    }
+}
+
+ConditionalConstantPropagation::BranchOutcome
+ConditionalConstantPropagation::get_outcome(BasicBlock *bb) const {
+    // the outcome is known if the values compared by a cmpi immediately
+    // preceding the final instruction are constant
+    const unsigned num_ins = bb->get_length();
+    if (num_ins < 2 || !is_conditional_branch(bb->get_last()) ||
+        bb->get_instruction(num_ins - 2)->get_opcode() != HINS_INT_COMPARE) {
+        return BRANCH_UNKNOWN;
+    }
+    Instruction *compare = bb->get_instruction(num_ins - 2);
+    LatticeValue left = get_value(compare->get_operand(0));
+    LatticeValue right = get_value(compare->get_operand(1));
+    if (!left.is_constant() || !right.is_constant()) {
+        return BRANCH_UNKNOWN;
+    }
+
+    bool taken;
+    switch (bb->get_last()->get_opcode()) {
+        case HINS_JE:   taken = left.value == right.value; break;
+        case HINS_JNE:  taken = left.value != right.value; break;
+        case HINS_JLT:  taken = left.value < right.value; break;
+        case HINS_JLTE: taken = left.value <= right.value; break;
+        case HINS_JGT:  taken = left.value > right.value; break;
+        case HINS_JGTE: taken = left.value >= right.value; break;
+        default:        assert(false); taken = false;
+    }
+    return taken ? BRANCH_TAKEN : BRANCH_NOT_TAKEN;
+}
+
+bool ConditionalConstantPropagation::can_use_literal(Instruction *ins, unsigned i) {
+    // only operands which the assembly code generator loads with
+    // a movq (and which aren't memory references) may become immediates
+    if (ins->get_operand(i).get_kind() != OPERAND_VREG) {
+        return false;
+    }
+
+    switch (ins->get_opcode()) {
+        case HINS_INT_ADD:
+        case HINS_INT_SUB:
+        case HINS_INT_MUL:
+        case HINS_INT_DIV:
+        case HINS_INT_MOD:
+        case HINS_INT_AND:
+            return i > 0;
+        case HINS_INT_SHL:
+        case HINS_INT_SHR:
+        case HINS_INT_SAR:
+            // the count is always a literal
+            return i == 1;
+        case HINS_STORE_INT:
+        case HINS_MOV:
+            return i == 1;
+        case HINS_WRITE_INT:
+        case HINS_INT_COMPARE:
+        case HINS_RETURN:
+            return true;
+        case HINS_CALL:
+            // the arguments
+            return i > HighLevel::get_call_target(ins);
+        default:
+            return false;
+    }
+}
+
+bool ConditionalConstantPropagation::is_divisor(Instruction *ins, unsigned i) {
+    // instruction selection expands division by a literal of any size (and
+    // loads a divisor it leaves to idivq into a register with movq)
+    return (ins->get_opcode() == HINS_INT_DIV || ins->get_opcode() == HINS_INT_MOD) && i == 2;
+}
+
+bool ConditionalConstantPropagation::fits_immediate(long value) {
+    // x86-64 instructions (other than movabsq) take at most a 32 bit immediate
+    return value >= INT_MIN && value <= INT_MAX;
+}
@@ -0,0 +1,100 @@
+#ifndef CONSTPROP_H
+#define CONSTPROP_H
+
+#include <vector>
+#include <set>
+#include "cfg.h"
+#include "cfg_transform.h"
+#include "ssa.h"
+
+// Global conditional constant propagation (Wegman and Zadeck), on SSA
+// form.  The CFG is converted to SSA form (see ssa.h), so that every vreg
+// of the SSA form has one definition and can be mapped to a single
+// lattice value (TOP, a constant, or BOTTOM).  Instructions are evaluated
+// when their block is first found to be reachable, and again when the
+// value of a vreg they use is lowered (following the def-use chains), so
+// the analysis takes time and memory proportional to the size of the
+// code, rather than to the number of blocks times the number of vregs.
+// Only edges found to be executable contribute to the phis of their
+// targets, so constants flowing around a loop or through a branch that
+// can never be taken are not lost at merge points.
+//
+// The SSA form is only analyzed: the result is applied to the original
+// CFG, whose blocks and instructions correspond one-to-one to those of
+// the SSA form (after its phis).
+//
+// Call execute() to run the analysis, then transform_cfg() to obtain a
+// copy of the CFG in which
+//   - uses of constant vregs are replaced by literals,
+//   - defs of constant vregs become ldci instructions (which are removed
+//     if the vreg is no longer live),
+//   - conditional branches with a known outcome become jmp instructions
+//     (or are removed), along with the cmpi that feeds them, and
+//   - unreachable blocks are deleted.
+class ConditionalConstantPropagation : public ControlFlowGraphTransform {
+public:
+    struct LatticeValue {
+        enum Kind { TOP, CONSTANT, BOTTOM };
+
+        Kind kind;
+        long value;     // only meaningful for CONSTANT
+
+        LatticeValue(Kind k = TOP, long v = 0) : kind(k), value(v) { }
+
+        bool is_constant() const { return kind == CONSTANT; }
+
+        // combine the values of a vreg arriving along two edges
+        LatticeValue meet(const LatticeValue &other) const;
+
+        bool operator==(const LatticeValue &other) const {
+            return kind == other.kind && (kind != CONSTANT || value == other.value);
+        }
+        bool operator!=(const LatticeValue &other) const { return !(*this == other); }
+    };
+
+    enum BranchOutcome {
+        BRANCH_UNKNOWN,     // block doesn't end in a conditional branch, or its outcome varies
+        BRANCH_TAKEN,
+        BRANCH_NOT_TAKEN,
+    };
+
+private:
+    ControlFlowGraph *m_ssa_cfg;            // the CFG in SSA form, which is analyzed
+    DefUseChains *m_def_use;                // of m_ssa_cfg
+    std::vector<LatticeValue> m_values;     // lattice value of each vreg of m_ssa_cfg
+    std::vector<BranchOutcome> m_outcomes;
+    std::vector<bool> m_reachable;
+    std::set<Edge *> m_executable;          // executable edges of m_ssa_cfg
+    std::vector<Edge *> m_edge_work_list;
+    std::vector<int> m_vreg_work_list;
+    bool m_executed;
+
+public:
+    ConditionalConstantPropagation(ControlFlowGraph *cfg);
+    virtual ~ConditionalConstantPropagation();
+
+    // execute the analysis
+    void execute();
+
+    // is the given block (of the original CFG) reachable?
+    bool is_reachable(BasicBlock *bb) const;
+
+    virtual ControlFlowGraph *transform_cfg();
+    virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq);
+
+private:
+    void visit_block(BasicBlock *bb);
+    void visit_instruction(BasicBlock *bb, Instruction *ins);
+    void visit_phi(BasicBlock *bb, Instruction *phi);
+    void visit_branch(BasicBlock *bb);
+    void lower_value(int vreg, const LatticeValue &value);
+    void mark_executable(Edge *e);
+    LatticeValue evaluate(Instruction *ins) const;
+    LatticeValue get_value(const Operand &operand) const;
+    BranchOutcome get_outcome(BasicBlock *bb) const;
+    static bool can_use_literal(Instruction *ins, unsigned i);
+    static bool is_divisor(Instruction *ins, unsigned i);
+    static bool fits_immediate(long value);
+};
+
+#endif // CONSTPROP_H
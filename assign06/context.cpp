@@ -3,6 +3,7 @@
 #include <cstdarg>
 #include <cstdlib>
 #include <cstring>
+#include <climits>
 #include <string>
 #include <map>
 #include <set>
@@ -20,6 +21,18 @@
 #include "x86_64.h"
 #include "cfg_transform.h"
 #include "live_vregs.h"
+#include "regalloc.h"
+#include "constprop.h"
+#include "peephole.h"
+#include "isel.h"
+#include "licm.h"
+#include "ivsr.h"
+#include "ssa.h"
+#include "gvn.h"
+#include "dce.h"
+#include "simplify.h"
+#include "unroll.h"
+#include "inline.h"
 
 ////////////////////////////////////////////////////////////////////////
 // Classes
@@ -33,17 +46,40 @@ private:
     bool flag_print_hins;
     bool flag_optimize;
     bool flag_compile;
+    bool flag_report_unroll;
+    bool flag_report_inline;
+    int opt_level;
+    unsigned unroll_factor;
+
+    // the code of the main program or of a procedure
+    struct Function {
+        std::string label;
+        InstructionSequence *iseq;
+        ControlFlowGraph *cfg;          // while optimizing
+        RegisterAssignment *assignment;
+        long storage_size;
+        long vreg_max;
+    };
 
 public:
   Context(struct Node *ast);
   ~Context();
 
   void set_flag(char flag);
+  void set_opt_level(int level);
+  void set_unroll_factor(unsigned factor);
 
   void build_symtab();
   void print_err(Node* node, const char *fmt, ...);
 
   void gen_code();
+
+private:
+  void optimize(Function &function);
+  void inline_calls(std::vector<Function> &functions);
+  ControlFlowGraph *eliminate_dead_code(ControlFlowGraph *cfg);
+  ControlFlowGraph *unroll_loops(ControlFlowGraph *cfg);
+  static std::set<std::string> get_reachable(const std::vector<Function> &functions);
 };
 
 class SymbolTableBuilder : public ASTVisitor {
@@ -52,6 +88,11 @@ private:
     Type* integer_type;
     Type* char_type;
     long curr_offset = 0;
+    // scope of the procedure being defined (null in the main program)
+    SymbolTable* proc_scope = nullptr;
+    Type* proc_signature = nullptr;
+    // is the call being visited a statement (whose result isn't used)?
+    bool is_call_statement = false;
 public:
 
     void print_err(Node* node, const char* fmt, ...) {
@@ -85,6 +126,26 @@ public:
         char_type = type_create_char();
     }
 
+    // Name resolution: every identifier naming a symbol, where the name is
+    // defined and wherever it's used, is bound to the symbol, so that
+    // later passes get it from the Node (node_get_symbol) instead of
+    // looking up the name again.
+    void bind(Node* ident, SymbolTable* owner, const Symbol* sym) {
+        ident->set_symbol(owner, owner->get_index(sym));
+    }
+
+    // define a name in a scope, binding the identifier defining it
+    void define(SymbolTable* owner, Node* ident, const Symbol& sym) {
+        owner->insert(sym);
+        bind(ident, owner, &owner->get_symbols().back());
+    }
+
+    // Is the name already defined?  The names defined in a procedure
+    // may hide those of the main program.
+    bool is_defined(const char* name) {
+        return scope == proc_scope ? scope->s_exists_local(name) : scope->s_exists(name);
+    }
+
     void visit_constant_def(struct Node *ast) override {
         recur_on_children(ast);
 
@@ -113,11 +174,11 @@ public:
         sym->set_ival(val);
         incr_curr_offset(type->get_size());
 
-        if (scope->s_exists(name)) {
+        if (is_defined(name)) {
             SourceInfo info = node_get_source_info(left);
             err_fatal("%s:%d:%d: Error: Name '%s' is already defined\n", info.filename, info.line, info.col, name);
         } else {
-            scope->insert(*sym);
+            define(scope, left, *sym);
         }
     }
 
@@ -139,11 +200,11 @@ public:
             long offset = get_curr_offset();
             Symbol* sym = symbol_create(name, type, VARIABLE, offset);
             incr_curr_offset(type->get_size());
-            if (scope->s_exists(name)) {
+            if (is_defined(name)) {
                 SourceInfo info = node_get_source_info(left);
                 err_fatal("%s:%d:%d: Error: Name '%s' is already defined\n", info.filename, info.line, info.col, name);
             } else {
-                scope->insert(*sym);
+                define(scope, id, *sym);
             }
         }
     }
@@ -163,11 +224,11 @@ public:
         long offset = get_curr_offset();
         Symbol* sym = symbol_create(name, type, TYPE, offset);
         incr_curr_offset(type->get_size());
-        if (scope->s_exists(name)) {
+        if (is_defined(name)) {
             SourceInfo info = node_get_source_info(left);
             err_fatal("%s:%d:%d: Error: Name '%s' is already defined\n", info.filename, info.line, info.col, name);
         } else {
-            scope->insert(*sym);
+            define(scope, left, *sym);
         }
     }
 
@@ -183,9 +244,11 @@ public:
             named_type = char_type;
         } else {
             // perform lookup
-            if (scope->s_exists(type_str)) {
-                Symbol typeSymbol = scope->lookup(type_str);
-                named_type = typeSymbol.get_type();
+            SymbolTable* owner;
+            Symbol* typeSymbol = scope->find(type_str, &owner);
+            if (typeSymbol != nullptr) {
+                bind(type, owner, typeSymbol);
+                named_type = typeSymbol->get_type();
             } else {
                 SourceInfo info = node_get_source_info(type);
                 err_fatal("%s:%d:%d: Error: Unknown type '%s'\n", info.filename, info.line, info.col, type_str);
@@ -222,25 +285,115 @@ public:
         SymbolTable* nestedSymTab = new SymbolTable(scope);
         scope = nestedSymTab;
 
+        // field offsets are relative to the start of the record
+        long outer_offset = curr_offset;
+        curr_offset = 0;
+
         recur_on_children(ast); // will populate the nested scope with values
 
+        curr_offset = outer_offset;
         scope = scope->get_parent();    // bring it back to parent scope
 
         Type* recordType = type_create_record(nestedSymTab);
         ast->set_type(recordType);
     }
 
+    void visit_procedure(struct Node *ast) override {
+        define_procedure(ast, nullptr);
+    }
+
+    void visit_function(struct Node *ast) override {
+        define_procedure(ast, node_get_kid(ast, 2));
+    }
+
+    void visit_instructions(struct Node *ast) override {
+        // a call can be a statement, which is the only place where a
+        // procedure without a result can be called
+        int num_kids = node_get_num_kids(ast);
+        for (int i = 0; i < num_kids; i++) {
+            Node* kid = node_get_kid(ast, i);
+            is_call_statement = node_get_tag(kid) == AST_CALL;
+            visit(kid);
+        }
+        is_call_statement = false;
+    }
+
+    void visit_call(struct Node *ast) override {
+        bool is_statement = is_call_statement;
+        is_call_statement = false;
+
+        Node* ident = node_get_kid(ast, 0);
+        const char* name = node_get_str(ident);
+        SourceInfo info = node_get_source_info(ident);
+        SymbolTable* owner;
+        Symbol* proc = scope->find(name, &owner);
+        if (proc == nullptr || proc->get_kind() != PROCEDURE) {
+            err_fatal("%s:%d:%d: Error: '%s' is not a procedure\n", info.filename, info.line, info.col, name);
+        }
+        bind(ident, owner, proc);
+        Type* signature = proc->get_type();
+
+        // the arguments are visited, but not the procedure name
+        Node* args = node_get_kid(ast, 1);
+        recur_on_children(args);
+        int num_args = node_get_num_kids(args);
+        if (num_args != signature->paramCount) {
+            err_fatal("%s:%d:%d: Error: '%s' takes %ld argument(s), but %d were given\n",
+                      info.filename, info.line, info.col, name, signature->paramCount, num_args);
+        }
+        for (int i = 0; i < num_args; i++) {
+            Type* type = node_get_kid(args, i)->get_type();
+            if (type != nullptr && type->realType != PRIMITIVE) {
+                SourceInfo arg_info = node_get_source_info(node_get_kid(args, i));
+                err_fatal("%s:%d:%d: Error: Arguments must be INTEGER or CHAR\n",
+                          arg_info.filename, arg_info.line, arg_info.col);
+            }
+        }
+
+        if (!is_statement && signature->returnType == nullptr) {
+            err_fatal("%s:%d:%d: Error: Procedure '%s' has no result\n", info.filename, info.line, info.col, name);
+        }
+        ast->set_str(name);
+        ast->set_type(signature->returnType);
+    }
+
+    void visit_return(struct Node *ast) override {
+        SourceInfo info = node_get_source_info(ast);
+        if (proc_signature == nullptr) {
+            err_fatal("%s:%d:%d: Error: RETURN outside of a procedure\n", info.filename, info.line, info.col);
+        }
+        bool has_value = node_get_num_kids(ast) > 0;
+        if (proc_signature->returnType != nullptr && !has_value) {
+            err_fatal("%s:%d:%d: Error: RETURN in a function needs a value\n", info.filename, info.line, info.col);
+        }
+        if (proc_signature->returnType == nullptr && has_value) {
+            err_fatal("%s:%d:%d: Error: RETURN with a value in a procedure\n", info.filename, info.line, info.col);
+        }
+        recur_on_children(ast);
+    }
+
     void visit_var_ref(struct Node *ast) override {
         Node* ident = node_get_kid(ast, 0);
         const char* varname = node_get_str(ident);
 
-        if (scope->s_exists(varname)) {
+        SymbolTable* owner;
+        Symbol* symbol = scope->find(varname, &owner);
+        if (symbol == nullptr) {
             // if name references a TYPE or RECORD, is also wrong
-        } else {
             SourceInfo info = node_get_source_info(ident);
             err_fatal("%s:%d:%d: Error: Undefined variable '%s'\n", info.filename, info.line, info.col, varname);
         }
-        Symbol sym = scope->lookup(varname);
+        bind(ident, owner, symbol);
+        Symbol& sym = *symbol;
+        if (sym.get_kind() == PROCEDURE) {
+            SourceInfo info = node_get_source_info(ident);
+            err_fatal("%s:%d:%d: Error: Procedure '%s' used as a variable\n", info.filename, info.line, info.col, varname);
+        }
+        if (proc_scope != nullptr && sym.get_kind() == VARIABLE && !proc_scope->s_exists_local(varname)) {
+            // a variable of the main program used by a procedure can't be
+            // in main's stack frame
+            sym.set_static(true);
+        }
         ast->set_str(varname);
         ast->set_type(sym.get_type());
         ast->set_source_info(node_get_source_info(ident));
@@ -250,9 +403,95 @@ public:
         }
     }
 
+    void visit_array_element_ref(struct Node *ast) override {
+        recur_on_children(ast);
+
+        Node* array = node_get_kid(ast, 0);
+        Type* type = array->get_type();
+        if (type == nullptr || type->realType != ARRAY) {
+            SourceInfo info = node_get_source_info(array);
+            err_fatal("%s:%d:%d: Error: Indexed value is not an array\n", info.filename, info.line, info.col);
+        }
+        ast->set_type(type->arrayElementType);
+    }
+
+    void visit_field_ref(struct Node *ast) override {
+        // the field name is looked up in the record's scope, not this one
+        Node* record = node_get_kid(ast, 0);
+        visit(record);
+
+        Node* field = node_get_kid(ast, 1);
+        const char* fieldname = node_get_str(field);
+        Type* type = record->get_type();
+        Symbol* sym = (type != nullptr && type->realType == RECORD) ? type->symtab->find_local(fieldname) : nullptr;
+        if (sym == nullptr) {
+            SourceInfo info = node_get_source_info(field);
+            err_fatal("%s:%d:%d: Error: Unknown field '%s'\n", info.filename, info.line, info.col, fieldname);
+        }
+        bind(field, type->symtab, sym);
+        ast->set_type(sym->get_type());
+    }
+
+private:
+    // Define a procedure (result is null) or function.  The procedure
+    // gets its own scope, in which the parameters come first, followed
+    // by its variables, which are at offsets in its own stack frame.
+    void define_procedure(struct Node *ast, struct Node *result) {
+        Node* ident = node_get_kid(ast, 0);
+        const char* name = node_get_str(ident);
+        SourceInfo info = node_get_source_info(ident);
+        if (proc_scope != nullptr) {
+            err_fatal("%s:%d:%d: Error: Procedures can't be nested\n", info.filename, info.line, info.col);
+        }
+        if (is_defined(name)) {
+            err_fatal("%s:%d:%d: Error: Name '%s' is already defined\n", info.filename, info.line, info.col, name);
+        }
+
+        Type* return_type = nullptr;
+        if (result != nullptr) {
+            visit(result);
+            return_type = result->get_type();
+            if (return_type->realType != PRIMITIVE) {
+                err_fatal("%s:%d:%d: Error: Result of '%s' must be INTEGER or CHAR\n", info.filename, info.line, info.col, name);
+            }
+        }
+
+        SymbolTable* proc = new SymbolTable(scope);
+        scope = proc;
+        proc_scope = proc;
+        long outer_offset = curr_offset;
+        curr_offset = 0;
+
+        Node* params = node_get_kid(ast, 1);
+        recur_on_children(params);
+        const std::vector<Symbol> &symbols = proc->get_symbols();
+        for (auto &sym : symbols) {
+            if (sym.get_type()->realType != PRIMITIVE) {
+                err_fatal("%s:%d:%d: Error: Parameter '%s' must be INTEGER or CHAR\n",
+                          info.filename, info.line, info.col, sym.get_name());
+            }
+        }
+
+        // the procedure is defined before its body, which may call it
+        long num_params = long(symbols.size());
+        Type* signature = type_create_signature(proc, num_params, return_type);
+        define(proc->get_parent(), ident, *symbol_create(name, signature, PROCEDURE, 0));
+        proc_signature = signature;
+
+        int num_kids = node_get_num_kids(ast);
+        visit(node_get_kid(ast, num_kids - 2));   // declarations
+        visit(node_get_kid(ast, num_kids - 1));   // instructions
+
+        curr_offset = outer_offset;
+        scope = proc->get_parent();
+        proc_scope = nullptr;
+        proc_signature = nullptr;
+        ast->set_type(signature);
+    }
+
+public:
     void visit_int_literal(struct Node *ast) override {
-        // set literal value
-        ast->set_ival(strtol(node_get_str(ast), nullptr, 10));
+        // the literal's value was converted by the lexer
         // set type to integer
         ast->set_type(integer_type);
         ast->set_is_const(true);
@@ -357,12 +596,20 @@ private:
     long loop_index = 0;
     long initial_vreg = -1;
     SymbolTable* m_symtab;
-    std::map<std::string, Operand> scalars;
+    std::map<const Symbol*, Operand> scalars;   // vregs of the scalar variables
     InstructionSequence* code;
+    // in a procedure: the label of its epilogue, its result vreg, and
+    // the RETURN which ends its body (which needn't jump to the epilogue)
+    std::string return_label;
+    Operand result;
+    Node* final_return = nullptr;
 
 public:
-    HighLevelCodeGen(SymbolTable* symbolTable)
-        : m_symtab(symbolTable),
+    // Labels are numbered from label_index, so that the code generated
+    // for each procedure can use distinct labels
+    HighLevelCodeGen(SymbolTable* symbolTable, long label_index = 0)
+        : loop_index(label_index),
+        m_symtab(symbolTable),
         scalars() {
         code = new InstructionSequence();
     }
@@ -380,6 +627,21 @@ public:
         return m_vreg_max + 1;
     }
 
+    // the index of the next label (to be used by the next procedure)
+    long get_label_index() {
+        return loop_index;
+    }
+
+    // the label of the code generated for a procedure
+    static std::string get_procedure_label(const char* name) {
+        return cpputil::format("proc_%s", name);
+    }
+
+    // the label of a variable of the main program used by procedures
+    static std::string get_static_label(const char* name) {
+        return cpputil::format("var_%s", name);
+    }
+
 private:
     long next_vreg() {
         m_vreg += 1;
@@ -403,18 +665,138 @@ private:
         return label;
     }
 
-public:
+    // is the node a reference to a variable, array element, or record field?
+    static bool is_designator(int tag) {
+        return tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF || tag == AST_FIELD_REF;
+    }
 
-    void visit_declarations(struct Node *ast) override {
-        for (auto symbol : m_symtab->get_symbols()) {
-            if (symbol.get_kind() == VARIABLE && symbol.get_type()->realType == PRIMITIVE) {
+    // The operand of a designator is either a vreg containing the address
+    // of the variable, or (for array elements and record fields) a memory
+    // reference.  Get the memory reference in either case.
+    static Operand get_memref(Operand op) {
+        return op.is_memref() ? op : op.to_memref();
+    }
+
+    static long get_memref_offset(const Operand &memref) {
+        return (memref.get_kind() & OPROP_HAS_INTVAL) != 0 ? memref.get_offset() : 0;
+    }
+
+    // Create the memory reference base+(index*scale)+offset, where index is
+    // either a vreg or OPERAND_NONE (in which case there is no index).
+    static Operand make_memref(int base, Operand index, long offset, int scale) {
+        if (index.get_kind() == OPERAND_NONE) {
+            if (offset == 0) {
+                return Operand(OPERAND_VREG_MEMREF, base);
+            }
+            return Operand(OPERAND_VREG_MEMREF_OFFSET, base, int(offset));
+        }
+        Operand memref(OPERAND_VREG_MEMREF_OFFSET_INDEX, base, index.get_base_reg(), int(offset), scale);
+        memref.set_index_is_scalar(index.get_is_scalar());
+        return memref;
+    }
+
+    static bool fits_offset(long offset) {
+        return offset >= INT_MIN && offset <= INT_MAX;
+    }
+
+    // Scalar variables are kept in vregs, except for variables of the
+    // main program used by procedures, which are static
+    void assign_scalar_vregs() {
+        for (auto &symbol : m_symtab->get_symbols()) {
+            if (symbol.get_kind() == VARIABLE && symbol.get_type()->realType == PRIMITIVE && !symbol.is_static()) {
                 // this is a scalar variable
                 long next = next_vreg();
                 Operand scalar_vreg(OPERAND_VREG, next);
                 scalar_vreg.set_is_scalar(true);
-                scalars[symbol.get_name()] = scalar_vreg;
+                scalars[&symbol] = scalar_vreg;
             }
         }
+    }
+
+    // Get the value of an expression as a vreg or literal, loading it
+    // if the expression is a variable in memory
+    Operand get_value(Node *expr) {
+        Operand op = expr->get_operand();
+        if (!expr->is_const() && !op.get_is_scalar() && is_designator(node_get_tag(expr))) {
+            long next = next_vreg();
+            Operand loaddest(OPERAND_VREG, next);
+            auto *loadins = new Instruction(HINS_LOAD_INT, loaddest, get_memref(op));
+            code->add_instruction(loadins);
+            op = loaddest;
+        }
+        return op;
+    }
+
+    // The code for a procedure (which is its only visited node): the
+    // parameters and the variables are scalars (their vregs come first,
+    // in that order), followed by the result of a function.  Every RETURN
+    // jumps to the end, where the result is returned.
+    void gen_procedure(struct Node *ast) {
+        Type* signature = ast->get_type();
+        assign_scalar_vregs();
+        if (signature->returnType != nullptr) {
+            result = Operand(OPERAND_VREG, next_vreg());
+            result.set_is_scalar(true);
+        }
+        set_initial_vreg(m_vreg);
+        return_label = next_label();
+
+        const std::vector<Symbol> &symbols = m_symtab->get_symbols();
+        for (long i = 0; i < signature->paramCount; i++) {
+            Operand index(OPERAND_INT_LITERAL, i);
+            code->add_instruction(new Instruction(HINS_PARAM, scalars[&symbols[i]], index));
+        }
+        if (signature->returnType != nullptr) {
+            // falling off the end of a function returns 0
+            code->add_instruction(new Instruction(HINS_MOV, result, Operand(OPERAND_INT_LITERAL, 0L)));
+        }
+
+        Node* instructions = node_get_kid(ast, node_get_num_kids(ast) - 1);
+        int num_instructions = node_get_num_kids(instructions);
+        if (num_instructions > 0 && node_get_tag(node_get_kid(instructions, num_instructions - 1)) == AST_RETURN) {
+            final_return = node_get_kid(instructions, num_instructions - 1);
+        }
+        visit(instructions);
+
+        if (code->has_label_at_end()) {
+            code->add_instruction(new Instruction(HINS_NOP));
+        }
+        code->define_label(return_label);
+        if (signature->returnType != nullptr) {
+            code->add_instruction(new Instruction(HINS_RETURN, result));
+        } else {
+            code->add_instruction(new Instruction(HINS_RETURN));
+        }
+    }
+
+    // call [vrD,] label, args...
+    void gen_call(struct Node *ast, bool has_result) {
+        Node *args = node_get_kid(ast, 1);
+        recur_on_children(args);
+
+        std::vector<Operand> values;
+        for (int i = 0; i < node_get_num_kids(args); i++) {
+            values.push_back(get_value(node_get_kid(args, i)));
+        }
+
+        Operand label(get_procedure_label(node_get_str(ast)));
+        auto *callins = new Instruction(HINS_CALL);
+        if (has_result) {
+            Operand dest(OPERAND_VREG, next_vreg());
+            callins->add_operand(dest);
+            ast->set_operand(dest);
+        }
+        callins->add_operand(label);
+        for (auto i = values.begin(); i != values.end(); i++) {
+            callins->add_operand(*i);
+        }
+        code->add_instruction(callins);
+    }
+
+public:
+
+    void visit_declarations(struct Node *ast) override {
+        assign_scalar_vregs();
 
         set_initial_vreg(scalars.size() - 1);
 
@@ -423,6 +805,57 @@ public:
         reset_vreg();
     }
 
+    void visit_program(struct Node *ast) override {
+        ASTVisitor::visit_program(ast);
+
+        // a label at the end of the program (e.g., after a final IF) must
+        // label an instruction, so that the CFG builder can find its target
+        if (code->has_label_at_end()) {
+            code->add_instruction(new Instruction(HINS_NOP));
+        }
+    }
+
+    void visit_procedure(struct Node *ast) override {
+        gen_procedure(ast);
+    }
+
+    void visit_function(struct Node *ast) override {
+        gen_procedure(ast);
+    }
+
+    void visit_instructions(struct Node *ast) override {
+        // the result of a call which is a statement isn't used
+        int num_kids = node_get_num_kids(ast);
+        for (int i = 0; i < num_kids; i++) {
+            Node *kid = node_get_kid(ast, i);
+            if (node_get_tag(kid) == AST_CALL) {
+                gen_call(kid, false);
+                reset_vreg();
+            } else {
+                visit(kid);
+            }
+        }
+    }
+
+    void visit_call(struct Node *ast) override {
+        gen_call(ast, true);
+    }
+
+    void visit_return(struct Node *ast) override {
+        if (node_get_num_kids(ast) > 0) {
+            Node *value = node_get_kid(ast, 0);
+            visit(value);
+            auto *movins = new Instruction(HINS_MOV, result, get_value(value));
+            code->add_instruction(movins);
+        }
+        if (ast != final_return) {
+            auto *jumpins = new Instruction(HINS_JUMP, Operand(return_label));
+            code->add_instruction(jumpins);
+        }
+
+        reset_vreg();
+    }
+
     void visit_if(struct Node *ast) override {
         Node *cond = ast->get_kid(0);
         Node *iftrue = ast->get_kid(1);
@@ -519,11 +952,11 @@ public:
         int tag = node_get_tag(lhs);
         if (l_op.get_is_scalar()) {
             // just use l_op directly
-        } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
+        } else if (!lhs->is_const() && is_designator(tag)) {
             // ldi vr3, (vr1)
             long lreg = next_vreg();
             Operand ldest(OPERAND_VREG, lreg);
-            Operand lfrom(OPERAND_VREG_MEMREF, l_op.get_base_reg());
+            Operand lfrom = get_memref(l_op);
             auto *lload = new Instruction(HINS_LOAD_INT, ldest, lfrom);
             l_op = ldest;
             code->add_instruction(lload);
@@ -533,11 +966,11 @@ public:
             tag = node_get_tag(rhs);
             if (r_op.get_is_scalar()) {
                 // just use r_op directly
-            } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
+            } else if (is_designator(tag)) {
                 // ldi vr4, (vr2)
                 long rreg = next_vreg();
                 Operand rdest(OPERAND_VREG, rreg);
-                Operand rfrom(OPERAND_VREG_MEMREF, r_op.get_base_reg());
+                Operand rfrom = get_memref(r_op);
                 auto *rload = new Instruction(HINS_LOAD_INT, rdest, rfrom);
                 r_op = rdest;
                 code->add_instruction(rload);
@@ -568,11 +1001,11 @@ public:
         int tag = node_get_tag(lhs);
         if (l_op.get_is_scalar()) {
             // just use l_op directly
-        } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
+        } else if (!lhs->is_const() && is_designator(tag)) {
             // ldi vr3, (vr1)
             long lreg = next_vreg();
             Operand ldest(OPERAND_VREG, lreg);
-            Operand lfrom(OPERAND_VREG_MEMREF, l_op.get_base_reg());
+            Operand lfrom = get_memref(l_op);
             auto* lload = new Instruction(HINS_LOAD_INT, ldest, lfrom);
             l_op = ldest;
             code->add_instruction(lload);
@@ -582,11 +1015,11 @@ public:
             tag = node_get_tag(rhs);
             if (r_op.get_is_scalar()) {
                 // just use r_op directly
-            } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
+            } else if (is_designator(tag)) {
                 // ldi vr4, (vr2)
                 long rreg = next_vreg();
                 Operand rdest(OPERAND_VREG, rreg);
-                Operand rfrom(OPERAND_VREG_MEMREF, r_op.get_base_reg());
+                Operand rfrom = get_memref(r_op);
                 auto *rload = new Instruction(HINS_LOAD_INT, rdest, rfrom);
                 r_op = rdest;
                 code->add_instruction(rload);
@@ -617,11 +1050,11 @@ public:
         int tag = node_get_tag(lhs);
         if (l_op.get_is_scalar()) {
             // just use l_op directly
-        } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
+        } else if (!lhs->is_const() && is_designator(tag)) {
             // ldi vr3, (vr1)
             long lreg = next_vreg();
             Operand ldest(OPERAND_VREG, lreg);
-            Operand lfrom(OPERAND_VREG_MEMREF, l_op.get_base_reg());
+            Operand lfrom = get_memref(l_op);
             auto* lload = new Instruction(HINS_LOAD_INT, ldest, lfrom);
             l_op = ldest;
             code->add_instruction(lload);
@@ -631,11 +1064,11 @@ public:
             tag = node_get_tag(rhs);
             if (r_op.get_is_scalar()) {
                 // just use r_op directly
-            } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
+            } else if (is_designator(tag)) {
                 // ldi vr4, (vr2)
                 long rreg = next_vreg();
                 Operand rdest(OPERAND_VREG, rreg);
-                Operand rfrom(OPERAND_VREG_MEMREF, r_op.get_base_reg());
+                Operand rfrom = get_memref(r_op);
                 auto *rload = new Instruction(HINS_LOAD_INT, rdest, rfrom);
                 r_op = rdest;
                 code->add_instruction(rload);
@@ -666,11 +1099,11 @@ public:
         int tag = node_get_tag(lhs);
         if (l_op.get_is_scalar()) {
             // just use l_op directly
-        } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
+        } else if (!lhs->is_const() && is_designator(tag)) {
             // ldi vr3, (vr1)
             long lreg = next_vreg();
             Operand ldest(OPERAND_VREG, lreg);
-            Operand lfrom(OPERAND_VREG_MEMREF, l_op.get_base_reg());
+            Operand lfrom = get_memref(l_op);
             auto* lload = new Instruction(HINS_LOAD_INT, ldest, lfrom);
             l_op = ldest;
             code->add_instruction(lload);
@@ -680,11 +1113,11 @@ public:
             tag = node_get_tag(rhs);
             if (r_op.get_is_scalar()) {
                 // just use r_op directly
-            } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
+            } else if (is_designator(tag)) {
                 // ldi vr4, (vr2)
                 long rreg = next_vreg();
                 Operand rdest(OPERAND_VREG, rreg);
-                Operand rfrom(OPERAND_VREG_MEMREF, r_op.get_base_reg());
+                Operand rfrom = get_memref(r_op);
                 auto *rload = new Instruction(HINS_LOAD_INT, rdest, rfrom);
                 r_op = rdest;
                 code->add_instruction(rload);
@@ -715,11 +1148,11 @@ public:
         int tag = node_get_tag(lhs);
         if (l_op.get_is_scalar()) {
             // just use l_op directly
-        } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
+        } else if (!lhs->is_const() && is_designator(tag)) {
             // ldi vr3, (vr1)
             long lreg = next_vreg();
             Operand ldest(OPERAND_VREG, lreg);
-            Operand lfrom(OPERAND_VREG_MEMREF, l_op.get_base_reg());
+            Operand lfrom = get_memref(l_op);
             auto* lload = new Instruction(HINS_LOAD_INT, ldest, lfrom);
             l_op = ldest;
             code->add_instruction(lload);
@@ -729,11 +1162,11 @@ public:
             tag = node_get_tag(rhs);
             if (r_op.get_is_scalar()) {
                 // just use r_op directly
-            } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
+            } else if (is_designator(tag)) {
                 // ldi vr4, (vr2)
                 long rreg = next_vreg();
                 Operand rdest(OPERAND_VREG, rreg);
-                Operand rfrom(OPERAND_VREG_MEMREF, r_op.get_base_reg());
+                Operand rfrom = get_memref(r_op);
                 auto *rload = new Instruction(HINS_LOAD_INT, rdest, rfrom);
                 r_op = rdest;
                 code->add_instruction(rload);
@@ -764,11 +1197,11 @@ public:
         int tag = node_get_tag(lhs);
         if (l_op.get_is_scalar()) {
             // just use l_op directly
-        } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
+        } else if (!lhs->is_const() && is_designator(tag)) {
             // ldi vr3, (vr1)
             long lreg = next_vreg();
             Operand ldest(OPERAND_VREG, lreg);
-            Operand lfrom(OPERAND_VREG_MEMREF, l_op.get_base_reg());
+            Operand lfrom = get_memref(l_op);
             auto* lload = new Instruction(HINS_LOAD_INT, ldest, lfrom);
             l_op = ldest;
             code->add_instruction(lload);
@@ -778,11 +1211,11 @@ public:
             tag = node_get_tag(rhs);
             if (r_op.get_is_scalar()) {
                 // just use r_op directly
-            } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
+            } else if (is_designator(tag)) {
                 // ldi vr4, (vr2)
                 long rreg = next_vreg();
                 Operand rdest(OPERAND_VREG, rreg);
-                Operand rfrom(OPERAND_VREG_MEMREF, r_op.get_base_reg());
+                Operand rfrom = get_memref(r_op);
                 auto *rload = new Instruction(HINS_LOAD_INT, rdest, rfrom);
                 r_op = rdest;
                 code->add_instruction(rload);
@@ -819,7 +1252,7 @@ public:
             auto *movins = new Instruction(HINS_MOV, destreg, readdest);
             code->add_instruction(movins);
         } else {
-            Operand toaddr(OPERAND_VREG_MEMREF, destreg.get_base_reg());   // use this one
+            Operand toaddr = get_memref(destreg);   // use this one
             auto *storeins = new Instruction(HINS_STORE_INT, toaddr, readdest);
             code->add_instruction(storeins);
         }
@@ -836,14 +1269,14 @@ public:
         int tag = node_get_tag(kid);
         if (op.get_is_scalar()) {
             // just use op directly
-        } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
+        } else if (!kid->is_const() && is_designator(tag)) {
             // loadint from addr to vreg
             // ldi vr1, (vr0)
             long toreg = next_vreg();
             Operand writedest(OPERAND_VREG, toreg);
             op = writedest;
             Operand fromreg = kid->get_operand();    // don't use this one
-            Operand fromaddr(OPERAND_VREG_MEMREF, fromreg.get_base_reg()); // use this one
+            Operand fromaddr = get_memref(fromreg); // use this one
             auto *loadins = new Instruction(HINS_LOAD_INT, writedest, fromaddr);
             code->add_instruction(loadins);
         }
@@ -870,10 +1303,10 @@ public:
             int tag = node_get_tag(rhs);
             if (valop.get_is_scalar()) {
                 // do nothing
-            } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
+            } else if (is_designator(tag)) {
                 long vreg = next_vreg();
                 Operand loaddest(OPERAND_VREG, vreg);
-                auto *loadins = new Instruction(HINS_LOAD_INT, loaddest, valop.to_memref());
+                auto *loadins = new Instruction(HINS_LOAD_INT, loaddest, get_memref(valop));
                 code->add_instruction(loadins);
                 valop = loaddest;
             }
@@ -881,12 +1314,12 @@ public:
 
         Operand l_vreg = lhs->get_operand();
 
-        if (node_get_tag(lhs) == AST_VAR_REF || node_get_tag(lhs) == AST_ARRAY_ELEMENT_REF) {
+        if (is_designator(node_get_tag(lhs))) {
             if (l_vreg.get_is_scalar()) {
                 auto *movins = new Instruction(HINS_MOV, l_vreg, valop);
                 code->add_instruction(movins);
             } else {
-                Operand refop(OPERAND_VREG_MEMREF, l_vreg.get_base_reg());
+                Operand refop = get_memref(l_vreg);
                 auto *storeins = new Instruction(HINS_STORE_INT, refop, valop);
                 code->add_instruction(storeins);
             }
@@ -910,11 +1343,11 @@ public:
         int tag = node_get_tag(lhs);
         if (l_op.get_is_scalar()) {
             // just use l_op directly
-        } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
+        } else if (!lhs->is_const() && is_designator(tag)) {
             // ldi vr3, (vr1)
             long lreg = next_vreg();
             Operand ldest(OPERAND_VREG, lreg);
-            Operand lfrom(OPERAND_VREG_MEMREF, l_op.get_base_reg());
+            Operand lfrom = get_memref(l_op);
             auto* lload = new Instruction(HINS_LOAD_INT, ldest, lfrom);
             l_op = ldest;
             code->add_instruction(lload);
@@ -924,11 +1357,11 @@ public:
             tag = node_get_tag(rhs);
             if (r_op.get_is_scalar()) {
                 // just use l_op directly
-            } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
+            } else if (is_designator(tag)) {
                 // ldi vr4, (vr2)
                 long rreg = next_vreg();
                 Operand rdest(OPERAND_VREG, rreg);
-                Operand rfrom(OPERAND_VREG_MEMREF, r_op.get_base_reg());
+                Operand rfrom = get_memref(r_op);
                 auto *rload = new Instruction(HINS_LOAD_INT, rdest, rfrom);
                 r_op = rdest;
                 code->add_instruction(rload);
@@ -957,10 +1390,10 @@ public:
         int tag = node_get_tag(lhs);
         if (l_op.get_is_scalar()) {
             // just use l_op directly
-        } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
+        } else if (!lhs->is_const() && is_designator(tag)) {
             long lreg = next_vreg();
             Operand ldest(OPERAND_VREG, lreg);
-            Operand lfrom(OPERAND_VREG_MEMREF, l_op.get_base_reg());
+            Operand lfrom = get_memref(l_op);
             auto *lload = new Instruction(HINS_LOAD_INT, ldest, lfrom);
             l_op = ldest;
             code->add_instruction(lload);
@@ -970,11 +1403,11 @@ public:
             tag = node_get_tag(rhs);
             if (r_op.get_is_scalar()) {
                 // just use l_op directly
-            } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
+            } else if (is_designator(tag)) {
                 // ldi vr4, (vr2)
                 long rreg = next_vreg();
                 Operand rdest(OPERAND_VREG, rreg);
-                Operand rfrom(OPERAND_VREG_MEMREF, r_op.get_base_reg());
+                Operand rfrom = get_memref(r_op);
                 auto *rload = new Instruction(HINS_LOAD_INT, rdest, rfrom);
                 r_op = rdest;
                 code->add_instruction(rload);
@@ -1002,11 +1435,11 @@ public:
         int tag = node_get_tag(lhs);
         if (l_op.get_is_scalar()) {
             // just use l_op directly
-        } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
+        } else if (!lhs->is_const() && is_designator(tag)) {
             // ldi vr3, (vr1)
             long lreg = next_vreg();
             Operand ldest(OPERAND_VREG, lreg);
-            Operand lfrom(OPERAND_VREG_MEMREF, l_op.get_base_reg());
+            Operand lfrom = get_memref(l_op);
             auto *lload = new Instruction(HINS_LOAD_INT, ldest, lfrom);
             l_op = ldest;
             code->add_instruction(lload);
@@ -1016,11 +1449,11 @@ public:
             tag = node_get_tag(rhs);
             if (r_op.get_is_scalar()) {
                 // just use l_op directly
-            } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
+            } else if (is_designator(tag)) {
                 // ldi vr4, (vr2)
                 long rreg = next_vreg();
                 Operand rdest(OPERAND_VREG, rreg);
-                Operand rfrom(OPERAND_VREG_MEMREF, r_op.get_base_reg());
+                Operand rfrom = get_memref(r_op);
                 auto *rload = new Instruction(HINS_LOAD_INT, rdest, rfrom);
                 r_op = rdest;
                 code->add_instruction(rload);
@@ -1048,11 +1481,11 @@ public:
         int tag = node_get_tag(lhs);
         if (l_op.get_is_scalar()) {
             // just use l_op directly
-        } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
+        } else if (!lhs->is_const() && is_designator(tag)) {
             // ldi vr3, (vr1)
             long lreg = next_vreg();
             Operand ldest(OPERAND_VREG, lreg);
-            Operand lfrom(OPERAND_VREG_MEMREF, l_op.get_base_reg());
+            Operand lfrom = get_memref(l_op);
             auto *lload = new Instruction(HINS_LOAD_INT, ldest, lfrom);
             l_op = ldest;
             code->add_instruction(lload);
@@ -1062,11 +1495,11 @@ public:
             tag = node_get_tag(rhs);
             if (r_op.get_is_scalar()) {
                 // just use l_op directly
-            } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
+            } else if (is_designator(tag)) {
                 // ldi vr4, (vr2)
                 long rreg = next_vreg();
                 Operand rdest(OPERAND_VREG, rreg);
-                Operand rfrom(OPERAND_VREG_MEMREF, r_op.get_base_reg());
+                Operand rfrom = get_memref(r_op);
                 auto *rload = new Instruction(HINS_LOAD_INT, rdest, rfrom);
                 r_op = rdest;
                 code->add_instruction(rload);
@@ -1094,11 +1527,11 @@ public:
         int tag = node_get_tag(lhs);
         if (l_op.get_is_scalar()) {
             // just use l_op directly
-        } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
+        } else if (!lhs->is_const() && is_designator(tag)) {
             // ldi vr3, (vr1)
             long lreg = next_vreg();
             Operand ldest(OPERAND_VREG, lreg);
-            Operand lfrom(OPERAND_VREG_MEMREF, l_op.get_base_reg());
+            Operand lfrom = get_memref(l_op);
             auto *lload = new Instruction(HINS_LOAD_INT, ldest, lfrom);
             l_op = ldest;
             code->add_instruction(lload);
@@ -1108,11 +1541,11 @@ public:
             tag = node_get_tag(rhs);
             if (r_op.get_is_scalar()) {
                 // just use l_op directly
-            } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
+            } else if (is_designator(tag)) {
                 // ldi vr4, (vr2)
                 long rreg = next_vreg();
                 Operand rdest(OPERAND_VREG, rreg);
-                Operand rfrom(OPERAND_VREG_MEMREF, r_op.get_base_reg());
+                Operand rfrom = get_memref(r_op);
                 auto *rload = new Instruction(HINS_LOAD_INT, rdest, rfrom);
                 r_op = rdest;
                 code->add_instruction(rload);
@@ -1129,47 +1562,96 @@ public:
     }
 
     void visit_array_element_ref(struct Node *ast) override {
-        ASTVisitor::visit_array_element_ref(ast);
+        // a constant index isn't evaluated (see below)
+        Node *array = node_get_kid(ast, 0);
+        Node *index = node_get_kid(ast, 1);
+        visit(array);
+        if (!index->is_const()) {
+            visit(index);
+        }
 
-        // load array start addr into vr0
-        // load array accessor into into vr1
-        // multiply
+        // The element is at base+(index*element_size)+offset, where the
+        // array itself is at base+offset (possibly with its own index, if
+        // it's an element of an enclosing array).  Element sizes of 1, 2,
+        // 4, or 8 are used as the scale of the index, so no multiplication
+        // or addition is needed for the common cases.
+        Operand array_ref = get_memref(array->get_operand());
+        long element_size = array->get_type()->arrayElementType->get_size();
+        long offset = get_memref_offset(array_ref);
+
+        if (index->is_const() && fits_offset(offset + node_get_ival(index) * element_size)) {
+            // constant index: the element is at a fixed offset from the array
+            offset += node_get_ival(index) * element_size;
+            Operand index_op = array_ref.has_index_reg() ? array_ref.get_index_operand() : Operand();
+            Operand element_ref = make_memref(array_ref.get_base_reg(), index_op, offset, array_ref.get_scale());
+            ast->set_operand(element_ref);
+            return;
+        }
 
-        // vr0 = (arr)
-        // vr0 is address of arr start
-        // vr1 = $index
-        // vr2 = vr1 * element_size
-        // vr3 = vr0 + vr2
+        if (index->is_const()) {
+            // ldci vr1, $index
+            visit(index);
+        }
+        Operand index_op = index->get_operand();
+        if (!index_op.get_is_scalar() && is_designator(node_get_tag(index))) {
+            // ldi vr2, (vr1)
+            long next = next_vreg();
+            Operand loaddest(OPERAND_VREG, next);
+            auto *loadins = new Instruction(HINS_LOAD_INT, loaddest, get_memref(index_op));
+            code->add_instruction(loadins);
+            index_op = loaddest;
+        }
 
-        Node *identifier = node_get_kid(ast, 0);
-        Operand arr_start = identifier->get_operand();
+        Operand base(OPERAND_VREG, array_ref.get_base_reg());
+        if (array_ref.has_index_reg()) {
+            // an address only has one index: add the enclosing array's
+            // scaled index to the base
+            Operand outer_index = array_ref.get_index_operand();
+            if (array_ref.get_scale() != 1) {
+                long next = next_vreg();
+                Operand scaled_reg(OPERAND_VREG, next);
+                Operand scale(OPERAND_INT_LITERAL, array_ref.get_scale());
+                auto *mulins = new Instruction(HINS_INT_MUL, scaled_reg, outer_index, scale);
+                code->add_instruction(mulins);
+                outer_index = scaled_reg;
+            }
+            long next = next_vreg();
+            Operand base_reg(OPERAND_VREG, next);
+            auto *addins = new Instruction(HINS_INT_ADD, base_reg, base, outer_index);
+            code->add_instruction(addins);
+            base = base_reg;
+        }
 
-        Node *index = node_get_kid(ast, 1);
-        Operand index_op = index->get_operand();
+        int scale = int(element_size);
+        if (element_size != 1 && element_size != 2 && element_size != 4 && element_size != 8) {
+            // vr3 = vr2 * element_size
+            long next = next_vreg();
+            Operand offset_reg(OPERAND_VREG, next);
+            Operand size(OPERAND_INT_LITERAL, element_size);
+            auto *mulins = new Instruction(HINS_INT_MUL, offset_reg, index_op, size);
+            code->add_instruction(mulins);
+            index_op = offset_reg;
+            scale = 1;
+        }
 
-        if (index_op.get_is_scalar()) {
-            // do nothing
-        } else if (node_get_tag(index) == AST_VAR_REF) {   // dereference any identifiers passed into index
-            index_op = index_op.to_memref();
-        }   // otherwise, the index immediate is safe to use
+        Operand element_ref = make_memref(base.get_base_reg(), index_op, offset, scale);
+        ast->set_operand(element_ref);
+    }
 
-        const char* varname = node_get_str(identifier);
-        Type *array_type = m_symtab->lookup(varname).get_type();
-        Type *element_type = array_type->arrayElementType;
-        Operand element_size(OPERAND_INT_LITERAL, element_type->get_size());
+    void visit_field_ref(struct Node *ast) override {
+        // only the record is visited: the field name isn't a variable
+        Node *record = node_get_kid(ast, 0);
+        visit(record);
 
-        long next = next_vreg();
-        Operand offset_reg(OPERAND_VREG, next);
-        auto *mulins = new Instruction(HINS_INT_MUL, offset_reg, index_op, element_size);
-        code->add_instruction(mulins);
+        // the field is at a fixed offset from the record
+        Node *field = node_get_kid(ast, 1);
+        const Symbol* sym = node_get_symbol(field);
+        Operand record_ref = get_memref(record->get_operand());
+        long offset = get_memref_offset(record_ref) + sym->get_offset();
 
-        // result reg now contains offset from array start
-        // add the address and offset to get address of (arr[index])
-        next = next_vreg();
-        Operand arr_addr_reg(OPERAND_VREG, next);
-        auto *addins = new Instruction(HINS_INT_ADD, arr_addr_reg, arr_start, offset_reg);
-        code->add_instruction(addins);
-        ast->set_operand(arr_addr_reg);
+        Operand index_op = record_ref.has_index_reg() ? record_ref.get_index_operand() : Operand();
+        Operand field_ref = make_memref(record_ref.get_base_reg(), index_op, offset, record_ref.get_scale());
+        ast->set_operand(field_ref);
     }
 
     void visit_var_ref(struct Node *ast) override {
@@ -1187,7 +1669,9 @@ public:
 
         const char* varname = node_get_str(ast);
 
-        auto it = scalars.find(varname);
+        // the identifier was bound to its symbol by the SymbolTableBuilder
+        const Symbol &sym = *node_get_symbol(ast);
+        auto it = scalars.find(&sym);
         if (it != scalars.end()) {
             Operand scalar_vreg = it->second;
             ast->set_operand(scalar_vreg);
@@ -1201,7 +1685,6 @@ public:
 
         // get offset from symbol
         // instruction is an offset ref
-        Symbol sym = m_symtab->lookup(varname);
 
         if (sym.get_kind() == CONST) {
             long value = sym.get_ival();
@@ -1209,6 +1692,11 @@ public:
 
             auto *loadins = new Instruction(HINS_LOAD_ICONST, destreg, constval);
             code->add_instruction(loadins);
+        } else if (sym.is_static()) {
+            // globaladdr vr0, $var_x
+            Operand label(get_static_label(varname), true);
+            auto *loadaddrins = new Instruction(HINS_GLOBALADDR, destreg, label);
+            code->add_instruction(loadaddrins);
         } else {
             long offset = sym.get_offset();
             Operand addroffset(OPERAND_INT_LITERAL, offset);
@@ -1235,7 +1723,7 @@ public:
     }
 };
 
-class AssemblyCodeGen {
+class AssemblyCodeGen : public X86_64CodeGenCallbacks {
     // needs to know about storage requirements
     // needs to know highest virtual register value
     // needs HINS instruction sequence
@@ -1244,12 +1732,35 @@ private:
     InstructionSequence* assembly;
     InstructionSequence* hins;
     PrintHighLevelInstructionSequence* print_helper;
+    RegisterAssignment* reg_assignment;
     const long WORD_SIZE = 8;
     long local_storage_size;
     long num_vreg;
     long total_storage_size;
     // total is just local_storage_size + (WORD_SIZE * num_vreg)
 
+    // with a RegisterAssignment, vregs not assigned an mreg live in spill slots
+    // starting at spill_area_offset
+    long spill_area_offset;
+
+    // the function's label, and its parameters: each param's vreg,
+    // and the index of the argument it receives
+    std::string function_label;
+    std::vector<std::pair<Operand, long> > params;
+    bool params_moved;
+
+    // The frame: the callee-saved registers used (pushed in the preamble),
+    // and whether the function is a leaf (makes no calls, so %rsp needn't
+    // be aligned).  A leaf function needing no stack slots and no
+    // callee-saved registers has no frame at all.
+    std::vector<int> saved_mregs;
+    bool is_leaf;
+    long frame_size;    // before alignment
+
+    // calls (in the CFG given to select_instructions) followed only by
+    // the return of their result, which are emitted as jumps
+    std::set<Instruction *> tail_calls;
+
     // localaddr with $N means N offset of rsp
     // N(%rsp)
 
@@ -1257,37 +1768,80 @@ private:
     // N = storage_size + (N * WORD_SIZE)
     // N(%rsp)
 public:
-    AssemblyCodeGen(InstructionSequence* highlevelins, long storage_size, long vreg_max) {
+    AssemblyCodeGen(InstructionSequence* highlevelins, long storage_size, long vreg_max,
+                    const std::string &label = "main") {
         hins = highlevelins;
-        local_storage_size = storage_size;
+        function_label = label;
+        is_leaf = true;
+        bool has_locals = false;
+        // vr0 - vr4 may be mapped to rbx, r12, r13, r14, r15 (see get_mreg)
+        unsigned mapped_vregs = 0;
+        for (auto i = hins->cbegin(); i != hins->cend(); i++) {
+            Instruction *hin = *i;
+            switch (hin->get_opcode()) {
+                case HINS_PARAM:
+                    params.push_back(std::make_pair(hin->get_operand(0), hin->get_operand(1).get_int_value()));
+                    break;
+                case HINS_READ_INT:
+                case HINS_WRITE_INT:
+                case HINS_CALL:
+                    is_leaf = false;
+                    break;
+                case HINS_LOCALADDR:
+                    has_locals = true;
+                    break;
+            }
+            for (unsigned j = 0; j < hin->get_num_operands(); j++) {
+                Operand operand = hin->get_operand(j);
+                if (operand.has_base_reg() && operand.get_does_map_mreg() && operand.get_base_reg() < 5) {
+                    mapped_vregs |= 1U << unsigned(operand.get_base_reg());
+                }
+                if (operand.has_index_reg() && operand.get_index_does_map_mreg() && operand.get_index_reg() < 5) {
+                    mapped_vregs |= 1U << unsigned(operand.get_index_reg());
+                }
+            }
+        }
+        const int mapped_mregs[] = { MREG_RBX, MREG_R12, MREG_R13, MREG_R14, MREG_R15 };
+        for (unsigned i = 0; i < 5; i++) {
+            if ((mapped_vregs & (1U << i)) != 0) {
+                saved_mregs.push_back(mapped_mregs[i]);
+            }
+        }
+        params_moved = false;
+        reg_assignment = nullptr;
+        // scalar variables are in vregs, so the storage for the variables
+        // is only needed if some variable is accessed in memory; the vregs'
+        // slots start at a word boundary
+        local_storage_size = has_locals ? (storage_size + WORD_SIZE - 1) / WORD_SIZE * WORD_SIZE : 0;
         num_vreg = vreg_max;
 
         // calculate total storage
-        total_storage_size = local_storage_size + (num_vreg * WORD_SIZE);
-        // stack alignment check
-        if (total_storage_size % 16 != 0) {
-            total_storage_size += 8;
-        }
+        set_frame_size(local_storage_size + (num_vreg * WORD_SIZE));
+        spill_area_offset = 0;
         assembly = new InstructionSequence();
         print_helper = new PrintHighLevelInstructionSequence(nullptr);
     }
 
-    void translate_instructions() {
-        // callee-owned
-        Operand rsp(OPERAND_MREG, MREG_RSP);
-        Operand rdi(OPERAND_MREG, MREG_RDI);
-        Operand rsi(OPERAND_MREG, MREG_RSI);
-        Operand r10(OPERAND_MREG, MREG_R10);
-        Operand r11(OPERAND_MREG, MREG_R11);
-        Operand rax(OPERAND_MREG, MREG_RAX);
-        Operand rdx(OPERAND_MREG, MREG_RDX);
+    // Use the vreg locations computed by a register allocator
+    // instead of a stack slot per vreg
+    void set_register_assignment(RegisterAssignment *assignment) {
+        reg_assignment = assignment;
+
+        // only the callee-saved registers which are assigned are saved
+        saved_mregs.clear();
+        const std::vector<int> &mregs = RegisterAssignment::get_allocatable_mregs();
+        for (auto i = mregs.cbegin(); i != mregs.cend(); i++) {
+            if (RegisterAssignment::is_callee_saved(*i) && assignment->uses_mreg(*i)) {
+                saved_mregs.push_back(*i);
+            }
+        }
 
-        // static labels
-        Operand inputfmt("s_readint_fmt", true);
-        Operand outputfmt("s_writeint_fmt", true);
-        Operand printf_label("printf");
-        Operand scanf_label("scanf");
+        // spill slots start at the first word boundary past the local variables
+        spill_area_offset = (local_storage_size + WORD_SIZE - 1) / WORD_SIZE * WORD_SIZE;
+        set_frame_size(spill_area_offset + (long(assignment->get_num_spill_slots()) * WORD_SIZE));
+    }
 
+    void translate_instructions() {
         const long num_ins = hins->get_length();
         for (int i = 0; i < num_ins; i++) {
             auto *hin = hins->get_instruction(i);
@@ -1297,354 +1851,676 @@ public:
                 assembly->define_label(label);
             }
 
-            switch(hin->get_opcode()) {
-                case HINS_LOCALADDR: {
-                    Operand rhs = hin->get_operand(1); // offset is rhs
-                    Operand locaddr(OPERAND_MREG_MEMREF_OFFSET, MREG_RSP, rhs.get_int_value());
-                    auto *leaq = new Instruction(MINS_LEAQ, locaddr, r10);
-                    leaq->set_comment(get_hins_comment(hin));
-                    assembly->add_instruction(leaq);
+            translate_instruction(hin, assembly);
+        }
 
-                    // vrN is offset 8N(rsp);
-                    Operand lhs = hin->get_operand(0);
-                    Operand dest = get_mreg(lhs);
-                    auto *movq = new Instruction(MINS_MOVQ, r10, dest);
-                    assembly->add_instruction(movq);
-                    break;
+        if (hins->has_label_at_end()) {
+            assembly->define_label(hins->get_label_at_end());
+        }
+    }
+
+    // Select instructions by tiling the expression trees in each basic
+    // block, falling back to translate_instruction for single instructions
+    void select_instructions() {
+        HighLevelControlFlowGraphBuilder cfg_builder(hins);
+        ControlFlowGraph *cfg = cfg_builder.build();
+        find_tail_calls(cfg);
+        if (!tail_calls.empty()) {
+            // a function whose only calls are tail calls needn't align %rsp
+            // (readi and writei are calls to the runtime)
+            unsigned num_calls = 0;
+            for (auto i = hins->cbegin(); i != hins->cend(); i++) {
+                switch ((*i)->get_opcode()) {
+                    case HINS_CALL: case HINS_READ_INT: case HINS_WRITE_INT:
+                        num_calls++;
+                        break;
+                    default:
+                        break;
                 }
-                case HINS_LOAD_INT:{
-                    Operand rhs = hin->get_operand(1);
-                    Operand loadsrc = get_mreg_or_lit(rhs);
+            }
+            if (num_calls == tail_calls.size()) {
+                is_leaf = true;
+                set_frame_size(frame_size);
+            }
+        }
+        X86_64InstructionSelection selection(cfg, this);
+        selection.execute();
+        cfg = selection.transform_cfg();
+        assembly = cfg->create_instruction_sequence();
+    }
 
-                    Operand lhs = hin->get_operand(0);
-                    Operand loaddest = get_mreg(lhs);
+    Operand get_vreg_location(const Operand &vreg) override {
+        return get_mreg(vreg);
+    }
 
+    void translate_instruction(Instruction *hin, InstructionSequence *out) override {
+        // callee-owned
+        Operand rsp(OPERAND_MREG, MREG_RSP);
+        Operand rdi(OPERAND_MREG, MREG_RDI);
+        Operand rsi(OPERAND_MREG, MREG_RSI);
+        Operand r10(OPERAND_MREG, MREG_R10);
+        Operand r11(OPERAND_MREG, MREG_R11);
+        Operand rax(OPERAND_MREG, MREG_RAX);
+        Operand rdx(OPERAND_MREG, MREG_RDX);
+
+        // runtime functions (runtime.c)
+        Operand read_label("rt_read_int");
+        Operand write_label("rt_write_int");
+
+        switch(hin->get_opcode()) {
+            case HINS_LOCALADDR: {
+                Operand rhs = hin->get_operand(1); // offset is rhs
+                Operand locaddr(OPERAND_MREG_MEMREF_OFFSET, MREG_RSP, rhs.get_int_value());
+                auto *leaq = new Instruction(MINS_LEAQ, locaddr, r10);
+                leaq->set_comment(get_hins_comment(hin));
+                out->add_instruction(leaq);
+
+                // vrN is offset 8N(rsp);
+                Operand lhs = hin->get_operand(0);
+                Operand dest = get_mreg(lhs);
+                auto *movq = new Instruction(MINS_MOVQ, r10, dest);
+                out->add_instruction(movq);
+                break;
+            }
+            case HINS_LOAD_INT:{
+                unsigned start = out->get_length();
+                Operand rhs = hin->get_operand(1);
+                Operand loadsrc = get_mreg_or_lit(rhs);
+
+                Operand lhs = hin->get_operand(0);
+                Operand loaddest = get_mreg(lhs);
+
+                if (rhs.get_kind() != OPERAND_INT_LITERAL) {
+                    Operand memref = get_mreg_memref(rhs, MREG_R11, MREG_R10, out);
+                    out->get_instruction(start)->set_comment(get_hins_comment(hin));
+                    auto *mov2 = new Instruction(MINS_MOVQ, memref, r11);
+                    out->add_instruction(mov2);
+                } else {
                     auto *mov1 = new Instruction(MINS_MOVQ, loadsrc, r11);
                     mov1->set_comment(get_hins_comment(hin));
-                    assembly->add_instruction(mov1);
-
-                    if (rhs.get_kind() != OPERAND_INT_LITERAL) {
-                        Operand r11memref(OPERAND_MREG_MEMREF, MREG_R11);
-                        auto *mov2 = new Instruction(MINS_MOVQ, r11memref, r11);
-                        assembly->add_instruction(mov2);
-                    }
-
-                    auto *mov3 = new Instruction(MINS_MOVQ, r11, loaddest);
-                    assembly->add_instruction(mov3);
-                    break;
+                    out->add_instruction(mov1);
                 }
-                case HINS_LOAD_ICONST: {
-                    Operand vreg = hin->get_operand(0);
-                    Operand lit = hin->get_operand(1);
 
-                    Operand dest = get_mreg(vreg);
-                    auto *movins = new Instruction(MINS_MOVQ, lit, dest);
+                auto *mov3 = new Instruction(MINS_MOVQ, r11, loaddest);
+                out->add_instruction(mov3);
+                break;
+            }
+            case HINS_LOAD_ICONST: {
+                Operand vreg = hin->get_operand(0);
+                Operand lit = hin->get_operand(1);
+
+                Operand dest = get_mreg(vreg);
+                if (!fits_int32(lit) && dest.is_memref()) {
+                    // a 64-bit immediate can only be moved to a register
+                    auto *movins = new Instruction(MINS_MOVQ, lit, r11);
                     movins->set_comment(get_hins_comment(hin));
-                    assembly->add_instruction(movins);
+                    out->add_instruction(movins);
+                    out->add_instruction(new Instruction(MINS_MOVQ, r11, dest));
                     break;
                 }
-                case HINS_STORE_INT: {
-                    Operand rhs = hin->get_operand(1);
-                    Operand src = get_mreg_or_lit(rhs);
+                auto *movins = new Instruction(MINS_MOVQ, lit, dest);
+                movins->set_comment(get_hins_comment(hin));
+                out->add_instruction(movins);
+                break;
+            }
+            case HINS_STORE_INT: {
+                Operand rhs = hin->get_operand(1);
+                Operand src = get_mreg_or_lit(rhs);
 
-                    Operand lhs = hin->get_operand(0);
-                    Operand dest = get_mreg(lhs);
+                Operand lhs = hin->get_operand(0);
 
-                    auto *mov1 = new Instruction(MINS_MOVQ, src, r11);
-                    mov1->set_comment(get_hins_comment(hin));
-                    assembly->add_instruction(mov1);
+                auto *mov1 = new Instruction(MINS_MOVQ, src, r11);
+                mov1->set_comment(get_hins_comment(hin));
+                out->add_instruction(mov1);
 
-                    auto *mov2 = new Instruction(MINS_MOVQ, dest, r10);
-                    assembly->add_instruction(mov2);
+                Operand memrefdest = get_mreg_memref(lhs, MREG_R10, MREG_RAX, out);
+                auto *mov3 = new Instruction(MINS_MOVQ, r11, memrefdest);
+                out->add_instruction(mov3);
+                break;
+            }
+            case HINS_MOV: {
+                Operand rhs = hin->get_operand(1);
+                Operand src = get_mreg_or_lit(rhs);
+                Operand lhs = hin->get_operand(0);
+                Operand dest = get_mreg(lhs);
+
+                auto *movins = new Instruction(MINS_MOVQ, src, r11);
+                movins->set_comment(get_hins_comment(hin));
+                out->add_instruction(movins);
+
+                auto *movins2 = new Instruction(MINS_MOVQ, r11, dest);
+                out->add_instruction(movins2);
+                break;
+            }
+            case HINS_WRITE_INT: {
+                // the value is the argument of rt_write_int
+                Operand op = hin->get_operand(0);
+                Operand src = get_mreg_or_lit(op);
+                auto *movarg = new Instruction(MINS_MOVQ, src, rdi);
+                movarg->set_comment(get_hins_comment(hin));
+                out->add_instruction(movarg);
+
+                auto *call = new Instruction(MINS_CALL, write_label);
+                out->add_instruction(call);
+                break;
+            }
+            case HINS_READ_INT: {
+                // rt_read_int returns the value read
+                auto *call = new Instruction(MINS_CALL, read_label);
+                call->set_comment(get_hins_comment(hin));
+                out->add_instruction(call);
+
+                Operand dest = get_mreg(hin->get_operand(0));
+                auto *movread = new Instruction(MINS_MOVQ, rax, dest);
+                out->add_instruction(movread);
+                break;
+            }
+            case HINS_INT_ADD: {
+                Operand dest = hin->get_operand(0);
+                Operand arg1 = hin->get_operand(1);
+                Operand arg2 = hin->get_operand(2);
 
-                    Operand memrefdest(OPERAND_MREG_MEMREF, MREG_R10);
-                    auto *mov3 = new Instruction(MINS_MOVQ, r11, memrefdest);
-                    assembly->add_instruction(mov3);
-                    break;
-                }
-                case HINS_MOV: {
-                    Operand rhs = hin->get_operand(1);
-                    Operand src = get_mreg_or_lit(rhs);
-                    Operand lhs = hin->get_operand(0);
-                    Operand dest = get_mreg(lhs);
+                Operand addend = get_mreg_or_lit(arg1);
+                auto *movarg1 = new Instruction(MINS_MOVQ,addend, r11);
+                movarg1->set_comment(get_hins_comment(hin));
+                out->add_instruction(movarg1);
 
-                    auto *movins = new Instruction(MINS_MOVQ, src, r11);
-                    movins->set_comment(get_hins_comment(hin));
-                    assembly->add_instruction(movins);
+                Operand destination = get_mreg_or_lit(arg2);
+                auto *movarg2 = new Instruction(MINS_MOVQ, destination, r10);
+                out->add_instruction(movarg2);
 
-                    auto *movins2 = new Instruction(MINS_MOVQ, r11, dest);
-                    assembly->add_instruction(movins2);
-                    break;
-                }
-                case HINS_WRITE_INT: {
-                    // move outputfmt to first argument register
-                    auto *movfmt = new Instruction(MINS_MOVQ, outputfmt, rdi);
-                    movfmt->set_comment(get_hins_comment(hin));
-                    assembly->add_instruction(movfmt);
-
-                    // load addr of vreg into second argument register
-                    Operand op = hin->get_operand(0);
-                    Operand src = get_mreg_or_lit(op);
-                    auto *leaq = new Instruction(MINS_MOVQ, src, rsi);
-                    assembly->add_instruction(leaq);
-
-                    // call the printf function
-                    auto *printf = new Instruction(MINS_CALL, printf_label);
-                    assembly->add_instruction(printf);
-                    break;
-                }
-                case HINS_READ_INT: {
-                    // move inputfmt to first argument register
-                    auto *movfmt = new Instruction(MINS_MOVQ, inputfmt, rdi);
-                    movfmt->set_comment(get_hins_comment(hin));
-                    assembly->add_instruction(movfmt);
-
-                    // load addr of vreg into second argument register
-                    Operand op = hin->get_operand(0);
-                    Operand dest = get_mreg(op);
-                    auto *leaq = new Instruction(MINS_LEAQ, dest, rsi);
-                    assembly->add_instruction(leaq);
-
-                    // call the scanf function
-                    auto *scanf = new Instruction(MINS_CALL, scanf_label);
-                    assembly->add_instruction(scanf);
-                    break;
-                }
-                case HINS_INT_ADD: {
-                    Operand dest = hin->get_operand(0);
-                    Operand arg1 = hin->get_operand(1);
-                    Operand arg2 = hin->get_operand(2);
-
-                    Operand addend = get_mreg_or_lit(arg1);
-                    auto *movarg1 = new Instruction(MINS_MOVQ,addend, r11);
-                    movarg1->set_comment(get_hins_comment(hin));
-                    assembly->add_instruction(movarg1);
-
-                    Operand destination = get_mreg_or_lit(arg2);
-                    auto *movarg2 = new Instruction(MINS_MOVQ, destination, r10);
-                    assembly->add_instruction(movarg2);
-
-                    auto *addins = new Instruction(MINS_ADDQ, r11, r10);
-                    assembly->add_instruction(addins);
-
-                    Operand resultdestination = get_mreg(dest);
-                    auto *movins = new Instruction(MINS_MOVQ, r10, resultdestination);
-                    assembly->add_instruction(movins);
-                    break;
-                }
-                case HINS_INT_SUB: {
-                    Operand dest = hin->get_operand(0);
-                    Operand arg1 = hin->get_operand(1);
-                    Operand arg2 = hin->get_operand(2);
-
-                    Operand destination = get_mreg_or_lit(arg1);
-                    auto *movarg1 = new Instruction(MINS_MOVQ, destination, r10);
-                    movarg1->set_comment(get_hins_comment(hin));
-                    assembly->add_instruction(movarg1);
-
-                    Operand subtrahend = get_mreg_or_lit(arg2);
-                    auto *movarg2 = new Instruction(MINS_MOVQ, subtrahend, r11);
-                    assembly->add_instruction(movarg2);
-
-                    // https://en.wikibooks.org/wiki/X86_Assembly/Arithmetic#Addition_and_Subtraction
-                    // sub subtrahend, dest
-                    // dest -= subtrahend
-                    // dest = dest - subtrahend
-                    // HINS_INT_SUB d, a1, a2
-                    // SUBQ a2, a1 // places result in a1
-                    auto *subins = new Instruction(MINS_SUBQ, r11, r10);
-                    assembly->add_instruction(subins);
-
-                    // r10 contains the result now
-                    Operand resultdestination = get_mreg(dest);
-                    auto *movins = new Instruction(MINS_MOVQ, r10, resultdestination);
-                    assembly->add_instruction(movins);
-                    break;
-                }
-                case HINS_INT_MUL: {
-                    Operand dest = hin->get_operand(0);
-                    Operand arg1 = hin->get_operand(1);
-                    Operand arg2 = hin->get_operand(2);
-
-                    Operand multiplicand = get_mreg_or_lit(arg1);
-                    auto *movarg1 = new Instruction(MINS_MOVQ, multiplicand, r11);
-                    movarg1->set_comment(get_hins_comment(hin));
-                    assembly->add_instruction(movarg1);
-
-                    if (arg1.is_memref()) {
-                        auto *deref = new Instruction(MINS_MOVQ, r11.to_memref(), r11);
-                        assembly->add_instruction(deref);
-                    }
+                auto *addins = new Instruction(MINS_ADDQ, r11, r10);
+                out->add_instruction(addins);
 
-                    Operand destination = get_mreg_or_lit(arg2);
-                    auto *movarg2 = new Instruction(MINS_MOVQ, destination, r10);
-                    assembly->add_instruction(movarg2);
+                Operand resultdestination = get_mreg(dest);
+                auto *movins = new Instruction(MINS_MOVQ, r10, resultdestination);
+                out->add_instruction(movins);
+                break;
+            }
+            case HINS_INT_SUB: {
+                Operand dest = hin->get_operand(0);
+                Operand arg1 = hin->get_operand(1);
+                Operand arg2 = hin->get_operand(2);
+
+                Operand destination = get_mreg_or_lit(arg1);
+                auto *movarg1 = new Instruction(MINS_MOVQ, destination, r10);
+                movarg1->set_comment(get_hins_comment(hin));
+                out->add_instruction(movarg1);
+
+                Operand subtrahend = get_mreg_or_lit(arg2);
+                auto *movarg2 = new Instruction(MINS_MOVQ, subtrahend, r11);
+                out->add_instruction(movarg2);
+
+                // https://en.wikibooks.org/wiki/X86_Assembly/Arithmetic#Addition_and_Subtraction
+                // sub subtrahend, dest
+                // dest -= subtrahend
+                // dest = dest - subtrahend
+                // HINS_INT_SUB d, a1, a2
+                // SUBQ a2, a1 // places result in a1
+                auto *subins = new Instruction(MINS_SUBQ, r11, r10);
+                out->add_instruction(subins);
+
+                // r10 contains the result now
+                Operand resultdestination = get_mreg(dest);
+                auto *movins = new Instruction(MINS_MOVQ, r10, resultdestination);
+                out->add_instruction(movins);
+                break;
+            }
+            case HINS_INT_MUL: {
+                Operand dest = hin->get_operand(0);
+                Operand arg1 = hin->get_operand(1);
+                Operand arg2 = hin->get_operand(2);
 
-                    if (arg2.is_memref()) {
-                        auto *deref = new Instruction(MINS_MOVQ, r10.to_memref(), r10);
-                        assembly->add_instruction(deref);
-                    }
+                Operand multiplicand = get_mreg_or_lit(arg1);
+                auto *movarg1 = new Instruction(MINS_MOVQ, multiplicand, r11);
+                movarg1->set_comment(get_hins_comment(hin));
+                out->add_instruction(movarg1);
 
-                    auto *mulins = new Instruction(MINS_IMULQ, r11, r10);
-                    assembly->add_instruction(mulins);
+                if (arg1.is_memref()) {
+                    auto *deref = new Instruction(MINS_MOVQ, r11.to_memref(), r11);
+                    out->add_instruction(deref);
+                }
 
-                    Operand resultdestination = get_mreg(dest);
-                    auto *movdest = new Instruction(MINS_MOVQ, r10, resultdestination);
-                    assembly->add_instruction(movdest);
-                    break;
+                Operand destination = get_mreg_or_lit(arg2);
+                auto *movarg2 = new Instruction(MINS_MOVQ, destination, r10);
+                out->add_instruction(movarg2);
+
+                if (arg2.is_memref()) {
+                    auto *deref = new Instruction(MINS_MOVQ, r10.to_memref(), r10);
+                    out->add_instruction(deref);
                 }
-                case HINS_INT_DIV: {
-                    Operand dest = hin->get_operand(0);
-                    Operand divarg1 = hin->get_operand(1);
-                    Operand divarg2 = hin->get_operand(2);
 
-                    Operand op1 = get_mreg_or_lit(divarg1);
-                    auto *movarg1 = new Instruction(MINS_MOVQ, op1, rax);
-                    movarg1->set_comment(get_hins_comment(hin));
-                    assembly->add_instruction(movarg1);
+                auto *mulins = new Instruction(MINS_IMULQ, r11, r10);
+                out->add_instruction(mulins);
 
-                    auto *convertins = new Instruction(MINS_CQTO);
-                    assembly->add_instruction(convertins);
+                Operand resultdestination = get_mreg(dest);
+                auto *movdest = new Instruction(MINS_MOVQ, r10, resultdestination);
+                out->add_instruction(movdest);
+                break;
+            }
+            case HINS_INT_DIV: {
+                Operand dest = hin->get_operand(0);
+                Operand divarg1 = hin->get_operand(1);
+                Operand divarg2 = hin->get_operand(2);
 
-                    Operand op2 = get_mreg_or_lit(divarg2);
-                    auto *movarg2 = new Instruction(MINS_MOVQ, op2, r10);
-                    assembly->add_instruction(movarg2);
+                Operand op1 = get_mreg_or_lit(divarg1);
+                auto *movarg1 = new Instruction(MINS_MOVQ, op1, rax);
+                movarg1->set_comment(get_hins_comment(hin));
+                out->add_instruction(movarg1);
 
-                    auto *divins = new Instruction(MINS_IDIVQ, r10);
-                    assembly->add_instruction(divins);
+                auto *convertins = new Instruction(MINS_CQTO);
+                out->add_instruction(convertins);
 
-                    Operand resultdestination = get_mreg(dest);
-                    auto *movdest = new Instruction(MINS_MOVQ, rax, resultdestination);
-                    assembly->add_instruction(movdest);
-                    break;
-                }
-                case HINS_INT_MOD: {
-                    Operand dest = hin->get_operand(0);
-                    Operand modarg1 = hin->get_operand(1);
-                    Operand modarg2 = hin->get_operand(2);
+                Operand op2 = get_mreg_or_lit(divarg2);
+                auto *movarg2 = new Instruction(MINS_MOVQ, op2, r10);
+                out->add_instruction(movarg2);
 
-                    Operand op1 = get_mreg_or_lit(modarg1);
-                    auto *movarg1 = new Instruction(MINS_MOVQ, op1, rax);
-                    movarg1->set_comment(get_hins_comment(hin));
-                    assembly->add_instruction(movarg1);
+                auto *divins = new Instruction(MINS_IDIVQ, r10);
+                out->add_instruction(divins);
 
-                    auto *convertins = new Instruction(MINS_CQTO);
-                    assembly->add_instruction(convertins);
+                Operand resultdestination = get_mreg(dest);
+                auto *movdest = new Instruction(MINS_MOVQ, rax, resultdestination);
+                out->add_instruction(movdest);
+                break;
+            }
+            case HINS_INT_MOD: {
+                Operand dest = hin->get_operand(0);
+                Operand modarg1 = hin->get_operand(1);
+                Operand modarg2 = hin->get_operand(2);
 
-                    Operand op2 = get_mreg_or_lit(modarg2);
-                    auto *movarg2 = new Instruction(MINS_MOVQ, op2, r10);
-                    assembly->add_instruction(movarg2);
+                Operand op1 = get_mreg_or_lit(modarg1);
+                auto *movarg1 = new Instruction(MINS_MOVQ, op1, rax);
+                movarg1->set_comment(get_hins_comment(hin));
+                out->add_instruction(movarg1);
 
-                    auto *divins = new Instruction(MINS_IDIVQ, r10);
-                    assembly->add_instruction(divins);
+                auto *convertins = new Instruction(MINS_CQTO);
+                out->add_instruction(convertins);
 
-                    Operand resultdestination = get_mreg(dest);
-                    auto *movdest = new Instruction(MINS_MOVQ, rdx, resultdestination);   // different from DIV, check %rdx for remainder
-                    assembly->add_instruction(movdest);
-                    break;
-                }
-                case HINS_INT_COMPARE: {
-                    Operand l_op = hin->get_operand(0);
-                    Operand r_op = hin->get_operand(1);
+                Operand op2 = get_mreg_or_lit(modarg2);
+                auto *movarg2 = new Instruction(MINS_MOVQ, op2, r10);
+                out->add_instruction(movarg2);
+
+                auto *divins = new Instruction(MINS_IDIVQ, r10);
+                out->add_instruction(divins);
+
+                Operand resultdestination = get_mreg(dest);
+                auto *movdest = new Instruction(MINS_MOVQ, rdx, resultdestination);   // different from DIV, check %rdx for remainder
+                out->add_instruction(movdest);
+                break;
+            }
+            case HINS_INT_SHL:
+            case HINS_INT_SHR:
+            case HINS_INT_SAR: {
+                Operand dest = hin->get_operand(0);
+                Operand arg1 = hin->get_operand(1);
+                Operand arg2 = hin->get_operand(2);
+
+                // the shift count is always a literal (see simplify.h)
+                assert(arg2.get_kind() == OPERAND_INT_LITERAL);
+
+                Operand value = get_mreg_or_lit(arg1);
+                auto *movarg1 = new Instruction(MINS_MOVQ, value, r10);
+                movarg1->set_comment(get_hins_comment(hin));
+                out->add_instruction(movarg1);
+
+                int opcode = hin->get_opcode() == HINS_INT_SHL ? MINS_SALQ
+                           : hin->get_opcode() == HINS_INT_SHR ? MINS_SHRQ : MINS_SARQ;
+                auto *shiftins = new Instruction(opcode, get_mreg_or_lit(arg2), r10);
+                out->add_instruction(shiftins);
+
+                Operand resultdestination = get_mreg(dest);
+                auto *movdest = new Instruction(MINS_MOVQ, r10, resultdestination);
+                out->add_instruction(movdest);
+                break;
+            }
+            case HINS_INT_AND: {
+                Operand dest = hin->get_operand(0);
+                Operand arg1 = hin->get_operand(1);
+                Operand arg2 = hin->get_operand(2);
 
-                    Operand l_arg = get_mreg_or_lit(l_op);
-                    auto *movarg1 = new Instruction(MINS_MOVQ, l_arg, r10);
-                    movarg1->set_comment(get_hins_comment(hin));
-                    assembly->add_instruction(movarg1);
+                Operand op1 = get_mreg_or_lit(arg1);
+                auto *movarg1 = new Instruction(MINS_MOVQ, op1, r11);
+                movarg1->set_comment(get_hins_comment(hin));
+                out->add_instruction(movarg1);
 
-                    Operand r_arg = get_mreg_or_lit(r_op);
-                    auto *movarg2 = new Instruction(MINS_MOVQ, r_arg, r11);
-                    assembly->add_instruction(movarg2);
+                Operand op2 = get_mreg_or_lit(arg2);
+                auto *movarg2 = new Instruction(MINS_MOVQ, op2, r10);
+                out->add_instruction(movarg2);
 
-                    auto *compareins = new Instruction(MINS_CMPQ, r11, r10);
-                    assembly->add_instruction(compareins);
-                    break;
-                }
-                case HINS_JUMP: {
-                    Operand label = hin->get_operand(0);
-                    auto *jumpins = new Instruction(MINS_JMP, label);
-                    jumpins->set_comment(get_hins_comment(hin));
-                    assembly->add_instruction(jumpins);
-                    break;
-                }
-                case HINS_JE: {
-                    Operand label = hin->get_operand(0);
-                    auto *jumpins = new Instruction(MINS_JE, label);
-                    jumpins->set_comment(get_hins_comment(hin));
-                    assembly->add_instruction(jumpins);
-                    break;
+                auto *andins = new Instruction(MINS_ANDQ, r11, r10);
+                out->add_instruction(andins);
+
+                Operand resultdestination = get_mreg(dest);
+                auto *movdest = new Instruction(MINS_MOVQ, r10, resultdestination);
+                out->add_instruction(movdest);
+                break;
+            }
+            case HINS_INT_COMPARE: {
+                Operand l_op = hin->get_operand(0);
+                Operand r_op = hin->get_operand(1);
+
+                Operand l_arg = get_mreg_or_lit(l_op);
+                auto *movarg1 = new Instruction(MINS_MOVQ, l_arg, r10);
+                movarg1->set_comment(get_hins_comment(hin));
+                out->add_instruction(movarg1);
+
+                Operand r_arg = get_mreg_or_lit(r_op);
+                auto *movarg2 = new Instruction(MINS_MOVQ, r_arg, r11);
+                out->add_instruction(movarg2);
+
+                auto *compareins = new Instruction(MINS_CMPQ, r11, r10);
+                out->add_instruction(compareins);
+                break;
+            }
+            case HINS_JUMP: {
+                Operand label = hin->get_operand(0);
+                auto *jumpins = new Instruction(MINS_JMP, label);
+                jumpins->set_comment(get_hins_comment(hin));
+                out->add_instruction(jumpins);
+                break;
+            }
+            case HINS_JE: {
+                Operand label = hin->get_operand(0);
+                auto *jumpins = new Instruction(MINS_JE, label);
+                jumpins->set_comment(get_hins_comment(hin));
+                out->add_instruction(jumpins);
+                break;
+            }
+            case HINS_JNE: {
+                Operand label = hin->get_operand(0);
+                auto *jumpins = new Instruction(MINS_JNE, label);
+                jumpins->set_comment(get_hins_comment(hin));
+                out->add_instruction(jumpins);
+                break;
+            }
+            case HINS_JLT: {
+                Operand label = hin->get_operand(0);
+                auto *jumpins = new Instruction(MINS_JL, label);
+                jumpins->set_comment(get_hins_comment(hin));
+                out->add_instruction(jumpins);
+                break;
+            }
+            case HINS_JLTE: {
+                Operand label = hin->get_operand(0);
+                auto *jumpins = new Instruction(MINS_JLE, label);
+                jumpins->set_comment(get_hins_comment(hin));
+                out->add_instruction(jumpins);
+                break;
+            }
+            case HINS_JGT: {
+                Operand label = hin->get_operand(0);
+                auto *jumpins = new Instruction(MINS_JG, label);
+                jumpins->set_comment(get_hins_comment(hin));
+                out->add_instruction(jumpins);
+                break;
+            }
+            case HINS_JGTE: {
+                Operand label = hin->get_operand(0);
+                auto *jumpins = new Instruction(MINS_JGE, label);
+                jumpins->set_comment(get_hins_comment(hin));
+                out->add_instruction(jumpins);
+                break;
+            }
+            case HINS_NOP: {
+                auto *nopins = new Instruction(MINS_NOP);
+                nopins->set_comment(get_hins_comment(hin));
+                out->add_instruction(nopins);
+                break;
+            }
+            case HINS_GLOBALADDR: {
+                Operand dest = get_mreg(hin->get_operand(0));
+                auto *movins = new Instruction(MINS_MOVQ, hin->get_operand(1), dest);
+                movins->set_comment(get_hins_comment(hin));
+                out->add_instruction(movins);
+                break;
+            }
+            case HINS_PARAM: {
+                // the first param moves every argument to its vreg,
+                // before any of the argument registers can be overwritten
+                if (!params_moved) {
+                    unsigned start = out->get_length();
+                    emit_param_moves(out);
+                    if (out->get_length() > start) {
+                        out->get_instruction(start)->set_comment(get_hins_comment(hin));
+                    }
+                    params_moved = true;
                 }
-                case HINS_JNE: {
-                    Operand label = hin->get_operand(0);
-                    auto *jumpins = new Instruction(MINS_JNE, label);
-                    jumpins->set_comment(get_hins_comment(hin));
-                    assembly->add_instruction(jumpins);
-                    break;
+                break;
+            }
+            case HINS_CALL: {
+                unsigned start = out->get_length();
+                emit_call(hin, out);
+                out->get_instruction(start)->set_comment(get_hins_comment(hin));
+                break;
+            }
+            case HINS_RETURN: {
+                // the epilogue follows: the result is returned in %rax
+                Instruction *retins;
+                if (hin->get_num_operands() > 0) {
+                    retins = new Instruction(MINS_MOVQ, get_mreg_or_lit(hin->get_operand(0)), rax);
+                } else {
+                    retins = new Instruction(MINS_NOP);
                 }
-                case HINS_JLT: {
-                    Operand label = hin->get_operand(0);
-                    auto *jumpins = new Instruction(MINS_JL, label);
-                    jumpins->set_comment(get_hins_comment(hin));
-                    assembly->add_instruction(jumpins);
-                    break;
+                retins->set_comment(get_hins_comment(hin));
+                out->add_instruction(retins);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    // Run the peephole optimizer over the translated instructions
+    // (one basic block at a time)
+    void optimize_instructions() {
+        X86_64ControlFlowGraphBuilder cfg_builder(assembly);
+        ControlFlowGraph *cfg = cfg_builder.build();
+        X86_64PeepholeOptimization peephole(cfg);
+        cfg = peephole.transform_cfg();
+        assembly = cfg->create_instruction_sequence();
+    }
+
+    void emit() {
+        emit_preamble();
+        emit_asm();
+        emit_epilogue();
+    }
+
+    // Emit the data used by every function (the variables of the main
+    // program used by procedures), which must come before the functions
+    static void emit_data(const std::vector<Symbol> &statics) {
+        if (!statics.empty()) {
+            printf("\t.section .bss\n");
+            for (auto sym : statics) {
+                // a CHAR is loaded and stored as a word, which must stay
+                // within the variable
+                long size = sym.get_size();
+                if (size % 8 != 0) {
+                    size += 7;
                 }
-                case HINS_JLTE: {
-                    Operand label = hin->get_operand(0);
-                    auto *jumpins = new Instruction(MINS_JLE, label);
-                    jumpins->set_comment(get_hins_comment(hin));
-                    assembly->add_instruction(jumpins);
-                    break;
+                std::string label = HighLevelCodeGen::get_static_label(sym.get_name());
+                printf("\t.align 8\n");
+                printf("%s: .zero %ld\n", label.c_str(), size);
+            }
+        }
+        printf("\t.section .text\n");
+        printf("\t.globl main\n");
+    }
+
+private:
+    // System V argument registers
+    static const unsigned NUM_ARG_MREGS = 6;
+
+    static int get_arg_mreg(unsigned i) {
+        static const int arg_mregs[NUM_ARG_MREGS] = {
+            MREG_RDI, MREG_RSI, MREG_RDX, MREG_RCX, MREG_R8, MREG_R9,
+        };
+        return arg_mregs[i];
+    }
+
+    static bool fits_int32(const Operand &op) {
+        return op.get_kind() != OPERAND_INT_LITERAL ||
+               (op.get_int_value() >= INT_MIN && op.get_int_value() <= INT_MAX);
+    }
+
+    // Move each source to its destination as if the moves happened at
+    // once.  Destinations in memory (which aren't sources) are written
+    // first, then registers, each only once no other move still reads it;
+    // a cycle of register moves is broken by saving a register in %r11.
+    void emit_parallel_move(std::vector<std::pair<Operand, Operand> > moves, InstructionSequence *out) {
+        Operand r11(OPERAND_MREG, MREG_R11);
+        std::vector<std::pair<Operand, Operand> > reg_moves;
+        for (auto i = moves.begin(); i != moves.end(); i++) {
+            Operand src = i->first, dest = i->second;
+            if (!dest.is_memref()) {
+                if (src.get_kind() != OPERAND_MREG || src.get_base_reg() != dest.get_base_reg()) {
+                    reg_moves.push_back(*i);
                 }
-                case HINS_JGT: {
-                    Operand label = hin->get_operand(0);
-                    auto *jumpins = new Instruction(MINS_JG, label);
-                    jumpins->set_comment(get_hins_comment(hin));
-                    assembly->add_instruction(jumpins);
-                    break;
+            } else if (src.is_memref() || !fits_int32(src)) {
+                out->add_instruction(new Instruction(MINS_MOVQ, src, r11));
+                out->add_instruction(new Instruction(MINS_MOVQ, r11, dest));
+            } else {
+                out->add_instruction(new Instruction(MINS_MOVQ, src, dest));
+            }
+        }
+
+        while (!reg_moves.empty()) {
+            auto ready = reg_moves.begin();
+            while (ready != reg_moves.end() && is_read_by(ready->second.get_base_reg(), reg_moves)) {
+                ready++;
+            }
+            if (ready != reg_moves.end()) {
+                out->add_instruction(new Instruction(MINS_MOVQ, ready->first, ready->second));
+                reg_moves.erase(ready);
+                continue;
+            }
+            // save the destination of the first move, and read it from %r11
+            int mreg = reg_moves.front().second.get_base_reg();
+            out->add_instruction(new Instruction(MINS_MOVQ, reg_moves.front().second, r11));
+            for (auto i = reg_moves.begin(); i != reg_moves.end(); i++) {
+                if (i->first.get_kind() == OPERAND_MREG && i->first.get_base_reg() == mreg) {
+                    i->first = r11;
                 }
-                case HINS_JGTE: {
-                    Operand label = hin->get_operand(0);
-                    auto *jumpins = new Instruction(MINS_JGE, label);
-                    jumpins->set_comment(get_hins_comment(hin));
-                    assembly->add_instruction(jumpins);
+            }
+        }
+    }
+
+    // does any of the (source, destination) moves read the mreg?
+    static bool is_read_by(int mreg, const std::vector<std::pair<Operand, Operand> > &moves) {
+        for (auto i = moves.cbegin(); i != moves.cend(); i++) {
+            const Operand &src = i->first;
+            if (src.has_base_reg() && src.get_base_reg() == mreg) {
+                return true;
+            }
+            if (src.has_index_reg() && src.get_index_reg() == mreg) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // The location of the i'th argument on entry: the first six are in
+    // registers, the rest above the return address, in the caller's frame
+    Operand get_incoming_argument(long i) {
+        if (i < long(NUM_ARG_MREGS)) {
+            return Operand(OPERAND_MREG, get_arg_mreg(unsigned(i)));
+        }
+        long frame_size = total_storage_size + WORD_SIZE * long(get_saved_mregs().size());
+        return Operand(OPERAND_MREG_MEMREF_OFFSET, MREG_RSP, frame_size + WORD_SIZE + WORD_SIZE * (i - NUM_ARG_MREGS));
+    }
+
+    void emit_param_moves(InstructionSequence *out) {
+        // a vreg which is the destination of two params (possible once
+        // one of them is dead) gets the later one
+        std::vector<std::pair<Operand, Operand> > moves;
+        for (auto i = params.begin(); i != params.end(); i++) {
+            Operand dest = get_mreg(i->first);
+            Operand src = get_incoming_argument(i->second);
+            for (auto j = moves.begin(); j != moves.end(); j++) {
+                if (same_location(j->second, dest)) {
+                    moves.erase(j);
                     break;
                 }
-                case HINS_NOP: {
-                    auto *nopins = new Instruction(MINS_NOP);
-                    nopins->set_comment(get_hins_comment(hin));
-                    assembly->add_instruction(nopins);
-                }
-                default:
-                    break;
             }
+            moves.push_back(std::make_pair(src, dest));
         }
+        emit_parallel_move(moves, out);
+    }
 
-        if (hins->has_label_at_end()) {
-            assembly->define_label(hins->get_label_at_end());
+    static bool same_location(const Operand &a, const Operand &b) {
+        if (a.get_kind() != b.get_kind() || a.get_base_reg() != b.get_base_reg()) {
+            return false;
         }
+        return !a.is_memref() || a.get_offset() == b.get_offset();
     }
 
-    void emit() {
-        emit_preamble();
-        emit_asm();
-        emit_epilogue();
+    // The location of an argument, after pushed bytes have been pushed
+    // on the stack (which moves the vregs in the stack frame away from %rsp)
+    Operand get_outgoing_argument(const Operand &arg, long pushed) {
+        Operand loc = get_mreg_or_lit(arg);
+        if (loc.get_kind() == OPERAND_MREG_MEMREF_OFFSET && loc.get_base_reg() == MREG_RSP) {
+            return Operand(OPERAND_MREG_MEMREF_OFFSET, MREG_RSP, int(loc.get_offset() + pushed));
+        }
+        return loc;
+    }
+
+    // call [vrD,] label, args...: arguments past the sixth are pushed from
+    // right to left (with padding to keep %rsp 16-byte aligned at the call),
+    // and popped by the caller; the result is returned in %rax
+    void emit_call(Instruction *hin, InstructionSequence *out) {
+        Operand rsp(OPERAND_MREG, MREG_RSP);
+        Operand rax(OPERAND_MREG, MREG_RAX);
+        Operand r11(OPERAND_MREG, MREG_R11);
+        unsigned target = HighLevel::get_call_target(hin);
+        unsigned first_arg = target + 1;
+        unsigned num_args = hin->get_num_operands() - first_arg;
+
+        long pushed = 0;
+        if (num_args > NUM_ARG_MREGS && (num_args - NUM_ARG_MREGS) % 2 != 0) {
+            out->add_instruction(new Instruction(MINS_SUBQ, Operand(OPERAND_INT_LITERAL, WORD_SIZE), rsp));
+            pushed += WORD_SIZE;
+        }
+        for (unsigned i = num_args; i-- > NUM_ARG_MREGS; ) {
+            Operand src = get_outgoing_argument(hin->get_operand(first_arg + i), pushed);
+            if (!fits_int32(src)) {
+                out->add_instruction(new Instruction(MINS_MOVQ, src, r11));
+                src = r11;
+            }
+            out->add_instruction(new Instruction(MINS_PUSHQ, src));
+            pushed += WORD_SIZE;
+        }
+
+        std::vector<std::pair<Operand, Operand> > moves;
+        for (unsigned i = 0; i < num_args && i < NUM_ARG_MREGS; i++) {
+            Operand src = get_outgoing_argument(hin->get_operand(first_arg + i), pushed);
+            moves.push_back(std::make_pair(src, Operand(OPERAND_MREG, get_arg_mreg(i))));
+        }
+        emit_parallel_move(moves, out);
+
+        if (tail_calls.count(hin) > 0) {
+            add_epilogue(out);
+            out->add_instruction(new Instruction(MINS_TAIL_JMP, hin->get_operand(target)));
+            return;
+        }
+        out->add_instruction(new Instruction(MINS_CALL, hin->get_operand(target)));
+        if (pushed > 0) {
+            out->add_instruction(new Instruction(MINS_ADDQ, Operand(OPERAND_INT_LITERAL, pushed), rsp));
+        }
+        if (target > 0) {
+            out->add_instruction(new Instruction(MINS_MOVQ, rax, get_mreg(hin->get_operand(0))));
+        }
     }
 
-private:
     void emit_preamble() {
         printf("/* %ld vregs used */\n", num_vreg);
-        printf("\t.section .rodata\n");
-        printf("s_readint_fmt: .string \"%%ld\"\n");
-        printf("s_writeint_fmt: .string \"%%ld\\n\"\n");
-        printf("\t.section .text\n");
-        printf("\t.globl main\n");
-        printf("main:\n");
-        printf("\tpushq %%rbx\n");
-        printf("\tpushq %%r12\n");
-        printf("\tpushq %%r13\n");
-        printf("\tpushq %%r14\n");
-        printf("\tpushq %%r15\n");
-        printf("\tsubq $%ld, %%rsp\n", total_storage_size);
+        printf("%s:\n", function_label.c_str());
+        PrintX86_64InstructionSequence print_asm(assembly);
+        for (int mreg : get_saved_mregs()) {
+            printf("\tpushq %s\n", print_asm.get_mreg_name(mreg).c_str());
+        }
+        if (total_storage_size > 0) {
+            printf("\tsubq $%ld, %%rsp\n", total_storage_size);
+        }
     }
 
     void emit_asm() {
@@ -1654,16 +2530,104 @@ private:
 
     // addq storage + (8 * num_vreg), rsp
     void emit_epilogue() {
-        printf("\taddq $%ld, %%rsp\n", total_storage_size);
-        printf("\tpopq %%r15\n");
-        printf("\tpopq %%r14\n");
-        printf("\tpopq %%r13\n");
-        printf("\tpopq %%r12\n");
-        printf("\tpopq %%rbx\n");
-        printf("\tmovl $0, %%eax\n");
+        InstructionSequence epilogue;
+        add_epilogue(&epilogue);
+        PrintX86_64InstructionSequence print_asm(&epilogue);
+        print_asm.print();
+        if (function_label == "main") {
+            printf("\tmovl $0, %%eax\n");
+        }
         printf("\tret\n");
     }
 
+    // free the stack frame, and restore the callee-saved registers
+    void add_epilogue(InstructionSequence *out) {
+        if (total_storage_size > 0) {
+            Operand rsp(OPERAND_MREG, MREG_RSP);
+            out->add_instruction(new Instruction(MINS_ADDQ, Operand(OPERAND_INT_LITERAL, total_storage_size), rsp));
+        }
+        const std::vector<int> &saved = get_saved_mregs();
+        for (auto i = saved.rbegin(); i != saved.rend(); i++) {
+            out->add_instruction(new Instruction(MINS_POPQ, Operand(OPERAND_MREG, *i)));
+        }
+    }
+
+    // callee-saved registers pushed in the preamble and popped in the epilogue
+    const std::vector<int> &get_saved_mregs() const {
+        return saved_mregs;
+    }
+
+    // Set the size of the stack frame: %rsp must be 16-byte aligned at calls,
+    // so account for the return address and the callee-saved registers
+    // pushed in the preamble (unless the function makes no calls)
+    void set_frame_size(long size) {
+        frame_size = size;
+        total_storage_size = size;
+        long pushed = WORD_SIZE * (1 + long(get_saved_mregs().size()));
+        if (!is_leaf && (pushed + total_storage_size) % 16 != 0) {
+            total_storage_size += 8;
+        }
+    }
+
+    // A call is a tail call if it's followed (possibly after jumps and
+    // moves of its result) by the return of its result, or by the return
+    // of a procedure, and its arguments fit in registers.  It then ends
+    // with a jump to the callee, which returns to this function's caller.
+    // The main program never makes tail calls, since it returns 0.
+    void find_tail_calls(ControlFlowGraph *cfg) {
+        const unsigned MAX_STEPS = 16;
+        if (function_label == "main") {
+            return;
+        }
+        for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+            for (unsigned j = 0; j < (*i)->get_length(); j++) {
+                Instruction *call = (*i)->get_instruction(j);
+                if (call->get_opcode() != HINS_CALL ||
+                    call->get_num_operands() - HighLevel::get_call_target(call) - 1 > NUM_ARG_MREGS) {
+                    continue;
+                }
+
+                // the vregs holding the result
+                std::set<int> result;
+                if (HighLevel::get_call_target(call) > 0) {
+                    result.insert(call->get_operand(0).get_base_reg());
+                }
+
+                BasicBlock *bb = *i;
+                unsigned k = j + 1;
+                for (unsigned steps = 0; steps < MAX_STEPS; steps++) {
+                    if (k == bb->get_length()) {
+                        // continue in the only successor
+                        const ControlFlowGraph::EdgeList &outgoing = cfg->get_outgoing_edges(bb);
+                        if (outgoing.size() != 1 || outgoing.front()->get_target()->get_kind() == BASICBLOCK_EXIT) {
+                            break;
+                        }
+                        bb = outgoing.front()->get_target();
+                        k = 0;
+                        continue;
+                    }
+                    Instruction *ins = bb->get_instruction(k++);
+                    int opcode = ins->get_opcode();
+                    if (opcode == HINS_NOP || opcode == HINS_JUMP) {
+                        continue;
+                    }
+                    if (opcode == HINS_MOV && ins->get_operand(0).get_kind() == OPERAND_VREG &&
+                        ins->get_operand(1).get_kind() == OPERAND_VREG &&
+                        result.count(ins->get_operand(1).get_base_reg()) > 0) {
+                        result.insert(ins->get_operand(0).get_base_reg());
+                        continue;
+                    }
+                    if (opcode == HINS_RETURN && (ins->get_num_operands() == 0 ||
+                        (ins->get_operand(0).get_kind() == OPERAND_VREG &&
+                         result.count(ins->get_operand(0).get_base_reg()) > 0))) {
+                        tail_calls.insert(call);
+                    }
+                    break;
+                }
+            }
+        }
+    }
+
     std::string get_hins_comment(Instruction* hin) {
         return print_helper->format_instruction(hin);
     }
@@ -1671,6 +2635,16 @@ private:
     Operand get_mreg(Operand vreg) {
         assert(vreg.has_base_reg());
 
+        if (reg_assignment != nullptr) {
+            int vr = vreg.get_base_reg();
+            if (reg_assignment->has_mreg(vr)) {
+                return Operand(OPERAND_MREG, reg_assignment->get_mreg(vr));
+            }
+            assert(reg_assignment->has_spill_slot(vr));
+            long offset = spill_area_offset + (reg_assignment->get_spill_slot(vr) * WORD_SIZE);
+            return Operand(OPERAND_MREG_MEMREF_OFFSET, MREG_RSP, offset);
+        }
+
         if (vreg.get_does_map_mreg()) {
             // naively map vr0 - vr4 to rbx, r12, r13, r14, r15
             switch(vreg.get_base_reg()) {
@@ -1692,6 +2666,26 @@ private:
         return rspwithoffset;
     }
 
+    // Load the base (and index) vregs of a memory reference into the given
+    // scratch registers, and return the equivalent mreg memory reference
+    Operand get_mreg_memref(Operand memref, int base_scratch, int index_scratch, InstructionSequence *out) {
+        Operand base(OPERAND_MREG, base_scratch);
+        auto *movbase = new Instruction(MINS_MOVQ, get_mreg(memref), base);
+        out->add_instruction(movbase);
+
+        int offset = (memref.get_kind() & OPROP_HAS_INTVAL) != 0 ? memref.get_offset() : 0;
+        if (memref.has_index_reg()) {
+            Operand index(OPERAND_MREG, index_scratch);
+            auto *movindex = new Instruction(MINS_MOVQ, get_mreg(memref.get_index_operand()), index);
+            out->add_instruction(movindex);
+            return Operand(OPERAND_MREG_MEMREF_OFFSET_INDEX, base_scratch, index_scratch, offset, memref.get_scale());
+        }
+        if (offset != 0) {
+            return Operand(OPERAND_MREG_MEMREF_OFFSET, base_scratch, offset);
+        }
+        return Operand(OPERAND_MREG_MEMREF, base_scratch);
+    }
+
     Operand get_mreg_or_lit(Operand vreg_or_lit) {
         if (vreg_or_lit.get_kind() == OPERAND_INT_LITERAL) {
             return vreg_or_lit;
@@ -1779,6 +2773,10 @@ public:
                     operand.set_does_map_mreg(true);
                     hin->operator[](j) = operand;
                 }
+                if (operand.has_index_reg() && operand.get_index_is_scalar()) {
+                    operand.set_index_does_map_mreg(true);
+                    hin->operator[](j) = operand;
+                }
             }
 
             out->add_instruction(hin);
@@ -1797,6 +2795,12 @@ Context::Context(struct Node *ast) {
     global = new SymbolTable(nullptr);
     flag_print_symtab = false;
     flag_print_hins = false;
+    flag_optimize = false;
+    flag_compile = false;
+    flag_report_unroll = false;
+    flag_report_inline = false;
+    opt_level = OPT_LEVEL_MAX;
+    unroll_factor = 4;
 }
 
 Context::~Context() {
@@ -1815,6 +2819,21 @@ void Context::set_flag(char flag) {
   if (flag == 'c') {
       flag_compile = true;
   }
+  if (flag == 'u') {
+      flag_report_unroll = true;
+  }
+  if (flag == 'i') {
+      flag_report_inline = true;
+  }
+}
+
+void Context::set_opt_level(int level) {
+    opt_level = level;
+    flag_optimize = (level > 0);
+}
+
+void Context::set_unroll_factor(unsigned factor) {
+    unroll_factor = factor;
 }
 
 void Context::build_symtab() {
@@ -1830,49 +2849,265 @@ void Context::build_symtab() {
 }
 
 void Context::gen_code() {
+    // the main program comes first, followed by the procedures in the
+    // order they're declared (so that a procedure follows those it calls)
+    std::vector<Function> functions;
     auto *hlcodegen = new HighLevelCodeGen(global);
     hlcodegen->visit(root);
-
-    InstructionSequence *iseq = hlcodegen->get_iseq();
+    functions.push_back(Function{"main", hlcodegen->get_iseq(), nullptr, nullptr,
+                                 hlcodegen->get_storage_size(), hlcodegen->get_vreg_max()});
+
+    long label_index = hlcodegen->get_label_index();
+    Node *declarations = node_get_kid(root, 0);
+    for (int i = 0; i < node_get_num_kids(declarations); i++) {
+        Node *decl = node_get_kid(declarations, i);
+        int tag = node_get_tag(decl);
+        if (tag != AST_PROCEDURE && tag != AST_FUNCTION) {
+            continue;
+        }
+        auto *proccodegen = new HighLevelCodeGen(decl->get_type()->symtab, label_index);
+        proccodegen->visit(decl);
+        label_index = proccodegen->get_label_index();
+        std::string label = HighLevelCodeGen::get_procedure_label(node_get_str(node_get_kid(decl, 0)));
+        functions.push_back(Function{label, proccodegen->get_iseq(), nullptr, nullptr,
+                                     proccodegen->get_storage_size(), proccodegen->get_vreg_max()});
+    }
 
     if (flag_optimize) {
-        HighLevelControlFlowGraphBuilder cfg_builder(iseq);
-        ControlFlowGraph *cfg = cfg_builder.build();
+        for (auto i = functions.begin(); i != functions.end(); i++) {
+            HighLevelControlFlowGraphBuilder cfg_builder(i->iseq);
+            i->cfg = cfg_builder.build();
+        }
+        if (opt_level >= OPT_LEVEL_LINEAR_SCAN) {
+            inline_calls(functions);
+        }
+        for (auto i = functions.begin(); i != functions.end(); i++) {
+            optimize(*i);
+        }
+    }
+
+    // procedures whose every call was inlined aren't needed
+    std::set<std::string> reachable = get_reachable(functions);
+
+    if (flag_print_hins) {
+        for (auto i = functions.cbegin(); i != functions.cend(); i++) {
+            if (reachable.count(i->label) == 0) {
+                continue;
+            }
+            if (i != functions.cbegin()) {
+                printf("\n%s:\n", i->label.c_str());
+            }
+            auto *hlprinter = new PrintHighLevelInstructionSequence(i->iseq);
+            hlprinter->print();
+        }
+    }
+
+    if (flag_compile) {
+        std::vector<Symbol> statics;
+        const std::vector<Symbol> &symbols = global->get_symbols();
+        for (auto i = symbols.cbegin(); i != symbols.cend(); i++) {
+            if (i->is_static()) {
+                statics.push_back(*i);
+            }
+        }
+        AssemblyCodeGen::emit_data(statics);
 
-        // CFG Printer
-        //HighLevelControlFlowGraphPrinter cfg_printer(cfg);
-        //cfg_printer.print();
+        for (auto i = functions.cbegin(); i != functions.cend(); i++) {
+            if (reachable.count(i->label) == 0) {
+                continue;
+            }
+            auto *asmcodegen = new AssemblyCodeGen(i->iseq, i->storage_size, i->vreg_max, i->label);
+            if (i->assignment != nullptr) {
+                asmcodegen->set_register_assignment(i->assignment);
+            }
+            if (flag_optimize) {
+                asmcodegen->select_instructions();
+                asmcodegen->optimize_instructions();
+            } else {
+                asmcodegen->translate_instructions();
+            }
+            asmcodegen->emit();
+        }
+    }
+}
+
+void Context::optimize(Function &function) {
+    ControlFlowGraph *cfg = function.cfg;
 
-        // Live Vregs Printer
-        // auto live_vregs = new LiveVregs(cfg);
-        // LiveVregsControlFlowGraphPrinter live_vregs_printer(cfg, live_vregs);
-        //live_vregs_printer.print();
+    // CFG Printer
+    //HighLevelControlFlowGraphPrinter cfg_printer(cfg);
+    //cfg_printer.print();
 
+    // Live Vregs Printer
+    // auto live_vregs = new LiveVregs(cfg);
+    // LiveVregsControlFlowGraphPrinter live_vregs_printer(cfg, live_vregs);
+    //live_vregs_printer.print();
+
+    if (opt_level == OPT_LEVEL_NAIVE) {
         NaiveRegisterAllocation registerAllocation(cfg);
         cfg = registerAllocation.transform_cfg();
 
         ConstantPropagation constantPropagation(cfg);
         cfg = constantPropagation.transform_cfg();
 
-        iseq = cfg->create_instruction_sequence();
+        AlgebraicSimplification simplification(cfg);
+        cfg = simplification.transform_cfg();
+    } else if (opt_level == OPT_LEVEL_LINEAR_SCAN) {
+        // a cheaper pipeline: no SSA form, and a single round of
+        // constant propagation and dead code elimination
+        ConditionalConstantPropagation constantPropagation(cfg);
+        constantPropagation.execute();
+        cfg = constantPropagation.transform_cfg();
+
+        AlgebraicSimplification simplification(cfg);
+        cfg = simplification.transform_cfg();
+
+        LoopInvariantCodeMotion licm(cfg);
+        licm.execute();
+        cfg = licm.transform_cfg();
+
+        DeadCodeElimination dce(cfg);
+        cfg = dce.transform_cfg();
+
+        LinearScanRegisterAllocation registerAllocation(cfg);
+        registerAllocation.execute();
+        cfg = registerAllocation.transform_cfg();
+        function.assignment = registerAllocation.get_assignment();
+    } else {
+        ConditionalConstantPropagation constantPropagation(cfg);
+        constantPropagation.execute();
+        cfg = constantPropagation.transform_cfg();
+
+        LoopInvariantCodeMotion licm(cfg);
+        licm.execute();
+        cfg = licm.transform_cfg();
+
+        InductionVariableStrengthReduction ivsr(cfg);
+        ivsr.execute();
+        cfg = ivsr.transform_cfg();
+
+        cfg = unroll_loops(cfg);
+
+        SSAConstruction ssa(cfg);
+        ssa.execute();
+        cfg = ssa.transform_cfg();
+
+        GlobalValueNumbering gvn(cfg);
+        gvn.execute();
+        cfg = gvn.transform_cfg();
+
+        SSADestruction out_of_ssa(cfg);
+        out_of_ssa.execute();
+        cfg = out_of_ssa.transform_cfg();
+
+        cfg = eliminate_dead_code(cfg);
+
+        // allocation must come last, since it depends on the liveness
+        // of the final code
+        GraphColoringRegisterAllocation registerAllocation(cfg);
+        registerAllocation.execute();
+        cfg = registerAllocation.transform_cfg();
+        function.assignment = registerAllocation.get_assignment();
     }
 
-    if (flag_print_hins) {
-        auto *hlprinter = new PrintHighLevelInstructionSequence(iseq);
-        hlprinter->print();
+    function.cfg = cfg;
+    function.iseq = cfg->create_instruction_sequence();
+}
+
+void Context::inline_calls(std::vector<Function> &functions) {
+    // the number of calls to each procedure
+    std::map<std::string, unsigned> num_calls;
+    for (auto i = functions.cbegin(); i != functions.cend(); i++) {
+        for (auto j = i->iseq->cbegin(); j != i->iseq->cend(); j++) {
+            Instruction *ins = *j;
+            if (ins->get_opcode() == HINS_CALL) {
+                num_calls[ins->get_operand(HighLevel::get_call_target(ins)).get_target_label()]++;
+            }
+        }
     }
 
-    if (flag_compile) {
-        auto *asmcodegen = new AssemblyCodeGen(
-                iseq,
-                hlcodegen->get_storage_size(),
-                hlcodegen->get_vreg_max()
-                );
-        asmcodegen->translate_instructions();
-        asmcodegen->emit();
+    // A procedure only calls those declared before it (or itself), so
+    // inlining into the procedures in the order they're declared, and
+    // then into the main program, inlines callees which became leaves
+    // by having their own calls inlined.  The callees are unoptimized.
+    std::map<std::string, ControlFlowGraph *> callees;
+    for (unsigned n = 0; n < functions.size(); n++) {
+        Function &function = functions[(n + 1) % functions.size()];
+
+        FunctionInlining inlining(function.cfg, function.label, callees, num_calls);
+        inlining.execute();
+        function.cfg = inlining.transform_cfg();
+
+        if (flag_report_inline) {
+            const std::vector<std::string> &report = inlining.get_report();
+            for (auto i = report.cbegin(); i != report.cend(); i++) {
+                fprintf(stderr, "%s\n", i->c_str());
+            }
+        }
+        callees[function.label] = function.cfg;
     }
 }
 
+std::set<std::string> Context::get_reachable(const std::vector<Function> &functions) {
+    std::map<std::string, const Function *> by_label;
+    for (auto i = functions.cbegin(); i != functions.cend(); i++) {
+        by_label[i->label] = &(*i);
+    }
+
+    std::set<std::string> reachable;
+    std::vector<std::string> work_list(1, "main");
+    while (!work_list.empty()) {
+        std::string label = work_list.back();
+        work_list.pop_back();
+        if (!reachable.insert(label).second) {
+            continue;
+        }
+        const Function *function = by_label[label];
+        for (auto i = function->iseq->cbegin(); i != function->iseq->cend(); i++) {
+            Instruction *ins = *i;
+            if (ins->get_opcode() == HINS_CALL) {
+                work_list.push_back(ins->get_operand(HighLevel::get_call_target(ins)).get_target_label());
+            }
+        }
+    }
+    return reachable;
+}
+
+ControlFlowGraph *Context::eliminate_dead_code(ControlFlowGraph *cfg) {
+    // removing dead code can leave more constants to propagate (e.g.,
+    // a vreg whose other def was dead), and propagating constants leaves
+    // more dead code, so alternate until nothing more is removed
+    // (simplifying the arithmetic with constant operands in between)
+    for (;;) {
+        ConditionalConstantPropagation constantPropagation(cfg);
+        constantPropagation.execute();
+        cfg = constantPropagation.transform_cfg();
+
+        AlgebraicSimplification simplification(cfg);
+        cfg = simplification.transform_cfg();
+
+        DeadCodeElimination dce(cfg);
+        cfg = dce.transform_cfg();
+        if (dce.get_num_removed() == 0) {
+            return cfg;
+        }
+    }
+}
+
+ControlFlowGraph *Context::unroll_loops(ControlFlowGraph *cfg) {
+    LoopUnrolling unrolling(cfg, unroll_factor);
+    unrolling.execute();
+    cfg = unrolling.transform_cfg();
+
+    if (flag_report_unroll) {
+        const std::vector<std::string> &report = unrolling.get_report();
+        for (auto i = report.cbegin(); i != report.cend(); i++) {
+            fprintf(stderr, "%s\n", i->c_str());
+        }
+    }
+    return cfg;
+}
+
 ////////////////////////////////////////////////////////////////////////
 // Context API functions
 ////////////////////////////////////////////////////////////////////////
@@ -1889,6 +3124,14 @@ void context_set_flag(struct Context *ctx, char flag) {
   ctx->set_flag(flag);
 }
 
+void context_set_opt_level(struct Context *ctx, int level) {
+  ctx->set_opt_level(level);
+}
+
+void context_set_unroll_factor(struct Context *ctx, unsigned factor) {
+  ctx->set_unroll_factor(factor);
+}
+
 void context_build_symtab(struct Context *ctx) {
   ctx->build_symtab();
 }
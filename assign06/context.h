@@ -17,11 +17,44 @@ void context_destroy(struct Context *ctx);
 // This function can be called multiple times to configure
 // compilation options.  Flags available:
 //   's' - print symbol table info
+//   'u' - report which loops were unrolled (on stderr)
+//   'i' - report which calls were inlined (on stderr)
 void context_set_flag(struct Context *ctx, char flag);
 
+// Optimization levels:
+//   0 - no optimization
+//   1 - constant propagation, scalar variables in callee-saved registers
+//   2 - inlining of small leaf procedures, global constant propagation,
+//       loop-invariant code motion, dead code elimination, linear-scan
+//       register allocation
+//   3 - as level 2, plus induction variable strength reduction, loop
+//       unrolling and global value numbering, with constant propagation
+//       and dead code elimination repeated until nothing more is removed,
+//       and graph-coloring register allocation
+// Every level above 0 also selects instructions by tiling expression trees,
+// emits calls followed by a return as jumps (tail calls), and runs the
+// x86-64 peephole optimizer.
+enum {
+  OPT_LEVEL_NONE = 0,
+  OPT_LEVEL_NAIVE = 1,
+  OPT_LEVEL_LINEAR_SCAN = 2,
+  OPT_LEVEL_GRAPH_COLORING = 3,
+  OPT_LEVEL_MAX = OPT_LEVEL_GRAPH_COLORING,
+};
+
+// Set the optimization level; a level above 0 enables optimization.
+void context_set_opt_level(struct Context *ctx, int level);
+
+// Set the number of copies of the body in an unrolled loop (at level 3);
+// 1 disables unrolling other than of loops with a small constant trip
+// count.
+void context_set_unroll_factor(struct Context *ctx, unsigned factor);
+
 void context_build_symtab(struct Context *ctx);
 void context_check_types(struct Context *ctx);
 
+// Print the generated assembly code, which is to be linked with the
+// runtime library (runtime.o) providing READ and WRITE.
 void context_gen_code(struct Context *ctx);
 
 #ifdef __cplusplus
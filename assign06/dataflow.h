@@ -0,0 +1,257 @@
+#ifndef DATAFLOW_H
+#define DATAFLOW_H
+
+#include <cassert>
+#include <vector>
+#include <set>
+#include <utility>
+#include <algorithm>
+#include "cfg.h"
+
+enum DataflowDirection {
+    DATAFLOW_FORWARD,
+    DATAFLOW_BACKWARD,
+};
+
+// Generic iterative dataflow solver.  The Analysis type parameter
+// describes the problem, and must provide:
+//
+//   typedef ... FactType;                  the lattice of dataflow facts
+//   static const DataflowDirection DIRECTION;
+//   FactType get_top_fact() const;         identity element of the meet
+//   FactType get_boundary_fact() const;    fact at the beginning of the entry
+//                                          block (forward) or at the end of the
+//                                          exit block (backward)
+//   void combine_facts(FactType &fact, const FactType &other) const;
+//                                          meet other into fact
+//   void model_instruction(Instruction *ins, FactType &fact) const;
+//                                          transfer function of an instruction
+//                                          (applied in the analysis direction)
+//
+// Blocks are kept on a worklist ordered by reverse postorder (on the
+// reversed CFG for backward problems), and a block is only revisited
+// when the fact flowing into it from a neighbor has changed.
+template<typename Analysis>
+class Dataflow {
+public:
+    typedef typename Analysis::FactType FactType;
+
+private:
+    ControlFlowGraph *m_cfg;
+    Analysis m_analysis;
+    // facts at beginning and end of each basic block
+    std::vector<FactType> m_beginfacts, m_endfacts;
+    // block iteration order, and the position of each block in it
+    std::vector<unsigned> m_iter_order;
+    std::vector<unsigned> m_rank;
+
+public:
+    Dataflow(ControlFlowGraph *cfg, const Analysis &analysis = Analysis());
+    virtual ~Dataflow();
+
+    // execute the analysis
+    void execute();
+
+    const Analysis &get_analysis() const { return m_analysis; }
+    ControlFlowGraph *get_cfg() const { return m_cfg; }
+
+    // get fact at end of specified block
+    const FactType &get_fact_at_end_of_block(BasicBlock *bb) const;
+
+    // get fact at beginning of specified block
+    const FactType &get_fact_at_beginning_of_block(BasicBlock *bb) const;
+
+    // get fact after specified instruction (in program order)
+    FactType get_fact_after_instruction(BasicBlock *bb, Instruction *ins) const;
+
+    // get fact before specified instruction (in program order)
+    FactType get_fact_before_instruction(BasicBlock *bb, Instruction *ins) const;
+
+private:
+    static bool is_forward() { return Analysis::DIRECTION == DATAFLOW_FORWARD; }
+    void compute_iter_order();
+    const ControlFlowGraph::EdgeList &get_inputs(BasicBlock *bb) const;
+    const ControlFlowGraph::EdgeList &get_outputs(BasicBlock *bb) const;
+    static BasicBlock *input_block(Edge *e) { return is_forward() ? e->get_source() : e->get_target(); }
+    static BasicBlock *output_block(Edge *e) { return is_forward() ? e->get_target() : e->get_source(); }
+};
+
+template<typename Analysis>
+Dataflow<Analysis>::Dataflow(ControlFlowGraph *cfg, const Analysis &analysis)
+        : m_cfg(cfg)
+        , m_analysis(analysis)
+        , m_beginfacts(cfg->get_num_blocks(), analysis.get_top_fact())
+        , m_endfacts(cfg->get_num_blocks(), analysis.get_top_fact()) {
+}
+
+template<typename Analysis>
+Dataflow<Analysis>::~Dataflow() {
+}
+
+template<typename Analysis>
+void Dataflow<Analysis>::execute() {
+    compute_iter_order();
+
+    // Facts flowing into a block are stored in m_beginfacts (forward)
+    // or m_endfacts (backward); the other vector holds the facts
+    // flowing out of each block.
+    std::vector<FactType> &in_facts = is_forward() ? m_beginfacts : m_endfacts;
+    std::vector<FactType> &out_facts = is_forward() ? m_endfacts : m_beginfacts;
+    BasicBlock *boundary = is_forward() ? m_cfg->get_entry_block() : m_cfg->get_exit_block();
+
+    // work list of block ranks: the block earliest in the iteration order
+    // is always processed first
+    std::set<unsigned> work_list;
+    for (unsigned i = 0; i < m_iter_order.size(); i++) {
+        work_list.insert(i);
+    }
+
+    while (!work_list.empty()) {
+        unsigned id = m_iter_order[*work_list.begin()];
+        work_list.erase(work_list.begin());
+        BasicBlock *bb = m_cfg->get_block(id);
+
+        // combine the facts flowing out of the block's neighbors
+        FactType fact = (bb == boundary) ? m_analysis.get_boundary_fact() : m_analysis.get_top_fact();
+        const ControlFlowGraph::EdgeList &inputs = get_inputs(bb);
+        for (auto i = inputs.cbegin(); i != inputs.cend(); i++) {
+            m_analysis.combine_facts(fact, out_facts[input_block(*i)->get_id()]);
+        }
+        in_facts[id] = fact;
+
+        // model each instruction, in the analysis direction
+        if (is_forward()) {
+            for (auto i = bb->cbegin(); i != bb->cend(); i++) {
+                m_analysis.model_instruction(*i, fact);
+            }
+        } else {
+            for (auto i = bb->crbegin(); i != bb->crend(); i++) {
+                m_analysis.model_instruction(*i, fact);
+            }
+        }
+
+        // if the fact flowing out of the block changed,
+        // the blocks it flows into must be revisited
+        if (!(fact == out_facts[id])) {
+            out_facts[id] = fact;
+            const ControlFlowGraph::EdgeList &outputs = get_outputs(bb);
+            for (auto i = outputs.cbegin(); i != outputs.cend(); i++) {
+                work_list.insert(m_rank[output_block(*i)->get_id()]);
+            }
+        }
+    }
+}
+
+template<typename Analysis>
+const typename Dataflow<Analysis>::FactType &Dataflow<Analysis>::get_fact_at_end_of_block(BasicBlock *bb) const {
+    return m_endfacts.at(bb->get_id());
+}
+
+template<typename Analysis>
+const typename Dataflow<Analysis>::FactType &Dataflow<Analysis>::get_fact_at_beginning_of_block(BasicBlock *bb) const {
+    return m_beginfacts.at(bb->get_id());
+}
+
+template<typename Analysis>
+typename Dataflow<Analysis>::FactType Dataflow<Analysis>::get_fact_after_instruction(BasicBlock *bb, Instruction *ins) const {
+    if (is_forward()) {
+        FactType fact = m_beginfacts[bb->get_id()];
+        for (auto i = bb->cbegin(); i != bb->cend(); i++) {
+            m_analysis.model_instruction(*i, fact);
+            if (*i == ins) {
+                break;
+            }
+        }
+        return fact;
+    } else {
+        FactType fact = m_endfacts[bb->get_id()];
+        for (auto i = bb->crbegin(); i != bb->crend(); i++) {
+            if (*i == ins) {
+                break;
+            }
+            m_analysis.model_instruction(*i, fact);
+        }
+        return fact;
+    }
+}
+
+template<typename Analysis>
+typename Dataflow<Analysis>::FactType Dataflow<Analysis>::get_fact_before_instruction(BasicBlock *bb, Instruction *ins) const {
+    if (is_forward()) {
+        FactType fact = m_beginfacts[bb->get_id()];
+        for (auto i = bb->cbegin(); i != bb->cend(); i++) {
+            if (*i == ins) {
+                break;
+            }
+            m_analysis.model_instruction(*i, fact);
+        }
+        return fact;
+    } else {
+        FactType fact = m_endfacts[bb->get_id()];
+        for (auto i = bb->crbegin(); i != bb->crend(); i++) {
+            m_analysis.model_instruction(*i, fact);
+            if (*i == ins) {
+                break;
+            }
+        }
+        return fact;
+    }
+}
+
+template<typename Analysis>
+void Dataflow<Analysis>::compute_iter_order() {
+    // Desired iteration order is reverse postorder, starting from the
+    // entry block (forward) or on the reversed CFG from the exit block
+    // (backward).  The depth-first search is iterative, so that deeply
+    // nested control flow can't overflow the stack.
+    const unsigned num_blocks = m_cfg->get_num_blocks();
+    std::vector<bool> visited(num_blocks, false);
+    m_iter_order.clear();
+
+    // stack of (block, index of next neighbor to visit)
+    std::vector<std::pair<BasicBlock *, unsigned> > stack;
+    BasicBlock *start = is_forward() ? m_cfg->get_entry_block() : m_cfg->get_exit_block();
+    visited[start->get_id()] = true;
+    stack.push_back(std::make_pair(start, 0U));
+
+    while (!stack.empty()) {
+        BasicBlock *bb = stack.back().first;
+        const ControlFlowGraph::EdgeList &outputs = get_outputs(bb);
+        if (stack.back().second < outputs.size()) {
+            BasicBlock *next = output_block(outputs[stack.back().second++]);
+            if (!visited[next->get_id()]) {
+                visited[next->get_id()] = true;
+                stack.push_back(std::make_pair(next, 0U));
+            }
+        } else {
+            m_iter_order.push_back(bb->get_id());
+            stack.pop_back();
+        }
+    }
+    std::reverse(m_iter_order.begin(), m_iter_order.end());
+
+    // blocks not reached by the search (e.g., an infinite loop never
+    // reaches the exit block) still need facts
+    for (unsigned i = 0; i < num_blocks; i++) {
+        if (!visited[i]) {
+            m_iter_order.push_back(i);
+        }
+    }
+
+    m_rank.assign(num_blocks, 0);
+    for (unsigned i = 0; i < num_blocks; i++) {
+        m_rank[m_iter_order[i]] = i;
+    }
+}
+
+template<typename Analysis>
+const ControlFlowGraph::EdgeList &Dataflow<Analysis>::get_inputs(BasicBlock *bb) const {
+    return is_forward() ? m_cfg->get_incoming_edges(bb) : m_cfg->get_outgoing_edges(bb);
+}
+
+template<typename Analysis>
+const ControlFlowGraph::EdgeList &Dataflow<Analysis>::get_outputs(BasicBlock *bb) const {
+    return is_forward() ? m_cfg->get_outgoing_edges(bb) : m_cfg->get_incoming_edges(bb);
+}
+
+#endif // DATAFLOW_H
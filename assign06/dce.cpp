@@ -0,0 +1,66 @@
+#include <vector>
+#include "cfg.h"
+#include "highlevel.h"
+#include "live_vregs.h"
+#include "dce.h"
+
+DeadCodeElimination::DeadCodeElimination(ControlFlowGraph *cfg)
+        : ControlFlowGraphTransform(cfg)
+        , m_live_vregs(cfg)
+        , m_num_removed(0) {
+    m_live_vregs.execute();
+}
+
+DeadCodeElimination::~DeadCodeElimination() {
+}
+
+InstructionSequence *DeadCodeElimination::transform_basic_block(InstructionSequence *iseq) {
+    BasicBlock *bb = static_cast<BasicBlock *>(iseq);
+
+    // the live set is updated only by the instructions which are kept,
+    // so the operands of a dead instruction don't keep their defs alive
+    LiveVregs::LiveSet live = m_live_vregs.get_fact_at_end_of_block(bb);
+
+    std::vector<Instruction *> kept;
+    for (auto i = bb->crbegin(); i != bb->crend(); i++) {
+        Instruction *ins = *i;
+        if (is_removable(ins) && !live.test(ins->get_operand(0).get_base_reg())) {
+            m_num_removed++;
+            continue;
+        }
+        kept.push_back(ins);
+        m_live_vregs.model_instruction(ins, live);
+    }
+
+    auto out = new InstructionSequence();
+    for (auto i = kept.rbegin(); i != kept.rend(); i++) {
+        out->add_instruction((*i)->duplicate());
+    }
+
+    keep_nonempty(out, bb, HINS_NOP);
+
+    return out;
+}
+
+bool DeadCodeElimination::is_removable(Instruction *ins) {
+    if (!HighLevel::is_def(ins) || ins->get_operand(0).get_kind() != OPERAND_VREG) {
+        return false;
+    }
+
+    switch (ins->get_opcode()) {
+        case HINS_READ_INT:
+        case HINS_CALL:
+            return false;
+
+        case HINS_INT_DIV:
+        case HINS_INT_MOD:
+            {
+                Operand divisor = ins->get_operand(2);
+                return divisor.get_kind() == OPERAND_INT_LITERAL
+                    && divisor.get_int_value() != 0 && divisor.get_int_value() != -1;
+            }
+
+        default:
+            return true;
+    }
+}
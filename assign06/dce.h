@@ -0,0 +1,38 @@
+#ifndef DCE_H
+#define DCE_H
+
+#include "cfg.h"
+#include "cfg_transform.h"
+#include "live_vregs.h"
+
+// Dead code elimination for high-level code.  An instruction which only
+// defines a vreg (i.e., has no other effect) is removed if the vreg is
+// not live after it.  Each block is scanned backwards, so that a chain of
+// dead computations within a block is removed in one pass; chains which
+// span blocks need another pass with fresh liveness facts.
+//
+// Instructions with an effect other than the def are kept: reads, calls,
+// and divisions which could trap (i.e., unless the divisor is a literal
+// other than 0 and -1).
+//
+// Call transform_cfg(), then get_num_removed() to see whether another
+// pass could remove more.
+class DeadCodeElimination : public ControlFlowGraphTransform {
+private:
+    LiveVregs m_live_vregs;
+    unsigned m_num_removed;
+
+public:
+    DeadCodeElimination(ControlFlowGraph *cfg);
+    virtual ~DeadCodeElimination();
+
+    virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq);
+
+    // number of instructions removed by transform_cfg()
+    unsigned get_num_removed() const { return m_num_removed; }
+
+    // is the instruction's only effect to define its destination vreg?
+    static bool is_removable(Instruction *ins);
+};
+
+#endif // DCE_H
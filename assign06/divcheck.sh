@@ -0,0 +1,219 @@
+#!/bin/sh
+# Checks the code generated for DIV and MOD by a constant against idivq.
+#
+# A program dividing dividends read at runtime by each of the divisors
+# below (as literals, so that they are lowered to shifts or to
+# multiplications by magic numbers) is compiled without optimization and
+# at each optimization level, and its output is compared with that of a
+# C reference which uses idivq.  The dividends are INT64_MIN, INT64_MAX,
+# 0, +/-1, +/-2^k and their neighbors, the multiples of each divisor
+# nearest to them, and pseudo-random values.  (INT64_MIN DIV -1, which
+# traps, is skipped.)
+#
+# Run from the directory of the compiler and runtime.o ("make divcheck").
+
+out=$(mktemp -d) || exit 1
+trap 'rm -rf "$out"' EXIT
+
+min=-9223372036854775808
+max=9223372036854775807
+
+# simplified away, or left to idivq
+trivial="1 -1 $min"
+# powers of two (shifts, see AlgebraicSimplification::simplify_division)
+pow2="2 -2 4 -4 8 -8 1024 -1024 2147483648 -2147483648 4294967296 -4294967296
+      4611686018427387904 -4611686018427387904"
+# magic numbers without a fixup, including shifts of 0
+magic="3 5 6 7 9 10 11 12 13 125 641 1000 -5 -6 -7 -10 -11 -641"
+# magic numbers which overflow into the sign bit, so that the dividend is
+# added to (for a positive divisor) or subtracted from (for a negative
+# divisor) the high half of the product
+fixup="25 100 1000000007 2147483647 -3 -9 -25 -1000000007"
+# divisors which don't fit in 32 bits (so the remainder can't use imulq $d)
+wide="2147483649 4294967297 4611686018427387905 $max -2147483649 -$max"
+
+divisors="$trivial $pow2 $magic $fixup $wide"
+
+# a divisor as an expression of the source language, which has no
+# negative literals (constant propagation folds it back to a literal)
+source_expr() {
+  case "$1" in
+    $min) echo "(0 - $max - 1)" ;;
+    -*) echo "(0 - ${1#-})" ;;
+    *) echo "$1" ;;
+  esac
+}
+
+cat > "$out/ref.c" <<'EOF'
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+static int num_divisors;
+static int64_t *divisors;
+
+// quotient and remainder as computed by idivq
+static void idivq(int64_t n, int64_t d, int64_t *q, int64_t *r) {
+    int64_t rax = n, rdx;
+    __asm__("cqto\n\tidivq %2" : "+a"(rax), "=&d"(rdx) : "r"(d) : "cc");
+    *q = rax;
+    *r = rdx;
+}
+
+static void dividend(uint64_t n) {
+    printf("%ld\n", (long) (int64_t) n);
+}
+
+// "data": print the number of dividends, then the dividends
+static void print_data(void) {
+    int count = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1) {
+            printf("%d\n", count);
+        }
+        count = 0;
+#define EMIT(n) do { if (pass == 1) dividend(n); count++; } while (0)
+        EMIT(UINT64_C(1) << 63);
+        EMIT((UINT64_C(1) << 63) + 1);
+        EMIT(INT64_MAX);
+        EMIT(INT64_MAX - 1);
+        for (int k = 0; k < 63; k++) {
+            uint64_t p = UINT64_C(1) << k;
+            EMIT(p);
+            EMIT(p - 1);
+            EMIT(p + 1);
+            EMIT(-p);
+            EMIT(-p - 1);
+            EMIT(-p + 1);
+        }
+        // multiples of each divisor near 0, +/-2^31 and the ends of the
+        // range, and their neighbors
+        for (int i = 0; i < num_divisors; i++) {
+            int64_t d = divisors[i];
+            if (d == INT64_MIN || d == -1 || d == 1) {
+                continue;
+            }
+            int64_t ad = d < 0 ? -d : d;
+            int64_t bases[] = { ad, INT64_C(1) << 31, INT64_MAX, INT64_MIN };
+            for (int b = 0; b < 4; b++) {
+                int64_t m = (bases[b] / ad) * ad;
+                for (int delta = -1; delta <= 1; delta++) {
+                    EMIT((uint64_t) m + (uint64_t) delta);
+                    EMIT(-((uint64_t) m + (uint64_t) delta));
+                }
+            }
+        }
+        uint64_t x = UINT64_C(88172645463325252);
+        for (int i = 0; i < 200; i++) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            EMIT(i % 2 == 0 ? x : x >> (i % 61));
+        }
+#undef EMIT
+    }
+}
+
+// "expect": print the quotient and remainder of each dividend read from
+// standard input by each divisor
+static void print_expected(void) {
+    int count;
+    if (scanf("%d", &count) != 1) {
+        exit(1);
+    }
+    for (int i = 0; i < count; i++) {
+        long n;
+        if (scanf("%ld", &n) != 1) {
+            exit(1);
+        }
+        for (int j = 0; j < num_divisors; j++) {
+            int64_t q, r;
+            if (n == INT64_MIN && divisors[j] == -1) {
+                continue;
+            }
+            idivq(n, divisors[j], &q, &r);
+            printf("%ld\n%ld\n", (long) q, (long) r);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    num_divisors = argc - 2;
+    divisors = malloc(sizeof(int64_t) * num_divisors);
+    for (int i = 0; i < num_divisors; i++) {
+        divisors[i] = strtoll(argv[i + 2], NULL, 10);
+    }
+    if (argv[1][0] == 'd') {
+        print_data();
+    } else {
+        print_expected();
+    }
+    return 0;
+}
+EOF
+
+if ! gcc -std=gnu99 -O2 -o "$out/ref" "$out/ref.c"; then
+  echo "FAIL: could not build the reference"
+  exit 1
+fi
+"$out/ref" data $divisors > "$out/divcheck.data"
+"$out/ref" expect $divisors < "$out/divcheck.data" > "$out/divcheck.expect"
+
+# the program: WRITE n DIV d and n MOD d for each dividend and divisor
+{
+  echo "PROGRAM divcheck;"
+  echo "  VAR count, i, n: INTEGER;"
+  echo "BEGIN"
+  echo "  READ count;"
+  echo "  i := 0;"
+  echo "  WHILE i < count DO"
+  echo "    READ n;"
+  for d in $divisors; do
+    e=$(source_expr "$d")
+    if [ "$d" = -1 ]; then
+      echo "    IF n # $(source_expr $min) THEN WRITE n DIV $e; WRITE n MOD $e; END;"
+    else
+      echo "    WRITE n DIV $e; WRITE n MOD $e;"
+    fi
+  done
+  echo "    i := i + 1;"
+  echo "  END;"
+  echo "END."
+} > "$out/divcheck.in"
+
+failed=0
+for level in none 0 1 2 3; do
+  opts=""
+  [ "$level" != none ] && opts="-O $level"
+  if ! ./compiler $opts "$out/divcheck.in" > "$out/divcheck.s"; then
+    echo "FAIL ($level): compilation failed"
+    failed=1
+    continue
+  fi
+  if ! gcc -no-pie -o "$out/divcheck" "$out/divcheck.s" runtime.o 2> "$out/divcheck.err"; then
+    echo "FAIL ($level): assembly failed"
+    cat "$out/divcheck.err"
+    failed=1
+    continue
+  fi
+  if ! "$out/divcheck" < "$out/divcheck.data" | cmp -s - "$out/divcheck.expect"; then
+    echo "FAIL ($level): wrong output"
+    failed=1
+  fi
+
+  # once constant propagation has folded the negative divisors, only
+  # division by -1 and INT64_MIN should be left to idivq (once each for
+  # DIV and MOD)
+  if [ "$level" = 2 ] || [ "$level" = 3 ]; then
+    n=$(grep -c idivq "$out/divcheck.s")
+    if [ "$n" -gt 4 ]; then
+      echo "FAIL ($level): $n idivq instructions"
+      failed=1
+    fi
+  fi
+done
+
+if [ $failed -eq 0 ]; then
+  echo "Division by constants matches idivq"
+fi
+exit $failed
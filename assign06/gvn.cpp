@@ -0,0 +1,299 @@
+#include <cassert>
+#include <algorithm>
+#include "cfg.h"
+#include "highlevel.h"
+#include "loops.h"
+#include "gvn.h"
+
+namespace {
+    // a word: loads and stores access 8 bytes
+    const long WORD_SIZE = 8;
+}
+
+GlobalValueNumbering::GlobalValueNumbering(ControlFlowGraph *cfg)
+        : ControlFlowGraphTransform(cfg) {
+}
+
+GlobalValueNumbering::~GlobalValueNumbering() {
+}
+
+void GlobalValueNumbering::execute() {
+    ControlFlowGraph *cfg = get_orig_cfg();
+    const unsigned num_vregs = HighLevel::get_num_vregs(cfg);
+    m_values.resize(num_vregs);
+    for (unsigned v = 0; v < num_vregs; v++) {
+        m_values[v] = int(v);
+    }
+
+    // walk the dominator tree from the entry block
+    std::vector<AvailableLoad> loads;
+    std::vector<Scope> scopes;
+    enter_block(cfg->get_entry_block(), loads, scopes);
+    while (!scopes.empty()) {
+        Scope &scope = scopes.back();
+        const ControlFlowGraph::BlockList &children = cfg->get_dominator_tree().get_children(scope.bb);
+        if (scope.next_child < children.size()) {
+            enter_block(children[scope.next_child++], loads, scopes);
+        } else {
+            leave_block(loads, scope);
+            scopes.pop_back();
+        }
+    }
+}
+
+InstructionSequence *GlobalValueNumbering::transform_basic_block(InstructionSequence *iseq) {
+    auto result = new InstructionSequence();
+    for (auto i = iseq->cbegin(); i != iseq->cend(); i++) {
+        if (m_removed.count(*i) > 0) {
+            continue;
+        }
+
+        Instruction *ins = (*i)->duplicate();
+        for (unsigned s = 0; s < ins->get_num_operands(); s++) {
+            Operand operand = ins->get_operand(s);
+            if (operand.has_base_reg()) {
+                operand.set_base_reg(get_value(operand.get_base_reg()));
+            }
+            if (operand.has_index_reg()) {
+                operand.set_index_reg(get_value(operand.get_index_reg()));
+            }
+            (*ins)[s] = operand;
+        }
+        result->add_instruction(ins);
+    }
+
+    keep_nonempty(result, iseq, HINS_NOP);
+    return result;
+}
+
+void GlobalValueNumbering::enter_block(BasicBlock *bb, std::vector<AvailableLoad> &loads, std::vector<Scope> &scopes) {
+    scopes.push_back(Scope());
+    Scope &scope = scopes.back();
+    scope.bb = bb;
+    scope.next_child = 0;
+
+    // the loads available at the end of the parent block are still
+    // available in a block which can't be reached any other way
+    scope.inherits_loads = (get_orig_cfg()->get_incoming_edges(bb).size() == 1);
+    if (!scope.inherits_loads) {
+        scope.outer_loads.swap(loads);
+    }
+
+    number_block(scope, loads);
+}
+
+void GlobalValueNumbering::leave_block(std::vector<AvailableLoad> &loads, Scope &scope) {
+    for (auto i = scope.added.begin(); i != scope.added.end(); i++) {
+        m_expressions.erase(*i);
+    }
+
+    if (scope.inherits_loads) {
+        for (auto i = scope.load_changes.rbegin(); i != scope.load_changes.rend(); i++) {
+            if (i->added) {
+                loads.pop_back();
+            } else {
+                loads.insert(loads.begin() + i->pos, i->load);
+            }
+        }
+    } else {
+        loads.swap(scope.outer_loads);
+    }
+}
+
+void GlobalValueNumbering::number_block(Scope &scope, std::vector<AvailableLoad> &loads) {
+    BasicBlock *bb = scope.bb;
+    for (auto i = bb->cbegin(); i != bb->cend(); i++) {
+        Instruction *ins = *i;
+        int opcode = ins->get_opcode();
+
+        if (opcode == HINS_PHI) {
+            int value = get_phi_value(ins);
+            if (value >= 0) {
+                replace(ins, value);
+            }
+        } else if (opcode == HINS_STORE_INT) {
+            Address addr = get_address(ins->get_operand(0));
+            for (unsigned j = 0; j < loads.size(); ) {
+                if (may_alias(loads[j].addr, addr)) {
+                    erase_load(loads, j, scope);
+                } else {
+                    j++;
+                }
+            }
+            Operand value = ins->get_operand(1);
+            if (value.get_kind() == OPERAND_VREG) {
+                AvailableLoad load = { addr, get_value(value.get_base_reg()) };
+                push_load(loads, load, scope);
+            }
+        } else if (opcode == HINS_CALL) {
+            // a procedure can only store to the static variables (and
+            // its own frame), not to the caller's frame
+            for (unsigned j = 0; j < loads.size(); ) {
+                if (loads[j].addr.base != -1) {
+                    erase_load(loads, j, scope);
+                } else {
+                    j++;
+                }
+            }
+        } else if (opcode == HINS_LOAD_INT && ins->get_operand(0).get_kind() == OPERAND_VREG) {
+            Address addr = get_address(ins->get_operand(1));
+            auto j = loads.begin();
+            while (j != loads.end() && !is_same_address(j->addr, addr)) {
+                j++;
+            }
+            if (j != loads.end()) {
+                replace(ins, j->vreg);
+            } else {
+                AvailableLoad load = { addr, ins->get_operand(0).get_base_reg() };
+                push_load(loads, load, scope);
+            }
+        } else if (opcode == HINS_MOV && ins->get_operand(1).get_kind() == OPERAND_VREG) {
+            replace(ins, get_value(ins->get_operand(1).get_base_reg()));
+        } else if (is_pure(ins)) {
+            Expression expr = get_expression(ins);
+            auto j = m_expressions.find(expr);
+            if (j != m_expressions.end()) {
+                replace(ins, j->second);
+            } else {
+                int vreg = ins->get_operand(0).get_base_reg();
+                m_expressions[expr] = vreg;
+                scope.added.push_back(expr);
+                if (opcode == HINS_LOCALADDR) {
+                    m_frame_offsets[vreg] = ins->get_operand(1).get_int_value();
+                }
+            }
+        }
+    }
+}
+
+void GlobalValueNumbering::erase_load(std::vector<AvailableLoad> &loads, unsigned pos, Scope &scope) {
+    LoadChange change = { false, pos, loads[pos] };
+    scope.load_changes.push_back(change);
+    loads.erase(loads.begin() + pos);
+}
+
+void GlobalValueNumbering::push_load(std::vector<AvailableLoad> &loads, const AvailableLoad &load, Scope &scope) {
+    LoadChange change = { true, unsigned(loads.size()), load };
+    scope.load_changes.push_back(change);
+    loads.push_back(load);
+}
+
+int GlobalValueNumbering::get_phi_value(Instruction *ins) const {
+    // if every operand (other than the phi itself, in a loop) is the
+    // same value, the phi is that value
+    int dest = ins->get_operand(0).get_base_reg();
+    int value = -1;
+    for (unsigned s = 1; s < ins->get_num_operands(); s++) {
+        Operand operand = ins->get_operand(s);
+        if (operand.get_kind() != OPERAND_VREG) {
+            return -1;
+        }
+        int v = get_value(operand.get_base_reg());
+        if (v == dest) {
+            continue;
+        }
+        if (value >= 0 && v != value) {
+            return -1;
+        }
+        value = v;
+    }
+    return value;
+}
+
+void GlobalValueNumbering::replace(Instruction *ins, int vreg) {
+    m_values[ins->get_operand(0).get_base_reg()] = vreg;
+    m_removed.insert(ins);
+}
+
+int GlobalValueNumbering::get_value(int vreg) const {
+    while (m_values.at(vreg) != vreg) {
+        vreg = m_values[vreg];
+    }
+    return vreg;
+}
+
+GlobalValueNumbering::Expression GlobalValueNumbering::get_expression(Instruction *ins) const {
+    // each source operand is (kind, value): the operands of a
+    // commutative operation are sorted
+    std::vector<std::pair<long, long> > operands;
+    for (unsigned s = 1; s < ins->get_num_operands(); s++) {
+        Operand operand = ins->get_operand(s);
+        if (operand.get_kind() == OPERAND_INT_LITERAL) {
+            operands.push_back(std::make_pair(long(OPERAND_INT_LITERAL), operand.get_int_value()));
+        } else {
+            assert(operand.get_kind() == OPERAND_VREG);
+            operands.push_back(std::make_pair(long(OPERAND_VREG), long(get_value(operand.get_base_reg()))));
+        }
+    }
+    int opcode = ins->get_opcode();
+    if (opcode == HINS_INT_ADD || opcode == HINS_INT_MUL || opcode == HINS_INT_AND) {
+        std::sort(operands.begin(), operands.end());
+    }
+
+    // a move of a constant is the same as loading it
+    Expression expr;
+    expr.push_back(opcode == HINS_MOV ? long(HINS_LOAD_ICONST) : long(opcode));
+    for (auto i = operands.begin(); i != operands.end(); i++) {
+        expr.push_back(i->first);
+        expr.push_back(i->second);
+    }
+    return expr;
+}
+
+GlobalValueNumbering::Address GlobalValueNumbering::get_address(const Operand &memref) const {
+    Address addr;
+    addr.base = get_value(memref.get_base_reg());
+    addr.offset = ((memref.get_kind() & OPROP_HAS_INTVAL) != 0) ? memref.get_offset() : 0;
+    auto i = m_frame_offsets.find(addr.base);
+    if (i != m_frame_offsets.end()) {
+        addr.base = -1;
+        addr.offset += i->second;
+    }
+    if (memref.has_index_reg()) {
+        addr.index = get_value(memref.get_index_reg());
+        addr.scale = memref.get_scale();
+    } else {
+        addr.index = -1;
+        addr.scale = 0;
+    }
+    return addr;
+}
+
+bool GlobalValueNumbering::is_pure(Instruction *ins) {
+    // these compute a value from their operands only (a division which
+    // would trap already trapped when the value was first computed)
+    if (!HighLevel::is_def(ins) || ins->get_operand(0).get_kind() != OPERAND_VREG) {
+        return false;
+    }
+    switch (ins->get_opcode()) {
+        case HINS_LOAD_ICONST:
+        case HINS_INT_ADD:
+        case HINS_INT_SUB:
+        case HINS_INT_MUL:
+        case HINS_INT_DIV:
+        case HINS_INT_MOD:
+        case HINS_INT_NEGATE:
+        case HINS_INT_SHL:
+        case HINS_INT_SHR:
+        case HINS_INT_SAR:
+        case HINS_INT_AND:
+        case HINS_LOCALADDR:
+            return true;
+        case HINS_MOV:
+            return ins->get_operand(1).get_kind() == OPERAND_INT_LITERAL;
+        default:
+            return false;
+    }
+}
+
+bool GlobalValueNumbering::is_same_address(const Address &a, const Address &b) {
+    return a.base == b.base && a.index == b.index && a.scale == b.scale && a.offset == b.offset;
+}
+
+bool GlobalValueNumbering::may_alias(const Address &a, const Address &b) {
+    if (a.base != b.base || a.index != b.index || a.scale != b.scale) {
+        return true;
+    }
+    long distance = a.offset - b.offset;
+    return distance > -WORD_SIZE && distance < WORD_SIZE;
+}
@@ -0,0 +1,98 @@
+#ifndef GVN_H
+#define GVN_H
+
+#include <vector>
+#include <map>
+#include <set>
+#include "cfg.h"
+#include "cfg_transform.h"
+
+// Global value numbering for high-level code in SSA form.
+//
+// The blocks are visited in dominator tree order, with a scoped table of
+// the expressions computed in the blocks dominating the current one.  An
+// instruction computing an expression which is already in the table (the
+// same opcode applied to the same values, up to commutativity) is removed,
+// and the vreg it defines is replaced by the vreg already holding the
+// value.  Moves, and phis whose operands all have the same value, are
+// removed the same way.
+//
+// A load is also replaced by an earlier load of (or store to) the same
+// address, unless there's a store to an address which may alias it in
+// between.  Two addresses are known not to alias if they have the same
+// base (or are both in the stack frame) and the same index, and their
+// offsets are at least a word apart.  A call may store to any address
+// outside of the stack frame.  Since any path into a block could
+// store to memory, only blocks with a single predecessor inherit the
+// available loads from it.
+//
+// The dominator tree is walked with an explicit stack (a procedure may
+// have thousands of nested blocks), and the expression table and the
+// list of available loads are shared by all of the blocks: each block
+// records its changes to them, which are undone when its subtree has
+// been visited.
+//
+// Call execute() to number the values, then transform_cfg().
+class GlobalValueNumbering : public ControlFlowGraphTransform {
+private:
+    struct Address {
+        int base;               // value of the base vreg (-1 for the stack frame)
+        int index;              // value of the index vreg (-1 if none)
+        int scale;
+        long offset;            // including the offset of a stack frame base
+    };
+
+    struct AvailableLoad {
+        Address addr;
+        int vreg;               // vreg holding the value at the address
+    };
+
+    // a change to the list of available loads, so that it can be undone
+    struct LoadChange {
+        bool added;             // pushed (rather than erased)
+        unsigned pos;
+        AvailableLoad load;
+    };
+
+    typedef std::vector<long> Expression;
+
+    // a block on the stack of the dominator tree walk
+    struct Scope {
+        BasicBlock *bb;
+        unsigned next_child;                    // index of the next child to visit
+        std::vector<Expression> added;          // expressions added to the table
+        std::vector<LoadChange> load_changes;   // in order
+        bool inherits_loads;                    // if false, the loads of the parent are in outer_loads
+        std::vector<AvailableLoad> outer_loads;
+    };
+
+    std::vector<int> m_values;              // vreg holding the value of each vreg
+    std::map<int, long> m_frame_offsets;    // offset of each vreg defined by localaddr
+    std::map<Expression, int> m_expressions; // expressions computed in the dominating blocks
+    std::set<Instruction *> m_removed;
+
+public:
+    GlobalValueNumbering(ControlFlowGraph *cfg);
+    virtual ~GlobalValueNumbering();
+
+    void execute();
+
+    virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq);
+
+private:
+    void enter_block(BasicBlock *bb, std::vector<AvailableLoad> &loads, std::vector<Scope> &scopes);
+    void leave_block(std::vector<AvailableLoad> &loads, Scope &scope);
+    void number_block(Scope &scope, std::vector<AvailableLoad> &loads);
+    static void erase_load(std::vector<AvailableLoad> &loads, unsigned pos, Scope &scope);
+    static void push_load(std::vector<AvailableLoad> &loads, const AvailableLoad &load, Scope &scope);
+    int get_phi_value(Instruction *ins) const;
+    void replace(Instruction *ins, int vreg);
+    int get_value(int vreg) const;
+    Expression get_expression(Instruction *ins) const;
+    Address get_address(const Operand &memref) const;
+    static bool is_pure(Instruction *ins);
+    static bool is_same_address(const Address &a, const Address &b);
+    static bool may_alias(const Address &a, const Address &b);
+};
+
+#endif // GVN_H
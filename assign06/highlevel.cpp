@@ -1,4 +1,5 @@
 #include <cassert>
+#include <algorithm>
 #include "highlevel.h"
 
 PrintHighLevelInstructionSequence::PrintHighLevelInstructionSequence(InstructionSequence *ins)
@@ -15,6 +16,10 @@ std::string PrintHighLevelInstructionSequence::get_opcode_name(int opcode) {
         case HINS_INT_DIV:     return "divi";
         case HINS_INT_MOD:     return "modi";
         case HINS_INT_NEGATE:  return "negi";
+        case HINS_INT_SHL:     return "shli";
+        case HINS_INT_SHR:     return "shri";
+        case HINS_INT_SAR:     return "sari";
+        case HINS_INT_AND:     return "andi";
         case HINS_LOCALADDR:   return "localaddr";
         case HINS_LOAD_INT:    return "ldi";
         case HINS_STORE_INT:   return "sti";
@@ -30,6 +35,11 @@ std::string PrintHighLevelInstructionSequence::get_opcode_name(int opcode) {
         case HINS_INT_COMPARE: return "cmpi";
         case HINS_LEA:         return "lea";
         case HINS_MOV:         return "mov";
+        case HINS_PHI:         return "phi";
+        case HINS_CALL:        return "call";
+        case HINS_PARAM:       return "param";
+        case HINS_RETURN:      return "ret";
+        case HINS_GLOBALADDR:  return "globaladdr";
 
         default:
             assert(false);
@@ -47,9 +57,20 @@ bool HighLevel::is_def(Instruction *ins) {
         case HINS_INT_DIV:      return true;
         case HINS_INT_MOD:      return true;
         case HINS_INT_NEGATE:   return true;
+        case HINS_INT_SHL:      return true;
+        case HINS_INT_SHR:      return true;
+        case HINS_INT_SAR:      return true;
+        case HINS_INT_AND:      return true;
         case HINS_LOCALADDR:    return true;
         case HINS_LOAD_INT:     return true;
         case HINS_READ_INT:     return true;
+        case HINS_LEA:          return true;
+        case HINS_MOV:          return true;
+        case HINS_PHI:          return true;
+        case HINS_PARAM:        return true;
+        case HINS_GLOBALADDR:   return true;
+        // a call to a procedure has no result
+        case HINS_CALL:         return ins->get_operand(0).get_kind() != OPERAND_LABEL;
         default:                return false;
     }
 }
@@ -60,8 +81,15 @@ bool HighLevel::is_use(Instruction *ins, unsigned i) {
     Operand op = ins->get_operand(i);
     bool op_is_vreg = op.has_base_reg();
 
+    // the destination vreg of a def is written, not read
+    // (a memory reference destination, as in sti, still reads its address)
+    if (i == 0 && is_def(ins) && op.get_kind() == OPERAND_VREG) {
+        return false;
+    }
+
     switch(opcode) {
-        // TODO:
+        // readi only writes its operand
+        case HINS_READ_INT: return false;
     }
 
     if (op_is_vreg) {
@@ -91,6 +119,30 @@ int HighLevel::get_num_vregs(InstructionSequence *hins) {
     return vregs.size();
 }
 
+unsigned HighLevel::get_call_target(Instruction *ins) {
+    assert(ins->get_opcode() == HINS_CALL);
+    return ins->get_operand(0).get_kind() == OPERAND_LABEL ? 0 : 1;
+}
+
+unsigned HighLevel::get_num_vregs(ControlFlowGraph *cfg) {
+    unsigned num_vregs = 0;
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        for (auto j = (*i)->cbegin(); j != (*i)->cend(); j++) {
+            Instruction *ins = *j;
+            for (unsigned k = 0; k < ins->get_num_operands(); k++) {
+                Operand operand = ins->get_operand(k);
+                if (operand.has_base_reg()) {
+                    num_vregs = std::max(num_vregs, unsigned(operand.get_base_reg()) + 1);
+                }
+                if (operand.has_index_reg()) {
+                    num_vregs = std::max(num_vregs, unsigned(operand.get_index_reg()) + 1);
+                }
+            }
+        }
+    }
+    return num_vregs;
+}
+
 std::string PrintHighLevelInstructionSequence::get_mreg_name(int regnum) {
     // high level instructions should not use machine registers
     assert(false);
@@ -104,6 +156,14 @@ HighLevelControlFlowGraphBuilder::HighLevelControlFlowGraphBuilder(InstructionSe
 HighLevelControlFlowGraphBuilder::~HighLevelControlFlowGraphBuilder() {
 }
 
+bool HighLevelControlFlowGraphBuilder::is_branch(Instruction *ins) {
+    // the label of a call is a function, not a branch target
+    if (ins->get_opcode() == HINS_CALL) {
+        return false;
+    }
+    return ControlFlowGraphBuilder::is_branch(ins);
+}
+
 bool HighLevelControlFlowGraphBuilder::falls_through(Instruction *ins) {
     // only unconditional jump instructions don't fall through
     return ins->get_opcode() != HINS_JUMP;
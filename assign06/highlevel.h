@@ -13,6 +13,10 @@ enum HighLevelOpcode {
     HINS_INT_DIV,
     HINS_INT_MOD,
     HINS_INT_NEGATE,
+    HINS_INT_SHL,
+    HINS_INT_SHR,   // logical
+    HINS_INT_SAR,   // arithmetic
+    HINS_INT_AND,
     HINS_LOCALADDR,
     HINS_LOAD_INT,
     HINS_STORE_INT,
@@ -27,7 +31,12 @@ enum HighLevelOpcode {
     HINS_JGTE,
     HINS_INT_COMPARE,
     HINS_LEA,
-    HINS_MOV
+    HINS_MOV,
+    HINS_PHI,       // only in SSA form (see ssa.h)
+    HINS_CALL,      // call [vrD,] label, args...
+    HINS_PARAM,     // param vrN, $i: vrN is the i'th argument (at entry)
+    HINS_RETURN,    // ret [vrN]: return vrN (at the end of a function)
+    HINS_GLOBALADDR // globaladdr vrN, $label
 };
 
 class HighLevel {
@@ -35,6 +44,13 @@ public:
     static bool is_def(Instruction *ins);
     static bool is_use(Instruction *ins, unsigned i);
     static int get_num_vregs(InstructionSequence *hins);
+
+    // index of the label operand of a call (its arguments follow it)
+    static unsigned get_call_target(Instruction *ins);
+
+    // get the number of vregs needed to index every vreg used in
+    // the CFG (i.e., one more than the highest vreg number)
+    static unsigned get_num_vregs(ControlFlowGraph *cfg);
 };
 
 class PrintHighLevelInstructionSequence : public PrintInstructionSequence {
@@ -50,6 +66,7 @@ public:
     HighLevelControlFlowGraphBuilder(InstructionSequence *iseq);
     virtual ~HighLevelControlFlowGraphBuilder();
 
+    virtual bool is_branch(Instruction *ins);
     virtual bool falls_through(Instruction *ins);
 };
 
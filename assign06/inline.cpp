@@ -0,0 +1,266 @@
+#include <cassert>
+#include <algorithm>
+#include "cfg.h"
+#include "highlevel.h"
+#include "loops.h"
+#include "inline.h"
+
+namespace {
+    // the cost of a call, in instructions: saving and restoring the
+    // registers live across it, the call and return, and the callee's
+    // prologue and epilogue (moving each argument costs one more)
+    const unsigned CALL_OVERHEAD = 12;
+
+    // the budget of a call in a loop is multiplied by this for each
+    // enclosing loop (up to MAX_LOOP_DEPTH loops)
+    const unsigned LOOP_WEIGHT = 4;
+    const unsigned MAX_LOOP_DEPTH = 3;
+
+    // the largest callee inlined (at its only call, or in a loop)
+    const unsigned MAX_INLINE_SIZE = 64;
+
+    // the most instructions inlined into a caller, unless it's bigger
+    const unsigned MIN_MAX_GROWTH = 200;
+
+    std::string get_target(Instruction *call) {
+        return call->get_operand(HighLevel::get_call_target(call)).get_target_label();
+    }
+
+    unsigned get_num_args(Instruction *call) {
+        return call->get_num_operands() - HighLevel::get_call_target(call) - 1;
+    }
+
+    // at most one label may be defined at a position of an InstructionSequence
+    void define_label(InstructionSequence *iseq, const std::string &label) {
+        if (iseq->has_label_at_end()) {
+            iseq->add_instruction(new Instruction(HINS_NOP));
+        }
+        iseq->define_label(label);
+    }
+
+    // renumber the vregs of an operand
+    Operand offset_vregs(Operand op, int offset) {
+        if (op.has_base_reg()) {
+            op.set_base_reg(op.get_base_reg() + offset);
+        }
+        if (op.has_index_reg()) {
+            op.set_index_reg(op.get_index_reg() + offset);
+        }
+        return op;
+    }
+}
+
+FunctionInlining::FunctionInlining(ControlFlowGraph *cfg, const std::string &name,
+                                   const std::map<std::string, ControlFlowGraph *> &callees,
+                                   const std::map<std::string, unsigned> &num_calls)
+        : ControlFlowGraphTransform(cfg)
+        , m_loops(&cfg->get_loop_forest())
+        , m_name(name)
+        , m_callees(callees)
+        , m_num_calls(num_calls) {
+}
+
+FunctionInlining::~FunctionInlining() {
+}
+
+void FunctionInlining::execute() {
+    ControlFlowGraph *cfg = get_orig_cfg();
+    const unsigned max_growth = std::max(get_size(cfg), MIN_MAX_GROWTH);
+    unsigned growth = 0;
+
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *bb = *i;
+        for (auto j = bb->cbegin(); j != bb->cend(); j++) {
+            Instruction *ins = *j;
+            if (ins->get_opcode() != HINS_CALL) {
+                continue;
+            }
+
+            const std::string target = get_target(ins);
+            const std::string site = m_name + ": call to " + target;
+            auto callee = m_callees.find(target);
+            std::string reason;
+            if (target == m_name) {
+                reason = "recursive";
+            } else if (callee == m_callees.end()) {
+                reason = "unknown callee";
+            } else {
+                can_inline(callee->second, reason);
+            }
+            if (!reason.empty()) {
+                m_report.push_back(site + ": not inlined: " + reason);
+                continue;
+            }
+
+            const unsigned size = get_size(callee->second);
+            unsigned budget = CALL_OVERHEAD + get_num_args(ins);
+            const unsigned depth = std::min(m_loops->get_loop_depth(bb), MAX_LOOP_DEPTH);
+            for (unsigned k = 0; k < depth; k++) {
+                budget *= LOOP_WEIGHT;
+            }
+            auto num_calls = m_num_calls.find(target);
+            if (num_calls != m_num_calls.end() && num_calls->second == 1) {
+                budget = std::max(budget, MAX_INLINE_SIZE);
+            }
+            budget = std::min(budget, MAX_INLINE_SIZE);
+
+            if (size > budget) {
+                m_report.push_back(site + ": not inlined: size " + std::to_string(size) +
+                                   " exceeds budget " + std::to_string(budget));
+                continue;
+            }
+            if (growth + size > max_growth) {
+                m_report.push_back(site + ": not inlined: caller too big");
+                continue;
+            }
+
+            growth += size;
+            m_inlined.insert(ins);
+            m_report.push_back(site + ": inlined (size " + std::to_string(size) + ")");
+        }
+    }
+}
+
+ControlFlowGraph *FunctionInlining::transform_cfg() {
+    ControlFlowGraph *cfg = get_orig_cfg();
+    if (m_inlined.empty()) {
+        return ControlFlowGraphTransform::transform_cfg();
+    }
+
+    // Inline into the flattened code, and build a new CFG from it.  The
+    // vregs of each inlined callee are numbered past all the caller's vregs
+    // (and those of the callees inlined before it).
+    ControlFlowGraph::BlockList order;
+    InstructionSequence *iseq = cfg->create_instruction_sequence(&order);
+    std::vector<Instruction *> orig;
+    for (auto i = order.cbegin(); i != order.cend(); i++) {
+        orig.insert(orig.end(), (*i)->cbegin(), (*i)->cend());
+    }
+    assert(orig.size() == iseq->get_length());
+
+    InstructionSequence *out = new InstructionSequence();
+    int next_vreg = int(HighLevel::get_num_vregs(cfg));
+    unsigned num_inlined = 0;
+
+    for (unsigned i = 0; i < iseq->get_length(); i++) {
+        if (iseq->has_label(i)) {
+            define_label(out, iseq->get_label(i));
+        }
+        Instruction *ins = iseq->get_instruction(i);
+        if (m_inlined.count(orig[i]) == 0) {
+            out->add_instruction(ins->duplicate());
+            continue;
+        }
+
+        ControlFlowGraph *callee = m_callees.find(get_target(ins))->second;
+        num_inlined++;
+        add_inlined_code(out, ins, callee, next_vreg, "_" + m_name + "_" + std::to_string(num_inlined));
+        next_vreg += int(HighLevel::get_num_vregs(callee));
+    }
+    if (iseq->has_label_at_end()) {
+        define_label(out, iseq->get_label_at_end());
+    }
+    delete iseq;
+
+    HighLevelControlFlowGraphBuilder builder(out);
+    return builder.build();
+}
+
+InstructionSequence *FunctionInlining::transform_basic_block(InstructionSequence *iseq) {
+    auto out = new InstructionSequence();
+    for (auto i = iseq->cbegin(); i != iseq->cend(); i++) {
+        out->add_instruction((*i)->duplicate());
+    }
+    return out;
+}
+
+unsigned FunctionInlining::get_size(ControlFlowGraph *cfg) {
+    unsigned size = 0;
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        for (auto j = (*i)->cbegin(); j != (*i)->cend(); j++) {
+            switch ((*j)->get_opcode()) {
+                case HINS_PARAM: case HINS_RETURN: case HINS_NOP: case HINS_JUMP:
+                    break;
+                default:
+                    size++;
+            }
+        }
+    }
+    return size;
+}
+
+bool FunctionInlining::can_inline(ControlFlowGraph *callee, std::string &reason) {
+    for (auto i = callee->bb_begin(); i != callee->bb_end(); i++) {
+        for (auto j = (*i)->cbegin(); j != (*i)->cend(); j++) {
+            if ((*j)->get_opcode() == HINS_CALL) {
+                reason = "not a leaf";
+                return false;
+            }
+            if ((*j)->get_opcode() == HINS_LOCALADDR) {
+                reason = "has local variables in memory";
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void FunctionInlining::add_inlined_code(InstructionSequence *out, Instruction *call, ControlFlowGraph *callee,
+                                        int vreg_offset, const std::string &suffix) {
+    const unsigned target = HighLevel::get_call_target(call);
+    const bool has_result = target > 0;
+    const std::string end_label = ".Lret" + suffix;
+    bool end_label_used = false;
+
+    InstructionSequence *body = callee->create_instruction_sequence();
+    for (unsigned i = 0; i < body->get_length(); i++) {
+        if (body->has_label(i)) {
+            define_label(out, body->get_label(i) + suffix);
+        }
+        Instruction *ins = body->get_instruction(i)->duplicate();
+        for (unsigned k = 0; k < ins->get_num_operands(); k++) {
+            Operand &op = (*ins)[k];
+            if (op.get_kind() == OPERAND_LABEL) {
+                op = Operand(op.get_target_label() + suffix);
+            } else {
+                op = offset_vregs(op, vreg_offset);
+            }
+        }
+
+        if (ins->get_opcode() == HINS_PARAM) {
+            // mov vrP, arg
+            Operand arg = call->get_operand(target + 1 + unsigned((*ins)[1].get_int_value()));
+            Instruction *mov = new Instruction(HINS_MOV, (*ins)[0], arg);
+            delete ins;
+            ins = mov;
+        } else if (ins->get_opcode() == HINS_RETURN) {
+            // mov vrD, vrR, then continue after the inlined code
+            Instruction *mov = nullptr;
+            if (has_result && ins->get_num_operands() > 0) {
+                mov = new Instruction(HINS_MOV, call->get_operand(0), (*ins)[0]);
+            } else {
+                mov = new Instruction(HINS_NOP);
+            }
+            delete ins;
+            ins = mov;
+            if (i + 1 < body->get_length()) {
+                out->add_instruction(ins);
+                ins = new Instruction(HINS_JUMP, Operand(end_label));
+                end_label_used = true;
+            }
+        }
+        if (call->has_comment() && i == 0) {
+            ins->set_comment(call->get_comment());
+        }
+        out->add_instruction(ins);
+    }
+    if (body->has_label_at_end()) {
+        define_label(out, body->get_label_at_end() + suffix);
+        out->add_instruction(new Instruction(HINS_NOP));
+    }
+    delete body;
+
+    if (end_label_used) {
+        define_label(out, end_label);
+    }
+}
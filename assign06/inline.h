@@ -0,0 +1,68 @@
+#ifndef INLINE_H
+#define INLINE_H
+
+#include <vector>
+#include <map>
+#include <set>
+#include <string>
+#include "cfg.h"
+#include "cfg_transform.h"
+#include "loops.h"
+
+// Inlining of calls to small leaf procedures in high-level code.
+//
+// A callee can be inlined if it's a leaf (it makes no calls) and has
+// no local variables in memory (no localaddr), so that its code only
+// uses vregs and the variables of the main program.  A call is inlined
+// if the callee's size (its instructions other than param, ret, nop,
+// and jmp) is within the budget of the call site: the cost of the call
+// itself (saving registers, moving the arguments, the call and return),
+// multiplied for calls in loops, since they're executed more often.
+// The only call to a procedure is always worth inlining if the callee
+// isn't too big.  The growth of the caller is limited overall.
+//
+// The inlined code is the callee's code with its vregs renumbered past
+// those of the caller and its labels renamed: each param becomes a mov
+// from the argument, and each ret a mov to the call's result (followed
+// by a jump past the inlined code, unless it's the last instruction).
+// The callees are expected to be unoptimized, so that the inlined code
+// is optimized along with the caller.
+//
+// Call execute() to decide which calls to inline, then transform_cfg().
+// get_report() describes the decision made for each call.
+class FunctionInlining : public ControlFlowGraphTransform {
+private:
+    const LoopForest *m_loops;
+    std::string m_name;
+    const std::map<std::string, ControlFlowGraph *> &m_callees;
+    const std::map<std::string, unsigned> &m_num_calls;
+    std::set<Instruction *> m_inlined;
+    std::vector<std::string> m_report;
+
+public:
+    // name is the caller's label, callees maps the label of each procedure
+    // to its CFG, and num_calls to the number of calls to it in the program
+    FunctionInlining(ControlFlowGraph *cfg, const std::string &name,
+                     const std::map<std::string, ControlFlowGraph *> &callees,
+                     const std::map<std::string, unsigned> &num_calls);
+    virtual ~FunctionInlining();
+
+    // decide which calls to inline
+    void execute();
+
+    virtual ControlFlowGraph *transform_cfg();
+    virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq);
+
+    // one line per call considered, describing what was done with it
+    const std::vector<std::string> &get_report() const { return m_report; }
+
+    // the number of instructions counted against the budget of a call site
+    static unsigned get_size(ControlFlowGraph *cfg);
+
+private:
+    static bool can_inline(ControlFlowGraph *callee, std::string &reason);
+    void add_inlined_code(InstructionSequence *out, Instruction *call, ControlFlowGraph *callee,
+                          int vreg_offset, const std::string &suffix);
+};
+
+#endif // INLINE_H
@@ -0,0 +1,902 @@
+#include <cassert>
+#include <climits>
+#include <algorithm>
+#include "cfg.h"
+#include "highlevel.h"
+#include "x86_64.h"
+#include "regalloc.h"
+#include "isel.h"
+
+namespace {
+    bool fits_int32(long value) {
+        return value >= INT_MIN && value <= INT_MAX;
+    }
+
+    bool is_vreg(const Operand &op) {
+        return op.get_kind() == OPERAND_VREG;
+    }
+
+    bool is_rsp(const Operand &op) {
+        return op.get_kind() == OPERAND_MREG && op.get_base_reg() == MREG_RSP;
+    }
+
+    bool is_valid_scale(long scale) {
+        return scale == 1 || scale == 2 || scale == 4 || scale == 8;
+    }
+
+    // calls, including readi and writei (calls to rt_read_int and rt_write_int)
+    bool is_call(Instruction *ins) {
+        return ins->get_opcode() == HINS_READ_INT || ins->get_opcode() == HINS_WRITE_INT ||
+               ins->get_opcode() == HINS_CALL;
+    }
+
+    // the number of operands with a slot for a folded instruction
+    // (nothing is folded into the arguments of a call, which may be more)
+    unsigned get_num_slots(Instruction *ins) {
+        return std::min(ins->get_num_operands(), 3U);
+    }
+
+    // does the instruction define a vreg?
+    bool defines_vreg(Instruction *ins) {
+        return HighLevel::is_def(ins) && is_vreg(ins->get_operand(0));
+    }
+
+    // The multiplier and shift for signed division by d (|d| >= 2) as
+    // a multiplication by its reciprocal: the quotient is the high 64 bits
+    // of multiplier * n (corrected by n if the multiplier overflowed into
+    // the sign bit) shifted right, plus 1 if that is negative.  See Hacker's
+    // Delight, section 10-4.
+    void get_magic(long d, long &multiplier, unsigned &shift) {
+        const unsigned long two63 = 1UL << 63;
+        unsigned long ad = (d < 0) ? 0UL - (unsigned long) d : (unsigned long) d;
+        unsigned long t = two63 + ((unsigned long) d >> 63);
+        unsigned long anc = t - 1 - t % ad;
+        unsigned long q1 = two63 / anc, r1 = two63 - q1 * anc;
+        unsigned long q2 = two63 / ad, r2 = two63 - q2 * ad;
+        unsigned long delta;
+        unsigned p = 63;
+        do {
+            p++;
+            q1 *= 2;
+            r1 *= 2;
+            if (r1 >= anc) {
+                q1++;
+                r1 -= anc;
+            }
+            q2 *= 2;
+            r2 *= 2;
+            if (r2 >= ad) {
+                q2++;
+                r2 -= ad;
+            }
+            delta = ad - r2;
+        } while (q1 < delta || (q1 == delta && r1 == 0));
+
+        multiplier = long((d < 0) ? 0UL - (q2 + 1) : q2 + 1);
+        shift = p - 64;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// X86_64CodeGenCallbacks implementation
+////////////////////////////////////////////////////////////////////////
+
+X86_64CodeGenCallbacks::~X86_64CodeGenCallbacks() {
+}
+
+////////////////////////////////////////////////////////////////////////
+// X86_64InstructionSelection implementation
+////////////////////////////////////////////////////////////////////////
+
+X86_64InstructionSelection::Node::Node()
+        : use(-1)
+        , fold(FOLD_NONE)
+        , has_addr(false)
+        , has_mem(false)
+        , reads_memory(false) {
+    children[0] = children[1] = children[2] = -1;
+}
+
+X86_64InstructionSelection::X86_64InstructionSelection(ControlFlowGraph *cfg, X86_64CodeGenCallbacks *codegen)
+        : ControlFlowGraphTransform(cfg)
+        , m_codegen(codegen)
+        , m_live_vregs(cfg)
+        , m_block(nullptr) {
+}
+
+X86_64InstructionSelection::~X86_64InstructionSelection() {
+}
+
+void X86_64InstructionSelection::execute() {
+    m_live_vregs.execute();
+}
+
+InstructionSequence *X86_64InstructionSelection::transform_basic_block(InstructionSequence *iseq) {
+    BasicBlock *bb = static_cast<BasicBlock *>(iseq);
+    m_block = bb;
+    m_nodes.assign(bb->get_length(), Node());
+
+    find_uses();
+    select_tiles();
+
+    // instructions folded into another are emitted as part of it
+    auto out = new InstructionSequence();
+    for (unsigned j = 0; j < bb->get_length(); j++) {
+        if (m_nodes[j].fold == FOLD_NONE) {
+            emit(j, out);
+        }
+    }
+
+    keep_nonempty(out, bb, MINS_NOP);
+
+    return out;
+}
+
+void X86_64InstructionSelection::find_uses() {
+    // Going backwards through the block, keep track of the next use of
+    // each vreg.  A vreg can only be folded into its next use if that
+    // instruction reads it exactly once, and it's dead (or redefined)
+    // afterwards.  Otherwise the next use is recorded as -1.
+    BasicBlock *bb = m_block;
+    LiveVregs::LiveSet live = m_live_vregs.get_fact_at_end_of_block(bb);
+    std::map<int, int> next_use;
+
+    for (unsigned k = bb->get_length(); k-- > 0; ) {
+        Instruction *ins = bb->get_instruction(k);
+
+        int def = -1;
+        if (defines_vreg(ins)) {
+            def = ins->get_operand(0).get_base_reg();
+            auto i = next_use.find(def);
+            m_nodes[k].use = (i != next_use.end()) ? i->second : -1;
+            next_use.erase(def);
+        }
+
+        std::map<int, unsigned> num_reads;
+        for (unsigned s = 0; s < ins->get_num_operands(); s++) {
+            if (HighLevel::is_use(ins, s)) {
+                Operand operand = ins->get_operand(s);
+                num_reads[operand.get_base_reg()]++;
+                if (operand.has_index_reg()) {
+                    num_reads[operand.get_index_reg()]++;
+                }
+            }
+        }
+        for (auto i = num_reads.begin(); i != num_reads.end(); i++) {
+            bool last = (i->second == 1) && (!live.test(i->first) || i->first == def);
+            next_use[i->first] = last ? int(k) : -1;
+        }
+
+        m_live_vregs.model_instruction(ins, live);
+    }
+}
+
+void X86_64InstructionSelection::select_tiles() {
+    BasicBlock *bb = m_block;
+    // instruction defining each vreg most recently
+    std::map<int, unsigned> last_def;
+
+    for (unsigned j = 0; j < bb->get_length(); j++) {
+        Instruction *ins = bb->get_instruction(j);
+        Node &node = m_nodes[j];
+        unsigned num_operands = get_num_slots(ins);
+
+        // instructions which could be folded into each operand
+        int child[3] = { -1, -1, -1 };
+        for (unsigned s = 0; s < num_operands; s++) {
+            if (HighLevel::is_use(ins, s)) {
+                child[s] = get_child(j, ins->get_operand(s), last_def);
+            }
+        }
+
+        // only vregs and literals can be folded into an arithmetic instruction
+        bool simple_operands = true;
+        for (unsigned s = 0; s < ins->get_num_operands(); s++) {
+            OperandKind kind = ins->get_operand(s).get_kind();
+            if (kind != OPERAND_VREG && kind != OPERAND_INT_LITERAL) {
+                simple_operands = false;
+            }
+        }
+
+        switch (ins->get_opcode()) {
+            case HINS_LOCALADDR: {
+                long offset = ins->get_operand(1).get_int_value();
+                if (fits_int32(offset)) {
+                    node.has_addr = true;
+                    node.addr.num_terms = 1;
+                    node.addr.terms[0] = Operand(OPERAND_MREG, MREG_RSP);
+                    node.addr.disp = offset;
+                }
+                break;
+            }
+            case HINS_LOAD_ICONST: {
+                long value = ins->get_operand(1).get_int_value();
+                if (fits_int32(value)) {
+                    node.has_addr = true;
+                    node.addr.disp = value;
+                }
+                break;
+            }
+            case HINS_INT_ADD:
+            case HINS_INT_SUB:
+            case HINS_INT_MUL: {
+                if (!simple_operands) {
+                    break;
+                }
+                if (is_foldable_load(child[1]) || is_foldable_load(child[2])) {
+                    // memory operands
+                    for (unsigned s = 1; s <= 2; s++) {
+                        if (is_foldable_load(child[s])) {
+                            fold(j, s, child[s], FOLD_LOAD);
+                        }
+                    }
+                    break;
+                }
+
+                // address arithmetic: fold the operands computing addresses
+                // if the result is still an address, otherwise try the
+                // operands on their own
+                for (int with_children = 1; with_children >= 0 && !node.has_addr; with_children--) {
+                    int c1 = (with_children && child[1] >= 0 && m_nodes[child[1]].has_addr) ? child[1] : -1;
+                    int c2 = (with_children && child[2] >= 0 && m_nodes[child[2]].has_addr) ? child[2] : -1;
+                    Address a = get_operand_address(ins->get_operand(1), c1);
+                    Address b = get_operand_address(ins->get_operand(2), c2);
+
+                    bool ok;
+                    if (ins->get_opcode() == HINS_INT_ADD) {
+                        ok = add_addresses(a, b, 1, node.addr);
+                    } else if (ins->get_opcode() == HINS_INT_SUB) {
+                        ok = add_addresses(a, b, -1, node.addr);
+                    } else {
+                        ok = (b.num_terms == 0 && scale_address(a, b.disp, node.addr)) ||
+                             (a.num_terms == 0 && scale_address(b, a.disp, node.addr));
+                    }
+                    if (ok) {
+                        node.has_addr = true;
+                        if (c1 >= 0) {
+                            fold(j, 1, c1, FOLD_ADDRESS);
+                        }
+                        if (c2 >= 0) {
+                            fold(j, 2, c2, FOLD_ADDRESS);
+                        }
+                    }
+                }
+                break;
+            }
+            case HINS_INT_SHL: {
+                // a shift by 1 to 3 bits scales an address like a multiplication
+                Operand count = ins->get_operand(2);
+                if (!simple_operands || count.get_kind() != OPERAND_INT_LITERAL ||
+                    count.get_int_value() < 1 || count.get_int_value() > 3) {
+                    break;
+                }
+                for (int with_children = 1; with_children >= 0 && !node.has_addr; with_children--) {
+                    int c1 = (with_children && child[1] >= 0 && m_nodes[child[1]].has_addr) ? child[1] : -1;
+                    Address a = get_operand_address(ins->get_operand(1), c1);
+                    if (scale_address(a, 1L << count.get_int_value(), node.addr)) {
+                        node.has_addr = true;
+                        if (c1 >= 0) {
+                            fold(j, 1, c1, FOLD_ADDRESS);
+                        }
+                    }
+                }
+                break;
+            }
+            case HINS_MOV: {
+                if (!simple_operands) {
+                    break;
+                }
+                if (is_foldable_load(child[1])) {
+                    fold(j, 1, child[1], FOLD_LOAD);
+                } else if (child[1] >= 0 && m_nodes[child[1]].has_addr) {
+                    node.has_addr = true;
+                    node.addr = m_nodes[child[1]].addr;
+                    fold(j, 1, child[1], FOLD_ADDRESS);
+                }
+                break;
+            }
+            case HINS_INT_COMPARE: {
+                if (!simple_operands) {
+                    break;
+                }
+                for (unsigned s = 0; s <= 1; s++) {
+                    if (is_foldable_load(child[s])) {
+                        fold(j, s, child[s], FOLD_LOAD);
+                    }
+                }
+                break;
+            }
+            case HINS_LOAD_INT:
+            case HINS_STORE_INT: {
+                // the slot of the memory reference
+                unsigned m = (ins->get_opcode() == HINS_LOAD_INT) ? 1 : 0;
+                Operand ref = ins->get_operand(m);
+                if (!ref.is_memref()) {
+                    break;
+                }
+
+                // the offset and scaled index of the memory reference
+                Address rest;
+                if ((ref.get_kind() & OPROP_HAS_INTVAL) != 0) {
+                    rest.disp = ref.get_offset();
+                }
+                if (ref.has_index_reg()) {
+                    rest.num_terms = 1;
+                    rest.terms[0] = ref.get_index_operand();
+                    rest.scales[0] = ref.get_scale();
+                }
+
+                node.has_mem = true;
+                if (child[m] < 0 || !m_nodes[child[m]].has_addr ||
+                    !add_addresses(m_nodes[child[m]].addr, rest, 1, node.mem) ||
+                    !is_emittable_address(node.mem)) {
+                    // the base vreg isn't folded
+                    Address base;
+                    base.num_terms = 1;
+                    base.terms[0] = ref;
+                    node.has_mem = add_addresses(base, rest, 1, node.mem);
+                } else {
+                    fold(j, m, child[m], FOLD_ADDRESS);
+                }
+                if (!node.has_mem) {
+                    break;
+                }
+
+                if (ins->get_opcode() == HINS_LOAD_INT) {
+                    node.reads_memory = true;
+                } else if (child[1] >= 0 && get_rmw_slot(unsigned(child[1]), node.mem) != 0) {
+                    fold(j, 1, child[1], FOLD_RMW);
+                }
+                break;
+            }
+            default:
+                break;
+        }
+
+        // locations read by the tree rooted at this instruction
+        for (unsigned s = 0; s < num_operands; s++) {
+            if (node.children[s] >= 0) {
+                const Node &c = m_nodes[node.children[s]];
+                node.leaves.insert(node.leaves.end(), c.leaves.begin(), c.leaves.end());
+                node.reads_memory = node.reads_memory || c.reads_memory;
+                if (ins->get_operand(s).has_index_reg()) {
+                    // only the base of a memory reference is folded
+                    node.leaves.push_back(get_location(ins->get_operand(s).get_index_operand()));
+                }
+            } else if (HighLevel::is_use(ins, s)) {
+                add_leaves(node, ins->get_operand(s));
+            }
+        }
+        for (unsigned s = num_operands; s < ins->get_num_operands(); s++) {
+            if (HighLevel::is_use(ins, s)) {
+                add_leaves(node, ins->get_operand(s));
+            }
+        }
+
+        if (defines_vreg(ins)) {
+            last_def[ins->get_operand(0).get_base_reg()] = j;
+        }
+    }
+}
+
+void X86_64InstructionSelection::emit(unsigned j, InstructionSequence *out) {
+    Instruction *ins = m_block->get_instruction(j);
+    const Node &node = m_nodes[j];
+    unsigned start = out->get_length();
+
+    bool folded_address = false, folded_load = false;
+    for (unsigned s = 0; s < get_num_slots(ins); s++) {
+        if (node.children[s] >= 0) {
+            folded_address = folded_address || m_nodes[node.children[s]].fold == FOLD_ADDRESS;
+            folded_load = folded_load || m_nodes[node.children[s]].fold == FOLD_LOAD;
+        }
+    }
+
+    Operand r10(OPERAND_MREG, MREG_R10);
+    bool tiled = true;
+
+    switch (ins->get_opcode()) {
+        case HINS_LOAD_INT: {
+            if (!node.has_mem) {
+                tiled = false;
+                break;
+            }
+            Operand mem = emit_address(node.mem, out);
+            emit_move(mem, get_location(ins->get_operand(0)), out);
+            break;
+        }
+        case HINS_STORE_INT: {
+            if (!node.has_mem) {
+                tiled = false;
+                break;
+            }
+            Operand mem = emit_address(node.mem, out);
+
+            int k = node.children[1];
+            if (k >= 0 && m_nodes[k].fold == FOLD_RMW) {
+                // addq/subq x, (A)
+                Instruction *op = m_block->get_instruction(unsigned(k));
+                unsigned other = 3 - get_rmw_slot(unsigned(k), node.mem);
+                Operand src = emit_source(unsigned(k), other, MREG_RAX, out);
+                if (src.is_memref()) {
+                    Operand rax(OPERAND_MREG, MREG_RAX);
+                    out->add_instruction(new Instruction(MINS_MOVQ, src, rax));
+                    src = rax;
+                }
+                int opcode = (op->get_opcode() == HINS_INT_ADD) ? MINS_ADDQ : MINS_SUBQ;
+                out->add_instruction(new Instruction(opcode, src, mem));
+            } else {
+                Operand src = emit_source(j, 1, MREG_RAX, out);
+                if (src.is_memref()) {
+                    Operand rax(OPERAND_MREG, MREG_RAX);
+                    out->add_instruction(new Instruction(MINS_MOVQ, src, rax));
+                    src = rax;
+                }
+                out->add_instruction(new Instruction(MINS_MOVQ, src, mem));
+            }
+            break;
+        }
+        case HINS_INT_ADD:
+        case HINS_INT_SUB:
+        case HINS_INT_MUL: {
+            Operand dest = get_location(ins->get_operand(0));
+            if (folded_address || (node.has_addr && is_lea_worthwhile(node.addr, dest))) {
+                emit_materialize(node.addr, dest, out);
+            } else if (folded_load) {
+                // movq A, %r10; OP B, %r10; movq %r10, dest
+                Operand a = emit_source(j, 1, MREG_R10, out);
+                if (!(a.get_kind() == OPERAND_MREG && a.get_base_reg() == MREG_R10)) {
+                    out->add_instruction(new Instruction(MINS_MOVQ, a, r10));
+                }
+                Operand b = emit_source(j, 2, MREG_R11, out);
+                int opcode = (ins->get_opcode() == HINS_INT_ADD) ? MINS_ADDQ :
+                             (ins->get_opcode() == HINS_INT_SUB) ? MINS_SUBQ : MINS_IMULQ;
+                out->add_instruction(new Instruction(opcode, b, r10));
+                emit_move(r10, dest, out);
+            } else {
+                tiled = false;
+            }
+            break;
+        }
+        case HINS_INT_DIV:
+        case HINS_INT_MOD: {
+            // division by 0 or -1 (which can trap) is left to idivq
+            Operand divisor = ins->get_operand(2);
+            if (!is_vreg(ins->get_operand(1)) || divisor.get_kind() != OPERAND_INT_LITERAL ||
+                (divisor.get_int_value() >= -1 && divisor.get_int_value() <= 1) ||
+                divisor.get_int_value() == LONG_MIN) {
+                tiled = false;
+                break;
+            }
+            emit_division_by_constant(ins, out);
+            break;
+        }
+        case HINS_INT_SHL: {
+            Operand dest = get_location(ins->get_operand(0));
+            if (folded_address || (node.has_addr && is_lea_worthwhile(node.addr, dest))) {
+                emit_materialize(node.addr, dest, out);
+            } else {
+                tiled = false;
+            }
+            break;
+        }
+        case HINS_MOV: {
+            Operand dest = get_location(ins->get_operand(0));
+            if (folded_load) {
+                const Node &c = m_nodes[node.children[1]];
+                emit_move(emit_address(c.mem, out), dest, out);
+            } else if (folded_address) {
+                emit_materialize(node.addr, dest, out);
+            } else {
+                tiled = false;
+            }
+            break;
+        }
+        case HINS_INT_COMPARE: {
+            if (!folded_load) {
+                tiled = false;
+                break;
+            }
+            // movq L, %r10; cmpq R, %r10
+            Operand l = emit_source(j, 0, MREG_R10, out);
+            if (!(l.get_kind() == OPERAND_MREG && l.get_base_reg() == MREG_R10)) {
+                out->add_instruction(new Instruction(MINS_MOVQ, l, r10));
+            }
+            Operand r = emit_source(j, 1, MREG_R11, out);
+            out->add_instruction(new Instruction(MINS_CMPQ, r, r10));
+            break;
+        }
+        default:
+            tiled = false;
+            break;
+    }
+
+    if (!tiled) {
+        assert(!folded_address && !folded_load);
+        m_codegen->translate_instruction(ins, out);
+    } else if (out->get_length() > start) {
+        PrintHighLevelInstructionSequence print_hins(nullptr);
+        out->get_instruction(start)->set_comment(print_hins.format_instruction(ins));
+    }
+}
+
+int X86_64InstructionSelection::get_child(unsigned j, const Operand &operand, const std::map<int, unsigned> &last_def) {
+    // only the base vreg of a memory reference is folded
+    if (operand.get_kind() != OPERAND_VREG && !(operand.is_memref() && operand.has_base_reg())) {
+        return -1;
+    }
+    auto i = last_def.find(operand.get_base_reg());
+    if (i == last_def.end() || m_nodes[i->second].use != int(j)) {
+        return -1;
+    }
+    const Node &c = m_nodes[i->second];
+    if (!c.has_addr && !c.has_mem && !is_rmw_candidate(i->second)) {
+        return -1;
+    }
+    return can_fold(i->second, j) ? int(i->second) : -1;
+}
+
+bool X86_64InstructionSelection::can_fold(unsigned i, unsigned j) {
+    // Folding moves the evaluation of the tree rooted at i to j, so none of
+    // the locations it reads may change in between (and no memory, if it
+    // loads from memory).  Calls may also overwrite the caller-saved mregs.
+    const Node &node = m_nodes[i];
+    for (unsigned k = i + 1; k < j; k++) {
+        Instruction *ins = m_block->get_instruction(k);
+        if (defines_vreg(ins)) {
+            Operand loc = get_location(ins->get_operand(0));
+            for (auto l = node.leaves.begin(); l != node.leaves.end(); l++) {
+                if (same_location(*l, loc)) {
+                    return false;
+                }
+            }
+        }
+        if (node.reads_memory && (ins->get_opcode() == HINS_STORE_INT || ins->get_opcode() == HINS_CALL)) {
+            return false;
+        }
+        if (is_call(ins)) {
+            for (auto l = node.leaves.begin(); l != node.leaves.end(); l++) {
+                if (l->get_kind() == OPERAND_MREG && !RegisterAssignment::is_callee_saved(l->get_base_reg())) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+void X86_64InstructionSelection::fold(unsigned j, unsigned slot, int i, FoldKind kind) {
+    m_nodes[i].fold = kind;
+    m_nodes[j].children[slot] = i;
+}
+
+void X86_64InstructionSelection::add_leaves(Node &node, const Operand &operand) {
+    if (operand.has_base_reg()) {
+        node.leaves.push_back(get_location(operand));
+    }
+    if (operand.has_index_reg()) {
+        node.leaves.push_back(get_location(operand.get_index_operand()));
+    }
+}
+
+X86_64InstructionSelection::Address X86_64InstructionSelection::get_operand_address(const Operand &operand, int child) {
+    if (child >= 0) {
+        return m_nodes[child].addr;
+    }
+    Address addr;
+    if (operand.get_kind() == OPERAND_INT_LITERAL) {
+        addr.disp = operand.get_int_value();
+    } else {
+        addr.num_terms = 1;
+        addr.terms[0] = operand;
+    }
+    return addr;
+}
+
+bool X86_64InstructionSelection::is_foldable_load(int i) {
+    // the address of a memory operand can't use the scratch registers,
+    // so every term must already be in a register
+    if (i < 0 || !m_nodes[i].has_mem) {
+        return false;
+    }
+    const Address &mem = m_nodes[i].mem;
+    for (unsigned t = 0; t < mem.num_terms; t++) {
+        if (get_location(mem.terms[t]).get_kind() != OPERAND_MREG) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool X86_64InstructionSelection::is_rmw_candidate(unsigned k) {
+    int opcode = m_block->get_instruction(k)->get_opcode();
+    if (opcode != HINS_INT_ADD && opcode != HINS_INT_SUB) {
+        return false;
+    }
+    const Node &node = m_nodes[k];
+    return (node.children[1] >= 0 && m_nodes[node.children[1]].fold == FOLD_LOAD) ||
+           (opcode == HINS_INT_ADD && node.children[2] >= 0 && m_nodes[node.children[2]].fold == FOLD_LOAD);
+}
+
+unsigned X86_64InstructionSelection::get_rmw_slot(unsigned k, const Address &dest) {
+    // the operand of addi/subi k loaded from dest (only the first operand of subi)
+    if (!is_rmw_candidate(k)) {
+        return 0;
+    }
+    int opcode = m_block->get_instruction(k)->get_opcode();
+    const Node &node = m_nodes[k];
+    for (unsigned s = 1; s <= (opcode == HINS_INT_ADD ? 2U : 1U); s++) {
+        int c = node.children[s];
+        if (c >= 0 && m_nodes[c].fold == FOLD_LOAD && same_address(m_nodes[c].mem, dest)) {
+            return s;
+        }
+    }
+    return 0;
+}
+
+Operand X86_64InstructionSelection::get_location(const Operand &operand) {
+    if (is_rsp(operand)) {
+        return operand;
+    }
+    return m_codegen->get_vreg_location(operand);
+}
+
+bool X86_64InstructionSelection::same_location(const Operand &a, const Operand &b) {
+    if (a.get_kind() != b.get_kind() || a.get_base_reg() != b.get_base_reg()) {
+        return false;
+    }
+    return (a.get_kind() & OPROP_HAS_INTVAL) == 0 || a.get_offset() == b.get_offset();
+}
+
+bool X86_64InstructionSelection::same_address(const Address &a, const Address &b) {
+    if (a.num_terms != b.num_terms || a.disp != b.disp) {
+        return false;
+    }
+    for (unsigned t = 0; t < a.num_terms; t++) {
+        bool found = false;
+        for (unsigned u = 0; u < b.num_terms && !found; u++) {
+            found = a.scales[t] == b.scales[u] && same_location(get_location(a.terms[t]), get_location(b.terms[u]));
+        }
+        if (!found) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool X86_64InstructionSelection::add_addresses(const Address &a, const Address &b, long sign, Address &result) {
+    // terms can only be subtracted if they're in both addresses,
+    // which doesn't happen in practice
+    if (sign < 0 && b.num_terms > 0) {
+        return false;
+    }
+
+    result = a;
+    for (unsigned u = 0; u < b.num_terms; u++) {
+        bool merged = false;
+        for (unsigned t = 0; t < result.num_terms && !merged; t++) {
+            if (same_location(get_location(result.terms[t]), get_location(b.terms[u]))) {
+                result.scales[t] += b.scales[u];
+                merged = true;
+            }
+        }
+        if (!merged) {
+            if (result.num_terms == 2) {
+                return false;
+            }
+            result.terms[result.num_terms] = b.terms[u];
+            result.scales[result.num_terms] = b.scales[u];
+            result.num_terms++;
+        }
+    }
+    result.disp = a.disp + sign * b.disp;
+    return is_valid_address(result);
+}
+
+bool X86_64InstructionSelection::scale_address(const Address &a, long factor, Address &result) {
+    if (a.num_terms > 0 && !is_valid_scale(factor)) {
+        return false;
+    }
+    result = a;
+    for (unsigned t = 0; t < result.num_terms; t++) {
+        result.scales[t] *= factor;
+    }
+    if (__builtin_mul_overflow(a.disp, factor, &result.disp)) {
+        return false;
+    }
+    return is_valid_address(result);
+}
+
+bool X86_64InstructionSelection::is_valid_address(const Address &addr) {
+    if (!fits_int32(addr.disp)) {
+        return false;
+    }
+    unsigned num_scaled = 0;
+    for (unsigned t = 0; t < addr.num_terms; t++) {
+        if (!is_valid_scale(addr.scales[t])) {
+            return false;
+        }
+        if (addr.scales[t] != 1) {
+            // %rsp can't be an index register
+            if (is_rsp(addr.terms[t])) {
+                return false;
+            }
+            num_scaled++;
+        }
+    }
+    if (addr.num_terms == 2 && is_rsp(addr.terms[0]) && is_rsp(addr.terms[1])) {
+        return false;
+    }
+    return num_scaled <= 1;
+}
+
+bool X86_64InstructionSelection::is_emittable_address(const Address &addr) {
+    // there must be a base register: a term with scale 1, or a single
+    // term with scale 2, which can be used as both base and index
+    for (unsigned t = 0; t < addr.num_terms; t++) {
+        if (addr.scales[t] == 1) {
+            return true;
+        }
+    }
+    return addr.num_terms == 1 && addr.scales[0] == 2;
+}
+
+bool X86_64InstructionSelection::is_lea_worthwhile(const Address &addr, const Operand &dest) {
+    // Computing an address without folded operands into dest: leaq is
+    // only better than a move followed by addq/imulq if it combines at least
+    // two things, and dest isn't one of its terms (where addq is as good).
+    if (!is_emittable_address(addr)) {
+        return false;
+    }
+    bool scaled = addr.scales[0] != 1 || (addr.num_terms == 2 && addr.scales[1] != 1);
+    if (addr.num_terms < 2 && addr.disp == 0 && !scaled) {
+        return false;
+    }
+    for (unsigned t = 0; t < addr.num_terms; t++) {
+        if (same_location(get_location(addr.terms[t]), dest)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+Operand X86_64InstructionSelection::emit_term(const Operand &term, int scratch, InstructionSequence *out) {
+    Operand loc = get_location(term);
+    if (loc.get_kind() == OPERAND_MREG) {
+        return loc;
+    }
+    Operand reg(OPERAND_MREG, scratch);
+    out->add_instruction(new Instruction(MINS_MOVQ, loc, reg));
+    return reg;
+}
+
+Operand X86_64InstructionSelection::emit_address(const Address &addr, InstructionSequence *out) {
+    assert(is_emittable_address(addr));
+
+    // Terms which aren't in a register are loaded into %r10 (base)
+    // and %r11 (index).  The base must have scale 1, and can't be %rsp.
+    unsigned b = 0;
+    if (addr.num_terms == 2 && (addr.scales[0] != 1 || is_rsp(addr.terms[1]))) {
+        b = 1;
+    }
+    Operand base = emit_term(addr.terms[b], MREG_R10, out);
+
+    if (addr.num_terms == 1 && addr.scales[0] == 1) {
+        if (addr.disp == 0) {
+            return Operand(OPERAND_MREG_MEMREF, base.get_base_reg());
+        }
+        return Operand(OPERAND_MREG_MEMREF_OFFSET, base.get_base_reg(), int(addr.disp));
+    }
+
+    if (addr.num_terms == 1) {
+        // (R,R) is 2*R
+        return Operand(OPERAND_MREG_MEMREF_OFFSET_INDEX, base.get_base_reg(), base.get_base_reg(), int(addr.disp));
+    }
+
+    Operand index = emit_term(addr.terms[1 - b], MREG_R11, out);
+    return Operand(OPERAND_MREG_MEMREF_OFFSET_INDEX, base.get_base_reg(), index.get_base_reg(),
+                   int(addr.disp), int(addr.scales[1 - b]));
+}
+
+Operand X86_64InstructionSelection::emit_source(unsigned j, unsigned slot, int scratch, InstructionSequence *out) {
+    // an operand usable as the source of movq, addq, subq, imulq, or cmpq
+    // (only movq to a register takes a 64 bit immediate)
+    Instruction *ins = m_block->get_instruction(j);
+    Operand operand = ins->get_operand(slot);
+    int c = m_nodes[j].children[slot];
+
+    if (c >= 0) {
+        assert(m_nodes[c].fold == FOLD_LOAD);
+        return emit_address(m_nodes[c].mem, out);
+    }
+    if (operand.get_kind() == OPERAND_INT_LITERAL) {
+        if (fits_int32(operand.get_int_value())) {
+            return operand;
+        }
+        Operand reg(OPERAND_MREG, scratch);
+        out->add_instruction(new Instruction(MINS_MOVQ, operand, reg));
+        return reg;
+    }
+    return get_location(operand);
+}
+
+void X86_64InstructionSelection::emit_move(const Operand &src, const Operand &dest, InstructionSequence *out) {
+    if (dest.get_kind() == OPERAND_MREG || !src.is_memref()) {
+        out->add_instruction(new Instruction(MINS_MOVQ, src, dest));
+    } else {
+        Operand r11(OPERAND_MREG, MREG_R11);
+        out->add_instruction(new Instruction(MINS_MOVQ, src, r11));
+        out->add_instruction(new Instruction(MINS_MOVQ, r11, dest));
+    }
+}
+
+void X86_64InstructionSelection::emit_division_by_constant(Instruction *ins, InstructionSequence *out) {
+    Operand rax(OPERAND_MREG, MREG_RAX), rdx(OPERAND_MREG, MREG_RDX);
+    Operand n = get_location(ins->get_operand(1));
+    long d = ins->get_operand(2).get_int_value();
+    long multiplier;
+    unsigned shift;
+    get_magic(d, multiplier, shift);
+
+    // movq $M, %rax; imulq N (%rdx = high 64 bits of M * N)
+    out->add_instruction(new Instruction(MINS_MOVQ, Operand(OPERAND_INT_LITERAL, multiplier), rax));
+    out->add_instruction(new Instruction(MINS_IMULQ_WIDE, n));
+    if (d > 0 && multiplier < 0) {
+        out->add_instruction(new Instruction(MINS_ADDQ, n, rdx));
+    } else if (d < 0 && multiplier > 0) {
+        out->add_instruction(new Instruction(MINS_SUBQ, n, rdx));
+    }
+    if (shift > 0) {
+        out->add_instruction(new Instruction(MINS_SARQ, Operand(OPERAND_INT_LITERAL, long(shift)), rdx));
+    }
+
+    // round towards zero: add 1 to a negative quotient
+    out->add_instruction(new Instruction(MINS_MOVQ, rdx, rax));
+    out->add_instruction(new Instruction(MINS_SHRQ, Operand(OPERAND_INT_LITERAL, 63), rax));
+    out->add_instruction(new Instruction(MINS_ADDQ, rax, rdx));
+
+    Operand dest = get_location(ins->get_operand(0));
+    if (ins->get_opcode() == HINS_INT_DIV) {
+        emit_move(rdx, dest, out);
+        return;
+    }
+
+    // the remainder is N - quotient * d
+    if (fits_int32(d)) {
+        out->add_instruction(new Instruction(MINS_IMULQ, Operand(OPERAND_INT_LITERAL, d), rdx));
+    } else {
+        out->add_instruction(new Instruction(MINS_MOVQ, Operand(OPERAND_INT_LITERAL, d), rax));
+        out->add_instruction(new Instruction(MINS_IMULQ, rax, rdx));
+    }
+    out->add_instruction(new Instruction(MINS_MOVQ, n, rax));
+    out->add_instruction(new Instruction(MINS_SUBQ, rdx, rax));
+    emit_move(rax, dest, out);
+}
+
+void X86_64InstructionSelection::emit_materialize(const Address &addr, const Operand &dest, InstructionSequence *out) {
+    Operand r10(OPERAND_MREG, MREG_R10);
+    Operand reg = (dest.get_kind() == OPERAND_MREG) ? dest : r10;
+
+    if (addr.num_terms == 0) {
+        emit_move(Operand(OPERAND_INT_LITERAL, addr.disp), dest, out);
+        return;
+    }
+
+    if (is_emittable_address(addr)) {
+        Operand mem = emit_address(addr, out);
+        out->add_instruction(new Instruction(MINS_LEAQ, mem, reg));
+    } else {
+        // a single scaled term: there is no base register for leaq
+        Operand term = get_location(addr.terms[0]);
+        out->add_instruction(new Instruction(MINS_MOVQ, term, r10));
+        out->add_instruction(new Instruction(MINS_IMULQ, Operand(OPERAND_INT_LITERAL, addr.scales[0]), r10));
+        if (addr.disp != 0) {
+            out->add_instruction(new Instruction(MINS_ADDQ, Operand(OPERAND_INT_LITERAL, addr.disp), r10));
+        }
+        reg = r10;
+    }
+
+    if (!(reg.get_kind() == dest.get_kind() && reg.get_base_reg() == dest.get_base_reg())) {
+        out->add_instruction(new Instruction(MINS_MOVQ, reg, dest));
+    }
+}
@@ -0,0 +1,137 @@
+#ifndef ISEL_H
+#define ISEL_H
+
+#include <vector>
+#include <map>
+#include "cfg.h"
+#include "cfg_transform.h"
+#include "live_vregs.h"
+
+// The parts of x86-64 code generation which depend on the layout of
+// the stack frame, and which the instruction selector leaves to the
+// code generator.
+class X86_64CodeGenCallbacks {
+public:
+    virtual ~X86_64CodeGenCallbacks();
+
+    // get the location of a vreg: either an mreg, or a memory
+    // reference into the stack frame
+    virtual Operand get_vreg_location(const Operand &vreg) = 0;
+
+    // append the x86-64 instructions for a single high-level
+    // instruction (which isn't covered by a larger tile) to out
+    virtual void translate_instruction(Instruction *hin, InstructionSequence *out) = 0;
+};
+
+// Instruction selection by tiling the expression trees in each basic
+// block of a high-level CFG.
+//
+// A vreg which is defined by localaddr, ldci, addi, subi, muli, or ldi, and
+// read exactly once later in the same block (after which it is dead), is an
+// interior node of the tree rooted at the instruction reading it, provided
+// that nothing in between modifies the locations (or, for ldi, the memory)
+// the subtree reads.  The trees are then covered with x86-64 tiles:
+//
+//   - address arithmetic (localaddr, adds, and multiplications by 1, 2, 4,
+//     or 8) folds into a single disp(base,index,scale) memory operand of the
+//     ldi or sti using it, or into a leaq,
+//   - an ldi whose value is used once folds into the addq/subq/imulq/cmpq
+//     or movq reading it, and
+//   - sti (A), vr where vr = (A) + x or (A) - x becomes addq/subq x, (A).
+//
+// Division and remainder by a constant (other than 0, 1, and -1) become a
+// multiplication by a "magic" reciprocal of the divisor instead of idivq.
+//
+// Everything else is expanded one high-level instruction at a time by
+// X86_64CodeGenCallbacks::translate_instruction.  The result is a CFG of
+// x86-64 instructions with the same blocks and edges as the original.
+//
+// Call execute() to compute the liveness information the selector
+// needs, then transform_cfg().
+class X86_64InstructionSelection : public ControlFlowGraphTransform {
+public:
+    // An address computation base + index*scale + disp, represented as
+    // up to two terms (vregs, or %rsp) with a multiplier each.  The terms
+    // are high-level operands; their locations are only determined when
+    // the address is emitted.
+    struct Address {
+        unsigned num_terms;
+        Operand terms[2];
+        long scales[2];
+        long disp;
+
+        Address() : num_terms(0), disp(0) { scales[0] = scales[1] = 1; }
+    };
+
+private:
+    // how the value computed by an instruction reaches the single
+    // instruction which uses it
+    enum FoldKind {
+        FOLD_NONE,      // stored in the location of the defined vreg
+        FOLD_ADDRESS,   // part of the address computation of the user
+        FOLD_LOAD,      // memory operand of the user
+        FOLD_RMW,       // source of a read-modify-write of the stored location
+    };
+
+    struct Node {
+        int use;                        // instruction reading the defined vreg (or -1)
+        FoldKind fold;                  // how the user consumes the value
+        int children[3];                // instruction folded into each operand (or -1)
+        bool has_addr;                  // the value is the address computation addr
+        Address addr;
+        bool has_mem;                   // (ldi/sti) the memory location accessed is mem
+        Address mem;
+        bool reads_memory;              // the tree contains an ldi
+        std::vector<Operand> leaves;    // locations read by the tree
+
+        Node();
+    };
+
+    X86_64CodeGenCallbacks *m_codegen;
+    LiveVregs m_live_vregs;
+    BasicBlock *m_block;                // block being transformed
+    std::vector<Node> m_nodes;          // one per instruction of m_block
+
+public:
+    X86_64InstructionSelection(ControlFlowGraph *cfg, X86_64CodeGenCallbacks *codegen);
+    virtual ~X86_64InstructionSelection();
+
+    // execute the liveness analysis
+    void execute();
+
+    virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq);
+
+private:
+    // selection
+    void find_uses();
+    void select_tiles();
+    int get_child(unsigned j, const Operand &operand, const std::map<int, unsigned> &last_def);
+    bool can_fold(unsigned i, unsigned j);
+    void fold(unsigned j, unsigned slot, int i, FoldKind kind);
+    void add_leaves(Node &node, const Operand &operand);
+    Address get_operand_address(const Operand &operand, int child);
+    bool is_foldable_load(int i);
+    bool is_rmw_candidate(unsigned k);
+    unsigned get_rmw_slot(unsigned k, const Address &dest);
+
+    // addresses
+    Operand get_location(const Operand &operand);
+    bool same_location(const Operand &a, const Operand &b);
+    bool same_address(const Address &a, const Address &b);
+    bool add_addresses(const Address &a, const Address &b, long sign, Address &result);
+    bool scale_address(const Address &a, long factor, Address &result);
+    bool is_lea_worthwhile(const Address &addr, const Operand &dest);
+    static bool is_valid_address(const Address &addr);
+    static bool is_emittable_address(const Address &addr);
+
+    // emission
+    void emit(unsigned j, InstructionSequence *out);
+    Operand emit_term(const Operand &term, int scratch, InstructionSequence *out);
+    Operand emit_address(const Address &addr, InstructionSequence *out);
+    Operand emit_source(unsigned j, unsigned slot, int scratch, InstructionSequence *out);
+    void emit_move(const Operand &src, const Operand &dest, InstructionSequence *out);
+    void emit_materialize(const Address &addr, const Operand &dest, InstructionSequence *out);
+    void emit_division_by_constant(Instruction *ins, InstructionSequence *out);
+};
+
+#endif // ISEL_H
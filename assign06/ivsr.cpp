@@ -0,0 +1,353 @@
+#include <cassert>
+#include <climits>
+#include "cfg.h"
+#include "highlevel.h"
+#include "ivsr.h"
+
+InductionVariableStrengthReduction::InductionVariableStrengthReduction(ControlFlowGraph *cfg)
+        : LoopTransform(cfg)
+        , m_live_vregs(cfg)
+        , m_next_vreg(0) {
+}
+
+InductionVariableStrengthReduction::~InductionVariableStrengthReduction() {
+    for (auto i = m_replaced.begin(); i != m_replaced.end(); i++) {
+        delete i->second;
+    }
+    for (auto i = m_increments.begin(); i != m_increments.end(); i++) {
+        for (auto j = i->second.begin(); j != i->second.end(); j++) {
+            delete *j;
+        }
+    }
+}
+
+void InductionVariableStrengthReduction::execute() {
+    ControlFlowGraph *cfg = get_orig_cfg();
+    m_live_vregs.execute();
+
+    // new vregs are numbered after the existing ones
+    m_next_vreg = int(HighLevel::get_num_vregs(cfg));
+
+    // a vreg defined in a loop is also defined in the loops enclosing it
+    m_loop_defs.assign(m_loops->get_num_loops(), std::map<int, std::vector<Instruction *> >());
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *bb = *i;
+        NaturalLoop *innermost = m_loops->get_innermost_loop(bb);
+        Instruction *prev = nullptr;
+        for (auto j = bb->cbegin(); j != bb->cend() && innermost != nullptr; prev = *j, j++) {
+            Instruction *ins = *j;
+            if (!HighLevel::is_def(ins) || ins->get_operand(0).get_kind() != OPERAND_VREG) {
+                continue;
+            }
+            int vreg = ins->get_operand(0).get_base_reg();
+            for (NaturalLoop *loop = innermost; loop != nullptr; loop = loop->parent) {
+                m_loop_defs[loop->index][vreg].push_back(ins);
+            }
+
+            // an assignment i := i + s is an addi to a temporary, then a
+            // mov to i (the temporary not being used again)
+            Operand src = (ins->get_opcode() == HINS_MOV) ? ins->get_operand(1) : Operand();
+            if (src.get_kind() == OPERAND_VREG && prev != nullptr && HighLevel::is_def(prev) &&
+                prev->get_operand(0).get_kind() == OPERAND_VREG && prev->get_operand(0).get_base_reg() == src.get_base_reg() &&
+                !m_live_vregs.get_fact_after_instruction(bb, ins).test(unsigned(src.get_base_reg()))) {
+                m_increment_adds[ins] = prev;
+            }
+        }
+    }
+
+    // reduce the multiplications of induction variables
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        if (m_loops->get_innermost_loop(*i) == nullptr) {
+            continue;
+        }
+        for (auto j = (*i)->cbegin(); j != (*i)->cend(); j++) {
+            Instruction *ins = *j;
+            if (ins->get_opcode() == HINS_INT_MUL && ins->get_operand(0).get_kind() == OPERAND_VREG) {
+                reduce(ins, *i);
+            }
+        }
+    }
+
+    // then remove the counters only needed by the loop test
+    std::set<std::pair<unsigned, int> > counters;
+    for (auto i = m_derived.begin(); i != m_derived.end(); i++) {
+        if (counters.insert(std::make_pair(i->loop->index, i->iv)).second) {
+            remove_counter(i->loop, i->iv);
+        }
+    }
+}
+
+InstructionSequence *InductionVariableStrengthReduction::transform_basic_block(InstructionSequence *iseq) {
+    auto out = new InstructionSequence();
+    for (auto i = iseq->cbegin(); i != iseq->cend(); i++) {
+        Instruction *ins = *i;
+
+        auto r = m_replaced.find(ins);
+        if (r != m_replaced.end()) {
+            out->add_instruction(r->second->duplicate());
+        } else if (m_removed.count(ins) == 0) {
+            out->add_instruction(ins->duplicate());
+        }
+
+        auto inc = m_increments.find(ins);
+        if (inc != m_increments.end()) {
+            for (auto j = inc->second.begin(); j != inc->second.end(); j++) {
+                out->add_instruction((*j)->duplicate());
+            }
+        }
+    }
+
+    keep_nonempty(out, iseq, HINS_NOP);
+
+    return out;
+}
+
+void InductionVariableStrengthReduction::reduce(Instruction *ins, BasicBlock *bb) {
+    // The multiplication is reduced in the innermost loop in which one
+    // operand is a basic induction variable and the other is invariant.
+    // If both are invariant, it may still be reduced in an enclosing loop.
+    Operand a = ins->get_operand(1), b = ins->get_operand(2);
+    for (NaturalLoop *loop = m_loops->get_innermost_loop(bb); loop != nullptr; loop = loop->parent) {
+        bool a_invariant = is_invariant(a, loop), b_invariant = is_invariant(b, loop);
+        if (a_invariant && b_invariant) {
+            continue;
+        }
+
+        long step;
+        int vreg = -1;
+        if (a.get_kind() == OPERAND_VREG && b_invariant && get_increment(loop, a.get_base_reg(), step) != nullptr) {
+            vreg = get_derived_iv(loop, a.get_base_reg(), b);
+        } else if (b.get_kind() == OPERAND_VREG && a_invariant && get_increment(loop, b.get_base_reg(), step) != nullptr) {
+            vreg = get_derived_iv(loop, b.get_base_reg(), a);
+        }
+        if (vreg >= 0) {
+            m_replaced[ins] = new Instruction(HINS_MOV, ins->get_operand(0), Operand(OPERAND_VREG, vreg));
+        }
+        return;
+    }
+}
+
+int InductionVariableStrengthReduction::get_derived_iv(NaturalLoop *loop, int iv, const Operand &factor) {
+    std::vector<long> key;
+    key.push_back(long(loop->index));
+    key.push_back(long(iv));
+    key.push_back(long(factor.get_kind()));
+    key.push_back(factor.get_kind() == OPERAND_INT_LITERAL ? factor.get_int_value() : long(factor.get_base_reg()));
+
+    auto i = m_derived_index.find(key);
+    if (i != m_derived_index.end()) {
+        return m_derived[i->second].vreg;
+    }
+
+    long step;
+    Instruction *increment = get_increment(loop, iv, step);
+    assert(increment != nullptr);
+
+    // the amount added to the derived induction variable on each iteration
+    int vreg = m_next_vreg;
+    Operand dest(OPERAND_VREG, vreg);
+    Instruction *update;
+    if (factor.get_kind() == OPERAND_INT_LITERAL) {
+        long c = factor.get_int_value();
+        if (!fits_immediate(c) || !fits_immediate(step) || !fits_immediate(c * step)) {
+            return -1;
+        }
+        update = new Instruction(HINS_INT_ADD, dest, dest, Operand(OPERAND_INT_LITERAL, c * step));
+    } else if (step == 1) {
+        update = new Instruction(HINS_INT_ADD, dest, dest, factor);
+    } else if (step == -1) {
+        update = new Instruction(HINS_INT_SUB, dest, dest, factor);
+    } else {
+        if (!fits_immediate(step)) {
+            return -1;
+        }
+        Operand scaled_step(OPERAND_VREG, vreg + 1);
+        add_to_preheader(loop, new Instruction(HINS_INT_MUL, scaled_step, factor, Operand(OPERAND_INT_LITERAL, step)));
+        update = new Instruction(HINS_INT_ADD, dest, dest, scaled_step);
+        m_next_vreg++;
+    }
+    m_next_vreg++;
+
+    add_to_preheader(loop, new Instruction(HINS_INT_MUL, dest, Operand(OPERAND_VREG, iv), factor));
+    m_increments[increment].push_back(update);
+
+    DerivedInductionVariable derived = { loop, iv, factor, vreg };
+    m_derived_index[key] = unsigned(m_derived.size());
+    m_derived.push_back(derived);
+    return vreg;
+}
+
+void InductionVariableStrengthReduction::remove_counter(NaturalLoop *loop, int iv) {
+    ControlFlowGraph *cfg = get_orig_cfg();
+
+    // the counter must only be scaled by this loop's derived induction
+    // variables (not those of a loop nested in it, or enclosing it), one
+    // of which must have a positive constant factor
+    const DerivedInductionVariable *scaled = nullptr;
+    for (auto i = m_derived.begin(); i != m_derived.end(); i++) {
+        bool uses_iv = i->iv == iv || (i->factor.get_kind() == OPERAND_VREG && i->factor.get_base_reg() == iv);
+        if (!uses_iv) {
+            continue;
+        }
+        if (i->loop != loop) {
+            if (is_nested(i->loop, loop) || is_nested(loop, i->loop)) {
+                return;
+            }
+            continue;
+        }
+        if (scaled == nullptr && i->factor.get_kind() == OPERAND_INT_LITERAL && i->factor.get_int_value() > 0) {
+            scaled = &*i;
+        }
+    }
+    if (scaled == nullptr) {
+        return;
+    }
+    long c = scaled->factor.get_int_value();
+
+    long step;
+    Instruction *increment = get_increment(loop, iv, step);
+    auto j = m_increment_adds.find(increment);
+    Instruction *add = (j != m_increment_adds.end()) ? j->second : nullptr;
+
+    // the counter can't be live when the loop exits, and its only other
+    // uses must be comparisons with a loop-invariant bound
+    std::vector<Instruction *> compares;
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *bb = *i;
+        if (!loop->contains(bb)) {
+            continue;
+        }
+
+        const ControlFlowGraph::EdgeList &outgoing = cfg->get_outgoing_edges(bb);
+        for (auto j = outgoing.cbegin(); j != outgoing.cend(); j++) {
+            BasicBlock *target = (*j)->get_target();
+            if (!loop->contains(target) && m_live_vregs.get_fact_at_beginning_of_block(target).test(unsigned(iv))) {
+                return;
+            }
+        }
+
+        for (auto j = bb->cbegin(); j != bb->cend(); j++) {
+            Instruction *ins = *j;
+            if (ins == increment || ins == add || m_replaced.count(ins) > 0) {
+                continue;
+            }
+
+            unsigned num_uses = 0;
+            for (unsigned s = 0; s < ins->get_num_operands(); s++) {
+                if (!HighLevel::is_use(ins, s)) {
+                    continue;
+                }
+                Operand operand = ins->get_operand(s);
+                if (operand.get_base_reg() == iv || (operand.has_index_reg() && operand.get_index_reg() == iv)) {
+                    num_uses++;
+                }
+            }
+            if (num_uses == 0) {
+                continue;
+            }
+
+            if (ins->get_opcode() != HINS_INT_COMPARE || num_uses != 1) {
+                return;
+            }
+            unsigned bound = (ins->get_operand(0).get_kind() == OPERAND_VREG && ins->get_operand(0).get_base_reg() == iv) ? 1 : 0;
+            Operand operand = ins->get_operand(bound);
+            if (!is_invariant(operand, loop) ||
+                (operand.get_kind() == OPERAND_INT_LITERAL && !fits_immediate(operand.get_int_value() * c))) {
+                return;
+            }
+            compares.push_back(ins);
+        }
+    }
+
+    // compare the derived induction variable with the scaled bound instead
+    for (auto i = compares.begin(); i != compares.end(); i++) {
+        Instruction *compare = (*i)->duplicate();
+        for (unsigned s = 0; s < 2; s++) {
+            Operand operand = compare->get_operand(s);
+            if (operand.get_kind() == OPERAND_VREG && operand.get_base_reg() == iv) {
+                (*compare)[s] = Operand(OPERAND_VREG, scaled->vreg);
+            } else if (operand.get_kind() == OPERAND_INT_LITERAL) {
+                (*compare)[s] = Operand(OPERAND_INT_LITERAL, operand.get_int_value() * c);
+            } else {
+                Operand bound(OPERAND_VREG, m_next_vreg++);
+                add_to_preheader(loop, new Instruction(HINS_INT_MUL, bound, operand, scaled->factor));
+                (*compare)[s] = bound;
+            }
+        }
+        m_replaced[*i] = compare;
+    }
+    m_removed.insert(increment);
+    if (add != nullptr) {
+        m_removed.insert(add);
+    }
+}
+
+Instruction *InductionVariableStrengthReduction::get_increment(NaturalLoop *loop, int vreg, long &step) const {
+    // the only definition of a basic induction variable in the loop
+    // adds a constant to it
+    auto i = m_loop_defs[loop->index].find(vreg);
+    if (i == m_loop_defs[loop->index].end() || i->second.size() != 1) {
+        return nullptr;
+    }
+
+    Instruction *def = i->second[0];
+    if (def->get_opcode() == HINS_MOV) {
+        auto j = m_increment_adds.find(def);
+        return (j != m_increment_adds.end() && get_step(j->second, vreg, step)) ? def : nullptr;
+    }
+    return get_step(def, vreg, step) ? def : nullptr;
+}
+
+bool InductionVariableStrengthReduction::get_step(Instruction *ins, int vreg, long &step) {
+    // does the instruction add a constant to the vreg?
+    if (ins->get_num_operands() != 3) {
+        return false;
+    }
+    Operand a = ins->get_operand(1), b = ins->get_operand(2);
+    bool a_is_iv = a.get_kind() == OPERAND_VREG && a.get_base_reg() == vreg;
+    bool b_is_iv = b.get_kind() == OPERAND_VREG && b.get_base_reg() == vreg;
+    switch (ins->get_opcode()) {
+        case HINS_INT_ADD:
+            if (a_is_iv && b.get_kind() == OPERAND_INT_LITERAL) {
+                step = b.get_int_value();
+                return true;
+            }
+            if (b_is_iv && a.get_kind() == OPERAND_INT_LITERAL) {
+                step = a.get_int_value();
+                return true;
+            }
+            return false;
+        case HINS_INT_SUB:
+            if (a_is_iv && b.get_kind() == OPERAND_INT_LITERAL) {
+                step = -b.get_int_value();
+                return true;
+            }
+            return false;
+        default:
+            return false;
+    }
+}
+
+bool InductionVariableStrengthReduction::is_invariant(const Operand &operand, NaturalLoop *loop) const {
+    if (operand.get_kind() == OPERAND_INT_LITERAL) {
+        return true;
+    }
+    if (operand.get_kind() != OPERAND_VREG) {
+        return false;
+    }
+    return m_loop_defs[loop->index].count(operand.get_base_reg()) == 0;
+}
+
+bool InductionVariableStrengthReduction::is_nested(NaturalLoop *inner, NaturalLoop *outer) {
+    for (NaturalLoop *loop = inner->parent; loop != nullptr; loop = loop->parent) {
+        if (loop == outer) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool InductionVariableStrengthReduction::fits_immediate(long value) {
+    // x86-64 instructions (other than movabsq) take at most a 32 bit immediate
+    return value >= INT_MIN && value <= INT_MAX;
+}
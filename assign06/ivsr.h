@@ -0,0 +1,73 @@
+#ifndef IVSR_H
+#define IVSR_H
+
+#include <vector>
+#include <map>
+#include <set>
+#include "cfg.h"
+#include "loops.h"
+#include "live_vregs.h"
+#include "licm.h"
+
+// Strength reduction of induction variables in loops of high-level code.
+//
+// A basic induction variable of a loop is a vreg whose only definition
+// in the loop adds a constant to it (addi i, i, $s or subi i, i, $s, or
+// a mov to i from a temporary which was just set to i plus a constant).  A
+// multiplication of a basic induction variable by a loop-invariant factor
+// (such as the i * element_size of an array element address) is a
+// derived induction variable: instead of multiplying on every iteration,
+// a new vreg is set to i * factor in the loop's preheader, and the
+// product of the step and the factor is added to it after each increment
+// of i.  The multiplication is replaced by a move from the new vreg,
+// which later passes propagate.
+//
+// If the only other uses of a basic induction variable in the loop are
+// comparisons with a loop-invariant bound (the loop test), and it isn't
+// live when the loop exits, the comparisons are rewritten in terms of a
+// derived induction variable with a positive constant factor (linear
+// function test replacement), and the counter is removed.  Like a C
+// compiler relying on signed overflow being undefined, this assumes
+// that the scaled counter and bound don't overflow.
+//
+// Call execute() to find the induction variables, then transform_cfg().
+class InductionVariableStrengthReduction : public LoopTransform {
+private:
+    // vreg holding factor times a basic induction variable
+    struct DerivedInductionVariable {
+        NaturalLoop *loop;
+        int iv;                 // the basic induction variable
+        Operand factor;         // literal, or loop-invariant vreg
+        int vreg;
+    };
+
+    LiveVregs m_live_vregs;
+    std::vector<std::map<int, std::vector<Instruction *> > > m_loop_defs; // defs of each vreg in each loop
+    std::vector<DerivedInductionVariable> m_derived;
+    std::map<std::vector<long>, unsigned> m_derived_index;  // (loop, iv, factor) -> derived IV
+    std::map<Instruction *, Instruction *> m_increment_adds; // addi to the temporary moved to a basic IV
+    std::map<Instruction *, Instruction *> m_replaced;      // replacement for each reduced instruction
+    std::map<Instruction *, std::vector<Instruction *> > m_increments; // added after each basic IV increment
+    std::set<Instruction *> m_removed;                      // increments of removed counters
+    int m_next_vreg;
+
+public:
+    InductionVariableStrengthReduction(ControlFlowGraph *cfg);
+    virtual ~InductionVariableStrengthReduction();
+
+    void execute();
+
+    virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq);
+
+private:
+    void reduce(Instruction *ins, BasicBlock *bb);
+    int get_derived_iv(NaturalLoop *loop, int iv, const Operand &factor);
+    void remove_counter(NaturalLoop *loop, int iv);
+    Instruction *get_increment(NaturalLoop *loop, int vreg, long &step) const;
+    bool is_invariant(const Operand &operand, NaturalLoop *loop) const;
+    static bool get_step(Instruction *ins, int vreg, long &step);
+    static bool is_nested(NaturalLoop *inner, NaturalLoop *outer);
+    static bool fits_immediate(long value);
+};
+
+#endif // IVSR_H
@@ -0,0 +1,371 @@
+#include <cassert>
+#include <map>
+#include "cfg.h"
+#include "highlevel.h"
+#include "licm.h"
+
+////////////////////////////////////////////////////////////////////////
+// LoopTransform implementation
+////////////////////////////////////////////////////////////////////////
+
+LoopTransform::LoopTransform(ControlFlowGraph *cfg)
+        : ControlFlowGraphTransform(cfg)
+        , m_loops(&cfg->get_loop_forest()) {
+    m_preheader_code.assign(m_loops->get_num_loops(), std::vector<Instruction *>());
+}
+
+LoopTransform::~LoopTransform() {
+    for (auto i = m_preheader_code.begin(); i != m_preheader_code.end(); i++) {
+        for (auto j = i->begin(); j != i->end(); j++) {
+            delete *j;
+        }
+    }
+}
+
+ControlFlowGraph *LoopTransform::transform_cfg() {
+    ControlFlowGraph *cfg = get_orig_cfg();
+    ControlFlowGraph *result = new ControlFlowGraph();
+
+    // transform the blocks first, since that may add preheader code
+    std::vector<InstructionSequence *> transformed;
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        transformed.push_back(transform_basic_block(*i));
+    }
+
+    // find the existing preheaders of the loops with preheader code
+    std::map<BasicBlock *, NaturalLoop *> preheader_loops;
+    std::vector<bool> needs_preheader(m_loops->get_num_loops(), false);
+    for (unsigned i = 0; i < m_loops->get_num_loops(); i++) {
+        if (m_preheader_code[i].empty()) {
+            continue;
+        }
+        BasicBlock *preheader = find_preheader(m_loops->get_loop(i));
+        if (preheader != nullptr) {
+            preheader_loops[preheader] = m_loops->get_loop(i);
+        } else {
+            needs_preheader[i] = true;
+        }
+    }
+
+    // copy the blocks, adding the code to the existing preheaders
+    // (before the jump to the header, if there is one)
+    std::map<BasicBlock *, BasicBlock *> block_map;
+    unsigned k = 0;
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++, k++) {
+        BasicBlock *orig = *i;
+        InstructionSequence *result_iseq = transformed[k];
+        BasicBlock *result_bb = result->create_basic_block(orig->get_kind(), orig->get_label());
+        block_map[orig] = result_bb;
+
+        auto p = preheader_loops.find(orig);
+        Instruction *jump = nullptr;
+        for (auto j = result_iseq->cbegin(); j != result_iseq->cend(); j++) {
+            if (p != preheader_loops.end() && j + 1 == result_iseq->cend() && (*j)->get_opcode() == HINS_JUMP) {
+                jump = *j;
+                break;
+            }
+            result_bb->add_instruction((*j)->duplicate());
+        }
+        if (p != preheader_loops.end()) {
+            const std::vector<Instruction *> &code = m_preheader_code[p->second->index];
+            for (auto j = code.begin(); j != code.end(); j++) {
+                result_bb->add_instruction((*j)->duplicate());
+            }
+        }
+        if (jump != nullptr) {
+            result_bb->add_instruction(jump->duplicate());
+        }
+        delete result_iseq;
+    }
+
+    // Create the other preheaders.  If the loop is entered by falling
+    // through into the header, the preheader takes the place of the
+    // header; otherwise it jumps to the header.
+    std::vector<BasicBlock *> preheaders(m_loops->get_num_loops(), nullptr);
+    for (unsigned i = 0; i < m_loops->get_num_loops(); i++) {
+        if (!needs_preheader[i]) {
+            continue;
+        }
+        NaturalLoop *loop = m_loops->get_loop(i);
+        BasicBlock *header = loop->header;
+
+        bool entered_by_branch = false, entered_by_fallthrough = false;
+        const ControlFlowGraph::EdgeList &incoming = cfg->get_incoming_edges(header);
+        for (auto j = incoming.cbegin(); j != incoming.cend(); j++) {
+            if (!loop->contains((*j)->get_source())) {
+                if ((*j)->get_kind() == EDGE_BRANCH) {
+                    entered_by_branch = true;
+                } else {
+                    entered_by_fallthrough = true;
+                }
+            }
+        }
+
+        // a header reached by a branch is labeled
+        assert(header->has_label() || (!entered_by_branch && entered_by_fallthrough));
+        std::string label = entered_by_branch ? header->get_label() + "_pre" : "";
+        BasicBlock *preheader = result->create_basic_block(BASICBLOCK_INTERIOR, label);
+        for (auto j = m_preheader_code[i].begin(); j != m_preheader_code[i].end(); j++) {
+            preheader->add_instruction((*j)->duplicate());
+        }
+
+        if (entered_by_fallthrough) {
+            result->create_edge(preheader, block_map[header], EDGE_FALLTHROUGH);
+        } else {
+            preheader->add_instruction(new Instruction(HINS_JUMP, Operand(header->get_label())));
+            result->create_edge(preheader, block_map[header], EDGE_BRANCH);
+        }
+        preheaders[i] = preheader;
+    }
+
+    // copy the edges, redirecting the ones entering a loop to its new preheader
+    std::map<BasicBlock *, NaturalLoop *> headers;
+    for (unsigned i = 0; i < m_loops->get_num_loops(); i++) {
+        headers[m_loops->get_loop(i)->header] = m_loops->get_loop(i);
+    }
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        const ControlFlowGraph::EdgeList &outgoing = cfg->get_outgoing_edges(*i);
+        for (auto j = outgoing.cbegin(); j != outgoing.cend(); j++) {
+            Edge *e = *j;
+            BasicBlock *source = block_map[e->get_source()];
+            BasicBlock *target = block_map[e->get_target()];
+
+            auto h = headers.find(e->get_target());
+            if (h != headers.end() && preheaders[h->second->index] != nullptr &&
+                !h->second->contains(e->get_source())) {
+                target = preheaders[h->second->index];
+                if (e->get_kind() == EDGE_BRANCH) {
+                    Instruction *branch = source->get_last();
+                    (*branch)[0] = Operand(target->get_label());
+                }
+            }
+
+            result->create_edge(source, target, e->get_kind());
+        }
+    }
+
+    return result;
+}
+
+void LoopTransform::add_to_preheader(NaturalLoop *loop, Instruction *ins) {
+    m_preheader_code.at(loop->index).push_back(ins);
+}
+
+BasicBlock *LoopTransform::find_preheader(NaturalLoop *loop) {
+    // the only block outside the loop from which the header is
+    // entered, if the header is its only successor
+    ControlFlowGraph *cfg = get_orig_cfg();
+    BasicBlock *preheader = nullptr;
+    const ControlFlowGraph::EdgeList &incoming = cfg->get_incoming_edges(loop->header);
+    for (auto i = incoming.cbegin(); i != incoming.cend(); i++) {
+        BasicBlock *source = (*i)->get_source();
+        if (loop->contains(source)) {
+            continue;
+        }
+        if (preheader != nullptr) {
+            return nullptr;
+        }
+        preheader = source;
+    }
+
+    if (preheader == nullptr || preheader->get_kind() != BASICBLOCK_INTERIOR ||
+        cfg->get_outgoing_edges(preheader).size() != 1) {
+        return nullptr;
+    }
+    return preheader;
+}
+
+////////////////////////////////////////////////////////////////////////
+// LoopInvariantCodeMotion implementation
+////////////////////////////////////////////////////////////////////////
+
+LoopInvariantCodeMotion::LoopInvariantCodeMotion(ControlFlowGraph *cfg)
+        : LoopTransform(cfg)
+        , m_live_vregs(cfg)
+        , m_next_vreg(0) {
+}
+
+LoopInvariantCodeMotion::~LoopInvariantCodeMotion() {
+}
+
+void LoopInvariantCodeMotion::execute() {
+    ControlFlowGraph *cfg = get_orig_cfg();
+    m_live_vregs.execute();
+
+    // new vregs are numbered after the existing ones
+    unsigned num_vregs = HighLevel::get_num_vregs(cfg);
+    m_next_vreg = int(num_vregs);
+
+    // a vreg defined in a loop is also defined in the loops enclosing it
+    const unsigned num_loops = m_loops->get_num_loops();
+    m_loop_defs.assign(num_loops, BitVector(num_vregs));
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *bb = *i;
+        NaturalLoop *innermost = m_loops->get_innermost_loop(bb);
+        if (innermost == nullptr) {
+            continue;
+        }
+        for (auto j = bb->cbegin(); j != bb->cend(); j++) {
+            if (HighLevel::is_def(*j)) {
+                int vreg = (*j)->get_operand(0).get_base_reg();
+                for (NaturalLoop *loop = innermost; loop != nullptr; loop = loop->parent) {
+                    m_loop_defs[loop->index].set(unsigned(vreg));
+                }
+            }
+        }
+    }
+}
+
+InstructionSequence *LoopInvariantCodeMotion::transform_basic_block(InstructionSequence *iseq) {
+    BasicBlock *bb = static_cast<BasicBlock *>(iseq);
+    auto out = new InstructionSequence();
+
+    // vregs replaced by hoisted vregs, until they're redefined
+    std::map<int, int> renamed;
+
+    for (unsigned k = 0; k < bb->get_length(); k++) {
+        Instruction *ins = bb->get_instruction(k)->duplicate();
+        rename_uses(ins, renamed);
+
+        if (HighLevel::is_def(ins)) {
+            int vreg = ins->get_operand(0).get_base_reg();
+            renamed.erase(vreg);
+
+            NaturalLoop *loop = get_target_loop(ins, bb);
+            if (loop != nullptr && has_local_uses_only(bb, k)) {
+                renamed[vreg] = hoist(ins, loop);
+                delete ins;
+                continue;
+            }
+        }
+
+        out->add_instruction(ins);
+    }
+
+    keep_nonempty(out, bb, HINS_NOP);
+
+    return out;
+}
+
+NaturalLoop *LoopInvariantCodeMotion::get_target_loop(Instruction *ins, BasicBlock *bb) {
+    // the outermost loop containing the block in which the
+    // instruction's operands are invariant
+    if (!is_hoistable(ins)) {
+        return nullptr;
+    }
+
+    std::vector<NaturalLoop *> enclosing;
+    for (NaturalLoop *loop = m_loops->get_innermost_loop(bb); loop != nullptr; loop = loop->parent) {
+        enclosing.push_back(loop);
+    }
+
+    for (auto i = enclosing.rbegin(); i != enclosing.rend(); i++) {
+        bool invariant = true;
+        for (unsigned s = 1; s < ins->get_num_operands() && invariant; s++) {
+            invariant = is_invariant(ins->get_operand(s), *i);
+        }
+        if (invariant) {
+            return *i;
+        }
+    }
+    return nullptr;
+}
+
+bool LoopInvariantCodeMotion::is_invariant(const Operand &operand, NaturalLoop *loop) {
+    if (operand.get_kind() == OPERAND_INT_LITERAL) {
+        return true;
+    }
+    if (operand.get_kind() != OPERAND_VREG) {
+        return false;
+    }
+
+    // a hoisted vreg is defined in the preheader of the loop it was
+    // hoisted out of, so it's invariant in that loop and the loops nested in it
+    int vreg = operand.get_base_reg();
+    auto i = m_vreg_loops.find(vreg);
+    if (i != m_vreg_loops.end()) {
+        for (NaturalLoop *l = loop; l != nullptr; l = l->parent) {
+            if (l == i->second) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    return !m_loop_defs[loop->index].test(unsigned(vreg));
+}
+
+bool LoopInvariantCodeMotion::has_local_uses_only(BasicBlock *bb, unsigned k) {
+    // the definition at k can only be used in the block if the vreg is
+    // redefined later in the block, or isn't live at the end of the block
+    int vreg = bb->get_instruction(k)->get_operand(0).get_base_reg();
+    for (unsigned j = k + 1; j < bb->get_length(); j++) {
+        Instruction *ins = bb->get_instruction(j);
+        if (HighLevel::is_def(ins) && ins->get_operand(0).get_base_reg() == vreg) {
+            return true;
+        }
+    }
+    return !m_live_vregs.get_fact_at_end_of_block(bb).test(unsigned(vreg));
+}
+
+int LoopInvariantCodeMotion::hoist(Instruction *ins, NaturalLoop *loop) {
+    // identical instructions hoisted to the same preheader define the same vreg
+    std::vector<long> key;
+    key.push_back(long(loop->index));
+    key.push_back(long(ins->get_opcode()));
+    for (unsigned s = 1; s < ins->get_num_operands(); s++) {
+        Operand operand = ins->get_operand(s);
+        key.push_back(long(operand.get_kind()));
+        key.push_back(operand.get_kind() == OPERAND_INT_LITERAL ? operand.get_int_value() : long(operand.get_base_reg()));
+    }
+
+    auto i = m_hoisted_vregs.find(key);
+    if (i != m_hoisted_vregs.end()) {
+        return i->second;
+    }
+
+    int vreg = m_next_vreg++;
+    Instruction *hoisted = ins->duplicate();
+    (*hoisted)[0] = Operand(OPERAND_VREG, vreg);
+    add_to_preheader(loop, hoisted);
+    m_hoisted_vregs[key] = vreg;
+    m_vreg_loops[vreg] = loop;
+    return vreg;
+}
+
+void LoopInvariantCodeMotion::rename_uses(Instruction *ins, const std::map<int, int> &renamed) {
+    for (unsigned s = 0; s < ins->get_num_operands(); s++) {
+        if (!HighLevel::is_use(ins, s)) {
+            continue;
+        }
+        Operand operand = ins->get_operand(s);
+        auto i = renamed.find(operand.get_base_reg());
+        if (i != renamed.end()) {
+            operand.set_base_reg(i->second);
+            operand.set_is_scalar(false);
+        }
+        if (operand.has_index_reg()) {
+            auto j = renamed.find(operand.get_index_reg());
+            if (j != renamed.end()) {
+                operand.set_index_reg(j->second);
+                operand.set_index_is_scalar(false);
+            }
+        }
+        (*ins)[s] = operand;
+    }
+}
+
+bool LoopInvariantCodeMotion::is_hoistable(Instruction *ins) {
+    // these can't trap, and have no side effects
+    switch (ins->get_opcode()) {
+        case HINS_LOCALADDR:
+        case HINS_GLOBALADDR:
+        case HINS_LOAD_ICONST:
+        case HINS_INT_ADD:
+        case HINS_INT_SUB:
+        case HINS_INT_MUL:
+            return ins->get_operand(0).get_kind() == OPERAND_VREG;
+        default:
+            return false;
+    }
+}
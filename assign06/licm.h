@@ -0,0 +1,83 @@
+#ifndef LICM_H
+#define LICM_H
+
+#include <vector>
+#include <map>
+#include "cfg.h"
+#include "cfg_transform.h"
+#include "loops.h"
+#include "live_vregs.h"
+
+// Base class for transforms of high-level code which add instructions
+// to the preheaders of loops.  Instructions passed to add_to_preheader()
+// (by execute() or transform_basic_block()) are placed by transform_cfg():
+// at the end of the loop's preheader, if it already has one (a block
+// whose only successor is the header, through which every path into
+// the loop passes), and otherwise in a preheader which is created in
+// front of the loop header, with every edge entering the loop from
+// outside redirected to it.
+class LoopTransform : public ControlFlowGraphTransform {
+private:
+    std::vector<std::vector<Instruction *> > m_preheader_code; // instructions added to each preheader
+
+protected:
+    const LoopForest *m_loops;
+
+public:
+    LoopTransform(ControlFlowGraph *cfg);
+    virtual ~LoopTransform();
+
+    virtual ControlFlowGraph *transform_cfg();
+
+protected:
+    // add an instruction (which the preheader takes ownership of)
+    void add_to_preheader(NaturalLoop *loop, Instruction *ins);
+
+private:
+    BasicBlock *find_preheader(NaturalLoop *loop);
+};
+
+// Loop-invariant code motion for high-level code.
+//
+// localaddr, ldci, and the address arithmetic (addi, subi, muli) whose
+// operands don't change in a loop are moved to the loop's preheader.
+// Instructions are hoisted out of the outermost loop in which they're
+// invariant, and identical instructions hoisted to the same preheader
+// are only computed once.
+//
+// Temporary vregs are reused by every statement, so the vreg defined by
+// a hoisted instruction is replaced by a new vreg.  This is only done if
+// all of the uses of the definition are in the same block, which is the
+// case for the temporaries of a statement.  None of the hoisted
+// instructions can trap, so they can be executed even if the loop body
+// isn't.
+//
+// Call execute() to find the loops and compute the liveness information
+// the transformation needs, then transform_cfg().
+class LoopInvariantCodeMotion : public LoopTransform {
+private:
+    LiveVregs m_live_vregs;
+    std::vector<BitVector> m_loop_defs;             // vregs defined in each loop
+    std::map<std::vector<long>, int> m_hoisted_vregs; // (loop, instruction) -> vreg defined in the preheader
+    std::map<int, NaturalLoop *> m_vreg_loops;      // loop out of which each new vreg was hoisted
+    int m_next_vreg;
+
+public:
+    LoopInvariantCodeMotion(ControlFlowGraph *cfg);
+    virtual ~LoopInvariantCodeMotion();
+
+    // find the loops, and execute the liveness analysis
+    void execute();
+
+    virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq);
+
+private:
+    NaturalLoop *get_target_loop(Instruction *ins, BasicBlock *bb);
+    bool is_invariant(const Operand &operand, NaturalLoop *loop);
+    bool has_local_uses_only(BasicBlock *bb, unsigned k);
+    int hoist(Instruction *ins, NaturalLoop *loop);
+    static void rename_uses(Instruction *ins, const std::map<int, int> &renamed);
+    static bool is_hoistable(Instruction *ins);
+};
+
+#endif // LICM_H
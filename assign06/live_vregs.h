@@ -1,55 +1,50 @@
 #ifndef LIVE_VREGS_H
 #define LIVE_VREGS_H
 
-#include <bitset>
 #include <vector>
 #include "cfg.h"
+#include "bitvector.h"
 #include "highlevel.h"
+#include "dataflow.h"
 
-class LiveVregs {
-public:
-    // we assume that there are never more than this many vregs used
-    static const unsigned MAX_VREGS = 256;
-
-    // We use a bitset to represent the set of live vregs.
-    // To check whether a vreg is live, check the bit indexed by
-    // its register number.
-    typedef std::bitset<MAX_VREGS> LiveSet;
-
-    // we assume there are never more than this many basic blocks
-    static const unsigned MAX_BLOCKS = 1024;
-
+// Liveness of vregs, as a backward dataflow problem: a vreg is live
+// at a point if its value may be used before it is redefined.
+class LiveVregsAnalysis {
 private:
-    // the control flow graph
-    ControlFlowGraph *m_cfg;
-    // live vregs at end and beginning of each basic block
-    std::vector<LiveSet> m_endfacts, m_beginfacts;
-    // block iteration order
-    std::vector<unsigned> m_iter_order;
+    unsigned m_num_vregs;
 
 public:
-    LiveVregs(ControlFlowGraph *cfg);
-    ~LiveVregs();
+    // We use a BitVector (with one element per vreg) to represent
+    // the set of live vregs.  To check whether a vreg is live, check
+    // the bit indexed by its register number.
+    typedef BitVector FactType;
 
-    // execute the analysis
-    void execute();
+    LiveVregsAnalysis(unsigned num_vregs) : m_num_vregs(num_vregs) { }
 
-    // get live vregs at end of specified block
-    const LiveSet &get_fact_at_end_of_block(BasicBlock *bb) const;
+    static const DataflowDirection DIRECTION = DATAFLOW_BACKWARD;
 
-    // get live vregs at beginning of specific block
-    const LiveSet &get_fact_at_beginning_of_block(BasicBlock *bb) const;
+    // no vregs are live until a use is found, or after the exit block
+    FactType get_top_fact() const { return FactType(m_num_vregs); }
+    FactType get_boundary_fact() const { return FactType(m_num_vregs); }
 
-    // get live vregs after specified instruction
-    LiveSet get_fact_after_instruction(BasicBlock *bb, Instruction *ins) const;
+    // a vreg live at the beginning of any successor is live
+    void combine_facts(FactType &fact, const FactType &other) const { fact |= other; }
 
-    // get live vregs before specified instruction
-    LiveSet get_fact_before_instruction(BasicBlock *bb, Instruction *ins) const;
+    // model the effect of an instruction (backwards) on a set of live vregs
+    void model_instruction(Instruction *ins, FactType &fact) const;
+};
 
-private:
-    void compute_iter_order();
-    void postorder_on_rcfg(std::bitset<MAX_BLOCKS> &visited, BasicBlock *bb);
-    void model_instruction(Instruction *ins, LiveSet &fact) const;
+class LiveVregs : public Dataflow<LiveVregsAnalysis> {
+public:
+    typedef LiveVregsAnalysis::FactType LiveSet;
+
+    LiveVregs(ControlFlowGraph *cfg);
+    virtual ~LiveVregs();
+
+    // model the effect of an instruction (backwards) on a set of live vregs
+    void model_instruction(Instruction *ins, LiveSet &fact) const {
+        get_analysis().model_instruction(ins, fact);
+    }
 };
 
 class LiveVregsControlFlowGraphPrinter : public HighLevelControlFlowGraphPrinter {
@@ -0,0 +1,279 @@
+#include <cassert>
+#include <algorithm>
+#include <map>
+#include <utility>
+#include "loops.h"
+
+////////////////////////////////////////////////////////////////////////
+// DominatorTree implementation
+////////////////////////////////////////////////////////////////////////
+
+DominatorTree::DominatorTree(ControlFlowGraph *cfg)
+        : m_cfg(cfg) {
+}
+
+DominatorTree::~DominatorTree() {
+}
+
+void DominatorTree::execute() {
+    compute_reverse_postorder();
+
+    const unsigned num_blocks = m_cfg->get_num_blocks();
+    m_idom.assign(num_blocks, -1);
+
+    unsigned entry = m_cfg->get_entry_block()->get_id();
+    m_idom[entry] = int(entry);
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto i = m_rpo.begin(); i != m_rpo.end(); i++) {
+            if (*i == entry) {
+                continue;
+            }
+
+            // the immediate dominator is the closest common dominator
+            // of the predecessors processed so far
+            BasicBlock *bb = m_cfg->get_block(*i);
+            int new_idom = -1;
+            const ControlFlowGraph::EdgeList &incoming = m_cfg->get_incoming_edges(bb);
+            for (auto j = incoming.cbegin(); j != incoming.cend(); j++) {
+                unsigned pred = (*j)->get_source()->get_id();
+                if (m_idom[pred] < 0) {
+                    continue;
+                }
+                new_idom = (new_idom < 0) ? int(pred) : int(intersect(pred, unsigned(new_idom)));
+            }
+
+            if (m_idom[*i] != new_idom) {
+                m_idom[*i] = new_idom;
+                changed = true;
+            }
+        }
+    }
+
+    m_children.assign(num_blocks, ControlFlowGraph::BlockList());
+    for (auto i = m_rpo.begin(); i != m_rpo.end(); i++) {
+        BasicBlock *idom = get_immediate_dominator(m_cfg->get_block(*i));
+        if (idom != nullptr) {
+            m_children[idom->get_id()].push_back(m_cfg->get_block(*i));
+        }
+    }
+
+    compute_dominance_frontiers();
+}
+
+bool DominatorTree::is_reachable(BasicBlock *bb) const {
+    return m_rank.at(bb->get_id()) >= 0;
+}
+
+BasicBlock *DominatorTree::get_immediate_dominator(BasicBlock *bb) const {
+    int idom = m_idom.at(bb->get_id());
+    if (idom < 0 || unsigned(idom) == bb->get_id()) {
+        return nullptr;
+    }
+    return m_cfg->get_block(unsigned(idom));
+}
+
+const ControlFlowGraph::BlockList &DominatorTree::get_children(BasicBlock *bb) const {
+    return m_children.at(bb->get_id());
+}
+
+bool DominatorTree::dominates(BasicBlock *a, BasicBlock *b) const {
+    if (!is_reachable(a) || !is_reachable(b)) {
+        return false;
+    }
+
+    // walk up the dominator tree from b: blocks closer to the
+    // entry block come earlier in reverse postorder
+    unsigned id = b->get_id();
+    while (m_rank[id] > m_rank[a->get_id()]) {
+        id = unsigned(m_idom[id]);
+    }
+    return id == a->get_id();
+}
+
+const BitVector &DominatorTree::get_dominance_frontier(BasicBlock *bb) const {
+    return m_frontiers.at(bb->get_id());
+}
+
+void DominatorTree::compute_reverse_postorder() {
+    // iterative depth-first search from the entry block
+    const unsigned num_blocks = m_cfg->get_num_blocks();
+    std::vector<bool> visited(num_blocks, false);
+    m_rpo.clear();
+
+    // stack of (block, index of next successor to visit)
+    std::vector<std::pair<BasicBlock *, unsigned> > stack;
+    BasicBlock *entry = m_cfg->get_entry_block();
+    visited[entry->get_id()] = true;
+    stack.push_back(std::make_pair(entry, 0U));
+
+    while (!stack.empty()) {
+        BasicBlock *bb = stack.back().first;
+        const ControlFlowGraph::EdgeList &outgoing = m_cfg->get_outgoing_edges(bb);
+        if (stack.back().second < outgoing.size()) {
+            BasicBlock *next = outgoing[stack.back().second++]->get_target();
+            if (!visited[next->get_id()]) {
+                visited[next->get_id()] = true;
+                stack.push_back(std::make_pair(next, 0U));
+            }
+        } else {
+            m_rpo.push_back(bb->get_id());
+            stack.pop_back();
+        }
+    }
+    std::reverse(m_rpo.begin(), m_rpo.end());
+
+    m_rank.assign(num_blocks, -1);
+    for (unsigned i = 0; i < m_rpo.size(); i++) {
+        m_rank[m_rpo[i]] = int(i);
+    }
+}
+
+void DominatorTree::compute_dominance_frontiers() {
+    const unsigned num_blocks = m_cfg->get_num_blocks();
+    m_frontiers.assign(num_blocks, BitVector(num_blocks));
+
+    // a join point is in the frontier of each block on the paths up
+    // the tree from its predecessors to its immediate dominator
+    for (auto i = m_rpo.begin(); i != m_rpo.end(); i++) {
+        BasicBlock *bb = m_cfg->get_block(*i);
+        const ControlFlowGraph::EdgeList &incoming = m_cfg->get_incoming_edges(bb);
+        if (incoming.size() < 2) {
+            continue;
+        }
+        for (auto j = incoming.cbegin(); j != incoming.cend(); j++) {
+            unsigned runner = (*j)->get_source()->get_id();
+            if (m_rank[runner] < 0) {
+                continue;
+            }
+            while (int(runner) != m_idom[*i]) {
+                m_frontiers[runner].set(*i);
+                runner = unsigned(m_idom[runner]);
+            }
+        }
+    }
+}
+
+unsigned DominatorTree::intersect(unsigned a, unsigned b) const {
+    // walk up from whichever block is later in reverse postorder
+    // until the two paths meet
+    while (a != b) {
+        while (m_rank[a] > m_rank[b]) {
+            a = unsigned(m_idom[a]);
+        }
+        while (m_rank[b] > m_rank[a]) {
+            b = unsigned(m_idom[b]);
+        }
+    }
+    return a;
+}
+
+////////////////////////////////////////////////////////////////////////
+// LoopForest implementation
+////////////////////////////////////////////////////////////////////////
+
+namespace {
+    bool is_larger_loop(const NaturalLoop *a, const NaturalLoop *b) {
+        unsigned na = a->blocks.count(), nb = b->blocks.count();
+        return na != nb ? na > nb : a->header->get_id() < b->header->get_id();
+    }
+}
+
+LoopForest::LoopForest(ControlFlowGraph *cfg)
+        : m_cfg(cfg) {
+}
+
+LoopForest::~LoopForest() {
+    for (auto i = m_loops.begin(); i != m_loops.end(); i++) {
+        delete *i;
+    }
+}
+
+void LoopForest::execute() {
+    const DominatorTree &dominators = m_cfg->get_dominator_tree();
+    const unsigned num_blocks = m_cfg->get_num_blocks();
+
+    // find the blocks of the loop of each back edge, merging
+    // the loops which have the same header
+    std::map<BasicBlock *, NaturalLoop *> loop_map;
+    for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+        const ControlFlowGraph::EdgeList &outgoing = m_cfg->get_outgoing_edges(*i);
+        for (auto j = outgoing.cbegin(); j != outgoing.cend(); j++) {
+            Edge *e = *j;
+            if (!is_back_edge(e)) {
+                continue;
+            }
+
+            BasicBlock *header = e->get_target();
+            NaturalLoop *loop = loop_map[header];
+            if (loop == nullptr) {
+                loop = new NaturalLoop();
+                loop->header = header;
+                loop->blocks = BitVector(num_blocks);
+                loop->blocks.set(header->get_id());
+                loop->parent = nullptr;
+                loop_map[header] = loop;
+            }
+
+            // the blocks reaching the source of the back edge
+            // (without going through the header) are in the loop
+            std::vector<BasicBlock *> work_list;
+            if (!loop->contains(e->get_source())) {
+                loop->blocks.set(e->get_source()->get_id());
+                work_list.push_back(e->get_source());
+            }
+            while (!work_list.empty()) {
+                BasicBlock *bb = work_list.back();
+                work_list.pop_back();
+                const ControlFlowGraph::EdgeList &incoming = m_cfg->get_incoming_edges(bb);
+                for (auto k = incoming.cbegin(); k != incoming.cend(); k++) {
+                    BasicBlock *pred = (*k)->get_source();
+                    if (dominators.is_reachable(pred) && !loop->contains(pred)) {
+                        loop->blocks.set(pred->get_id());
+                        work_list.push_back(pred);
+                    }
+                }
+            }
+        }
+    }
+
+    // an enclosing loop has more blocks than the loops nested in it
+    for (auto i = loop_map.begin(); i != loop_map.end(); i++) {
+        m_loops.push_back(i->second);
+    }
+    std::sort(m_loops.begin(), m_loops.end(), is_larger_loop);
+
+    m_innermost.assign(num_blocks, nullptr);
+    for (unsigned i = 0; i < m_loops.size(); i++) {
+        NaturalLoop *loop = m_loops[i];
+        loop->index = i;
+
+        // the innermost loop containing the header, so far, is the parent
+        loop->parent = m_innermost[loop->header->get_id()];
+        if (loop->parent != nullptr) {
+            loop->parent->children.push_back(loop);
+            loop->depth = loop->parent->depth + 1;
+        } else {
+            m_roots.push_back(loop);
+            loop->depth = 1;
+        }
+        for (unsigned b = loop->blocks.find_first(); b != BitVector::NPOS; b = loop->blocks.find_next(b + 1)) {
+            m_innermost[b] = loop;
+        }
+    }
+}
+
+NaturalLoop *LoopForest::get_innermost_loop(BasicBlock *bb) const {
+    return m_innermost.at(bb->get_id());
+}
+
+unsigned LoopForest::get_loop_depth(BasicBlock *bb) const {
+    NaturalLoop *loop = get_innermost_loop(bb);
+    return loop != nullptr ? loop->depth : 0;
+}
+
+bool LoopForest::is_back_edge(Edge *e) const {
+    return m_cfg->get_dominator_tree().dominates(e->get_target(), e->get_source());
+}
@@ -0,0 +1,112 @@
+#ifndef LOOPS_H
+#define LOOPS_H
+
+#include <vector>
+#include "cfg.h"
+#include "bitvector.h"
+
+// Dominator tree of a CFG, computed using the iterative algorithm of
+// Cooper, Harvey, and Kennedy ("A Simple, Fast Dominance Algorithm"):
+// the immediate dominator of each block is refined, in reverse
+// postorder, until none of them change.  The dominance frontier of
+// each block is computed from the immediate dominators using the
+// algorithm from the same paper.  Blocks which aren't reachable from
+// the entry block have no dominators, and aren't in the tree.
+//
+// The ControlFlowGraph caches its dominator tree: use
+// ControlFlowGraph::get_dominator_tree() rather than creating one.
+class DominatorTree {
+private:
+    ControlFlowGraph *m_cfg;
+    std::vector<int> m_idom;            // immediate dominator of each block (-1 if none)
+    std::vector<unsigned> m_rpo;        // reachable blocks, in reverse postorder
+    std::vector<int> m_rank;            // position of each block in m_rpo (-1 if unreachable)
+    std::vector<ControlFlowGraph::BlockList> m_children;
+    std::vector<BitVector> m_frontiers; // ids of the blocks in each dominance frontier
+
+public:
+    DominatorTree(ControlFlowGraph *cfg);
+    ~DominatorTree();
+
+    // compute the dominator tree and the dominance frontiers
+    void execute();
+
+    bool is_reachable(BasicBlock *bb) const;
+
+    // get the immediate dominator of a block (nullptr for the entry
+    // block and unreachable blocks)
+    BasicBlock *get_immediate_dominator(BasicBlock *bb) const;
+
+    // get the blocks immediately dominated by a block
+    const ControlFlowGraph::BlockList &get_children(BasicBlock *bb) const;
+
+    // does a dominate b?  (every block dominates itself)
+    bool dominates(BasicBlock *a, BasicBlock *b) const;
+
+    // get the ids of the blocks in the dominance frontier of a block
+    // (the blocks with a predecessor dominated by it which aren't
+    // strictly dominated by it)
+    const BitVector &get_dominance_frontier(BasicBlock *bb) const;
+
+    // ids of the reachable blocks, in reverse postorder
+    const std::vector<unsigned> &get_reverse_postorder() const { return m_rpo; }
+
+private:
+    void compute_reverse_postorder();
+    void compute_dominance_frontiers();
+    unsigned intersect(unsigned a, unsigned b) const;
+};
+
+// A natural loop: its header dominates every block in the loop, and
+// the other blocks are those which can reach a back edge to the header
+// without going through the header.  Loops with the same header are
+// merged, so two loops are either disjoint or one is nested in the other
+// (the CFGs of our programs are always reducible).
+struct NaturalLoop {
+    unsigned index;             // position in LoopForest
+    BasicBlock *header;
+    BitVector blocks;           // ids of the blocks in the loop
+    NaturalLoop *parent;        // innermost enclosing loop (nullptr if none)
+    std::vector<NaturalLoop *> children; // loops immediately nested in this one
+    unsigned depth;             // 1 for an outermost loop
+
+    bool contains(BasicBlock *bb) const { return blocks.test(bb->get_id()); }
+};
+
+// The natural loops of a CFG, as a forest in which the parent of each
+// loop is the innermost loop enclosing it.
+//
+// The ControlFlowGraph caches its loop forest: use
+// ControlFlowGraph::get_loop_forest() rather than creating one.
+class LoopForest {
+private:
+    ControlFlowGraph *m_cfg;
+    std::vector<NaturalLoop *> m_loops;     // enclosing loops precede the loops nested in them
+    std::vector<NaturalLoop *> m_roots;     // outermost loops
+    std::vector<NaturalLoop *> m_innermost; // innermost loop containing each block
+
+public:
+    LoopForest(ControlFlowGraph *cfg);
+    ~LoopForest();
+
+    // find the loops (using the CFG's dominator tree)
+    void execute();
+
+    unsigned get_num_loops() const { return unsigned(m_loops.size()); }
+    NaturalLoop *get_loop(unsigned i) const { return m_loops.at(i); }
+
+    // get the loops which aren't nested in another loop
+    const std::vector<NaturalLoop *> &get_outermost_loops() const { return m_roots; }
+
+    // get the innermost loop containing a block (nullptr if the
+    // block isn't in a loop)
+    NaturalLoop *get_innermost_loop(BasicBlock *bb) const;
+
+    // get the number of loops containing a block
+    unsigned get_loop_depth(BasicBlock *bb) const;
+
+    // is the given edge a back edge (i.e., its target dominates its source)?
+    bool is_back_edge(Edge *e) const;
+};
+
+#endif // LOOPS_H
@@ -11,6 +11,7 @@
 extern "C" {
 int yyparse(void);
 void lexer_set_source_file(const char *filename);
+int lexer_map_source_file(const char *filename);
 }
 
 void print_usage(void) {
@@ -22,6 +23,11 @@ void print_usage(void) {
     "   -s    print symbol table information\n"
     "   -h    print high-level instruction translation\n"
     "   -o    perform optimization on emitted assembly\n"
+    "   -O N  optimize at level N (0 = none, 1 = naive register allocation,\n"
+    "         2 = linear-scan register allocation,\n"
+    "         3 = graph-coloring register allocation); -o is -O 3\n"
+    "   -u N  unroll counted loops N times at level 3 (1 = don't)\n"
+    "   -r    report loop unrolling and inlining decisions on stderr\n"
   );
 }
 
@@ -39,9 +45,12 @@ int main(int argc, char **argv) {
   extern struct Node *g_program;
 
   int mode = COMPILE;
+  int opt_level = OPT_LEVEL_MAX;
+  int unroll_factor = 4;
+  bool report_unroll = false;
   int opt;
 
-  while ((opt = getopt(argc, argv, "pgsho")) != -1) {
+  while ((opt = getopt(argc, argv, "pgshoO:u:r")) != -1) {
     switch (opt) {
     case 'p':
       mode = PRINT_AST;
@@ -63,6 +72,25 @@ int main(int argc, char **argv) {
       mode = OPTIMIZE;
       break;
 
+    case 'O':
+      mode = OPTIMIZE;
+      opt_level = atoi(optarg);
+      if (opt_level < OPT_LEVEL_NONE || opt_level > OPT_LEVEL_MAX) {
+        print_usage();
+      }
+      break;
+
+    case 'u':
+      unroll_factor = atoi(optarg);
+      if (unroll_factor < 1) {
+        print_usage();
+      }
+      break;
+
+    case 'r':
+      report_unroll = true;
+      break;
+
     case '?':
       print_usage();
       break;
@@ -79,9 +107,12 @@ int main(int argc, char **argv) {
 
   const char *filename = argv[optind];
 
-  yyin = fopen(filename, "r");
-  if (!yyin) {
-    err_fatal("Could not open input file \"%s\"\n", filename);
+  // the source is scanned in place if it can be mapped into memory
+  if (!lexer_map_source_file(filename)) {
+    yyin = fopen(filename, "r");
+    if (!yyin) {
+      err_fatal("Could not open input file \"%s\"\n", filename);
+    }
   }
   lexer_set_source_file(filename);
 
@@ -98,6 +129,12 @@ int main(int argc, char **argv) {
       context_set_flag(ctx, 'h');
   } else if (mode == OPTIMIZE) {
       context_set_flag(ctx, 'o');
+      context_set_opt_level(ctx, opt_level);
+      context_set_unroll_factor(ctx, unroll_factor);
+      if (report_unroll) {
+        context_set_flag(ctx, 'u');
+        context_set_flag(ctx, 'i');
+      }
       context_set_flag(ctx, 'c');
   } else {
       // mode is only compile
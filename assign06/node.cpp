@@ -1,6 +1,8 @@
 #include <cstdio>
 #include <cstdarg>
 #include <cassert>
+#include <algorithm>
+#include <string>
 #include "util.h"
 /*
 #include "symbol.h"
@@ -16,15 +18,45 @@
 
 Node::Node(int tag)
   : m_tag(tag)
+  , m_num_kids(0)
+  , m_kids_capacity(0)
+  , m_kids(nullptr)
   , m_source_info { .filename = "<unknown file>", .line = -1, .col = -1 }
   , m_ival(0L)
-/*
+  , m_strval("")
   , m_symtab(nullptr)
+  , m_type(nullptr)
+  , m_operand(nullptr)
   , m_index(0)
-*/ {
+  , m_is_const(false)
+  , m_invert(false) {
 }
 
-Node::~Node() {
+Node *Node::create(int tag, unsigned kids_capacity) {
+  Node *n = get_arena().create<Node>(tag);
+  n->reserve_kids(kids_capacity);
+  return n;
+}
+
+Arena &Node::get_arena() {
+  static Arena arena;
+  return arena;
+}
+
+StringPool &Node::get_string_pool() {
+  static StringPool pool;
+  return pool;
+}
+
+void Node::reserve_kids(unsigned capacity) {
+  if (capacity <= m_kids_capacity) {
+    return;
+  }
+  // the old array is left in the arena
+  Node **kids = get_arena().allocate_array<Node *>(capacity);
+  std::copy(m_kids, m_kids + m_num_kids, kids);
+  m_kids = kids;
+  m_kids_capacity = capacity;
 }
 
 int Node::get_tag() const {
@@ -32,11 +64,14 @@ int Node::get_tag() const {
 }
 
 int Node::get_num_kids() const {
-  return int(m_kids.size());
+  return int(m_num_kids);
 }
 
 void Node::add_kid(Node *kid) {
-  m_kids.push_back(kid);
+  if (m_num_kids == m_kids_capacity) {
+    reserve_kids(m_kids_capacity < 2 ? 4 : 2 * m_kids_capacity);
+  }
+  m_kids[m_num_kids++] = kid;
 
   // If the parent node doesn't yet have source info set,
   // and the child has source info, copy the child's source info
@@ -46,7 +81,12 @@ void Node::add_kid(Node *kid) {
 }
 
 void Node::prepend_kid(Node *kid) {
-  m_kids.insert(m_kids.begin(), kid);
+  if (m_num_kids == m_kids_capacity) {
+    reserve_kids(m_kids_capacity < 2 ? 4 : 2 * m_kids_capacity);
+  }
+  std::copy_backward(m_kids, m_kids + m_num_kids, m_kids + m_num_kids + 1);
+  m_kids[0] = kid;
+  m_num_kids++;
 
   // Copy child's source info, if it has valid source info
   if (kid->m_source_info.line > 0) {
@@ -55,15 +95,27 @@ void Node::prepend_kid(Node *kid) {
 }
 
 Node *Node::get_kid(int index) {
-  assert(index >= 0);
-  return m_kids.at(unsigned(index));
+  assert(index >= 0 && unsigned(index) < m_num_kids);
+  return m_kids[index];
+}
+
+void Node::set_str(const char *s) {
+  m_strval = get_string_pool().intern(s);
 }
 
-void Node::set_str(const std::string &s) {
+void Node::set_str(const char *s, size_t len) {
+  m_strval = get_string_pool().intern(s, len);
+}
+
+void Node::set_static_str(const char *s) {
   m_strval = s;
 }
 
-const std::string &Node::get_str() const {
+const char *Node::get_str() const {
+  if (m_strval == nullptr) {
+    // an integer literal's string is only formed when it's needed
+    m_strval = get_string_pool().intern(std::to_string(m_ival).c_str());
+  }
   return m_strval;
 }
 
@@ -126,11 +178,15 @@ Type *Node::get_type() {
 }
 
 void Node::set_operand(Operand &op) {
-    m_operand = op;
+    if (m_operand == nullptr) {
+        m_operand = get_arena().create<Operand>(op);
+    } else {
+        *m_operand = op;
+    }
 }
 
 Operand Node::get_operand() {
-    return m_operand;
+    return m_operand != nullptr ? *m_operand : Operand();
 }
 
 void Node::set_inverted(bool inverted) {
@@ -154,28 +210,47 @@ bool Node::is_const() {
 ////////////////////////////////////////////////////////////////////////
 
 struct Node *node_alloc(int tag) {
-  return new Node(tag);
+  return Node::create(tag);
 }
 
 struct Node *node_alloc_str_copy(int tag, const char *str_to_copy) {
-  Node *n = new Node(tag);
+  Node *n = Node::create(tag);
   n->set_str(str_to_copy);
   return n;
 }
 
 struct Node *node_alloc_str_adopt(int tag, char *str_to_adopt) {
-  Node *n = new Node(tag);
+  Node *n = Node::create(tag);
   n->set_str(str_to_adopt);
   free(str_to_adopt);
   return n;
 }
 
+struct Node *node_alloc_str_intern(int tag, const char *str, size_t len) {
+  Node *n = Node::create(tag);
+  n->set_str(str, len);
+  return n;
+}
+
+struct Node *node_alloc_str_static(int tag, const char *static_str) {
+  Node *n = Node::create(tag);
+  n->set_static_str(static_str);
+  return n;
+}
+
 struct Node *node_alloc_ival(int tag, long ival) {
-  Node *n = new Node(tag);
+  Node *n = Node::create(tag);
   n->set_ival(ival);
   return n;
 }
 
+struct Node *node_alloc_int_literal(int tag, long ival) {
+  Node *n = Node::create(tag);
+  n->set_ival(ival);
+  n->set_static_str(nullptr);
+  return n;
+}
+
 struct Node *node_build0(int tag) {
   DEBUG_PRINT("Node0: %d\n", tag);
   return node_buildn(tag, NULL);
@@ -235,8 +310,17 @@ struct Node *node_build8(int tag,
 
 struct Node *node_buildn(int tag, ...) {
   va_list args;
+
+  // count the children, so that they're allocated at once
+  unsigned num_kids = 0;
+  va_start(args, tag);
+  while (va_arg(args, struct Node *) != nullptr) {
+    num_kids++;
+  }
+  va_end(args);
+
   va_start(args, tag);
-  struct Node *n = node_alloc(tag);
+  struct Node *n = Node::create(tag, num_kids);
   int done = 0;
   while (!done) {
     struct Node *child = (struct Node *) va_arg(args, struct Node *);
@@ -251,7 +335,7 @@ struct Node *node_buildn(int tag, ...) {
 }
 
 void node_destroy(struct Node *n) {
-  delete n;
+  // the Node is freed with its Arena
 }
 
 void node_destroy_recursive(struct Node *n) {
@@ -298,7 +382,7 @@ struct SourceInfo node_get_source_info(struct Node *n) {
 }
 
 const char *node_get_str(struct Node *n) {
-  return n->get_str().c_str();
+  return n->get_str();
 }
 
 long node_get_ival(struct Node *n) {
@@ -322,15 +406,11 @@ unsigned node_get_index(struct Node *n) {
   return n->get_index();
 }
 
-// Assume that this function exists, and can retrieve a pointer to
-// a Symbol from a SymbolTable, given its index.
-//extern "C" struct Symbol *symtab_get_entry(struct SymbolTable *symtab, unsigned index);
-
 struct Symbol *node_get_symbol(struct Node *n) {
   SymbolTable *symtab = n->get_symtab();
   if (!symtab) {
     // The Node doesn't have a symbol table entry
     return nullptr;
   }
-  //return symtab_get_entry(symtab, n->get_index());
+  return symtab->get_symbol(n->get_index());
 }
@@ -1,10 +1,13 @@
 #ifndef NODE_H
 #define NODE_H
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 
 #include <string>
 #include <vector>
+#include "arena.h"
 #include "symbol.h"
 #include "symtab.h"
 #include "cfg.h"
@@ -31,17 +34,25 @@ struct Node;
 // Node data type exposed as a full C++ class.
 // The C functions from previous assignments still work,
 // and are retained for backwards compatibility.
+//
+// Nodes are allocated from an Arena, and live as long as the program
+// (node_destroy does nothing).  A Node's children are stored in a
+// contiguous array (also in the Arena), and its string value is interned
+// in a StringPool, so that equal strings (identifiers, keywords) are
+// stored once and can be compared by address.
 struct Node {
 private:
   int m_tag;
-  std::vector<Node *> m_kids;
+  unsigned m_num_kids;
+  unsigned m_kids_capacity;
+  Node **m_kids;
   SourceInfo m_source_info;
   long m_ival;
-  std::string m_strval;
+  mutable const char *m_strval;   // null for an integer literal (see get_str)
   SymbolTable *m_symtab;
-  unsigned m_index; // index of symbol table entry
   Type *m_type;
-  Operand m_operand;
+  Operand *m_operand;
+  unsigned m_index; // index of symbol table entry
   bool m_is_const;
   bool m_invert;
 
@@ -50,21 +61,30 @@ private:
   Node &operator=(const Node &);
   
 public:
-  typedef std::vector<Node *>::iterator iterator;
+  typedef Node **iterator;
 
   Node(int tag);
-  ~Node();
 
-  iterator begin() { return m_kids.begin(); }
-  iterator end() { return m_kids.end(); }
+  // create a Node in the Arena of all Nodes, with room for the given
+  // number of children
+  static Node *create(int tag, unsigned kids_capacity = 0);
+
+  // the Arena containing all Nodes, and the StringPool of their strings
+  static Arena &get_arena();
+  static StringPool &get_string_pool();
+
+  iterator begin() { return m_kids; }
+  iterator end() { return m_kids + m_num_kids; }
 
   int get_tag() const;
   int get_num_kids() const;
   void add_kid(Node *kid);
   void prepend_kid(Node *kid);
   Node *get_kid(int index);
-  void set_str(const std::string &s);
-  const std::string &get_str() const;
+  void set_str(const char *s);
+  void set_str(const char *s, size_t len);
+  void set_static_str(const char *s);
+  const char *get_str() const;
   SourceInfo get_source_info() const;
   void set_source_info(const SourceInfo &source_info);
   long get_ival() const;
@@ -82,6 +102,9 @@ public:
   bool is_const();
   void set_inverted(bool inverted);
   bool is_inverted();
+
+private:
+  void reserve_kids(unsigned capacity);
 };
 
 extern "C" {
@@ -100,9 +123,21 @@ struct Node *node_alloc_str_copy(int tag, const char *str_to_copy);
 // which will be freed when the Node is destroyed.
 struct Node *node_alloc_str_adopt(int tag, char *str_to_adopt);
 
+// Create a node with a string value by interning the first len characters
+// of a string (which needn't be NUL-terminated).
+struct Node *node_alloc_str_intern(int tag, const char *str, size_t len);
+
+// Create a node with a string value which outlives the node (e.g., a
+// string literal), without copying it.
+struct Node *node_alloc_str_static(int tag, const char *static_str);
+
 // Create a node with a given integer value.
 struct Node *node_alloc_ival(int tag, long ival);
 
+// Create a node for an integer literal: its string value (the value
+// in decimal) is only formed if it's requested.
+struct Node *node_alloc_int_literal(int tag, long ival);
+
 // Convenience functions to create a Node with specified tag value
 // and pointers to children.
 struct Node *node_build0(int tag);
@@ -131,7 +166,8 @@ struct Node *node_build8(int tag,
 // The sequence of child pointers should be terminated with a null pointer.
 struct Node *node_buildn(int tag, ...);
 
-// Destroy a Node.
+// Destroy a Node.  (Nodes are freed along with the Arena they are
+// allocated from, so this does nothing.)
 void node_destroy(struct Node *n);
 
 // Recursively destroy a tree of Nodes.
@@ -23,7 +23,7 @@ int yylex(void);
 %token<node> TOK_PROGRAM TOK_BEGIN TOK_END TOK_CONST TOK_TYPE TOK_VAR
 %token<node> TOK_ARRAY TOK_OF TOK_RECORD TOK_DIV TOK_MOD TOK_IF
 %token<node> TOK_THEN TOK_ELSE TOK_REPEAT TOK_UNTIL TOK_WHILE TOK_DO
-%token<node> TOK_READ TOK_WRITE
+%token<node> TOK_READ TOK_WRITE TOK_PROCEDURE TOK_FUNCTION TOK_RETURN
 
 %token<node> TOK_ASSIGN
 %token<node> TOK_SEMICOLON TOK_EQUALS TOK_COLON TOK_PLUS TOK_MINUS TOK_TIMES
@@ -35,11 +35,13 @@ int yylex(void);
 %type<node> constdecl constdefn_list constdefn
 %type<node> typedecl typedefn_list typedefn
 %type<node> vardecl vardefn_list vardefn
+%type<node> procdecl funcdecl opt_parameters parameter_list parameter
 %type<node> type named_type array_type record_type
 %type<node> opt_instructions instructions instruction
 %type<node> expression term factor primary
 %type<node> assignstmt ifstmt repeatstmt whilestmt condition writestmt readstmt
-%type<node> designator identifier_list
+%type<node> callstmt returnstmt call
+%type<node> designator identifier_list opt_expression_list expression_list
 
 %%
 
@@ -62,6 +64,8 @@ declaration
     : constdecl { $$ = $1; }
     | typedecl { $$ = $1; }
     | vardecl { $$ = $1; }
+    | procdecl { $$ = $1; }
+    | funcdecl { $$ = $1; }
     ;
 
 constdecl
@@ -103,6 +107,31 @@ vardefn
     : identifier_list TOK_COLON type TOK_SEMICOLON { $$ = node_build2(AST_VAR_DEF, $1, $3); }
     ;
 
+procdecl
+    : TOK_PROCEDURE TOK_IDENT opt_parameters TOK_SEMICOLON opt_declarations TOK_BEGIN opt_instructions TOK_END TOK_SEMICOLON
+        { $$ = node_build4(AST_PROCEDURE, $2, $3, $5, $7); }
+    ;
+
+funcdecl
+    : TOK_FUNCTION TOK_IDENT opt_parameters TOK_COLON type TOK_SEMICOLON opt_declarations TOK_BEGIN opt_instructions TOK_END TOK_SEMICOLON
+        { $$ = node_build5(AST_FUNCTION, $2, $3, $5, $7, $9); }
+    ;
+
+opt_parameters
+    : TOK_LPAREN parameter_list TOK_RPAREN { $$ = $2; }
+    | TOK_LPAREN TOK_RPAREN { $$ = node_build0(AST_PARAMETERS); }
+    | /* epsilon */ { $$ = node_build0(AST_PARAMETERS); }
+    ;
+
+parameter_list
+    : parameter_list TOK_SEMICOLON parameter { $$ = $1; node_add_kid($1, $3); }
+    | parameter { $$ = node_build1(AST_PARAMETERS, $1); }
+    ;
+
+parameter
+    : identifier_list TOK_COLON type { $$ = node_build2(AST_VAR_DEF, $1, $3); }
+    ;
+
 identifier_list
     : identifier_list TOK_COMMA TOK_IDENT { $$ = $1; node_add_kid($1, $3); }
     | TOK_IDENT { $$ = node_build1(AST_IDENTIFIER_LIST, $1); }
@@ -143,6 +172,8 @@ instruction
     | whilestmt TOK_SEMICOLON
     | writestmt TOK_SEMICOLON
     | readstmt TOK_SEMICOLON
+    | callstmt TOK_SEMICOLON
+    | returnstmt TOK_SEMICOLON
     ;
 
 assignstmt
@@ -170,6 +201,20 @@ readstmt
     : TOK_READ designator { $$ = node_build1(AST_READ, $2); }
     ;
 
+callstmt
+    : TOK_IDENT { $$ = node_build2(AST_CALL, $1, node_build0(AST_EXPRESSION_LIST)); }
+    | call { $$ = $1; }
+    ;
+
+returnstmt
+    : TOK_RETURN { $$ = node_build0(AST_RETURN); node_set_source_info($$, node_get_source_info($1)); }
+    | TOK_RETURN expression { $$ = node_build1(AST_RETURN, $2); node_set_source_info($$, node_get_source_info($1)); }
+    ;
+
+call
+    : TOK_IDENT TOK_LPAREN opt_expression_list TOK_RPAREN { $$ = node_build2(AST_CALL, $1, $3); }
+    ;
+
 condition
     : expression TOK_EQUALS expression { $$ = node_build2(AST_COMPARE_EQ, $1, $3); }
     | expression TOK_HASH expression { $$ = node_build2(AST_COMPARE_NEQ, $1, $3); }
@@ -185,12 +230,15 @@ designator
     | designator TOK_DOT TOK_IDENT { $$ = node_build2(AST_FIELD_REF, $1, $3); }
     ;
 
-/*
+opt_expression_list
+    : expression_list
+    | /* epsilon */ { $$ = node_build0(AST_EXPRESSION_LIST); }
+    ;
+
 expression_list
     : expression_list TOK_COMMA expression { $$ = $1; node_add_kid($1, $3); }
-    | expression { $$ = node_build1(NODE_expression_list, $1); }
+    | expression { $$ = node_build1(AST_EXPRESSION_LIST, $1); }
     ;
-*/
 
 expression
     : expression TOK_PLUS term { $$ = node_build2(AST_ADD, $1, $3); }
@@ -212,6 +260,7 @@ factor
 primary
     : TOK_INT_LITERAL { $$ = $1; }
     | designator { $$ = $1; }
+    | call { $$ = $1; }
     | TOK_LPAREN expression TOK_RPAREN { $$ = $2; }
     ;
 
@@ -0,0 +1,643 @@
+#include <cassert>
+#include <climits>
+#include <algorithm>
+#include "cfg.h"
+#include "x86_64.h"
+#include "peephole.h"
+
+namespace {
+    unsigned mreg_bit(int mreg) {
+        return 1U << unsigned(mreg);
+    }
+
+    // scratch registers: never live between the instructions
+    // generated for different high-level instructions
+    const unsigned SCRATCH_MREGS = (1U << MREG_R10) | (1U << MREG_R11) | (1U << MREG_RAX) | (1U << MREG_RDX);
+
+    // registers assumed to be live at the end of every block
+    const unsigned LIVE_OUT_MREGS = 0xFFFFU & ~SCRATCH_MREGS;
+
+    // registers which a call may modify
+    const unsigned CALLER_SAVED_MREGS =
+        (1U << MREG_RAX) | (1U << MREG_RCX) | (1U << MREG_RDX) | (1U << MREG_RSI) | (1U << MREG_RDI) |
+        (1U << MREG_R8) | (1U << MREG_R9) | (1U << MREG_R10) | (1U << MREG_R11);
+
+    bool is_reg(const Operand &op) {
+        return op.get_kind() == OPERAND_MREG;
+    }
+
+    bool is_mem(const Operand &op) {
+        return op.is_memref();
+    }
+
+    // is the operand an integer literal that can be encoded as an immediate
+    // in any instruction?  (only movq to a register takes a 64 bit immediate)
+    bool is_small_imm(const Operand &op) {
+        return op.get_kind() == OPERAND_INT_LITERAL &&
+               op.get_int_value() >= INT_MIN && op.get_int_value() <= INT_MAX;
+    }
+
+    // can the operand be the source operand of addq, subq, imulq, or cmpq?
+    bool is_arith_source(const Operand &op) {
+        return is_reg(op) || is_mem(op) || is_small_imm(op);
+    }
+
+    // mregs read when evaluating the operand (as a value or an address)
+    unsigned operand_mregs(const Operand &op) {
+        if (op.get_kind() == OPERAND_MREG) {
+            return mreg_bit(op.get_base_reg());
+        }
+        if (!op.is_memref()) {
+            return 0;
+        }
+        unsigned mregs = mreg_bit(op.get_base_reg());
+        if (op.has_index_reg()) {
+            mregs |= mreg_bit(op.get_index_reg());
+        }
+        return mregs;
+    }
+
+    bool same_operand(const Operand &a, const Operand &b) {
+        if (a.get_kind() != b.get_kind()) {
+            return false;
+        }
+        if (a.has_base_reg() && a.get_base_reg() != b.get_base_reg()) {
+            return false;
+        }
+        if (a.has_index_reg() && (a.get_index_reg() != b.get_index_reg() || a.get_scale() != b.get_scale())) {
+            return false;
+        }
+        if (a.get_kind() == OPERAND_INT_LITERAL && a.get_int_value() != b.get_int_value()) {
+            return false;
+        }
+        if (a.is_memref() && (a.get_kind() & OPROP_HAS_INTVAL) != 0 && a.get_offset() != b.get_offset()) {
+            return false;
+        }
+        if ((a.get_kind() & OPROP_HAS_LABEL) != 0 && a.get_target_label() != b.get_target_label()) {
+            return false;
+        }
+        return true;
+    }
+
+    bool is_opcode(Instruction *ins, int opcode) {
+        return ins->get_opcode() == opcode;
+    }
+
+    // two-operand instructions which read and write their destination
+    // (a shift's source is always an immediate count)
+    bool is_arith(Instruction *ins) {
+        switch (ins->get_opcode()) {
+            case MINS_ADDQ: case MINS_SUBQ: case MINS_IMULQ: case MINS_ANDQ:
+            case MINS_SALQ: case MINS_SHRQ: case MINS_SARQ:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    bool is_commutative(Instruction *ins) {
+        return is_opcode(ins, MINS_ADDQ) || is_opcode(ins, MINS_IMULQ) || is_opcode(ins, MINS_ANDQ);
+    }
+
+    // is the instruction a movq into a register?
+    bool is_move_to_reg(Instruction *ins) {
+        return is_opcode(ins, MINS_MOVQ) && is_reg(ins->get_operand(1));
+    }
+
+    bool writes_memory(Instruction *ins) {
+        switch (ins->get_opcode()) {
+            case MINS_MOVQ: case MINS_ADDQ: case MINS_SUBQ: case MINS_IMULQ:
+            case MINS_ANDQ: case MINS_SALQ: case MINS_SHRQ: case MINS_SARQ:
+                return is_mem(ins->get_operand(1));
+            case MINS_CALL:
+            case MINS_PUSHQ:
+            case MINS_TAIL_JMP:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // Substitute the operand x for reads of the mreg s in the instruction,
+    // returning the resulting instruction, or a null pointer if the
+    // instruction doesn't read s or the result wouldn't be encodable.
+    Instruction *substitute(Instruction *ins, int s, const Operand &x) {
+        if ((X86_64PeepholeOptimization::get_uses(ins) & mreg_bit(s)) == 0) {
+            return nullptr;
+        }
+
+        int opcode = ins->get_opcode();
+        switch (opcode) {
+            case MINS_MOVQ: case MINS_LEAQ: case MINS_ADDQ: case MINS_SUBQ:
+            case MINS_IMULQ: case MINS_ANDQ: case MINS_CMPQ:
+                break;
+            case MINS_IDIVQ:
+                // idivq implicitly reads %rax and %rdx
+                if (s == MREG_RAX || s == MREG_RDX) {
+                    return nullptr;
+                }
+                break;
+            default:
+                return nullptr;
+        }
+
+        Instruction *result = ins->duplicate();
+        bool ok = true;
+        for (unsigned k = 0; k < result->get_num_operands() && ok; k++) {
+            Operand op = (*result)[k];
+            if (op.get_kind() == OPERAND_MREG && op.get_base_reg() == s) {
+                if (k == 1 && (opcode == MINS_MOVQ || opcode == MINS_LEAQ)) {
+                    // destination: written, not read
+                    continue;
+                }
+                if (k == 1 && opcode != MINS_CMPQ) {
+                    // destination of a read-modify-write instruction
+                    ok = false;
+                } else if (is_reg(x) || is_mem(x)) {
+                    (*result)[k] = x;
+                } else if (k == 0 && is_small_imm(x) && opcode != MINS_IDIVQ) {
+                    (*result)[k] = x;
+                } else if (k == 0 && x.get_kind() == OPERAND_LABEL_IMMEDIATE && opcode == MINS_MOVQ) {
+                    (*result)[k] = x;
+                } else {
+                    ok = false;
+                }
+            } else if (op.is_memref() && (operand_mregs(op) & mreg_bit(s)) != 0) {
+                // an address can only be based on a register
+                if (!is_reg(x)) {
+                    ok = false;
+                } else {
+                    if (op.get_base_reg() == s) {
+                        op.set_base_reg(x.get_base_reg());
+                    }
+                    if (op.has_index_reg() && op.get_index_reg() == s) {
+                        op.set_index_reg(x.get_base_reg());
+                    }
+                    (*result)[k] = op;
+                }
+            }
+        }
+
+        // at most one operand may refer to memory (the address computed
+        // by leaq isn't a memory access)
+        if (ok && opcode != MINS_LEAQ && result->get_num_operands() == 2 &&
+            is_mem((*result)[0]) && is_mem((*result)[1])) {
+            ok = false;
+        }
+
+        if (!ok) {
+            delete result;
+            return nullptr;
+        }
+        return result;
+    }
+
+    ////////////////////////////////////////////////////////////////////////
+    // Patterns
+    ////////////////////////////////////////////////////////////////////////
+
+    // nop
+    //   => (nothing)
+    bool remove_nop(const PeepholeWindow &w, std::vector<Instruction *> &r) {
+        return is_opcode(w.get(0), MINS_NOP);
+    }
+
+    // movq %R, %R
+    //   => (nothing)
+    bool remove_redundant_move(const PeepholeWindow &w, std::vector<Instruction *> &r) {
+        Instruction *ins = w.get(0);
+        return is_move_to_reg(ins) && same_operand(ins->get_operand(0), ins->get_operand(1));
+    }
+
+    // movq/leaq X, %R     (%R dead afterwards)
+    //   => (nothing)
+    bool remove_dead_def(const PeepholeWindow &w, std::vector<Instruction *> &r) {
+        Instruction *ins = w.get(0);
+        if (!is_opcode(ins, MINS_MOVQ) && !is_opcode(ins, MINS_LEAQ)) {
+            return false;
+        }
+        Operand dest = ins->get_operand(1);
+        return is_reg(dest) && !w.is_live_after(0, dest.get_base_reg());
+    }
+
+    // movq %R, M          movq M, %R2
+    // movq M, X      or   movq M, X
+    //   => movq %R, M       => movq M, %R2
+    //      movq %R, X          movq %R2, X
+    bool forward_memory_value(const PeepholeWindow &w, std::vector<Instruction *> &r) {
+        Instruction *a = w.get(0), *b = w.get(1);
+        if (!is_opcode(a, MINS_MOVQ) || !is_opcode(b, MINS_MOVQ)) {
+            return false;
+        }
+
+        // which operand of the first movq is the memory location, and which the register?
+        Operand mem, reg;
+        if (is_reg(a->get_operand(0)) && is_mem(a->get_operand(1))) {
+            reg = a->get_operand(0);
+            mem = a->get_operand(1);
+        } else if (is_mem(a->get_operand(0)) && is_reg(a->get_operand(1))) {
+            mem = a->get_operand(0);
+            reg = a->get_operand(1);
+            // a load which overwrites its own address register can't be reused
+            if ((operand_mregs(mem) & mreg_bit(reg.get_base_reg())) != 0) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+
+        if (!same_operand(b->get_operand(0), mem)) {
+            return false;
+        }
+
+        r.push_back(a->duplicate());
+        if (!same_operand(b->get_operand(1), reg)) {
+            r.push_back(new Instruction(MINS_MOVQ, reg, b->get_operand(1)));
+        }
+        return true;
+    }
+
+    // movq P, %Ra
+    // movq Q, %Rb
+    // OP %Rs, %Rd         ({Rs, Rd} = {Ra, Rb}, both dead afterwards)
+    // movq %Rd, %D
+    //   => OP src, %D           (if dst is %D)
+    //   => OP dst, %D           (if src is %D, and OP is commutative)
+    //   => movq dst, %D         (otherwise)
+    //      OP src, %D
+    // where src and dst are the operands P, Q that were loaded into Rs and Rd
+    bool combine_three_address(const PeepholeWindow &w, std::vector<Instruction *> &r) {
+        Instruction *a = w.get(0), *b = w.get(1), *op = w.get(2), *c = w.get(3);
+        if (!is_move_to_reg(a) || !is_move_to_reg(b) || !is_arith(op) || !is_opcode(c, MINS_MOVQ)) {
+            return false;
+        }
+        int ra = a->get_operand(1).get_base_reg(), rb = b->get_operand(1).get_base_reg();
+        if (ra == rb || (operand_mregs(b->get_operand(0)) & mreg_bit(ra)) != 0) {
+            return false;
+        }
+        if (!is_reg(op->get_operand(0)) || !is_reg(op->get_operand(1))) {
+            return false;
+        }
+        int rs = op->get_operand(0).get_base_reg(), rd = op->get_operand(1).get_base_reg();
+        if (!((rs == ra && rd == rb) || (rs == rb && rd == ra))) {
+            return false;
+        }
+        if (!same_operand(c->get_operand(0), op->get_operand(1)) || !is_reg(c->get_operand(1))) {
+            return false;
+        }
+        Operand d = c->get_operand(1);
+        if (d.get_base_reg() == ra || d.get_base_reg() == rb || w.is_live_after(3, ra) || w.is_live_after(3, rb)) {
+            return false;
+        }
+
+        Operand src = (rs == ra) ? a->get_operand(0) : b->get_operand(0);
+        Operand dst = (rd == ra) ? a->get_operand(0) : b->get_operand(0);
+        int opcode = op->get_opcode();
+
+        if (same_operand(dst, d) && is_arith_source(src)) {
+            r.push_back(new Instruction(opcode, src, d));
+        } else if (is_commutative(op) && same_operand(src, d) && is_arith_source(dst)) {
+            r.push_back(new Instruction(opcode, dst, d));
+        } else if (is_commutative(op) && dst.get_kind() == OPERAND_INT_LITERAL &&
+                   (operand_mregs(dst) & mreg_bit(d.get_base_reg())) == 0 && is_arith_source(dst)) {
+            // prefer the immediate as the source operand
+            r.push_back(new Instruction(MINS_MOVQ, src, d));
+            r.push_back(new Instruction(opcode, dst, d));
+        } else if ((operand_mregs(src) & mreg_bit(d.get_base_reg())) == 0 && is_arith_source(src)) {
+            r.push_back(new Instruction(MINS_MOVQ, dst, d));
+            r.push_back(new Instruction(opcode, src, d));
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    // movq Y, %S
+    // OP X, %S            (X doesn't refer to %S)
+    // movq %S, %D         (%S dead afterwards)
+    //   => movq Y, %D     (if X doesn't refer to %D)
+    //      OP X, %D
+    //   => OP Y, %D       (if X is %D, and OP is commutative)
+    bool compute_into_dest(const PeepholeWindow &w, std::vector<Instruction *> &r) {
+        Instruction *a = w.get(0), *op = w.get(1), *c = w.get(2);
+        if (!is_move_to_reg(a) || !is_arith(op) || !is_opcode(c, MINS_MOVQ)) {
+            return false;
+        }
+        Operand s = a->get_operand(1);
+        if (!same_operand(op->get_operand(1), s) || !same_operand(c->get_operand(0), s)) {
+            return false;
+        }
+        Operand d = c->get_operand(1);
+        if (!is_reg(d) || d.get_base_reg() == s.get_base_reg() || w.is_live_after(2, s.get_base_reg())) {
+            return false;
+        }
+        Operand x = op->get_operand(0), y = a->get_operand(0);
+        if ((operand_mregs(x) & mreg_bit(s.get_base_reg())) != 0) {
+            return false;
+        }
+
+        if ((operand_mregs(x) & mreg_bit(d.get_base_reg())) == 0) {
+            r.push_back(new Instruction(MINS_MOVQ, y, d));
+            r.push_back(new Instruction(op->get_opcode(), x, d));
+        } else if (is_commutative(op) && same_operand(x, d) && is_arith_source(y)) {
+            r.push_back(new Instruction(op->get_opcode(), y, d));
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    // movq/leaq X, %S
+    // movq %S, D          (%S dead afterwards)
+    //   => movq/leaq X, D
+    bool def_into_dest(const PeepholeWindow &w, std::vector<Instruction *> &r) {
+        Instruction *a = w.get(0), *c = w.get(1);
+        if ((!is_opcode(a, MINS_MOVQ) && !is_opcode(a, MINS_LEAQ)) || !is_opcode(c, MINS_MOVQ)) {
+            return false;
+        }
+        Operand s = a->get_operand(1);
+        if (!is_reg(s) || !same_operand(c->get_operand(0), s) || w.is_live_after(1, s.get_base_reg())) {
+            return false;
+        }
+        Operand d = c->get_operand(1);
+        if ((operand_mregs(d) & mreg_bit(s.get_base_reg())) != 0) {
+            return false;
+        }
+        if (is_mem(d)) {
+            // only a register or a small immediate can be stored directly
+            Operand x = a->get_operand(0);
+            if (!is_opcode(a, MINS_MOVQ) || !(is_reg(x) || is_small_imm(x))) {
+                return false;
+            }
+        }
+
+        Instruction *ins = a->duplicate();
+        (*ins)[1] = d;
+        r.push_back(ins);
+        return true;
+    }
+
+    // movq X, %S
+    // I                   (reads %S, which is dead afterwards)
+    //   => I[X/%S]
+    bool forward_substitute(const PeepholeWindow &w, std::vector<Instruction *> &r) {
+        Instruction *a = w.get(0), *ins = w.get(1);
+        if (!is_move_to_reg(a)) {
+            return false;
+        }
+        int s = a->get_operand(1).get_base_reg();
+        if (w.is_live_after(1, s) && (X86_64PeepholeOptimization::get_defs(ins) & mreg_bit(s)) == 0) {
+            return false;
+        }
+        Instruction *result = substitute(ins, s, a->get_operand(0));
+        if (result == nullptr) {
+            return false;
+        }
+        r.push_back(result);
+        return true;
+    }
+
+    // movq X, %S
+    // M                   (doesn't use %S, or change X)
+    // I                   (reads %S, which is dead afterwards)
+    //   => M
+    //      I[X/%S]
+    bool forward_substitute_across(const PeepholeWindow &w, std::vector<Instruction *> &r) {
+        Instruction *a = w.get(0), *m = w.get(1), *ins = w.get(2);
+        if (!is_move_to_reg(a)) {
+            return false;
+        }
+        int s = a->get_operand(1).get_base_reg();
+        Operand x = a->get_operand(0);
+        unsigned m_uses = X86_64PeepholeOptimization::get_uses(m);
+        unsigned m_defs = X86_64PeepholeOptimization::get_defs(m);
+        if (((m_uses | m_defs) & mreg_bit(s)) != 0 || (m_defs & operand_mregs(x)) != 0) {
+            return false;
+        }
+        if (is_mem(x) && writes_memory(m)) {
+            return false;
+        }
+        if (w.is_live_after(2, s) && (X86_64PeepholeOptimization::get_defs(ins) & mreg_bit(s)) == 0) {
+            return false;
+        }
+        Instruction *result = substitute(ins, s, x);
+        if (result == nullptr) {
+            return false;
+        }
+        r.push_back(m->duplicate());
+        r.push_back(result);
+        return true;
+    }
+
+    // The built-in patterns, in the order they are tried.
+    // Every pattern must either shorten the code or remove a memory
+    // access, so that optimization terminates.
+    const PeepholePattern BUILTIN_PATTERNS[] = {
+        { "remove_nop",                 1, remove_nop },
+        { "remove_redundant_move",      1, remove_redundant_move },
+        { "remove_dead_def",            1, remove_dead_def },
+        { "forward_memory_value",       2, forward_memory_value },
+        { "combine_three_address",      4, combine_three_address },
+        { "compute_into_dest",          3, compute_into_dest },
+        { "def_into_dest",              2, def_into_dest },
+        { "forward_substitute",         2, forward_substitute },
+        { "forward_substitute_across",  3, forward_substitute_across },
+    };
+}
+
+////////////////////////////////////////////////////////////////////////
+// X86_64PeepholeOptimization implementation
+////////////////////////////////////////////////////////////////////////
+
+X86_64PeepholeOptimization::X86_64PeepholeOptimization(ControlFlowGraph *cfg)
+        : ControlFlowGraphTransform(cfg)
+        , m_patterns(std::begin(BUILTIN_PATTERNS), std::end(BUILTIN_PATTERNS))
+        , m_live_out(LIVE_OUT_MREGS) {
+}
+
+X86_64PeepholeOptimization::~X86_64PeepholeOptimization() {
+}
+
+void X86_64PeepholeOptimization::add_pattern(const PeepholePattern &pattern) {
+    m_patterns.push_back(pattern);
+}
+
+InstructionSequence *X86_64PeepholeOptimization::transform_basic_block(InstructionSequence *iseq) {
+    BasicBlock *bb = static_cast<BasicBlock *>(iseq);
+    m_live_out = LIVE_OUT_MREGS;
+    const ControlFlowGraph::EdgeList &outgoing = get_orig_cfg()->get_outgoing_edges(bb);
+    for (auto i = outgoing.cbegin(); i != outgoing.cend(); i++) {
+        if ((*i)->get_target()->get_kind() == BASICBLOCK_EXIT) {
+            m_live_out |= mreg_bit(MREG_RAX);
+        }
+    }
+
+    std::vector<Instruction *> code;
+    for (auto i = iseq->cbegin(); i != iseq->cend(); i++) {
+        code.push_back((*i)->duplicate());
+    }
+
+    optimize(code);
+
+    auto out = new InstructionSequence();
+    for (auto i = code.begin(); i != code.end(); i++) {
+        out->add_instruction(*i);
+    }
+
+    keep_nonempty(out, iseq, MINS_NOP);
+
+    return out;
+}
+
+unsigned X86_64PeepholeOptimization::get_uses(Instruction *ins) {
+    switch (ins->get_opcode()) {
+        case MINS_MOVQ:
+        case MINS_LEAQ: {
+            // the destination is only read if it's a memory reference
+            Operand dest = ins->get_operand(1);
+            return operand_mregs(ins->get_operand(0)) | (is_mem(dest) ? operand_mregs(dest) : 0);
+        }
+        case MINS_ADDQ:
+        case MINS_SUBQ:
+        case MINS_IMULQ:
+        case MINS_ANDQ:
+        case MINS_SALQ:
+        case MINS_SHRQ:
+        case MINS_SARQ:
+        case MINS_CMPQ:
+            return operand_mregs(ins->get_operand(0)) | operand_mregs(ins->get_operand(1));
+        case MINS_IDIVQ:
+            return operand_mregs(ins->get_operand(0)) | mreg_bit(MREG_RAX) | mreg_bit(MREG_RDX);
+        case MINS_IMULQ_WIDE:
+            return operand_mregs(ins->get_operand(0)) | mreg_bit(MREG_RAX);
+        case MINS_CQTO:
+            return mreg_bit(MREG_RAX);
+        case MINS_CALL:
+            // the argument registers (and %al, the number of vector arguments)
+            return mreg_bit(MREG_RDI) | mreg_bit(MREG_RSI) | mreg_bit(MREG_RDX) |
+                   mreg_bit(MREG_RCX) | mreg_bit(MREG_R8) | mreg_bit(MREG_R9) | mreg_bit(MREG_RAX);
+        case MINS_PUSHQ:
+            return operand_mregs(ins->get_operand(0)) | mreg_bit(MREG_RSP);
+        case MINS_POPQ:
+            return mreg_bit(MREG_RSP);
+        case MINS_TAIL_JMP:
+            // the argument registers, and everything the callee returns to
+            // this function's caller (%rsp and the callee-saved registers)
+            return LIVE_OUT_MREGS | mreg_bit(MREG_RDX);
+        default:
+            return 0;
+    }
+}
+
+unsigned X86_64PeepholeOptimization::get_defs(Instruction *ins) {
+    switch (ins->get_opcode()) {
+        case MINS_MOVQ:
+        case MINS_LEAQ:
+        case MINS_ADDQ:
+        case MINS_SUBQ:
+        case MINS_IMULQ:
+        case MINS_ANDQ:
+        case MINS_SALQ:
+        case MINS_SHRQ:
+        case MINS_SARQ: {
+            Operand dest = ins->get_operand(1);
+            return is_reg(dest) ? mreg_bit(dest.get_base_reg()) : 0;
+        }
+        case MINS_IDIVQ:
+        case MINS_IMULQ_WIDE:
+            return mreg_bit(MREG_RAX) | mreg_bit(MREG_RDX);
+        case MINS_CQTO:
+            return mreg_bit(MREG_RDX);
+        case MINS_CALL:
+            return CALLER_SAVED_MREGS;
+        case MINS_PUSHQ:
+            return mreg_bit(MREG_RSP);
+        case MINS_POPQ:
+            return mreg_bit(ins->get_operand(0).get_base_reg()) | mreg_bit(MREG_RSP);
+        default:
+            return 0;
+    }
+}
+
+unsigned X86_64PeepholeOptimization::live_before(Instruction *ins, unsigned live_after) {
+    return (live_after & ~get_defs(ins)) | get_uses(ins);
+}
+
+bool X86_64PeepholeOptimization::optimize(std::vector<Instruction *> &code) {
+    unsigned max_window = 1;
+    for (auto i = m_patterns.begin(); i != m_patterns.end(); i++) {
+        max_window = std::max(max_window, i->window_size);
+    }
+
+    // Instructions not yet examined are kept in reverse order, so that
+    // todo.back() is the first instruction of the current window,
+    // along with the mregs live after each of them.
+    std::vector<Instruction *> done, todo(code.rbegin(), code.rend());
+    std::vector<unsigned> todo_live(todo.size());
+    unsigned live = m_live_out;
+    for (unsigned i = 0; i < todo.size(); i++) {
+        todo_live[i] = live;
+        live = live_before(todo[i], live);
+    }
+
+    bool changed = false;
+    while (!todo.empty()) {
+        if (apply_pattern(todo, todo_live)) {
+            changed = true;
+
+            // back up, so that windows overlapping the replacement are tried again
+            for (unsigned n = 0; n + 1 < max_window && !done.empty(); n++) {
+                unsigned live_after = todo.empty() ? m_live_out : live_before(todo.back(), todo_live.back());
+                todo.push_back(done.back());
+                todo_live.push_back(live_after);
+                done.pop_back();
+            }
+        } else {
+            done.push_back(todo.back());
+            todo.pop_back();
+            todo_live.pop_back();
+        }
+    }
+
+    code = done;
+    return changed;
+}
+
+bool X86_64PeepholeOptimization::apply_pattern(std::vector<Instruction *> &todo, std::vector<unsigned> &todo_live) {
+    for (auto p = m_patterns.begin(); p != m_patterns.end(); p++) {
+        unsigned n = p->window_size;
+        if (todo.size() < n) {
+            continue;
+        }
+
+        std::vector<Instruction *> window_ins(todo.rbegin(), todo.rbegin() + n);
+        std::vector<unsigned> window_live(todo_live.rbegin(), todo_live.rbegin() + n);
+        PeepholeWindow window(window_ins, window_live);
+
+        std::vector<Instruction *> replacement;
+        if (!p->apply(window, replacement)) {
+            assert(replacement.empty());
+            continue;
+        }
+
+        // the first replacement instruction inherits the window's comment
+        // (which describes the high-level instruction it came from)
+        for (auto i = window_ins.begin(); i != window_ins.end(); i++) {
+            if ((*i)->has_comment() && !replacement.empty() && !replacement.front()->has_comment()) {
+                replacement.front()->set_comment((*i)->get_comment());
+            }
+            delete *i;
+        }
+        todo.resize(todo.size() - n);
+        todo_live.resize(todo_live.size() - n);
+
+        unsigned live = todo.empty() ? m_live_out : live_before(todo.back(), todo_live.back());
+        for (auto i = replacement.rbegin(); i != replacement.rend(); i++) {
+            todo.push_back(*i);
+            todo_live.push_back(live);
+            live = live_before(*i, live);
+        }
+        return true;
+    }
+    return false;
+}
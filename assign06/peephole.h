@@ -0,0 +1,73 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include <vector>
+#include "cfg.h"
+#include "cfg_transform.h"
+
+// A window of consecutive x86-64 instructions within a basic block,
+// along with the machine registers live after each of them.
+class PeepholeWindow {
+private:
+    const std::vector<Instruction *> &m_ins;
+    const std::vector<unsigned> &m_live_after;
+
+public:
+    PeepholeWindow(const std::vector<Instruction *> &ins, const std::vector<unsigned> &live_after)
+            : m_ins(ins), m_live_after(live_after) { }
+
+    unsigned size() const { return unsigned(m_ins.size()); }
+
+    Instruction *get(unsigned i) const { return m_ins.at(i); }
+
+    // is the given mreg live after the i'th instruction of the window?
+    bool is_live_after(unsigned i, int mreg) const {
+        return (m_live_after.at(i) & (1U << unsigned(mreg))) != 0;
+    }
+};
+
+// A peephole pattern looks at a window of window_size instructions.  If
+// it matches, the apply function adds the instructions which replace the
+// window to the replacement vector (which can be left empty to delete
+// the window), and returns true.
+struct PeepholePattern {
+    const char *name;
+    unsigned window_size;
+    bool (*apply)(const PeepholeWindow &window, std::vector<Instruction *> &replacement);
+};
+
+// Peephole optimizer for the x86-64 code produced by AssemblyCodeGen,
+// which moves every operand through the %r10/%r11 scratch registers.
+// Patterns are tried at each position of every basic block, from the last
+// instruction to the first, so a window always looks ahead into code that
+// has already been improved.  Blocks are rescanned until no pattern matches.
+//
+// The CFG should be built using X86_64ControlFlowGraphBuilder.  Only the
+// scratch registers (%r10, %r11, %rax and %rdx) are assumed to be dead at
+// the end of a block, except for %rax at the end of a function, where it
+// holds the result.
+class X86_64PeepholeOptimization : public ControlFlowGraphTransform {
+private:
+    std::vector<PeepholePattern> m_patterns;
+    unsigned m_live_out;    // mregs live at the end of the current block
+
+public:
+    X86_64PeepholeOptimization(ControlFlowGraph *cfg);
+    virtual ~X86_64PeepholeOptimization();
+
+    // add a pattern, to be tried after the built-in ones
+    void add_pattern(const PeepholePattern &pattern);
+
+    virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq);
+
+    // bitmasks of the mregs read and written by an instruction
+    static unsigned get_uses(Instruction *ins);
+    static unsigned get_defs(Instruction *ins);
+
+private:
+    bool optimize(std::vector<Instruction *> &code);
+    bool apply_pattern(std::vector<Instruction *> &stack, std::vector<unsigned> &live_after);
+    static unsigned live_before(Instruction *ins, unsigned live_after);
+};
+
+#endif // PEEPHOLE_H
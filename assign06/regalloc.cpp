@@ -0,0 +1,891 @@
+#include <cassert>
+#include <algorithm>
+#include <climits>
+#include <iterator>
+#include "cfg.h"
+#include "highlevel.h"
+#include "x86_64.h"
+#include "live_vregs.h"
+#include "regalloc.h"
+
+namespace {
+    unsigned mreg_bit(int mreg) {
+        return 1U << unsigned(mreg);
+    }
+
+    unsigned count_bits(unsigned mask) {
+        unsigned count = 0;
+        while (mask != 0) {
+            mask &= mask - 1;
+            count++;
+        }
+        return count;
+    }
+
+    unsigned allocatable_mask() {
+        unsigned mask = 0;
+        for (int mreg : RegisterAssignment::get_allocatable_mregs()) {
+            mask |= mreg_bit(mreg);
+        }
+        return mask;
+    }
+
+    unsigned callee_saved_mask() {
+        unsigned mask = 0;
+        for (int mreg : RegisterAssignment::get_allocatable_mregs()) {
+            if (RegisterAssignment::is_callee_saved(mreg)) {
+                mask |= mreg_bit(mreg);
+            }
+        }
+        return mask;
+    }
+
+    // calls clobber the caller-saved registers (readi and writei are
+    // translated to calls to rt_read_int/rt_write_int)
+    bool is_call(Instruction *ins) {
+        return ins->get_opcode() == HINS_READ_INT || ins->get_opcode() == HINS_WRITE_INT ||
+               ins->get_opcode() == HINS_CALL;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// RegisterAssignment implementation
+////////////////////////////////////////////////////////////////////////
+
+const int RegisterAssignment::NONE;
+
+RegisterAssignment::RegisterAssignment()
+        : m_num_spill_slots(0) {
+}
+
+RegisterAssignment::~RegisterAssignment() {
+}
+
+void RegisterAssignment::assign_mreg(int vreg, int mreg) {
+    assert(vreg >= 0);
+    if (unsigned(vreg) >= m_mregs.size()) {
+        m_mregs.resize(vreg + 1, NONE);
+    }
+    m_mregs[vreg] = mreg;
+}
+
+void RegisterAssignment::assign_spill_slot(int vreg, int slot) {
+    assert(vreg >= 0 && slot >= 0);
+    if (unsigned(vreg) >= m_spill_slots.size()) {
+        m_spill_slots.resize(vreg + 1, NONE);
+    }
+    m_spill_slots[vreg] = slot;
+    if (unsigned(slot) >= m_num_spill_slots) {
+        m_num_spill_slots = unsigned(slot) + 1;
+    }
+}
+
+bool RegisterAssignment::has_mreg(int vreg) const {
+    return get_mreg(vreg) != NONE;
+}
+
+int RegisterAssignment::get_mreg(int vreg) const {
+    return unsigned(vreg) < m_mregs.size() ? m_mregs[vreg] : NONE;
+}
+
+bool RegisterAssignment::has_spill_slot(int vreg) const {
+    return get_spill_slot(vreg) != NONE;
+}
+
+int RegisterAssignment::get_spill_slot(int vreg) const {
+    return unsigned(vreg) < m_spill_slots.size() ? m_spill_slots[vreg] : NONE;
+}
+
+bool RegisterAssignment::uses_mreg(int mreg) const {
+    return std::find(m_mregs.begin(), m_mregs.end(), mreg) != m_mregs.end();
+}
+
+const std::vector<int> &RegisterAssignment::get_allocatable_mregs() {
+    // caller-saved registers come first, so that vregs which are not live
+    // across calls leave the callee-saved registers for those that are
+    static const std::vector<int> mregs = {
+        MREG_RCX, MREG_R8, MREG_R9, MREG_RSI, MREG_RDI,
+        MREG_RBX, MREG_R12, MREG_R13, MREG_R14, MREG_R15, MREG_RBP,
+    };
+    return mregs;
+}
+
+bool RegisterAssignment::is_callee_saved(int mreg) {
+    switch (mreg) {
+        case MREG_RBX:
+        case MREG_RBP:
+        case MREG_R12:
+        case MREG_R13:
+        case MREG_R14:
+        case MREG_R15:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool regalloc_is_redundant_move(Instruction *ins, const RegisterAssignment *assignment) {
+    if (ins->get_opcode() != HINS_MOV) {
+        return false;
+    }
+    Operand dest = ins->get_operand(0);
+    Operand src = ins->get_operand(1);
+    if (dest.get_kind() != OPERAND_VREG || src.get_kind() != OPERAND_VREG) {
+        return false;
+    }
+    int d = dest.get_base_reg(), s = src.get_base_reg();
+    if (d == s) {
+        return true;
+    }
+    if (assignment->has_mreg(d)) {
+        return assignment->get_mreg(d) == assignment->get_mreg(s);
+    }
+    return assignment->has_spill_slot(d) && assignment->get_spill_slot(d) == assignment->get_spill_slot(s);
+}
+
+////////////////////////////////////////////////////////////////////////
+// GraphColoringRegisterAllocation implementation
+////////////////////////////////////////////////////////////////////////
+
+GraphColoringRegisterAllocation::GraphColoringRegisterAllocation(ControlFlowGraph *cfg)
+        : ControlFlowGraphTransform(cfg)
+        , m_assignment(nullptr) {
+}
+
+GraphColoringRegisterAllocation::~GraphColoringRegisterAllocation() {
+}
+
+void GraphColoringRegisterAllocation::execute() {
+    build();
+    coalesce();
+    color();
+    merge_moved_nodes();
+    assign();
+}
+
+InstructionSequence *GraphColoringRegisterAllocation::transform_basic_block(InstructionSequence *iseq) {
+    assert(m_assignment != nullptr);
+    auto out = new InstructionSequence();
+
+    for (auto ins : *iseq) {
+        // rename each vreg to the representative of its merged node, so
+        // that later passes see the uses of a removed move's source
+        // and destination as uses of the same vreg
+        Instruction *hin = ins->duplicate();
+        for (unsigned j = 0; j < hin->get_num_operands(); j++) {
+            Operand operand = hin->get_operand(j);
+            if (operand.has_base_reg()) {
+                operand.set_base_reg(get_representative(operand.get_base_reg()));
+            }
+            if (operand.has_index_reg()) {
+                operand.set_index_reg(get_representative(operand.get_index_reg()));
+            }
+            (*hin)[j] = operand;
+        }
+
+        // moves between merged vregs are no longer needed (since nodes
+        // with the same register were merged, these are the only moves
+        // between vregs with the same location)
+        if (regalloc_is_redundant_move(hin, m_assignment)) {
+            delete hin;
+        } else {
+            out->add_instruction(hin);
+        }
+    }
+
+    keep_nonempty(out, iseq, HINS_NOP);
+
+    return out;
+}
+
+int GraphColoringRegisterAllocation::get_node(int vreg) {
+    assert(vreg >= 0);
+    if (unsigned(vreg) >= m_vreg_to_node.size()) {
+        m_vreg_to_node.resize(vreg + 1, -1);
+    }
+    if (m_vreg_to_node[vreg] < 0) {
+        InterferenceNode node;
+        node.vreg = vreg;
+        node.allowed = allocatable_mask();
+        node.cost = 0.0;
+        node.alias = -1;
+        node.color = RegisterAssignment::NONE;
+        m_vreg_to_node[vreg] = int(m_nodes.size());
+        m_nodes.push_back(node);
+    }
+    return m_vreg_to_node[vreg];
+}
+
+int GraphColoringRegisterAllocation::get_representative(int vreg) const {
+    if (vreg < 0 || unsigned(vreg) >= m_vreg_to_node.size() || m_vreg_to_node[vreg] < 0) {
+        return vreg;
+    }
+    return m_nodes[find(m_vreg_to_node[vreg])].vreg;
+}
+
+int GraphColoringRegisterAllocation::find(int node) const {
+    while (m_nodes[node].alias >= 0) {
+        node = m_nodes[node].alias;
+    }
+    return node;
+}
+
+void GraphColoringRegisterAllocation::add_edge(int a, int b) {
+    if (a == b) {
+        return;
+    }
+    m_nodes[a].adj.insert(b);
+    m_nodes[b].adj.insert(a);
+}
+
+void GraphColoringRegisterAllocation::build() {
+    ControlFlowGraph *cfg = get_orig_cfg();
+
+    // create a node for every vreg, counting uses and defs as the spill cost
+    // (each loop containing them multiplies their weight by 10), and record
+    // vreg-to-vreg moves as coalescing candidates
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *bb = *i;
+        double weight = 1.0;
+        for (unsigned depth = cfg->get_loop_depth(bb); depth > 0; depth--) {
+            weight *= 10.0;
+        }
+        for (auto j = bb->cbegin(); j != bb->cend(); j++) {
+            Instruction *ins = *j;
+            for (unsigned k = 0; k < ins->get_num_operands(); k++) {
+                Operand operand = ins->get_operand(k);
+                if (operand.has_base_reg()) {
+                    m_nodes[get_node(operand.get_base_reg())].cost += weight;
+                }
+                if (operand.has_index_reg()) {
+                    m_nodes[get_node(operand.get_index_reg())].cost += weight;
+                }
+            }
+            if (ins->get_opcode() == HINS_MOV &&
+                ins->get_operand(0).get_kind() == OPERAND_VREG &&
+                ins->get_operand(1).get_kind() == OPERAND_VREG) {
+                m_moves.push_back(std::make_pair(ins->get_operand(0).get_base_reg(),
+                                                 ins->get_operand(1).get_base_reg()));
+            }
+        }
+    }
+
+    LiveVregs live_vregs(cfg);
+    live_vregs.execute();
+
+    const unsigned callee_saved = callee_saved_mask();
+
+    // a def interferes with every vreg live after it (except the source of a move)
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *bb = *i;
+        LiveVregs::LiveSet live_set = live_vregs.get_fact_at_end_of_block(bb);
+
+        for (auto j = bb->crbegin(); j != bb->crend(); j++) {
+            Instruction *ins = *j;
+
+            int def = -1;
+            if (HighLevel::is_def(ins)) {
+                def = ins->get_operand(0).get_base_reg();
+                int src = -1;
+                if (ins->get_opcode() == HINS_MOV && ins->get_operand(1).get_kind() == OPERAND_VREG) {
+                    src = ins->get_operand(1).get_base_reg();
+                }
+                int def_node = get_node(def);
+                for (unsigned v = live_set.find_first(); v != BitVector::NPOS; v = live_set.find_next(v + 1)) {
+                    if (int(v) != def && int(v) != src) {
+                        add_edge(def_node, get_node(int(v)));
+                    }
+                }
+            }
+
+            if (is_call(ins)) {
+                // vregs live across the call must survive it
+                for (unsigned v = live_set.find_first(); v != BitVector::NPOS; v = live_set.find_next(v + 1)) {
+                    if (int(v) != def) {
+                        m_nodes[get_node(int(v))].allowed &= callee_saved;
+                    }
+                }
+            }
+
+            live_vregs.model_instruction(ins, live_set);
+        }
+    }
+}
+
+void GraphColoringRegisterAllocation::coalesce() {
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto i = m_moves.begin(); i != m_moves.end(); i++) {
+            int a = find(get_node(i->first));
+            int b = find(get_node(i->second));
+            if (a == b || m_nodes[a].adj.count(b) > 0) {
+                continue;
+            }
+            if (can_coalesce(a, b)) {
+                merge(a, b);
+                changed = true;
+            }
+        }
+    }
+}
+
+bool GraphColoringRegisterAllocation::can_coalesce(int a, int b) const {
+    // Briggs: the merged node must have fewer than K neighbors of significant degree
+    unsigned allowed = m_nodes[a].allowed & m_nodes[b].allowed;
+    unsigned k = count_bits(allowed);
+    if (k == 0) {
+        return false;
+    }
+
+    std::set<int> neighbors(m_nodes[a].adj);
+    neighbors.insert(m_nodes[b].adj.begin(), m_nodes[b].adj.end());
+
+    unsigned significant = 0;
+    for (int n : neighbors) {
+        if (m_nodes[n].adj.size() >= k) {
+            significant++;
+        }
+    }
+    return significant < k;
+}
+
+void GraphColoringRegisterAllocation::merge(int a, int b) {
+    InterferenceNode &into = m_nodes[a];
+    InterferenceNode &from = m_nodes[b];
+
+    for (int n : from.adj) {
+        m_nodes[n].adj.erase(b);
+        add_edge(a, n);
+    }
+    from.adj.clear();
+    from.alias = a;
+    into.allowed &= from.allowed;
+    into.cost += from.cost;
+}
+
+void GraphColoringRegisterAllocation::color() {
+    const unsigned num_nodes = unsigned(m_nodes.size());
+    std::vector<unsigned> degree(num_nodes, 0);
+    std::vector<bool> removed(num_nodes, true);
+    unsigned remaining = 0;
+
+    for (unsigned n = 0; n < num_nodes; n++) {
+        if (m_nodes[n].alias < 0) {
+            degree[n] = unsigned(m_nodes[n].adj.size());
+            removed[n] = false;
+            remaining++;
+        }
+    }
+
+    // the nodes of insignificant degree: a node's degree only decreases,
+    // so once in the set it stays there until it's removed
+    std::set<unsigned> low_degree;
+    for (unsigned n = 0; n < num_nodes; n++) {
+        if (!removed[n] && degree[n] < count_bits(m_nodes[n].allowed)) {
+            low_degree.insert(n);
+        }
+    }
+
+    // simplify: repeatedly remove a node of insignificant degree (the
+    // first one); if there is none, optimistically remove the cheapest
+    // spill candidate
+    std::vector<int> stack;
+    while (remaining > 0) {
+        int chosen = -1;
+        if (!low_degree.empty()) {
+            chosen = int(*low_degree.begin());
+            low_degree.erase(low_degree.begin());
+        } else {
+            double best = 0.0;
+            for (unsigned n = 0; n < num_nodes; n++) {
+                if (removed[n]) {
+                    continue;
+                }
+                double spill_metric = m_nodes[n].cost / double(degree[n] + 1);
+                if (chosen < 0 || spill_metric < best) {
+                    chosen = int(n);
+                    best = spill_metric;
+                }
+            }
+        }
+
+        stack.push_back(chosen);
+        removed[chosen] = true;
+        remaining--;
+        for (int n : m_nodes[chosen].adj) {
+            degree[n]--;
+            if (!removed[n] && degree[n] + 1 == count_bits(m_nodes[n].allowed)) {
+                low_degree.insert(unsigned(n));
+            }
+        }
+    }
+
+    // select: assign each node the first register not used by a neighbor
+    while (!stack.empty()) {
+        InterferenceNode &node = m_nodes[stack.back()];
+        stack.pop_back();
+
+        unsigned used = 0;
+        for (int n : node.adj) {
+            if (m_nodes[n].color != RegisterAssignment::NONE) {
+                used |= mreg_bit(m_nodes[n].color);
+            }
+        }
+        for (int mreg : RegisterAssignment::get_allocatable_mregs()) {
+            if ((node.allowed & mreg_bit(mreg)) != 0 && (used & mreg_bit(mreg)) == 0) {
+                node.color = mreg;
+                break;
+            }
+        }
+    }
+}
+
+void GraphColoringRegisterAllocation::merge_moved_nodes() {
+    // The moves between nodes given the same register are removed, so
+    // merge the nodes they join (whether or not they were coalesced),
+    // renaming them to a single vreg; otherwise later passes would see
+    // the source as read only by its other uses, and the destination as
+    // never defined.  (Nodes given the same register don't interfere.)
+    for (auto i = m_moves.begin(); i != m_moves.end(); i++) {
+        int a = find(get_node(i->first));
+        int b = find(get_node(i->second));
+        if (a != b && m_nodes[a].color != RegisterAssignment::NONE && m_nodes[a].color == m_nodes[b].color) {
+            m_nodes[b].alias = a;
+        }
+    }
+}
+
+void GraphColoringRegisterAllocation::assign() {
+    m_assignment = new RegisterAssignment();
+
+    // each spilled node gets its own spill slot
+    std::vector<int> node_slot(m_nodes.size(), RegisterAssignment::NONE);
+    int num_slots = 0;
+
+    for (unsigned vreg = 0; vreg < m_vreg_to_node.size(); vreg++) {
+        if (m_vreg_to_node[vreg] < 0) {
+            continue;
+        }
+        int n = find(m_vreg_to_node[vreg]);
+        if (m_nodes[n].color != RegisterAssignment::NONE) {
+            m_assignment->assign_mreg(int(vreg), m_nodes[n].color);
+        } else {
+            if (node_slot[n] == RegisterAssignment::NONE) {
+                node_slot[n] = num_slots++;
+            }
+            m_assignment->assign_spill_slot(int(vreg), node_slot[n]);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// LinearScanRegisterAllocation implementation
+////////////////////////////////////////////////////////////////////////
+
+LinearScanRegisterAllocation::LinearScanRegisterAllocation(ControlFlowGraph *cfg)
+        : ControlFlowGraphTransform(cfg)
+        , m_assignment(nullptr) {
+}
+
+LinearScanRegisterAllocation::~LinearScanRegisterAllocation() {
+}
+
+void LinearScanRegisterAllocation::execute() {
+    build_ranges();
+    build_intervals();
+    allocate_registers();
+    allocate_spill_slots();
+    merge_moved_intervals();
+
+    m_assignment = new RegisterAssignment();
+    for (auto i = m_intervals.begin(); i != m_intervals.end(); i++) {
+        if (i->mreg != RegisterAssignment::NONE) {
+            m_assignment->assign_mreg(i->vreg, i->mreg);
+        } else {
+            m_assignment->assign_spill_slot(i->vreg, i->spill_slot);
+        }
+    }
+}
+
+InstructionSequence *LinearScanRegisterAllocation::transform_basic_block(InstructionSequence *iseq) {
+    assert(m_assignment != nullptr);
+    auto out = new InstructionSequence();
+
+    auto ranges = m_operand_ranges.find(iseq);
+    unsigned index = 0;
+    for (auto ins : *iseq) {
+        Instruction *hin = ins->duplicate();
+
+        // rename each vreg to the vreg of its web
+        assert(ranges != m_operand_ranges.end());
+        const std::vector<int> &ins_ranges = ranges->second[index++];
+        for (unsigned j = 0; j < hin->get_num_operands(); j++) {
+            Operand operand = hin->get_operand(j);
+            if (ins_ranges[2*j] >= 0) {
+                operand.set_base_reg(m_intervals[m_range_interval[find(ins_ranges[2*j])]].vreg);
+            }
+            if (ins_ranges[2*j + 1] >= 0) {
+                operand.set_index_reg(m_intervals[m_range_interval[find(ins_ranges[2*j + 1])]].vreg);
+            }
+            (*hin)[j] = operand;
+        }
+
+        if (regalloc_is_redundant_move(hin, m_assignment)) {
+            delete hin;
+        } else {
+            out->add_instruction(hin);
+        }
+    }
+
+    keep_nonempty(out, iseq, HINS_NOP);
+
+    return out;
+}
+
+int LinearScanRegisterAllocation::new_range(int vreg) {
+    int range = int(m_range_parent.size());
+    m_range_parent.push_back(range);
+    m_range_start.push_back(INT_MAX);
+    m_range_end.push_back(-1);
+    m_range_vreg.push_back(vreg);
+    return range;
+}
+
+int LinearScanRegisterAllocation::find(int range) {
+    while (m_range_parent[range] != range) {
+        m_range_parent[range] = m_range_parent[m_range_parent[range]];
+        range = m_range_parent[range];
+    }
+    return range;
+}
+
+void LinearScanRegisterAllocation::join(int a, int b) {
+    a = find(a);
+    b = find(b);
+    if (a != b) {
+        m_range_parent[b] = a;
+    }
+}
+
+void LinearScanRegisterAllocation::extend(int range, int pos) {
+    m_range_start[range] = std::min(m_range_start[range], pos);
+    m_range_end[range] = std::max(m_range_end[range], pos);
+}
+
+void LinearScanRegisterAllocation::build_ranges() {
+    ControlFlowGraph *cfg = get_orig_cfg();
+
+    // instruction positions are in the order in which the blocks are
+    // emitted when the CFG is flattened
+    ControlFlowGraph::BlockList order = cfg->get_block_order();
+
+    LiveVregs live_vregs(cfg);
+    live_vregs.execute();
+
+    const unsigned num_vregs = HighLevel::get_num_vregs(cfg);
+
+    // (vreg, live range) pairs for the vregs live into/out of each block,
+    // sorted by vreg; a vreg live out of a block is only listed in its
+    // out_ranges if its range differs from the one live into the block
+    // (i.e., if the block redefines it), since most vregs live across a
+    // block are live through it untouched
+    typedef std::vector<std::pair<int, int> > BlockRanges;
+    std::vector<BlockRanges> in_ranges(cfg->get_num_blocks()), out_ranges(cfg->get_num_blocks());
+    std::vector<int> live_in_range(num_vregs, -1);
+    std::vector<int> cur(num_vregs, -1);
+    std::vector<int> touched;   // vregs whose entry in cur must be reset after each block
+
+    // Within a block, every def starts a new live range, and uses belong to
+    // the range of the most recent def (or to the range live into the block)
+    int index = 0;
+    for (auto i = order.begin(); i != order.end(); i++) {
+        BasicBlock *bb = *i;
+        int first = index, last = index + int(bb->get_length()) - 1;
+        for (auto v : touched) {
+            cur[v] = live_in_range[v] = -1;
+        }
+        touched.clear();
+
+        const LiveVregs::LiveSet &live_in = live_vregs.get_fact_at_beginning_of_block(bb);
+        BlockRanges &block_in = in_ranges[bb->get_id()];
+        block_in.reserve(live_in.count());
+        for (unsigned v = live_in.find_first(); v != BitVector::NPOS; v = live_in.find_next(v + 1)) {
+            cur[v] = live_in_range[v] = new_range(v);
+            block_in.push_back(std::make_pair(int(v), cur[v]));
+            touched.push_back(v);
+            if (last >= first) {
+                extend(cur[v], 2*first);
+            }
+        }
+
+        OperandRanges &ranges = m_operand_ranges[bb];
+        for (auto j = bb->cbegin(); j != bb->cend(); j++, index++) {
+            Instruction *ins = *j;
+            if (is_call(ins)) {
+                m_calls.push_back(2*index);
+            }
+
+            std::vector<int> ins_ranges(2 * ins->get_num_operands(), -1);
+            for (unsigned k = 0; k < ins->get_num_operands(); k++) {
+                if (!HighLevel::is_use(ins, k)) {
+                    continue;
+                }
+                Operand operand = ins->get_operand(k);
+                int regs[2] = { operand.get_base_reg(), operand.has_index_reg() ? operand.get_index_reg() : -1 };
+                for (unsigned r = 0; r < 2; r++) {
+                    int v = regs[r];
+                    if (v < 0) {
+                        continue;
+                    }
+                    if (cur[v] < 0) {
+                        cur[v] = new_range(v);
+                        touched.push_back(v);
+                    }
+                    ins_ranges[2*k + r] = cur[v];
+                    extend(cur[v], 2*index);
+                }
+            }
+
+            if (HighLevel::is_def(ins)) {
+                int v = ins->get_operand(0).get_base_reg();
+                cur[v] = new_range(v);
+                touched.push_back(v);
+                ins_ranges[0] = cur[v];
+                extend(cur[v], 2*index + 1);
+
+                if (ins->get_opcode() == HINS_MOV && ins->get_operand(1).get_kind() == OPERAND_VREG) {
+                    m_move_ranges.push_back(std::make_pair(ins_ranges[0], ins_ranges[2]));
+                }
+            }
+
+            ranges.push_back(ins_ranges);
+        }
+
+        const LiveVregs::LiveSet &live_out = live_vregs.get_fact_at_end_of_block(bb);
+        for (unsigned v = live_out.find_first(); v != BitVector::NPOS; v = live_out.find_next(v + 1)) {
+            if (cur[v] < 0) {
+                cur[v] = new_range(v);
+                touched.push_back(v);
+            }
+            if (cur[v] != live_in_range[v]) {
+                out_ranges[bb->get_id()].push_back(std::make_pair(int(v), cur[v]));
+            }
+            if (last >= first) {
+                extend(cur[v], 2*last + 1);
+            }
+        }
+    }
+
+    // ranges connected by a control flow edge belong to the same web: each
+    // vreg live into the successor is live out of the predecessor, either
+    // in a range listed in its out_ranges or in the range live into it
+    for (auto i = order.begin(); i != order.end(); i++) {
+        BasicBlock *bb = *i;
+        const BlockRanges &pred_in = in_ranges[bb->get_id()];
+        const BlockRanges &pred_out = out_ranges[bb->get_id()];
+        const ControlFlowGraph::EdgeList &outgoing_edges = cfg->get_outgoing_edges(bb);
+        for (auto j = outgoing_edges.cbegin(); j != outgoing_edges.cend(); j++) {
+            BasicBlock *succ = (*j)->get_target();
+            const BlockRanges &succ_in = in_ranges[succ->get_id()];
+            auto in = pred_in.begin(), out = pred_out.begin();
+            for (auto k = succ_in.begin(); k != succ_in.end(); k++) {
+                while (out != pred_out.end() && out->first < k->first) {
+                    out++;
+                }
+                if (out != pred_out.end() && out->first == k->first) {
+                    join(out->second, k->second);
+                    continue;
+                }
+                while (in != pred_in.end() && in->first < k->first) {
+                    in++;
+                }
+                assert(in != pred_in.end() && in->first == k->first);
+                join(in->second, k->second);
+            }
+        }
+    }
+}
+
+void LinearScanRegisterAllocation::build_intervals() {
+    const int num_ranges = int(m_range_parent.size());
+    m_range_interval.assign(num_ranges, -1);
+
+    // the first web of each vreg keeps its number, the others are renumbered
+    int next_vreg = 0;
+    for (int r = 0; r < num_ranges; r++) {
+        next_vreg = std::max(next_vreg, m_range_vreg[r] + 1);
+    }
+    std::set<int> named;
+
+    for (int r = 0; r < num_ranges; r++) {
+        int root = find(r);
+        if (m_range_interval[root] < 0) {
+            LiveInterval interval;
+            int vreg = m_range_vreg[root];
+            interval.vreg = named.insert(vreg).second ? vreg : next_vreg++;
+            interval.start = INT_MAX;
+            interval.end = -1;
+            interval.hint = -1;
+            interval.mreg = RegisterAssignment::NONE;
+            interval.spill_slot = RegisterAssignment::NONE;
+            m_range_interval[root] = int(m_intervals.size());
+            m_intervals.push_back(interval);
+        }
+        LiveInterval &interval = m_intervals[m_range_interval[root]];
+        interval.start = std::min(interval.start, m_range_start[r]);
+        interval.end = std::max(interval.end, m_range_end[r]);
+    }
+
+    for (auto i = m_intervals.begin(); i != m_intervals.end(); i++) {
+        i->crosses_call = crosses_call(*i);
+    }
+
+    for (auto i = m_move_ranges.begin(); i != m_move_ranges.end(); i++) {
+        int dest = m_range_interval[find(i->first)];
+        int src = m_range_interval[find(i->second)];
+        if (dest != src) {
+            m_intervals[dest].hint = src;
+        }
+    }
+}
+
+void LinearScanRegisterAllocation::merge_moved_intervals() {
+    // The moves between intervals with the same location are removed, so
+    // rename the intervals they join to a single vreg; otherwise later
+    // passes would see the source as dead and the destination as never
+    // defined.  (Intervals sharing a location never overlap.)
+    std::vector<int> parent(m_intervals.size());
+    for (unsigned i = 0; i < parent.size(); i++) {
+        parent[i] = int(i);
+    }
+    auto root = [&parent](int n) {
+        while (parent[n] != n) {
+            n = parent[n] = parent[parent[n]];
+        }
+        return n;
+    };
+
+    for (auto i = m_move_ranges.begin(); i != m_move_ranges.end(); i++) {
+        int dest = root(m_range_interval[find(i->first)]);
+        int src = root(m_range_interval[find(i->second)]);
+        const LiveInterval &a = m_intervals[dest], &b = m_intervals[src];
+        bool allocated = (a.mreg != RegisterAssignment::NONE || a.spill_slot != RegisterAssignment::NONE);
+        if (dest != src && allocated && a.mreg == b.mreg && a.spill_slot == b.spill_slot) {
+            parent[dest] = src;
+        }
+    }
+
+    for (unsigned i = 0; i < m_intervals.size(); i++) {
+        m_intervals[i].vreg = m_intervals[root(int(i))].vreg;
+    }
+}
+
+bool LinearScanRegisterAllocation::crosses_call(const LiveInterval &interval) const {
+    // only the first call at or after the start of the interval matters:
+    // if the interval doesn't survive it, it can't reach any later call
+    auto i = std::lower_bound(m_calls.begin(), m_calls.end(), interval.start);
+    if (i == m_calls.end()) {
+        return false;
+    }
+    return interval.end >= *i + 1;
+}
+
+void LinearScanRegisterAllocation::allocate_registers() {
+    std::vector<int> order;
+    for (unsigned i = 0; i < m_intervals.size(); i++) {
+        if (m_intervals[i].start <= m_intervals[i].end) {
+            order.push_back(int(i));
+        }
+    }
+    std::sort(order.begin(), order.end(), [this](int a, int b) {
+        return m_intervals[a].start < m_intervals[b].start;
+    });
+
+    const unsigned all_mregs = allocatable_mask();
+    const unsigned callee_saved = callee_saved_mask();
+    unsigned free = all_mregs;
+
+    // active intervals (which have a register), ordered by end position
+    std::multimap<int, int> active;
+
+    for (auto i = order.begin(); i != order.end(); i++) {
+        LiveInterval &cur = m_intervals[*i];
+
+        // expire intervals which ended before this one starts
+        while (!active.empty() && active.begin()->first < cur.start) {
+            free |= mreg_bit(m_intervals[active.begin()->second].mreg);
+            active.erase(active.begin());
+        }
+
+        unsigned allowed = free & (cur.crosses_call ? callee_saved : all_mregs);
+        if (cur.hint >= 0 && m_intervals[cur.hint].mreg != RegisterAssignment::NONE &&
+            (allowed & mreg_bit(m_intervals[cur.hint].mreg)) != 0) {
+            // a copy can share the register of its (expired) source
+            cur.mreg = m_intervals[cur.hint].mreg;
+        } else {
+            for (int mreg : RegisterAssignment::get_allocatable_mregs()) {
+                if ((allowed & mreg_bit(mreg)) != 0) {
+                    cur.mreg = mreg;
+                    break;
+                }
+            }
+        }
+
+        if (cur.mreg != RegisterAssignment::NONE) {
+            free &= ~mreg_bit(cur.mreg);
+            active.insert(std::make_pair(cur.end, *i));
+            continue;
+        }
+
+        // no register is free: spill whichever usable interval ends last
+        unsigned usable = cur.crosses_call ? callee_saved : all_mregs;
+        for (auto j = active.rbegin(); j != active.rend(); j++) {
+            LiveInterval &other = m_intervals[j->second];
+            if ((usable & mreg_bit(other.mreg)) == 0) {
+                continue;
+            }
+            if (other.end > cur.end) {
+                cur.mreg = other.mreg;
+                other.mreg = RegisterAssignment::NONE;
+                active.erase(std::next(j).base());
+                active.insert(std::make_pair(cur.end, *i));
+            }
+            break;
+        }
+    }
+}
+
+void LinearScanRegisterAllocation::allocate_spill_slots() {
+    std::vector<int> spilled;
+    for (unsigned i = 0; i < m_intervals.size(); i++) {
+        if (m_intervals[i].mreg == RegisterAssignment::NONE) {
+            spilled.push_back(int(i));
+        }
+    }
+    std::sort(spilled.begin(), spilled.end(), [this](int a, int b) {
+        return m_intervals[a].start < m_intervals[b].start;
+    });
+
+    // a slot is reused once the interval occupying it has ended
+    std::multimap<int, int> active;     // end position -> spill slot
+    std::set<int> free_slots;
+    int num_slots = 0;
+
+    for (auto i = spilled.begin(); i != spilled.end(); i++) {
+        LiveInterval &cur = m_intervals[*i];
+
+        while (!active.empty() && active.begin()->first < cur.start) {
+            free_slots.insert(active.begin()->second);
+            active.erase(active.begin());
+        }
+
+        if (free_slots.empty()) {
+            cur.spill_slot = num_slots++;
+        } else {
+            cur.spill_slot = *free_slots.begin();
+            free_slots.erase(free_slots.begin());
+        }
+        active.insert(std::make_pair(cur.end, cur.spill_slot));
+    }
+}
@@ -0,0 +1,166 @@
+#ifndef REGALLOC_H
+#define REGALLOC_H
+
+#include <vector>
+#include <set>
+#include <map>
+#include "cfg.h"
+#include "cfg_transform.h"
+#include "live_vregs.h"
+
+// The result of register allocation: every vreg is either assigned
+// a machine register, or a spill slot in the stack frame.
+class RegisterAssignment {
+public:
+    static const int NONE = -1;
+
+private:
+    std::vector<int> m_mregs;           // mreg assigned to each vreg (or NONE)
+    std::vector<int> m_spill_slots;     // spill slot assigned to each vreg (or NONE)
+    unsigned m_num_spill_slots;
+
+public:
+    RegisterAssignment();
+    ~RegisterAssignment();
+
+    void assign_mreg(int vreg, int mreg);
+    void assign_spill_slot(int vreg, int slot);
+
+    bool has_mreg(int vreg) const;
+    int get_mreg(int vreg) const;
+    bool has_spill_slot(int vreg) const;
+    int get_spill_slot(int vreg) const;
+
+    // number of distinct spill slots needed in the stack frame
+    unsigned get_num_spill_slots() const { return m_num_spill_slots; }
+
+    // is the given machine register assigned to at least one vreg?
+    bool uses_mreg(int mreg) const;
+
+    // machine registers available to the allocators, in order of preference;
+    // %rax/%rdx (division), %r10/%r11 (scratch) and %rsp are never allocated
+    static const std::vector<int> &get_allocatable_mregs();
+
+    // is the given machine register preserved across calls?
+    static bool is_callee_saved(int mreg);
+};
+
+// Graph-coloring register allocator.  An interference graph is built from
+// the LiveVregs facts, HINS_MOV instructions are coalesced conservatively
+// (Briggs), and nodes are colored optimistically, choosing spill candidates
+// by lowest (uses + defs) / degree, where uses and defs in loops count for
+// more.  Vregs live across a call are restricted to callee-saved registers.
+//
+// Call execute() to compute the allocation, then transform_cfg() to obtain
+// a copy of the CFG in which coalesced vregs (and vregs joined by a move
+// which were given the same register) are renamed to a single vreg, and
+// the moves between them are removed.
+class GraphColoringRegisterAllocation : public ControlFlowGraphTransform {
+private:
+    struct InterferenceNode {
+        int vreg;               // representative vreg
+        std::set<int> adj;      // neighbors (node indices)
+        unsigned allowed;       // bitmask of mregs this node may be assigned
+        double cost;            // spill cost
+        int alias;              // node this was coalesced into (or -1)
+        int color;              // assigned mreg (or NONE)
+    };
+
+    std::vector<InterferenceNode> m_nodes;
+    std::vector<int> m_vreg_to_node;
+    std::vector<std::pair<int, int> > m_moves;
+    RegisterAssignment *m_assignment;
+
+public:
+    GraphColoringRegisterAllocation(ControlFlowGraph *cfg);
+    virtual ~GraphColoringRegisterAllocation();
+
+    // compute the register assignment
+    void execute();
+
+    RegisterAssignment *get_assignment() const { return m_assignment; }
+
+    virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq);
+
+private:
+    int get_node(int vreg);
+    int find(int node) const;
+    int get_representative(int vreg) const;
+    void add_edge(int a, int b);
+    void build();
+    void coalesce();
+    bool can_coalesce(int a, int b) const;
+    void merge(int a, int b);
+    void color();
+    void merge_moved_nodes();
+    void assign();
+};
+
+// Linear-scan register allocator, for when compile time matters more
+// than code quality.  Live intervals are computed over the flattened
+// InstructionSequence produced by ControlFlowGraph::create_instruction_sequence.
+// Each vreg is first split at its lifetime holes into webs (maximal sets of
+// connected live ranges), and every web is renamed to its own vreg, so that
+// reused temporaries get independent intervals.  Intervals are then
+// assigned registers in order of start position, spilling the interval
+// with the furthest end when no register is free; spilled intervals share
+// stack slots whenever their lifetimes do not overlap.
+//
+// Call execute() to compute the allocation, then transform_cfg() to obtain
+// a copy of the CFG with renamed vregs and without redundant moves.
+class LinearScanRegisterAllocation : public ControlFlowGraphTransform {
+private:
+    // Positions: instruction i of the flattened sequence reads its
+    // operands at 2i and writes its destination at 2i+1.
+    struct LiveInterval {
+        int vreg;           // vreg the web is renamed to
+        int start, end;     // first and last position at which the web is live
+        bool crosses_call;  // must be assigned a callee-saved register
+        int hint;           // interval this one is a copy of (or -1)
+        int mreg;           // assigned mreg (or NONE)
+        int spill_slot;     // assigned spill slot (or NONE)
+    };
+
+    // live range numbers of the base and index register of each operand,
+    // for each instruction of each basic block
+    typedef std::vector<std::vector<int> > OperandRanges;
+    std::map<InstructionSequence *, OperandRanges> m_operand_ranges;
+
+    std::vector<int> m_range_parent;    // union-find over live ranges
+    std::vector<int> m_range_start, m_range_end;
+    std::vector<int> m_range_vreg;
+    std::vector<int> m_range_interval;
+    std::vector<std::pair<int, int> > m_move_ranges;  // (dest, src) ranges of vreg moves
+    std::vector<LiveInterval> m_intervals;
+    std::vector<int> m_calls;           // positions of calls (including readi/writei)
+    RegisterAssignment *m_assignment;
+
+public:
+    LinearScanRegisterAllocation(ControlFlowGraph *cfg);
+    virtual ~LinearScanRegisterAllocation();
+
+    // compute the register assignment
+    void execute();
+
+    RegisterAssignment *get_assignment() const { return m_assignment; }
+
+    virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq);
+
+private:
+    int new_range(int vreg);
+    int find(int range);
+    void join(int a, int b);
+    void extend(int range, int pos);
+    void build_ranges();
+    void build_intervals();
+    bool crosses_call(const LiveInterval &interval) const;
+    void allocate_registers();
+    void allocate_spill_slots();
+    void merge_moved_intervals();
+};
+
+// Returns true if the instruction is a HINS_MOV between two vregs that
+// were given the same location, and can therefore be removed.
+bool regalloc_is_redundant_move(Instruction *ins, const RegisterAssignment *assignment);
+
+#endif // REGALLOC_H
@@ -0,0 +1,146 @@
+// Runtime library linked with the generated code, which calls
+// rt_read_int for READ and rt_write_int for WRITE:
+//
+//   gcc -no-pie -o prog prog.s runtime.o
+//
+// Input and output are buffered, so each READ or WRITE is a plain call
+// (no format string to interpret) and system calls are only made once
+// per buffer.  The output is flushed when the program exits, and before
+// waiting for more input, so that prompts appear before a READ blocks.
+
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define RT_INPUT_SIZE  (1 << 16)
+#define RT_OUTPUT_SIZE (1 << 16)
+
+// the longest number written: 20 characters for LONG_MIN, and a newline
+#define RT_MAX_INT_CHARS 21
+
+static char s_input[RT_INPUT_SIZE];
+static unsigned s_input_pos, s_input_end;
+static int s_input_eof;
+
+static char s_output[RT_OUTPUT_SIZE];
+static unsigned s_output_len;
+
+static void rt_flush(void) {
+  unsigned pos = 0;
+  while (pos < s_output_len) {
+    ssize_t n = write(1, s_output + pos, s_output_len - pos);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    pos += (unsigned) n;
+  }
+  s_output_len = 0;
+}
+
+// output is also flushed by exit (or a return from main)
+__attribute__((destructor))
+static void rt_fini(void) {
+  rt_flush();
+}
+
+// refill the input buffer; returns 0 at the end of the input
+static int rt_fill(void) {
+  if (s_input_eof) {
+    return 0;
+  }
+  rt_flush();
+  for (;;) {
+    ssize_t n = read(0, s_input, RT_INPUT_SIZE);
+    if (n > 0) {
+      s_input_pos = 0;
+      s_input_end = (unsigned) n;
+      return 1;
+    }
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    s_input_eof = 1;
+    return 0;
+  }
+}
+
+// the next input character (without consuming it), or -1 at the end of the input
+static int rt_peek(void) {
+  if (s_input_pos == s_input_end && !rt_fill()) {
+    return -1;
+  }
+  return (unsigned char) s_input[s_input_pos];
+}
+
+// Read a decimal integer, skipping leading whitespace, like scanf's "%ld":
+// a value out of range is clamped to LONG_MIN or LONG_MAX.  Returns 0 if
+// the input doesn't start with an integer (or has ended).
+long rt_read_int(void) {
+  int c = rt_peek();
+  while (c == ' ' || (c >= '\t' && c <= '\r')) {
+    s_input_pos++;
+    c = rt_peek();
+  }
+
+  int negative = 0;
+  if (c == '-' || c == '+') {
+    negative = (c == '-');
+    s_input_pos++;
+    c = rt_peek();
+  }
+
+  const unsigned long limit = negative ? (unsigned long) LONG_MAX + 1 : (unsigned long) LONG_MAX;
+  unsigned long value = 0;
+  int overflow = 0;
+  while (c >= '0' && c <= '9') {
+    // scan the digits in the buffer without checking for its end
+    const char *p = s_input + s_input_pos;
+    const char *end = s_input + s_input_end;
+    while (p < end && *p >= '0' && *p <= '9') {
+      unsigned digit = (unsigned) (*p - '0');
+      if (value > (limit - digit) / 10) {
+        overflow = 1;
+      } else {
+        value = value * 10 + digit;
+      }
+      p++;
+    }
+    s_input_pos = (unsigned) (p - s_input);
+    c = rt_peek();
+  }
+
+  if (overflow) {
+    return negative ? LONG_MIN : LONG_MAX;
+  }
+  return negative ? (long) (0UL - value) : (long) value;
+}
+
+// Write an integer followed by a newline, like printf's "%ld\n"
+void rt_write_int(long value) {
+  if (RT_OUTPUT_SIZE - s_output_len < RT_MAX_INT_CHARS) {
+    rt_flush();
+  }
+
+  // convert the digits backwards into a temporary buffer
+  char digits[RT_MAX_INT_CHARS];
+  char *p = digits + RT_MAX_INT_CHARS;
+  unsigned long magnitude = value < 0 ? 0UL - (unsigned long) value : (unsigned long) value;
+  *--p = '\n';
+  do {
+    *--p = (char) ('0' + magnitude % 10);
+    magnitude /= 10;
+  } while (magnitude != 0);
+  if (value < 0) {
+    *--p = '-';
+  }
+
+  char *out = s_output + s_output_len;
+  const char *end = digits + RT_MAX_INT_CHARS;
+  while (p < end) {
+    *out++ = *p++;
+  }
+  s_output_len = (unsigned) (out - s_output);
+}
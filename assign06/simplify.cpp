@@ -0,0 +1,194 @@
+#include <climits>
+#include <utility>
+#include "cfg.h"
+#include "highlevel.h"
+#include "simplify.h"
+
+namespace {
+    bool is_literal(const Operand &op) {
+        return op.get_kind() == OPERAND_INT_LITERAL;
+    }
+
+    bool is_literal(const Operand &op, long value) {
+        return is_literal(op) && op.get_int_value() == value;
+    }
+
+    bool is_same_vreg(const Operand &a, const Operand &b) {
+        return a.get_kind() == OPERAND_VREG && b.get_kind() == OPERAND_VREG &&
+               a.get_base_reg() == b.get_base_reg();
+    }
+
+    // k if value is 2^k for k in 1..30 (so that 2^k and -2^k are valid
+    // immediates), otherwise 0
+    int get_shift(long value) {
+        if (value < 2 || value > (1L << 30) || (value & (value - 1)) != 0) {
+            return 0;
+        }
+        return __builtin_ctzl((unsigned long) value);
+    }
+
+    Operand literal(long value) {
+        return Operand(OPERAND_INT_LITERAL, value);
+    }
+}
+
+AlgebraicSimplification::AlgebraicSimplification(ControlFlowGraph *cfg)
+        : ControlFlowGraphTransform(cfg) {
+}
+
+AlgebraicSimplification::~AlgebraicSimplification() {
+}
+
+InstructionSequence *AlgebraicSimplification::transform_basic_block(InstructionSequence *iseq) {
+    auto out = new InstructionSequence();
+    for (auto i = iseq->cbegin(); i != iseq->cend(); i++) {
+        if (!simplify(*i, out)) {
+            out->add_instruction((*i)->duplicate());
+        }
+    }
+    return out;
+}
+
+bool AlgebraicSimplification::simplify(Instruction *ins, InstructionSequence *out) {
+    int opcode = ins->get_opcode();
+    switch (opcode) {
+        case HINS_INT_ADD: case HINS_INT_SUB: case HINS_INT_MUL:
+        case HINS_INT_DIV: case HINS_INT_MOD: case HINS_INT_AND:
+        case HINS_INT_SHL: case HINS_INT_SHR: case HINS_INT_SAR:
+            break;
+        default:
+            return false;
+    }
+
+    Operand dest = ins->get_operand(0), a = ins->get_operand(1), b = ins->get_operand(2);
+    if (dest.get_kind() != OPERAND_VREG) {
+        return false;
+    }
+
+    long value;
+    if (is_literal(a) && is_literal(b)) {
+        if (!fold(opcode, a.get_int_value(), b.get_int_value(), value) ||
+            value < INT_MIN || value > INT_MAX) {
+            return false;
+        }
+        out->add_instruction(new Instruction(HINS_LOAD_ICONST, dest, literal(value)));
+        return true;
+    }
+
+    // the literal operand of a commutative operation is the second one
+    if ((opcode == HINS_INT_ADD || opcode == HINS_INT_MUL || opcode == HINS_INT_AND) && is_literal(a)) {
+        std::swap(a, b);
+    }
+
+    Instruction *result = nullptr;
+    switch (opcode) {
+        case HINS_INT_ADD:
+        case HINS_INT_SHL:
+        case HINS_INT_SHR:
+        case HINS_INT_SAR:
+            if (is_literal(b, 0)) {
+                result = new Instruction(HINS_MOV, dest, a);
+            }
+            break;
+
+        case HINS_INT_SUB:
+            if (is_literal(b, 0)) {
+                result = new Instruction(HINS_MOV, dest, a);
+            } else if (is_same_vreg(a, b)) {
+                result = new Instruction(HINS_LOAD_ICONST, dest, literal(0));
+            }
+            break;
+
+        case HINS_INT_MUL:
+            if (is_literal(b, 0)) {
+                result = new Instruction(HINS_LOAD_ICONST, dest, literal(0));
+            } else if (is_literal(b, 1)) {
+                result = new Instruction(HINS_MOV, dest, a);
+            } else if (is_literal(b, -1)) {
+                result = new Instruction(HINS_INT_SUB, dest, literal(0), a);
+            } else if (is_literal(b) && get_shift(b.get_int_value()) > 0) {
+                result = new Instruction(HINS_INT_SHL, dest, a, literal(get_shift(b.get_int_value())));
+            }
+            break;
+
+        case HINS_INT_AND:
+            if (is_literal(b, 0)) {
+                result = new Instruction(HINS_LOAD_ICONST, dest, literal(0));
+            } else if (is_literal(b, -1)) {
+                result = new Instruction(HINS_MOV, dest, a);
+            }
+            break;
+
+        case HINS_INT_DIV:
+            if (is_literal(b, 1)) {
+                result = new Instruction(HINS_MOV, dest, a);
+            } else {
+                return simplify_division(ins, out);
+            }
+            break;
+
+        case HINS_INT_MOD:
+            if (is_literal(b, 1)) {
+                result = new Instruction(HINS_LOAD_ICONST, dest, literal(0));
+            } else {
+                return simplify_division(ins, out);
+            }
+            break;
+    }
+
+    if (result == nullptr) {
+        return false;
+    }
+    out->add_instruction(result);
+    return true;
+}
+
+bool AlgebraicSimplification::simplify_division(Instruction *ins, InstructionSequence *out) {
+    Operand dest = ins->get_operand(0), x = ins->get_operand(1), divisor = ins->get_operand(2);
+    if (x.get_kind() != OPERAND_VREG || is_same_vreg(dest, x) || !is_literal(divisor)) {
+        return false;
+    }
+    long d = divisor.get_int_value();
+    int k = get_shift(d < 0 ? -d : d);
+    if (k == 0) {
+        return false;
+    }
+
+    // dest = bias, then dest = x + bias
+    out->add_instruction(new Instruction(HINS_INT_SAR, dest, x, literal(63)));
+    out->add_instruction(new Instruction(HINS_INT_SHR, dest, dest, literal(64 - k)));
+    out->add_instruction(new Instruction(HINS_INT_ADD, dest, x, dest));
+
+    if (ins->get_opcode() == HINS_INT_DIV) {
+        out->add_instruction(new Instruction(HINS_INT_SAR, dest, dest, literal(k)));
+        if (d < 0) {
+            out->add_instruction(new Instruction(HINS_INT_SUB, dest, literal(0), dest));
+        }
+    } else {
+        out->add_instruction(new Instruction(HINS_INT_AND, dest, dest, literal(-(1L << k))));
+        out->add_instruction(new Instruction(HINS_INT_SUB, dest, x, dest));
+    }
+    return true;
+}
+
+bool AlgebraicSimplification::fold(int opcode, long a, long b, long &result) {
+    // arithmetic wraps (as it does in the generated code)
+    unsigned long ua = (unsigned long) a, ub = (unsigned long) b;
+    switch (opcode) {
+        case HINS_INT_ADD: result = long(ua + ub); return true;
+        case HINS_INT_SUB: result = long(ua - ub); return true;
+        case HINS_INT_MUL: result = long(ua * ub); return true;
+        case HINS_INT_AND: result = long(ua & ub); return true;
+        case HINS_INT_SHL: result = long(ua << (ub & 63)); return true;
+        case HINS_INT_SHR: result = long(ua >> (ub & 63)); return true;
+        case HINS_INT_SAR: result = a >> (ub & 63); return true;
+        default: break;
+    }
+
+    // leave division by zero (and overflowing division) to happen at runtime
+    if (b == 0 || (a == LONG_MIN && b == -1)) {
+        return false;
+    }
+    result = (opcode == HINS_INT_DIV) ? a / b : a % b;
+    return true;
+}
@@ -0,0 +1,40 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include "cfg.h"
+#include "cfg_transform.h"
+
+// Algebraic simplification of high-level code.  Arithmetic on two
+// literals is folded into a ldci, and operations with an identity or
+// zero operand (x+0, x-0, x*1, x*0, x&-1, x&0, shifts by 0) become moves
+// or constants.  Multiplication by a power of two becomes a left shift
+// (which instruction selection can still fold into an address).
+//
+// Signed division and remainder by a power of two 2^k become shifts and
+// masks.  Since the quotient is rounded towards zero, a negative dividend
+// is first biased by 2^k-1, computed without a branch as
+//
+//   bias = (x >> 63) >>> (64 - k)       (arithmetic, then logical shift)
+//   x / 2^k = (x + bias) >> k           (negated for a divisor of -2^k)
+//   x % 2^k = x - ((x + bias) & -2^k)   (the sign of the divisor doesn't matter)
+//
+// The destination vreg holds the intermediate values, so no new vregs are
+// needed (and the pass can run before naive register allocation sizes the
+// frame); an instruction whose destination is also the dividend is left
+// alone.  Division by -1 is left alone too, since it traps on overflow.
+//
+// Call transform_cfg().
+class AlgebraicSimplification : public ControlFlowGraphTransform {
+public:
+    AlgebraicSimplification(ControlFlowGraph *cfg);
+    virtual ~AlgebraicSimplification();
+
+    virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq);
+
+private:
+    static bool simplify(Instruction *ins, InstructionSequence *out);
+    static bool simplify_division(Instruction *ins, InstructionSequence *out);
+    static bool fold(int opcode, long a, long b, long &result);
+};
+
+#endif // SIMPLIFY_H
@@ -0,0 +1,775 @@
+#include <cassert>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include "cfg.h"
+#include "highlevel.h"
+#include "bitvector.h"
+#include "live_vregs.h"
+#include "loops.h"
+#include "ssa.h"
+
+namespace {
+    bool has_lower_id(BasicBlock *a, BasicBlock *b) {
+        return a->get_id() < b->get_id();
+    }
+
+    bool is_branch(Instruction *ins) {
+        return ins->get_opcode() != HINS_CALL && ins->get_num_operands() == 1 &&
+               (*ins)[0].get_kind() == OPERAND_LABEL;
+    }
+
+    int invert_jump(int opcode) {
+        switch (opcode) {
+            case HINS_JE:   return HINS_JNE;
+            case HINS_JNE:  return HINS_JE;
+            case HINS_JLT:  return HINS_JGTE;
+            case HINS_JGTE: return HINS_JLT;
+            case HINS_JLTE: return HINS_JGT;
+            case HINS_JGT:  return HINS_JLTE;
+            default:
+                assert(false);
+                return opcode;
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// SSA implementation
+////////////////////////////////////////////////////////////////////////
+
+ControlFlowGraph::BlockList SSA::get_predecessors(ControlFlowGraph *cfg, BasicBlock *bb) {
+    ControlFlowGraph::BlockList preds;
+    const ControlFlowGraph::EdgeList &incoming = cfg->get_incoming_edges(bb);
+    for (auto i = incoming.cbegin(); i != incoming.cend(); i++) {
+        preds.push_back((*i)->get_source());
+    }
+    std::sort(preds.begin(), preds.end(), has_lower_id);
+    return preds;
+}
+
+////////////////////////////////////////////////////////////////////////
+// SSAConstruction implementation
+////////////////////////////////////////////////////////////////////////
+
+SSAConstruction::SSAConstruction(ControlFlowGraph *cfg)
+        : ControlFlowGraphTransform(cfg)
+        , m_next_vreg(0) {
+}
+
+SSAConstruction::~SSAConstruction() {
+    for (auto i = m_phis.begin(); i != m_phis.end(); i++) {
+        for (auto j = i->begin(); j != i->end(); j++) {
+            delete *j;
+        }
+    }
+    for (auto i = m_blocks.begin(); i != m_blocks.end(); i++) {
+        if (*i != nullptr) {
+            for (auto j = (*i)->cbegin(); j != (*i)->cend(); j++) {
+                delete *j;
+            }
+            delete *i;
+        }
+    }
+}
+
+void SSAConstruction::execute() {
+    ControlFlowGraph *cfg = get_orig_cfg();
+    const unsigned num_blocks = cfg->get_num_blocks();
+    const unsigned num_vregs = HighLevel::get_num_vregs(cfg);
+
+    // the original vregs are only used where no definition reaches
+    // a use, so every definition gets a new vreg
+    m_next_vreg = int(num_vregs);
+    m_stacks.assign(num_vregs, std::vector<int>());
+    m_blocks.assign(num_blocks, nullptr);
+
+    place_phis();
+
+    // create the phis: their operands are filled in when the
+    // predecessors are renamed
+    m_phis.assign(num_blocks, std::vector<Instruction *>());
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *bb = *i;
+        unsigned num_preds = unsigned(cfg->get_incoming_edges(bb).size());
+        const std::vector<int> &vregs = m_phi_vregs[bb->get_id()];
+        for (auto j = vregs.cbegin(); j != vregs.cend(); j++) {
+            Instruction *phi = new Instruction(HINS_PHI, Operand(OPERAND_VREG, *j));
+            for (unsigned k = 0; k < num_preds; k++) {
+                phi->add_operand(Operand(OPERAND_VREG, *j));
+            }
+            m_phis[bb->get_id()].push_back(phi);
+        }
+    }
+
+    rename(cfg->get_entry_block());
+
+    // blocks which aren't reachable aren't in the dominator tree
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        if (m_blocks[(*i)->get_id()] == nullptr) {
+            std::vector<int> pushed;
+            rename_block(*i, pushed);
+            for (auto j = pushed.rbegin(); j != pushed.rend(); j++) {
+                m_stacks[*j].pop_back();
+            }
+        }
+    }
+}
+
+InstructionSequence *SSAConstruction::transform_basic_block(InstructionSequence *iseq) {
+    BasicBlock *bb = static_cast<BasicBlock *>(iseq);
+    auto result = new InstructionSequence();
+
+    const std::vector<Instruction *> &phis = m_phis[bb->get_id()];
+    for (auto i = phis.cbegin(); i != phis.cend(); i++) {
+        result->add_instruction((*i)->duplicate());
+    }
+
+    InstructionSequence *renamed = m_blocks[bb->get_id()];
+    for (auto i = renamed->cbegin(); i != renamed->cend(); i++) {
+        result->add_instruction((*i)->duplicate());
+    }
+
+    return result;
+}
+
+void SSAConstruction::place_phis() {
+    ControlFlowGraph *cfg = get_orig_cfg();
+    const DominatorTree &dominators = cfg->get_dominator_tree();
+    const unsigned num_blocks = cfg->get_num_blocks();
+    const unsigned num_vregs = unsigned(m_stacks.size());
+
+    LiveVregs live_vregs(cfg);
+    live_vregs.execute();
+
+    // find the (reachable) blocks defining each vreg
+    std::vector<ControlFlowGraph::BlockList> def_blocks(num_vregs);
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *bb = *i;
+        if (!dominators.is_reachable(bb)) {
+            continue;
+        }
+        for (auto j = bb->cbegin(); j != bb->cend(); j++) {
+            if (HighLevel::is_def(*j)) {
+                ControlFlowGraph::BlockList &blocks = def_blocks[(*j)->get_operand(0).get_base_reg()];
+                if (blocks.empty() || blocks.back() != bb) {
+                    blocks.push_back(bb);
+                }
+            }
+        }
+    }
+
+    // a phi is a definition too, so the blocks it's placed in are
+    // added to the work list (the arrays are marked with the vreg
+    // being placed, so they don't need to be cleared)
+    m_phi_vregs.assign(num_blocks, std::vector<int>());
+    std::vector<int> visited(num_blocks, -1), queued(num_blocks, -1);
+    for (unsigned v = 0; v < num_vregs; v++) {
+        ControlFlowGraph::BlockList work_list = def_blocks[v];
+        for (auto i = work_list.begin(); i != work_list.end(); i++) {
+            queued[(*i)->get_id()] = int(v);
+        }
+
+        while (!work_list.empty()) {
+            BasicBlock *bb = work_list.back();
+            work_list.pop_back();
+
+            const BitVector &frontier = dominators.get_dominance_frontier(bb);
+            for (unsigned y = frontier.find_first(); y != BitVector::NPOS; y = frontier.find_next(y + 1)) {
+                if (visited[y] == int(v)) {
+                    continue;
+                }
+                visited[y] = int(v);
+
+                BasicBlock *join = cfg->get_block(y);
+                if (!live_vregs.get_fact_at_beginning_of_block(join).test(v)) {
+                    continue;
+                }
+                m_phi_vregs[y].push_back(int(v));
+                if (queued[y] != int(v)) {
+                    queued[y] = int(v);
+                    work_list.push_back(join);
+                }
+            }
+        }
+    }
+}
+
+void SSAConstruction::rename(BasicBlock *bb) {
+    const DominatorTree &dom_tree = get_orig_cfg()->get_dominator_tree();
+
+    // iterative walk of the dominator tree (a procedure may have
+    // thousands of nested blocks): the definitions pushed by each block
+    // are popped once its subtree has been renamed
+    std::vector<int> pushed;
+    struct Scope {
+        BasicBlock *bb;
+        unsigned next_child;    // index of the next child to rename
+        unsigned num_pushed;    // size of pushed before the block was renamed
+    };
+    std::vector<Scope> scopes;
+
+    Scope entry = { bb, 0, 0 };
+    scopes.push_back(entry);
+    rename_block(bb, pushed);
+
+    while (!scopes.empty()) {
+        Scope &scope = scopes.back();
+        const ControlFlowGraph::BlockList &children = dom_tree.get_children(scope.bb);
+        if (scope.next_child < children.size()) {
+            BasicBlock *child = children[scope.next_child++];
+            Scope inner = { child, 0, unsigned(pushed.size()) };
+            scopes.push_back(inner);
+            rename_block(child, pushed);
+        } else {
+            while (pushed.size() > scope.num_pushed) {
+                m_stacks[pushed.back()].pop_back();
+                pushed.pop_back();
+            }
+            scopes.pop_back();
+        }
+    }
+}
+
+void SSAConstruction::rename_block(BasicBlock *bb, std::vector<int> &pushed) {
+    ControlFlowGraph *cfg = get_orig_cfg();
+    const unsigned id = bb->get_id();
+
+    const std::vector<int> &phi_vregs = m_phi_vregs[id];
+    for (unsigned k = 0; k < phi_vregs.size(); k++) {
+        int vreg = m_next_vreg++;
+        (*m_phis[id][k])[0] = Operand(OPERAND_VREG, vreg);
+        m_stacks[phi_vregs[k]].push_back(vreg);
+        pushed.push_back(phi_vregs[k]);
+    }
+
+    auto renamed = new InstructionSequence();
+    for (auto i = bb->cbegin(); i != bb->cend(); i++) {
+        Instruction *ins = (*i)->duplicate();
+
+        for (unsigned s = 0; s < ins->get_num_operands(); s++) {
+            if (!HighLevel::is_use(ins, s)) {
+                continue;
+            }
+            Operand operand = ins->get_operand(s);
+            operand.set_base_reg(get_current_def(operand.get_base_reg()));
+            if (operand.has_index_reg()) {
+                operand.set_index_reg(get_current_def(operand.get_index_reg()));
+            }
+            (*ins)[s] = operand;
+        }
+
+        if (HighLevel::is_def(ins)) {
+            Operand dest = ins->get_operand(0);
+            int vreg = m_next_vreg++;
+            m_stacks[dest.get_base_reg()].push_back(vreg);
+            pushed.push_back(dest.get_base_reg());
+            dest.set_base_reg(vreg);
+            (*ins)[0] = dest;
+        }
+
+        renamed->add_instruction(ins);
+    }
+    m_blocks[id] = renamed;
+
+    // fill in the operands of the successors' phis for this block
+    const ControlFlowGraph::EdgeList &outgoing = cfg->get_outgoing_edges(bb);
+    for (auto i = outgoing.cbegin(); i != outgoing.cend(); i++) {
+        BasicBlock *succ = (*i)->get_target();
+        const std::vector<int> &succ_vregs = m_phi_vregs[succ->get_id()];
+        if (succ_vregs.empty()) {
+            continue;
+        }
+
+        ControlFlowGraph::BlockList preds = SSA::get_predecessors(cfg, succ);
+        unsigned index = unsigned(std::find(preds.begin(), preds.end(), bb) - preds.begin());
+        for (unsigned k = 0; k < succ_vregs.size(); k++) {
+            (*m_phis[succ->get_id()][k])[index + 1] = Operand(OPERAND_VREG, get_current_def(succ_vregs[k]));
+        }
+    }
+}
+
+int SSAConstruction::get_current_def(int vreg) const {
+    const std::vector<int> &stack = m_stacks.at(vreg);
+    return stack.empty() ? vreg : stack.back();
+}
+
+////////////////////////////////////////////////////////////////////////
+// SSADestruction implementation
+////////////////////////////////////////////////////////////////////////
+
+SSADestruction::SSADestruction(ControlFlowGraph *cfg)
+        : ControlFlowGraphTransform(cfg)
+        , m_next_vreg(0) {
+}
+
+SSADestruction::~SSADestruction() {
+}
+
+void SSADestruction::execute() {
+    ControlFlowGraph *cfg = get_orig_cfg();
+    const unsigned num_vregs = HighLevel::get_num_vregs(cfg);
+    m_next_vreg = int(num_vregs);
+
+    // copies from vregs which are never defined (whose values are
+    // undefined) are omitted
+    m_defined = BitVector(num_vregs);
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        for (auto j = (*i)->cbegin(); j != (*i)->cend(); j++) {
+            if (HighLevel::is_def(*j)) {
+                m_defined.set(unsigned((*j)->get_operand(0).get_base_reg()));
+            }
+        }
+    }
+
+    m_names.resize(num_vregs);
+    for (unsigned v = 0; v < num_vregs; v++) {
+        m_names[v] = int(v);
+    }
+    coalesce();
+}
+
+ControlFlowGraph *SSADestruction::transform_cfg() {
+    ControlFlowGraph *cfg = get_orig_cfg();
+    ControlFlowGraph *result = new ControlFlowGraph();
+
+    // find the parallel copy for each edge into a block with phis
+    std::map<Edge *, std::vector<Copy> > edge_copies;
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *bb = *i;
+        ControlFlowGraph::BlockList preds = SSA::get_predecessors(cfg, bb);
+        for (unsigned j = 0; j < preds.size(); j++) {
+            std::vector<Copy> copies;
+            for (auto k = bb->cbegin(); k != bb->cend() && (*k)->get_opcode() == HINS_PHI; k++) {
+                Copy copy;
+                copy.dest = m_names[(**k)[0].get_base_reg()];
+                copy.src = (**k)[j + 1];
+                if (copy.src.get_kind() == OPERAND_VREG) {
+                    int src = copy.src.get_base_reg();
+                    if (!m_defined.test(unsigned(src)) || m_names[src] == copy.dest) {
+                        continue;
+                    }
+                    copy.src.set_base_reg(m_names[src]);
+                }
+                copies.push_back(copy);
+            }
+            if (!copies.empty()) {
+                edge_copies[cfg->lookup_edge(preds[j], bb)] = copies;
+            }
+        }
+    }
+
+    // A block's copies on its only outgoing edge go at its end (but before
+    // the branch ending it).  Otherwise the edge is critical (or is the
+    // edge from the entry block, which must stay empty), and the copies
+    // go in a new block.  New blocks are placed right after the block
+    // they're copied from, so that they never need to be placed out of
+    // line: if the branch of a conditional jump has copies, the jump is
+    // inverted so that the new block for the branch is its fallthrough.
+    std::map<BasicBlock *, Edge *> split_branches, split_fallthroughs;
+    std::map<BasicBlock *, std::string> branch_labels, block_labels;
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *bb = *i;
+        const ControlFlowGraph::EdgeList &outgoing = cfg->get_outgoing_edges(bb);
+        if (outgoing.size() == 1 && bb->get_kind() != BASICBLOCK_ENTRY) {
+            continue;
+        }
+
+        Edge *branch = nullptr, *fallthrough = nullptr;
+        for (auto j = outgoing.cbegin(); j != outgoing.cend(); j++) {
+            if (edge_copies.count(*j) > 0) {
+                ((*j)->get_kind() == EDGE_BRANCH ? branch : fallthrough) = *j;
+            }
+        }
+        if (fallthrough != nullptr) {
+            split_fallthroughs[bb] = fallthrough;
+        }
+        if (branch == nullptr) {
+            continue;
+        }
+
+        // the inverted jump goes to the new block for the fallthrough's
+        // copies (if any), or to the fallthrough successor
+        split_branches[bb] = branch;
+        BasicBlock *next = nullptr;
+        for (auto j = outgoing.cbegin(); j != outgoing.cend(); j++) {
+            if ((*j)->get_kind() == EDGE_FALLTHROUGH) {
+                next = (*j)->get_target();
+            }
+        }
+        assert(next != nullptr);
+        std::string label = branch->get_target()->get_label() + "_" + std::to_string(bb->get_id());
+        if (fallthrough != nullptr) {
+            branch_labels[bb] = label;
+        } else if (!next->has_label() && block_labels.count(next) == 0) {
+            block_labels[next] = label;
+            branch_labels[bb] = label;
+        } else {
+            branch_labels[bb] = next->has_label() ? next->get_label() : block_labels[next];
+        }
+    }
+
+    std::map<BasicBlock *, BasicBlock *> block_map;
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *orig = *i;
+        InstructionSequence *result_iseq = transform_basic_block(orig);
+        auto label = block_labels.find(orig);
+        BasicBlock *result_bb = result->create_basic_block(orig->get_kind(), label != block_labels.end() ? label->second : orig->get_label());
+        block_map[orig] = result_bb;
+
+        const ControlFlowGraph::EdgeList &outgoing = cfg->get_outgoing_edges(orig);
+        auto copies = edge_copies.end();
+        if (outgoing.size() == 1 && orig->get_kind() != BASICBLOCK_ENTRY) {
+            copies = edge_copies.find(outgoing[0]);
+        }
+        bool inverted = split_branches.count(orig) > 0;
+
+        Instruction *branch = nullptr;
+        for (auto j = result_iseq->cbegin(); j != result_iseq->cend(); j++) {
+            if ((copies != edge_copies.end() || inverted) && j + 1 == result_iseq->cend() && is_branch(*j)) {
+                branch = *j;
+            } else {
+                result_bb->add_instruction((*j)->duplicate());
+            }
+        }
+        if (copies != edge_copies.end()) {
+            sequentialize(copies->second, result_bb);
+        }
+        if (inverted) {
+            assert(branch != nullptr);
+            result_bb->add_instruction(new Instruction(invert_jump(branch->get_opcode()), Operand(branch_labels[orig])));
+        } else if (branch != nullptr) {
+            result_bb->add_instruction(branch->duplicate());
+        }
+        delete result_iseq;
+    }
+
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *orig = *i;
+        BasicBlock *source = block_map[orig];
+        auto split_branch = split_branches.find(orig);
+        auto split_fallthrough = split_fallthroughs.find(orig);
+
+        const ControlFlowGraph::EdgeList &outgoing = cfg->get_outgoing_edges(orig);
+        for (auto j = outgoing.cbegin(); j != outgoing.cend(); j++) {
+            Edge *e = *j;
+            BasicBlock *target = block_map[e->get_target()];
+
+            if (split_branch != split_branches.end() && e == split_branch->second) {
+                // the copies fall through from the inverted jump
+                BasicBlock *split = result->create_basic_block(BASICBLOCK_INTERIOR);
+                sequentialize(edge_copies[e], split);
+                split->add_instruction(new Instruction(HINS_JUMP, Operand(e->get_target()->get_label())));
+                result->create_edge(source, split, EDGE_FALLTHROUGH);
+                result->create_edge(split, target, EDGE_BRANCH);
+            } else if (split_fallthrough != split_fallthroughs.end() && e == split_fallthrough->second) {
+                // the copies fall through to the target, and are
+                // reached by the inverted jump if there is one
+                bool inverted = split_branch != split_branches.end();
+                BasicBlock *split = result->create_basic_block(BASICBLOCK_INTERIOR, inverted ? branch_labels[orig] : "");
+                sequentialize(edge_copies[e], split);
+                result->create_edge(source, split, inverted ? EDGE_BRANCH : EDGE_FALLTHROUGH);
+                result->create_edge(split, target, EDGE_FALLTHROUGH);
+            } else if (split_branch != split_branches.end() && e->get_kind() == EDGE_FALLTHROUGH) {
+                result->create_edge(source, target, EDGE_BRANCH);
+            } else {
+                result->create_edge(source, target, e->get_kind());
+            }
+        }
+    }
+
+    return result;
+}
+
+InstructionSequence *SSADestruction::transform_basic_block(InstructionSequence *iseq) {
+    auto result = new InstructionSequence();
+    for (auto i = iseq->cbegin(); i != iseq->cend(); i++) {
+        if ((*i)->get_opcode() == HINS_PHI) {
+            continue;
+        }
+
+        Instruction *ins = (*i)->duplicate();
+        for (unsigned s = 0; s < ins->get_num_operands(); s++) {
+            Operand operand = ins->get_operand(s);
+            if (operand.has_base_reg()) {
+                operand.set_base_reg(m_names[operand.get_base_reg()]);
+            }
+            if (operand.has_index_reg()) {
+                operand.set_index_reg(m_names[operand.get_index_reg()]);
+            }
+            (*ins)[s] = operand;
+        }
+        result->add_instruction(ins);
+    }
+
+    keep_nonempty(result, iseq, HINS_NOP);
+    return result;
+}
+
+void SSADestruction::coalesce() {
+    ControlFlowGraph *cfg = get_orig_cfg();
+    const unsigned num_vregs = unsigned(m_names.size());
+    const unsigned num_blocks = cfg->get_num_blocks();
+
+    // the phi resources: the (defined) vregs defined or used by phis
+    BitVector resources(num_vregs);
+    std::vector<ControlFlowGraph::BlockList> preds(num_blocks);
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        preds[(*i)->get_id()] = SSA::get_predecessors(cfg, *i);
+        for (auto j = (*i)->cbegin(); j != (*i)->cend() && (*j)->get_opcode() == HINS_PHI; j++) {
+            for (unsigned k = 0; k < (*j)->get_num_operands(); k++) {
+                Operand operand = (*j)->get_operand(k);
+                if (operand.get_kind() == OPERAND_VREG && m_defined.test(unsigned(operand.get_base_reg()))) {
+                    resources.set(unsigned(operand.get_base_reg()));
+                }
+            }
+        }
+    }
+    if (!resources.any()) {
+        return;
+    }
+
+    // liveness of the phi resources (the only vregs whose interference is
+    // needed), with the operands of a phi used at the end of the
+    // corresponding predecessors (rather than at the start of the phi's block)
+    std::vector<BitVector> live_in(num_blocks, BitVector(num_vregs));
+    std::vector<BitVector> live_out(num_blocks, BitVector(num_vregs));
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (unsigned b = num_blocks; b-- > 0; ) {
+            BasicBlock *bb = cfg->get_block(b);
+            BitVector out(num_vregs);
+            const ControlFlowGraph::EdgeList &outgoing = cfg->get_outgoing_edges(bb);
+            for (auto i = outgoing.cbegin(); i != outgoing.cend(); i++) {
+                BasicBlock *succ = (*i)->get_target();
+                out |= live_in[succ->get_id()];
+                const ControlFlowGraph::BlockList &succ_preds = preds[succ->get_id()];
+                unsigned index = unsigned(std::find(succ_preds.begin(), succ_preds.end(), bb) - succ_preds.begin());
+                for (auto j = succ->cbegin(); j != succ->cend() && (*j)->get_opcode() == HINS_PHI; j++) {
+                    Operand operand = (*j)->get_operand(index + 1);
+                    if (operand.get_kind() == OPERAND_VREG && resources.test(unsigned(operand.get_base_reg()))) {
+                        out.set(unsigned(operand.get_base_reg()));
+                    }
+                }
+            }
+
+            BitVector in = out;
+            for (auto i = bb->crbegin(); i != bb->crend(); i++) {
+                Instruction *ins = *i;
+                if (HighLevel::is_def(ins)) {
+                    in.reset(unsigned(ins->get_operand(0).get_base_reg()));
+                }
+                if (ins->get_opcode() == HINS_PHI) {
+                    continue;
+                }
+                for (unsigned k = 0; k < ins->get_num_operands(); k++) {
+                    if (HighLevel::is_use(ins, k)) {
+                        Operand operand = ins->get_operand(k);
+                        if (resources.test(unsigned(operand.get_base_reg()))) {
+                            in.set(unsigned(operand.get_base_reg()));
+                        }
+                        if (operand.has_index_reg() && resources.test(unsigned(operand.get_index_reg()))) {
+                            in.set(unsigned(operand.get_index_reg()));
+                        }
+                    }
+                }
+            }
+
+            if (in != live_in[b] || out != live_out[b]) {
+                live_in[b] = in;
+                live_out[b] = out;
+                changed = true;
+            }
+        }
+    }
+
+    // Two vregs interfere if one is live where the other is defined (except
+    // for the source and destination of a move, which hold the same value).
+    // The phis of a block are defined at the same time.  Only interference
+    // between two phi resources is needed, since only they are coalesced.
+    std::vector<std::set<int> > interference(num_vregs);
+    for (unsigned b = 0; b < num_blocks; b++) {
+        BasicBlock *bb = cfg->get_block(b);
+        BitVector live = live_out[b];
+        std::vector<int> phi_dests;
+        for (auto i = bb->crbegin(); i != bb->crend(); i++) {
+            Instruction *ins = *i;
+            if (ins->get_opcode() == HINS_PHI) {
+                phi_dests.push_back(ins->get_operand(0).get_base_reg());
+                continue;
+            }
+            if (HighLevel::is_def(ins)) {
+                int dest = ins->get_operand(0).get_base_reg();
+                int src = -1;
+                if (ins->get_opcode() == HINS_MOV && ins->get_operand(1).get_kind() == OPERAND_VREG) {
+                    src = ins->get_operand(1).get_base_reg();
+                }
+                if (resources.test(unsigned(dest))) {
+                    for (unsigned v = live.find_first(); v != BitVector::NPOS; v = live.find_next(v + 1)) {
+                        if (int(v) != dest && int(v) != src) {
+                            interference[dest].insert(int(v));
+                            interference[v].insert(dest);
+                        }
+                    }
+                }
+                live.reset(unsigned(dest));
+            }
+            for (unsigned k = 0; k < ins->get_num_operands(); k++) {
+                if (HighLevel::is_use(ins, k)) {
+                    Operand operand = ins->get_operand(k);
+                    if (resources.test(unsigned(operand.get_base_reg()))) {
+                        live.set(unsigned(operand.get_base_reg()));
+                    }
+                    if (operand.has_index_reg() && resources.test(unsigned(operand.get_index_reg()))) {
+                        live.set(unsigned(operand.get_index_reg()));
+                    }
+                }
+            }
+        }
+        for (auto i = phi_dests.begin(); i != phi_dests.end(); i++) {
+            live.set(unsigned(*i));
+        }
+        for (auto i = phi_dests.begin(); i != phi_dests.end(); i++) {
+            for (unsigned v = live.find_first(); v != BitVector::NPOS; v = live.find_next(v + 1)) {
+                if (int(v) != *i) {
+                    interference[*i].insert(int(v));
+                    interference[v].insert(*i);
+                }
+            }
+        }
+    }
+
+    // Put each phi's destination and operands in the same class unless
+    // that would put two interfering vregs in a class.  A class is named
+    // by its first member.
+    std::vector<std::vector<int> > members(num_vregs);
+    for (unsigned v = resources.find_first(); v != BitVector::NPOS; v = resources.find_next(v + 1)) {
+        members[v].push_back(int(v));
+    }
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        for (auto j = (*i)->cbegin(); j != (*i)->cend() && (*j)->get_opcode() == HINS_PHI; j++) {
+            for (unsigned k = 1; k < (*j)->get_num_operands(); k++) {
+                Operand operand = (*j)->get_operand(k);
+                if (operand.get_kind() != OPERAND_VREG || !resources.test(unsigned(operand.get_base_reg()))) {
+                    continue;
+                }
+                int a = m_names[(*j)->get_operand(0).get_base_reg()];
+                int b = m_names[operand.get_base_reg()];
+                if (a == b) {
+                    continue;
+                }
+
+                bool interferes = false;
+                for (auto x = members[a].begin(); x != members[a].end() && !interferes; x++) {
+                    for (auto y = members[b].begin(); y != members[b].end() && !interferes; y++) {
+                        interferes = interference[*x].count(*y) > 0;
+                    }
+                }
+                if (interferes) {
+                    continue;
+                }
+
+                if (b < a) {
+                    std::swap(a, b);
+                }
+                for (auto x = members[b].begin(); x != members[b].end(); x++) {
+                    m_names[*x] = a;
+                    members[a].push_back(*x);
+                }
+                members[b].clear();
+            }
+        }
+    }
+}
+
+void SSADestruction::sequentialize(std::vector<Copy> copies, InstructionSequence *out) {
+    // A copy can be done once no other pending copy reads its destination.
+    // If no copy can be done, the remaining copies form cycles: one is
+    // broken by saving a destination in a new vreg, and reading the new
+    // vreg instead.
+    while (!copies.empty()) {
+        bool progress = false;
+        for (auto i = copies.begin(); i != copies.end(); ) {
+            bool blocked = false;
+            for (auto j = copies.begin(); j != copies.end() && !blocked; j++) {
+                blocked = j != i && j->src.get_kind() == OPERAND_VREG && j->src.get_base_reg() == i->dest;
+            }
+            if (blocked) {
+                i++;
+                continue;
+            }
+
+            int opcode = (i->src.get_kind() == OPERAND_INT_LITERAL) ? HINS_LOAD_ICONST : HINS_MOV;
+            out->add_instruction(new Instruction(opcode, Operand(OPERAND_VREG, i->dest), i->src));
+            i = copies.erase(i);
+            progress = true;
+        }
+
+        if (!progress) {
+            int saved = copies.front().dest;
+            int temp = m_next_vreg++;
+            out->add_instruction(new Instruction(HINS_MOV, Operand(OPERAND_VREG, temp), Operand(OPERAND_VREG, saved)));
+            for (auto i = copies.begin(); i != copies.end(); i++) {
+                if (i->src.get_kind() == OPERAND_VREG && i->src.get_base_reg() == saved) {
+                    i->src.set_base_reg(temp);
+                }
+            }
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// DefUseChains implementation
+////////////////////////////////////////////////////////////////////////
+
+DefUseChains::DefUseChains(ControlFlowGraph *cfg)
+        : m_cfg(cfg) {
+}
+
+DefUseChains::~DefUseChains() {
+}
+
+void DefUseChains::execute() {
+    const unsigned num_vregs = HighLevel::get_num_vregs(m_cfg);
+    m_def_blocks.assign(num_vregs, nullptr);
+    m_defs.assign(num_vregs, nullptr);
+    m_uses.assign(num_vregs, std::vector<Use>());
+
+    for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+        BasicBlock *bb = *i;
+        for (auto j = bb->cbegin(); j != bb->cend(); j++) {
+            Instruction *ins = *j;
+            if (HighLevel::is_def(ins)) {
+                int vreg = ins->get_operand(0).get_base_reg();
+                assert(m_defs[vreg] == nullptr);
+                m_defs[vreg] = ins;
+                m_def_blocks[vreg] = bb;
+            }
+            for (unsigned s = 0; s < ins->get_num_operands(); s++) {
+                if (!HighLevel::is_use(ins, s)) {
+                    continue;
+                }
+                Use use = { bb, ins, s };
+                Operand operand = ins->get_operand(s);
+                m_uses[operand.get_base_reg()].push_back(use);
+                if (operand.has_index_reg() && operand.get_index_reg() != operand.get_base_reg()) {
+                    m_uses[operand.get_index_reg()].push_back(use);
+                }
+            }
+        }
+    }
+}
+
+Instruction *DefUseChains::get_def(int vreg) const {
+    return m_defs.at(vreg);
+}
+
+BasicBlock *DefUseChains::get_def_block(int vreg) const {
+    return m_def_blocks.at(vreg);
+}
+
+const std::vector<DefUseChains::Use> &DefUseChains::get_uses(int vreg) const {
+    return m_uses.at(vreg);
+}
@@ -0,0 +1,130 @@
+#ifndef SSA_H
+#define SSA_H
+
+#include <vector>
+#include "cfg.h"
+#include "cfg_transform.h"
+#include "bitvector.h"
+
+// Static single assignment form for high-level code.
+//
+// In SSA form, each vreg has exactly one definition.  Where definitions
+// of the same original vreg meet, a phi instruction selects the value
+// coming from each predecessor:
+//
+//     phi vrD, vrA, vrB
+//
+// Operand i + 1 of a phi is the value coming from the i-th predecessor
+// of its block, with the predecessors ordered by block id (see
+// SSA::get_predecessors).  Since transforms copy the blocks of a CFG
+// in order, a transform which doesn't add or remove edges preserves
+// the meaning of the phis.  The phis of a block precede its other
+// instructions.
+class SSA {
+public:
+    // get the predecessors of a block, in order of block id
+    static ControlFlowGraph::BlockList get_predecessors(ControlFlowGraph *cfg, BasicBlock *bb);
+};
+
+// Convert a CFG to SSA form (Cytron et al.).  Phis for a vreg are placed
+// in the iterated dominance frontier of the blocks defining it, but only
+// in blocks where the vreg is live (pruned SSA).  The blocks are then
+// visited in dominator tree order, renaming the vreg defined by each
+// instruction to a new vreg, and each use to the vreg of the definition
+// reaching it.
+//
+// A use which isn't reached by any definition (e.g., of a variable which
+// is never assigned) keeps the original vreg, which is never defined in
+// SSA form.
+//
+// Call execute() to place the phis and rename the vregs, then transform_cfg().
+class SSAConstruction : public ControlFlowGraphTransform {
+private:
+    std::vector<std::vector<int> > m_phi_vregs;         // original vreg of each phi in each block
+    std::vector<std::vector<Instruction *> > m_phis;    // phis in each block
+    std::vector<InstructionSequence *> m_blocks;        // renamed instructions of each block
+    std::vector<std::vector<int> > m_stacks;            // current definition of each original vreg
+    int m_next_vreg;
+
+public:
+    SSAConstruction(ControlFlowGraph *cfg);
+    virtual ~SSAConstruction();
+
+    void execute();
+
+    virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq);
+
+private:
+    void place_phis();
+    void rename(BasicBlock *bb);
+    void rename_block(BasicBlock *bb, std::vector<int> &pushed);
+    int get_current_def(int vreg) const;
+};
+
+// Convert a CFG out of SSA form.  First, the destination and operands of
+// each phi are coalesced into one vreg where their live ranges don't
+// interfere (which, for code fresh out of SSAConstruction, is almost
+// always).  The phis of each block are then replaced by a parallel copy
+// on each incoming edge: the copy is appended to the predecessor if the
+// block is its only successor, and otherwise placed in a new block which
+// splits the (critical) edge.  Each parallel copy is sequentialized into
+// moves, using a new vreg to break cycles of copies.
+//
+// Call execute() to coalesce the vregs, then transform_cfg().
+class SSADestruction : public ControlFlowGraphTransform {
+private:
+    struct Copy {
+        int dest;
+        Operand src;
+    };
+
+    BitVector m_defined;            // vregs which are defined
+    std::vector<int> m_names;       // vreg replacing each vreg
+    int m_next_vreg;
+
+public:
+    SSADestruction(ControlFlowGraph *cfg);
+    virtual ~SSADestruction();
+
+    void execute();
+
+    virtual ControlFlowGraph *transform_cfg();
+
+    // phis are only removed (the copies are added by transform_cfg)
+    virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq);
+
+private:
+    void coalesce();
+    void sequentialize(std::vector<Copy> copies, InstructionSequence *out);
+};
+
+// Definitions and uses of the vregs of a CFG in SSA form.
+class DefUseChains {
+public:
+    struct Use {
+        BasicBlock *bb;
+        Instruction *ins;
+        unsigned index;         // operand using the vreg (as its base or index)
+    };
+
+private:
+    ControlFlowGraph *m_cfg;
+    std::vector<BasicBlock *> m_def_blocks;
+    std::vector<Instruction *> m_defs;
+    std::vector<std::vector<Use> > m_uses;
+
+public:
+    DefUseChains(ControlFlowGraph *cfg);
+    ~DefUseChains();
+
+    void execute();
+
+    // get the instruction defining a vreg, and its block (nullptr if
+    // the vreg isn't defined)
+    Instruction *get_def(int vreg) const;
+    BasicBlock *get_def_block(int vreg) const;
+
+    const std::vector<Use> &get_uses(int vreg) const;
+};
+
+#endif // SSA_H
@@ -4,27 +4,27 @@
 
 #include "symbol.h"
 
-const char* Symbol::get_name() {
+const char* Symbol::get_name() const {
     return m_name;
 }
 
-Type* Symbol::get_type() {
+Type* Symbol::get_type() const {
     return m_type;
 }
 
-int Symbol::get_kind() {
+int Symbol::get_kind() const {
     return m_kind;
 }
 
-long Symbol::get_size() {
+long Symbol::get_size() const {
     return get_type()->get_size();
 }
 
-long Symbol::get_offset() {
+long Symbol::get_offset() const {
     return m_offset;
 }
 
-long Symbol::get_ival() {
+long Symbol::get_ival() const {
     return ival;
 }
 
@@ -32,12 +32,21 @@ void Symbol::set_ival(long val) {
     ival = val;
 }
 
+bool Symbol::is_static() const {
+    return m_is_static;
+}
+
+void Symbol::set_static(bool is_static) {
+    m_is_static = is_static;
+}
+
 struct Symbol *symbol_create(const char* name, Type* type, int kind, long offset) {
     Symbol *symbol = new Symbol();
     symbol->m_name = name;
     symbol->m_type = type;
     symbol->m_kind = kind;
     symbol->m_offset = offset;
+    symbol->m_is_static = false;
     return symbol;
 }
 
@@ -46,6 +55,8 @@ const char* get_name_for_kind(int kind) {
         return "TYPE";
     } else if (kind == CONST) {
         return "CONST";
+    } else if (kind == PROCEDURE) {
+        return "PROC";
     } else {
         return "VAR";
     }
@@ -12,7 +12,8 @@ struct Type;
 enum Kind {
     VARIABLE = 5000,
     CONST,
-    TYPE
+    TYPE,
+    PROCEDURE
 };
 
 struct Symbol {
@@ -22,13 +23,16 @@ public:
     int m_kind;
     long m_offset;
     long ival;
-    const char* get_name();
-    Type* get_type();
-    int get_kind();
-    long get_size();
-    long get_offset();
-    long get_ival();
+    bool m_is_static;   // global variable referenced by a procedure (not in main's frame)
+    const char* get_name() const;
+    Type* get_type() const;
+    int get_kind() const;
+    long get_size() const;
+    long get_offset() const;
+    long get_ival() const;
     void set_ival(long val);
+    bool is_static() const;
+    void set_static(bool is_static);
 };
 
 Symbol *symbol_create(const char* name, Type* type, int kind, long offset);
@@ -2,11 +2,18 @@
 // Created by Jesse Li on 10/31/20.
 //
 
-#include <cstring>
+#include <cassert>
+#include <cstdint>
 #include <string>
+#include "node.h"
 #include "symtab.h"
 #include "util.h"
 
+namespace {
+    // the number of slots of a new scope's hash table (a power of 2)
+    const unsigned INITIAL_LOG2_SLOTS = 3;
+}
+
 SymbolTable::SymbolTable(SymbolTable *outer) {
     parent = outer;
     if (outer == nullptr) {
@@ -14,62 +21,138 @@ SymbolTable::SymbolTable(SymbolTable *outer) {
     } else {
         depth = outer->depth + 1;
     }
+    index.assign(1U << INITIAL_LOG2_SLOTS, -1);
+    index_shift = 64 - INITIAL_LOG2_SLOTS;
 }
 
 void SymbolTable::insert(Symbol symbol) {
-    if (s_exists(symbol.get_name())) {
+    // a procedure's parameters and variables may shadow global names
+    symbol.m_name = intern(symbol.get_name());
+    if (find_interned_local(symbol.get_name()) != nullptr) {
         err_fatal("Name '%s' is already defined", symbol.get_name());
     }
+
+    // keep the table at most half full
+    if ((tab.size() + 1) * 2 > index.size()) {
+        grow_index();
+    }
+    unsigned slot = get_slot(symbol.get_name());
+    while (index[slot] >= 0) {
+        slot = (slot + 1) & unsigned(index.size() - 1);
+    }
+    index[slot] = int(tab.size());
     tab.push_back(symbol);
 }
 
-Symbol SymbolTable::lookup(const char *name) {
-    // searching for names in the current scope
-    // redefining a name in local scope is an error
+Symbol* SymbolTable::lookup(const char *name) {
+    Symbol* sym = find(name);
+    if (sym == nullptr) {
+        err_fatal("Undefined variable '%s'\n", name);
+    }
+    return sym;
+}
 
-    // for loop
-    for (auto sym : tab) {
-        if (std::strcmp(name, sym.get_name()) == 0) {
+Symbol* SymbolTable::find(const char *name, SymbolTable** owner) {
+    // the name is interned once, and looked up by address in each scope
+    const char* interned_name = intern(name);
+    for (SymbolTable* scope = this; scope != nullptr; scope = scope->parent) {
+        Symbol* sym = scope->find_interned_local(interned_name);
+        if (sym != nullptr) {
+            if (owner != nullptr) {
+                *owner = scope;
+            }
             return sym;
         }
     }
-    if (parent != nullptr) {
-        return parent->lookup(name);
-    }
-    err_fatal("Undefined variable '%s'\n", name);
+    return nullptr;
 }
 
-std::vector<Symbol> SymbolTable::get_symbols() {
+Symbol* SymbolTable::find_local(const char *name) {
+    return find_interned_local(intern(name));
+}
+
+const std::vector<Symbol> &SymbolTable::get_symbols() const {
     return tab;
 }
 
+Symbol* SymbolTable::get_symbol(unsigned i) {
+    assert(i < tab.size());
+    return &tab[i];
+}
+
+unsigned SymbolTable::get_index(const Symbol* sym) const {
+    assert(sym >= tab.data() && sym < tab.data() + tab.size());
+    return unsigned(sym - tab.data());
+}
+
 SymbolTable* SymbolTable::get_parent() {
     return parent;
 }
 
 long SymbolTable::get_total_size() {
     long total_size = 0;
-    for (auto sym : tab) {
+    for (auto &sym : tab) {
         total_size += sym.get_size();
     }
     return total_size;
 }
 
 bool SymbolTable::s_exists(const char* name) {
-    for (auto sym : tab) {
-        if (std::strcmp(name, sym.get_name()) == 0) {
-            return true;
-        }
+    return find(name) != nullptr;
+}
+
+bool SymbolTable::s_exists_local(const char* name) {
+    // only search the current scope (e.g., the fields of a record)
+    return find_local(name) != nullptr;
+}
+
+void SymbolTable::set_static(const char* name) {
+    Symbol* sym = find(name);
+    if (sym != nullptr) {
+        sym->set_static(true);
     }
-    if (parent) {
-        return parent->s_exists(name);
+}
+
+const char* SymbolTable::intern(const char* name) {
+    return Node::get_string_pool().intern(name);
+}
+
+unsigned SymbolTable::get_slot(const char* interned_name) const {
+    // Fibonacci hashing of the address: the high bits of the product
+    return unsigned((uintptr_t(interned_name) * 0x9E3779B97F4A7C15ULL) >> index_shift);
+}
+
+Symbol* SymbolTable::find_interned_local(const char* interned_name) {
+    unsigned slot = get_slot(interned_name);
+    while (index[slot] >= 0) {
+        Symbol &sym = tab[unsigned(index[slot])];
+        if (sym.get_name() == interned_name) {
+            return &sym;
+        }
+        slot = (slot + 1) & unsigned(index.size() - 1);
     }
+    return nullptr;
+}
 
-    return false;
+void SymbolTable::grow_index() {
+    index.assign(index.size() * 2, -1);
+    index_shift--;
+    for (unsigned i = 0; i < tab.size(); i++) {
+        unsigned slot = get_slot(tab[i].get_name());
+        while (index[slot] >= 0) {
+            slot = (slot + 1) & unsigned(index.size() - 1);
+        }
+        index[slot] = int(i);
+    }
 }
 
 void SymbolTable::print_sym_tab() {
-    for (auto sym : tab) {
+    for (auto &sym : tab) {
+
+        if (sym.get_kind() == PROCEDURE) {
+            // print the parameters and local variables first
+            sym.get_type()->symtab->print_sym_tab();
+        }
 
         if (sym.get_kind() == RECORD) {
             // print record internals first
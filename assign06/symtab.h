@@ -11,20 +11,46 @@
 
 struct Symbol;
 
+// A scope: its symbols are kept in order of definition, and found by
+// an open-addressing hash table (with linear probing) keyed by their
+// names, which are interned (in the StringPool of the AST's strings),
+// so that names are compared and hashed by address.  A name is looked
+// up in the enclosing scopes if it isn't defined in this one, so a
+// scope's names shadow those of the enclosing scopes.
 struct SymbolTable {
 private:
     std::vector<Symbol> tab;
+    std::vector<int> index;     // index in tab of each slot's symbol (or -1)
+    unsigned index_shift;       // 64 - log2(number of slots)
     SymbolTable* parent;
     int depth;
 public:
     SymbolTable(SymbolTable* outer);
     void insert(Symbol symbol);
-    Symbol lookup(const char* name);
-    std::vector<Symbol> get_symbols();
+    // the symbol defined for a name (fatal error if there is none)
+    Symbol* lookup(const char* name);
+    // the symbol defined for a name, or null if there is none; if owner
+    // isn't null, it's set to the scope defining the name
+    Symbol* find(const char* name, SymbolTable** owner = nullptr);
+    // the symbol defined for a name in this scope only, or null
+    Symbol* find_local(const char* name);
+    // the symbols in order of definition (valid until the next insert)
+    const std::vector<Symbol> &get_symbols() const;
+    // a symbol by its position in the scope (as bound to a Node), and
+    // the position of a symbol of this scope
+    Symbol* get_symbol(unsigned i);
+    unsigned get_index(const Symbol* sym) const;
     SymbolTable* get_parent();
     long get_total_size();
     void print_sym_tab();
     bool s_exists(const char* name);
+    bool s_exists_local(const char* name);
+    void set_static(const char* name);
+private:
+    static const char* intern(const char* name);
+    unsigned get_slot(const char* interned_name) const;
+    Symbol* find_interned_local(const char* interned_name);
+    void grow_index();
 };
 
 
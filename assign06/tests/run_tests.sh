@@ -0,0 +1,59 @@
+#!/bin/sh
+# Regression tests: each tests/NAME.in is compiled without optimization
+# and at each optimization level, linked with the runtime library, and
+# run, reading tests/NAME.data if there is one.  Its output must match
+# tests/NAME.expect.  If there is a tests/NAME.flags, each of its lines
+# gives options added to every compilation, and the test is repeated
+# with each line.
+#
+# Run from the directory of the compiler and runtime.o ("make check").
+
+out=$(mktemp -d) || exit 1
+trap 'rm -rf "$out"' EXIT
+
+failed=0
+
+# run_test NAME DATA OPTIONS
+run_test() {
+  name=$1
+  data=$2
+  extra=$3
+  for level in none 0 1 2 3; do
+    opts="$extra"
+    [ "$level" != none ] && opts="-O $level $extra"
+    desc="$level${extra:+ $extra}"
+    if ! ./compiler $opts "tests/$name.in" > "$out/$name.s"; then
+      echo "FAIL $name ($desc): compilation failed"
+      failed=1
+      continue
+    fi
+    if ! gcc -no-pie -o "$out/$name" "$out/$name.s" runtime.o 2> "$out/$name.err"; then
+      echo "FAIL $name ($desc): assembly failed"
+      cat "$out/$name.err"
+      failed=1
+      continue
+    fi
+    if ! "$out/$name" < "$data" | cmp -s - "tests/$name.expect"; then
+      echo "FAIL $name ($desc): wrong output"
+      failed=1
+    fi
+  done
+}
+
+for src in tests/*.in; do
+  name=$(basename "$src" .in)
+  data=/dev/null
+  [ -f "tests/$name.data" ] && data="tests/$name.data"
+  if [ -f "tests/$name.flags" ]; then
+    while read -r extra; do
+      run_test "$name" "$data" "$extra"
+    done < "tests/$name.flags"
+  else
+    run_test "$name" "$data" ""
+  fi
+done
+
+if [ $failed -eq 0 ]; then
+  echo "All tests passed"
+fi
+exit $failed
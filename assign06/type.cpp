@@ -43,6 +43,16 @@ Type* type_create_record(SymbolTable* symbolTable) {
     return record;
 }
 
+Type* type_create_signature(SymbolTable* scope, long paramCount, Type* returnType) {
+    Type* signature = new Type(SIGNATURE);
+    signature->symtab = scope;
+    signature->paramCount = paramCount;
+    signature->returnType = returnType;
+    // procedures take no storage
+    signature->size = 0;
+    return signature;
+}
+
 std::string Type::to_string() {
     switch(realType){
         case PRIMITIVE:
@@ -51,7 +61,7 @@ std::string Type::to_string() {
             return cpputil::format("ARRAY %ld OF %s", arraySize, arrayElementType->to_string().c_str());
         case RECORD: {
             std::string record_str = "RECORD (";
-            std::vector<Symbol> symbols = symtab->get_symbols();
+            const std::vector<Symbol> &symbols = symtab->get_symbols();
             for (int i = 0; i < symbols.size(); i++) {
                 if (i == 0) {
                     record_str += symbols[i].get_type()->to_string();
@@ -62,6 +72,21 @@ std::string Type::to_string() {
             record_str += ")";
             return record_str;
         }
+        case SIGNATURE: {
+            std::string signature_str = returnType == nullptr ? "PROCEDURE (" : "FUNCTION (";
+            const std::vector<Symbol> &symbols = symtab->get_symbols();
+            for (long i = 0; i < paramCount; i++) {
+                if (i > 0) {
+                    signature_str += " x ";
+                }
+                signature_str += symbols[i].get_type()->to_string();
+            }
+            signature_str += ")";
+            if (returnType != nullptr) {
+                signature_str += " : " + returnType->to_string();
+            }
+            return signature_str;
+        }
         default:
             return "<<unknown>>";
     }
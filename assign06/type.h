@@ -13,7 +13,8 @@ struct SymbolTable;
 enum RealType {
     PRIMITIVE = 6000,
     ARRAY,
-    RECORD
+    RECORD,
+    SIGNATURE
 };
 
 struct Type {
@@ -30,6 +31,11 @@ public:
     const char* name;
 
     SymbolTable* symtab;
+
+    // a procedure's signature: its parameters are the first paramCount
+    // symbols of its scope (symtab), returnType is null for a PROCEDURE
+    long paramCount;
+    Type* returnType;
 public:
     Type(int realType);
     ~Type();
@@ -45,4 +51,6 @@ Type* type_create_array(long size, Type* elementType);
 
 Type* type_create_record(SymbolTable* symbolTable);
 
+Type* type_create_signature(SymbolTable* scope, long paramCount, Type* returnType);
+
 #endif //ASSIGN03_TYPE_H
@@ -0,0 +1,482 @@
+#include <cassert>
+#include <climits>
+#include "cfg.h"
+#include "highlevel.h"
+#include "loops.h"
+#include "unroll.h"
+
+namespace {
+    // limits on the code added by unrolling: the number of instructions
+    // in the unrolled body, and the trip count of a fully unrolled loop
+    const unsigned MAX_UNROLLED_SIZE = 64;
+    const long MAX_FULL_TRIP_COUNT = 16;
+
+    // the most blocks walked back from a loop to find the initial value
+    // of its induction variable
+    const unsigned MAX_ENTRY_BLOCKS = 8;
+
+    bool is_conditional_branch(Instruction *ins) {
+        switch (ins->get_opcode()) {
+            case HINS_JE: case HINS_JNE: case HINS_JLT:
+            case HINS_JLTE: case HINS_JGT: case HINS_JGTE:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // the branch taken when the operands of the cmpi are swapped
+    int mirror(int opcode) {
+        switch (opcode) {
+            case HINS_JLT:  return HINS_JGT;
+            case HINS_JLTE: return HINS_JGTE;
+            case HINS_JGT:  return HINS_JLT;
+            case HINS_JGTE: return HINS_JLTE;
+            default:        return opcode;
+        }
+    }
+
+    // the branch taken when the comparison fails
+    int invert(int opcode) {
+        switch (opcode) {
+            case HINS_JLT:  return HINS_JGTE;
+            case HINS_JLTE: return HINS_JGT;
+            case HINS_JGT:  return HINS_JLTE;
+            case HINS_JGTE: return HINS_JLT;
+            default:        assert(false); return opcode;
+        }
+    }
+
+    bool fits_immediate(long value) {
+        return value >= INT_MIN && value <= INT_MAX;
+    }
+
+    bool defines(Instruction *ins, int vreg) {
+        return HighLevel::is_def(ins) && ins->get_operand(0).get_kind() == OPERAND_VREG &&
+               ins->get_operand(0).get_base_reg() == vreg;
+    }
+
+    bool is_vreg(const Operand &op, int vreg) {
+        return op.get_kind() == OPERAND_VREG && op.get_base_reg() == vreg;
+    }
+
+    // the body's instructions, other than a jump to the test
+    unsigned get_body_size(BasicBlock *body) {
+        unsigned size = body->get_length();
+        if (size > 0 && body->get_last()->get_opcode() == HINS_JUMP) {
+            size--;
+        }
+        return size;
+    }
+}
+
+LoopUnrolling::LoopUnrolling(ControlFlowGraph *cfg, unsigned factor)
+        : ControlFlowGraphTransform(cfg)
+        , m_loops(&cfg->get_loop_forest())
+        , m_factor(factor)
+        , m_next_vreg(0) {
+}
+
+LoopUnrolling::~LoopUnrolling() {
+}
+
+void LoopUnrolling::execute() {
+    // new vregs are numbered after the existing ones
+    m_next_vreg = int(HighLevel::get_num_vregs(get_orig_cfg()));
+
+    for (unsigned i = 0; i < m_loops->get_num_loops(); i++) {
+        NaturalLoop *loop = m_loops->get_loop(i);
+        std::string name = get_name(loop);
+
+        CountedLoop counted;
+        std::string reason;
+        if (!find_counted_loop(loop, counted, reason)) {
+            m_report.push_back(name + ": not unrolled: " + reason);
+            continue;
+        }
+
+        long initial;
+        const unsigned body_size = get_body_size(counted.body);
+        const Operand bound = get_bound(counted);
+        counted.trip_count = -1;
+        if (bound.get_kind() == OPERAND_INT_LITERAL && get_entry_value(loop, counted.iv, initial)) {
+            counted.trip_count = get_trip_count(counted, initial);
+        }
+
+        if (counted.trip_count >= 0 && counted.trip_count * long(body_size) <= long(MAX_UNROLLED_SIZE)) {
+            counted.factor = 0;
+            counted.limit_vreg = -1;
+            m_unrolled.push_back(counted);
+            m_report.push_back(name + ": fully unrolled (" + std::to_string(counted.trip_count) + " iterations)");
+            continue;
+        }
+
+        // as many copies as the limits allow (there's no point in more
+        // copies than iterations)
+        unsigned factor = m_factor;
+        if (counted.trip_count >= 0 && long(factor) > counted.trip_count) {
+            factor = unsigned(counted.trip_count);
+        }
+        while (factor >= 2 && factor * body_size > MAX_UNROLLED_SIZE) {
+            factor--;
+        }
+        if (factor < 2) {
+            m_report.push_back(name + ": not unrolled: " +
+                               (m_factor < 2 ? "unrolling disabled" : "body too large"));
+            continue;
+        }
+
+        // the test of the unrolled loop compares with the bound moved in by
+        // (factor-1) steps
+        long distance = long(factor - 1) * counted.step;
+        if (!fits_immediate(distance) ||
+            (bound.get_kind() == OPERAND_INT_LITERAL && !fits_immediate(bound.get_int_value() - distance))) {
+            m_report.push_back(name + ": not unrolled: bound out of range");
+            continue;
+        }
+        counted.factor = factor;
+        counted.limit_vreg = (bound.get_kind() == OPERAND_INT_LITERAL) ? -1 : m_next_vreg++;
+        m_unrolled.push_back(counted);
+        m_report.push_back(name + ": unrolled " + std::to_string(factor) + " times");
+    }
+}
+
+ControlFlowGraph *LoopUnrolling::transform_cfg() {
+    ControlFlowGraph *cfg = get_orig_cfg();
+    ControlFlowGraph *result = new ControlFlowGraph();
+
+    // unrolled loop containing each body or test block
+    std::map<BasicBlock *, unsigned> unrolled_blocks;
+    for (unsigned i = 0; i < m_unrolled.size(); i++) {
+        unrolled_blocks[m_unrolled[i].body] = i;
+        unrolled_blocks[m_unrolled[i].test] = i;
+    }
+
+    // Copy the blocks.  A fully unrolled loop is replaced by a single
+    // block (with the header's label).  A partially unrolled loop gets a
+    // guard and an unrolled body in front of its test block, which falls
+    // through to the guard's failure target (the test block) when its own
+    // test fails, so the test block needs a label.
+    std::map<BasicBlock *, BasicBlock *> block_map;
+    std::vector<BasicBlock *> guards(m_unrolled.size(), nullptr);
+    std::vector<BasicBlock *> unrolled_bodies(m_unrolled.size(), nullptr);
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *orig = *i;
+        auto u = unrolled_blocks.find(orig);
+        const CountedLoop *counted = (u != unrolled_blocks.end()) ? &m_unrolled[u->second] : nullptr;
+
+        if (counted != nullptr && counted->factor == 0) {
+            if (orig != counted->loop->header) {
+                continue;
+            }
+            BasicBlock *bb = result->create_basic_block(BASICBLOCK_INTERIOR, orig->get_label());
+            for (long k = 0; k < counted->trip_count; k++) {
+                add_body(*counted, bb);
+            }
+            if (bb->get_length() == 0) {
+                bb->add_instruction(new Instruction(HINS_NOP));
+            }
+            block_map[counted->body] = block_map[counted->test] = bb;
+            continue;
+        }
+
+        std::string label = orig->get_label();
+        if (counted != nullptr && orig == counted->test) {
+            const unsigned index = u->second;
+            const std::string base = counted->body->get_label();
+            if (label.empty()) {
+                label = base + "_test";
+            }
+            BasicBlock *guard = result->create_basic_block(BASICBLOCK_INTERIOR, base + "_unrolled_test");
+            BasicBlock *body = result->create_basic_block(BASICBLOCK_INTERIOR, base + "_unrolled");
+
+            // the guard and the unrolled body compare with the limit
+            // instead of the bound
+            Instruction *compare = orig->get_instruction(0);
+            const int opcode = orig->get_last()->get_opcode();
+            Operand bound = get_bound(*counted);
+            long distance = long(counted->factor - 1) * counted->step;
+            Operand limit;
+            if (counted->limit_vreg >= 0) {
+                limit = Operand(OPERAND_VREG, counted->limit_vreg);
+                guard->add_instruction(new Instruction(HINS_INT_SUB, limit, bound, Operand(OPERAND_INT_LITERAL, distance)));
+            } else {
+                limit = Operand(OPERAND_INT_LITERAL, bound.get_int_value() - distance);
+            }
+            Instruction *limit_compare = compare->duplicate();
+            (*limit_compare)[1 - counted->iv_slot] = limit;
+
+            guard->add_instruction(limit_compare->duplicate());
+            guard->add_instruction(new Instruction(invert(opcode), Operand(label)));
+
+            for (unsigned k = 0; k < counted->factor; k++) {
+                add_body(*counted, body);
+            }
+            body->add_instruction(limit_compare);
+            body->add_instruction(new Instruction(opcode, Operand(body->get_label())));
+
+            guards[index] = guard;
+            unrolled_bodies[index] = body;
+        }
+
+        BasicBlock *bb = result->create_basic_block(orig->get_kind(), label);
+        InstructionSequence *iseq = transform_basic_block(orig);
+        for (auto j = iseq->cbegin(); j != iseq->cend(); j++) {
+            bb->add_instruction((*j)->duplicate());
+        }
+        delete iseq;
+        block_map[orig] = bb;
+    }
+
+    // Copy the edges.  The edges within a fully unrolled loop are gone,
+    // and every edge into the test block of a partially unrolled loop goes
+    // to its guard instead.
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        const ControlFlowGraph::EdgeList &outgoing = cfg->get_outgoing_edges(*i);
+        for (auto j = outgoing.cbegin(); j != outgoing.cend(); j++) {
+            Edge *e = *j;
+            auto s = unrolled_blocks.find(e->get_source());
+            auto t = unrolled_blocks.find(e->get_target());
+            if (s != unrolled_blocks.end() && t != unrolled_blocks.end() && s->second == t->second &&
+                m_unrolled[s->second].factor == 0) {
+                continue;
+            }
+
+            BasicBlock *source = block_map[e->get_source()];
+            BasicBlock *target = block_map[e->get_target()];
+            if (t != unrolled_blocks.end() && m_unrolled[t->second].factor > 0 &&
+                e->get_target() == m_unrolled[t->second].test) {
+                target = guards[t->second];
+                if (e->get_kind() == EDGE_BRANCH) {
+                    Instruction *branch = source->get_last();
+                    (*branch)[0] = Operand(target->get_label());
+                }
+            }
+            result->create_edge(source, target, e->get_kind());
+        }
+    }
+
+    for (unsigned i = 0; i < m_unrolled.size(); i++) {
+        if (m_unrolled[i].factor > 0) {
+            BasicBlock *test = block_map[m_unrolled[i].test];
+            result->create_edge(guards[i], unrolled_bodies[i], EDGE_FALLTHROUGH);
+            result->create_edge(guards[i], test, EDGE_BRANCH);
+            result->create_edge(unrolled_bodies[i], unrolled_bodies[i], EDGE_BRANCH);
+            result->create_edge(unrolled_bodies[i], test, EDGE_FALLTHROUGH);
+        }
+    }
+
+    return result;
+}
+
+InstructionSequence *LoopUnrolling::transform_basic_block(InstructionSequence *iseq) {
+    auto out = new InstructionSequence();
+    for (auto i = iseq->cbegin(); i != iseq->cend(); i++) {
+        out->add_instruction((*i)->duplicate());
+    }
+    return out;
+}
+
+bool LoopUnrolling::find_counted_loop(NaturalLoop *loop, CountedLoop &counted, std::string &reason) {
+    ControlFlowGraph *cfg = get_orig_cfg();
+    if (!loop->children.empty() || loop->blocks.count() != 2) {
+        reason = "body is not a single block";
+        return false;
+    }
+
+    // the test block ends with cmpi and a branch back to the body, and
+    // falls through out of the loop
+    BasicBlock *test = nullptr, *body = nullptr;
+    for (unsigned id = loop->blocks.find_first(); id != BitVector::NPOS; id = loop->blocks.find_next(id + 1)) {
+        BasicBlock *bb = cfg->get_block(id);
+        if (bb->get_length() > 0 && is_conditional_branch(bb->get_last())) {
+            test = bb;
+        } else {
+            body = bb;
+        }
+    }
+    if (test == nullptr || body == nullptr || test->get_length() != 2 ||
+        test->get_instruction(0)->get_opcode() != HINS_INT_COMPARE) {
+        reason = "not a counted loop";
+        return false;
+    }
+    const ControlFlowGraph::EdgeList &test_edges = cfg->get_outgoing_edges(test);
+    const ControlFlowGraph::EdgeList &body_edges = cfg->get_outgoing_edges(body);
+    for (auto i = test_edges.cbegin(); i != test_edges.cend(); i++) {
+        bool to_body = (*i)->get_target() == body;
+        if (to_body != ((*i)->get_kind() == EDGE_BRANCH) || (!to_body && loop->contains((*i)->get_target()))) {
+            reason = "not a counted loop";
+            return false;
+        }
+    }
+    if (body_edges.size() != 1 || body_edges[0]->get_target() != test) {
+        reason = "not a counted loop";
+        return false;
+    }
+
+    // one of the operands of cmpi is an induction variable, and the other
+    // is a literal or a vreg which isn't defined in the loop
+    Instruction *compare = test->get_instruction(0);
+    for (unsigned slot = 0; slot < 2; slot++) {
+        Operand iv = compare->get_operand(slot), bound = compare->get_operand(1 - slot);
+        if (iv.get_kind() != OPERAND_VREG ||
+            (bound.get_kind() != OPERAND_INT_LITERAL && bound.get_kind() != OPERAND_VREG)) {
+            continue;
+        }
+
+        Instruction *def = nullptr;
+        unsigned num_defs = 0;
+        bool bound_is_invariant = true;
+        for (auto i = body->cbegin(); i != body->cend(); i++) {
+            if (defines(*i, iv.get_base_reg())) {
+                def = *i;
+                num_defs++;
+            }
+            if (bound.get_kind() == OPERAND_VREG && defines(*i, bound.get_base_reg())) {
+                bound_is_invariant = false;
+            }
+        }
+        long step;
+        if (num_defs != 1 || !bound_is_invariant || !get_increment(def, body, iv.get_base_reg(), step)) {
+            continue;
+        }
+
+        // the loop continues while the IV is below (or above) the bound,
+        // and the IV goes up (or down)
+        int opcode = (slot == 0) ? test->get_last()->get_opcode() : mirror(test->get_last()->get_opcode());
+        bool up = (opcode == HINS_JLT || opcode == HINS_JLTE);
+        bool down = (opcode == HINS_JGT || opcode == HINS_JGTE);
+        if ((up && step > 0) || (down && step < 0)) {
+            counted.loop = loop;
+            counted.body = body;
+            counted.test = test;
+            counted.iv = iv.get_base_reg();
+            counted.step = step;
+            counted.iv_slot = slot;
+            return true;
+        }
+    }
+
+    reason = "not a counted loop";
+    return false;
+}
+
+bool LoopUnrolling::get_entry_value(NaturalLoop *loop, int vreg, long &value) {
+    // the value assigned by the last def of the vreg on the (only) path
+    // into the loop, if it's a literal
+    ControlFlowGraph *cfg = get_orig_cfg();
+    BasicBlock *bb = nullptr;
+    const ControlFlowGraph::EdgeList &incoming = cfg->get_incoming_edges(loop->header);
+    for (auto i = incoming.cbegin(); i != incoming.cend(); i++) {
+        if (!loop->contains((*i)->get_source())) {
+            if (bb != nullptr) {
+                return false;
+            }
+            bb = (*i)->get_source();
+        }
+    }
+
+    for (unsigned n = 0; bb != nullptr && n < MAX_ENTRY_BLOCKS; n++) {
+        for (auto i = bb->crbegin(); i != bb->crend(); i++) {
+            if (!defines(*i, vreg)) {
+                continue;
+            }
+            Operand src = (*i)->get_operand(1);
+            if (((*i)->get_opcode() != HINS_LOAD_ICONST && (*i)->get_opcode() != HINS_MOV) ||
+                src.get_kind() != OPERAND_INT_LITERAL) {
+                return false;
+            }
+            value = src.get_int_value();
+            return true;
+        }
+
+        // a block with a single predecessor is only reached through it
+        const ControlFlowGraph::EdgeList &preds = cfg->get_incoming_edges(bb);
+        bb = (preds.size() == 1) ? preds[0]->get_source() : nullptr;
+    }
+    return false;
+}
+
+long LoopUnrolling::get_trip_count(const CountedLoop &counted, long initial) {
+    // simulate the tests (the IV wraps as it does in the generated code);
+    // a REPEAT loop, entered at its body, executes it before the first test
+    const long bound = get_bound(counted).get_int_value();
+    long iv = initial, trip_count = 0;
+    if (counted.loop->header == counted.body) {
+        trip_count++;
+        iv = long((unsigned long) iv + (unsigned long) counted.step);
+    }
+    while (passes_test(counted, iv, bound)) {
+        if (++trip_count > MAX_FULL_TRIP_COUNT) {
+            return -1;
+        }
+        iv = long((unsigned long) iv + (unsigned long) counted.step);
+    }
+    return trip_count;
+}
+
+bool LoopUnrolling::passes_test(const CountedLoop &counted, long iv_value, long bound) const {
+    long left = (counted.iv_slot == 0) ? iv_value : bound;
+    long right = (counted.iv_slot == 0) ? bound : iv_value;
+    switch (counted.test->get_last()->get_opcode()) {
+        case HINS_JLT:  return left < right;
+        case HINS_JLTE: return left <= right;
+        case HINS_JGT:  return left > right;
+        case HINS_JGTE: return left >= right;
+        default:        assert(false); return false;
+    }
+}
+
+void LoopUnrolling::add_body(const CountedLoop &counted, BasicBlock *bb) {
+    const unsigned size = get_body_size(counted.body);
+    for (unsigned i = 0; i < size; i++) {
+        bb->add_instruction(counted.body->get_instruction(i)->duplicate());
+    }
+}
+
+Operand LoopUnrolling::get_bound(const CountedLoop &counted) const {
+    return counted.test->get_instruction(0)->get_operand(1 - counted.iv_slot);
+}
+
+bool LoopUnrolling::get_increment(Instruction *def, BasicBlock *bb, int iv, long &step) {
+    // addi iv, iv, $s (or subi), or mov iv, t where t was set to iv plus a constant
+    if (def->get_opcode() == HINS_MOV && def->get_operand(1).get_kind() == OPERAND_VREG) {
+        int temp = def->get_operand(1).get_base_reg();
+        Instruction *add = nullptr;
+        for (auto i = bb->cbegin(); i != bb->cend() && *i != def; i++) {
+            if (defines(*i, temp)) {
+                add = *i;
+            }
+        }
+        if (add == nullptr) {
+            return false;
+        }
+        def = add;
+    }
+
+    Operand a = def->get_operand(1), b = def->get_operand(2);
+    switch (def->get_opcode()) {
+        case HINS_INT_ADD:
+            if (is_vreg(a, iv) && b.get_kind() == OPERAND_INT_LITERAL) {
+                step = b.get_int_value();
+            } else if (is_vreg(b, iv) && a.get_kind() == OPERAND_INT_LITERAL) {
+                step = a.get_int_value();
+            } else {
+                return false;
+            }
+            break;
+        case HINS_INT_SUB:
+            if (!is_vreg(a, iv) || b.get_kind() != OPERAND_INT_LITERAL || b.get_int_value() == LONG_MIN) {
+                return false;
+            }
+            step = -b.get_int_value();
+            break;
+        default:
+            return false;
+    }
+    return step != 0;
+}
+
+std::string LoopUnrolling::get_name(NaturalLoop *loop) {
+    return "loop at " + (loop->header->has_label() ? loop->header->get_label() : std::string("unlabeled block"));
+}
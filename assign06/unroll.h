@@ -0,0 +1,78 @@
+#ifndef UNROLL_H
+#define UNROLL_H
+
+#include <vector>
+#include <map>
+#include <string>
+#include "cfg.h"
+#include "cfg_transform.h"
+#include "loops.h"
+
+// Unrolling of counted loops in high-level code.
+//
+// WHILE and REPEAT loops whose body is a single block are translated as
+// the body followed by a test block (cmpi, then a branch back to the
+// body).  Such a loop is counted if one of the compared operands is an
+// induction variable, whose only definition in the loop adds a constant
+// step to it (directly, or through a temporary moved to it), and the
+// other is a literal or a vreg not defined in the loop (the bound), and
+// the comparison (<, <=, >, or >=) goes the same way as the step.
+//
+// If the value of the induction variable on entry to the loop is a known
+// constant and the trip count is small, the loop is fully unrolled: it's
+// replaced by a block with one copy of the body per iteration.
+// Otherwise, a copy of the loop with the body repeated factor times is
+// placed in front of the test.  It's entered (and repeated) while factor
+// more iterations would be executed, i.e., while the induction variable
+// still passes the test with the bound moved in by (factor-1) steps.
+// (Like induction variable strength reduction, this assumes that moving
+// the bound doesn't overflow.)  The original loop runs the remaining
+// iterations, going back to the unrolled loop's guard after each one.
+//
+// Call execute() to decide which loops to unroll, then transform_cfg().
+// get_report() describes the decision made for each loop.
+class LoopUnrolling : public ControlFlowGraphTransform {
+private:
+    // a counted loop: the body and test blocks, and the induction variable
+    struct CountedLoop {
+        NaturalLoop *loop;
+        BasicBlock *body, *test;
+        int iv;
+        long step;
+        unsigned iv_slot;       // operand of the test's cmpi which is the IV
+        long trip_count;        // -1 if unknown
+        unsigned factor;        // copies of the body (0 if fully unrolled)
+        int limit_vreg;         // vreg holding the moved bound (-1 if it's a literal)
+    };
+
+    const LoopForest *m_loops;
+    unsigned m_factor;
+    std::vector<CountedLoop> m_unrolled;
+    std::vector<std::string> m_report;
+    int m_next_vreg;
+
+public:
+    LoopUnrolling(ControlFlowGraph *cfg, unsigned factor);
+    virtual ~LoopUnrolling();
+
+    // find the counted loops, and decide how to unroll them
+    void execute();
+
+    virtual ControlFlowGraph *transform_cfg();
+    virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq);
+
+    // one line per loop considered, describing what was done with it
+    const std::vector<std::string> &get_report() const { return m_report; }
+
+private:
+    bool find_counted_loop(NaturalLoop *loop, CountedLoop &counted, std::string &reason);
+    bool get_entry_value(NaturalLoop *loop, int vreg, long &value);
+    long get_trip_count(const CountedLoop &counted, long initial);
+    bool passes_test(const CountedLoop &counted, long iv_value, long bound) const;
+    void add_body(const CountedLoop &counted, BasicBlock *bb);
+    Operand get_bound(const CountedLoop &counted) const;
+    static bool get_increment(Instruction *def, BasicBlock *bb, int iv, long &step);
+    static std::string get_name(NaturalLoop *loop);
+};
+
+#endif // UNROLL_H
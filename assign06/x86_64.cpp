@@ -23,8 +23,16 @@ std::string PrintX86_64InstructionSequence::get_opcode_name(int opcode) {
         case MINS_CMPQ: return "cmpq";
         case MINS_CALL: return "call";
         case MINS_IMULQ: return "imulq";
+        case MINS_IMULQ_WIDE: return "imulq";
         case MINS_IDIVQ: return "idivq";
         case MINS_CQTO: return "cqto";
+        case MINS_SALQ: return "salq";
+        case MINS_SHRQ: return "shrq";
+        case MINS_SARQ: return "sarq";
+        case MINS_ANDQ: return "andq";
+        case MINS_PUSHQ: return "pushq";
+        case MINS_POPQ: return "popq";
+        case MINS_TAIL_JMP: return "jmp";
         default:
             assert(false);
             s = "<invalid>";
@@ -66,18 +74,18 @@ X86_64ControlFlowGraphBuilder::~X86_64ControlFlowGraphBuilder() {
 }
 
 // It's necessary to override this method for x86-64, because call instructions
-// have a single label as an Operand, but for our purposes, should not be considered
-// as a branch.
+// (and jumps to other functions) have a single label as an Operand, but for our
+// purposes, should not be considered as a branch.
 bool X86_64ControlFlowGraphBuilder::is_branch(Instruction *ins) {
-    if (ins->get_opcode() == MINS_CALL) {
+    if (ins->get_opcode() == MINS_CALL || ins->get_opcode() == MINS_TAIL_JMP) {
         return false;
     }
     return ControlFlowGraphBuilder::is_branch(ins);
 }
 
 bool X86_64ControlFlowGraphBuilder::falls_through(Instruction *ins) {
-    // only the jmp instruction does not fall through
-    return ins->get_opcode() != MINS_JMP;
+    // only the jmp instructions do not fall through
+    return ins->get_opcode() != MINS_JMP && ins->get_opcode() != MINS_TAIL_JMP;
 }
 
 X86_64ControlFlowGraphPrinter::X86_64ControlFlowGraphPrinter(ControlFlowGraph *cfg)
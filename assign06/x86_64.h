@@ -38,8 +38,16 @@ enum X86_64Instruction {
     MINS_CMPQ,
     MINS_CALL,
     MINS_IMULQ,
+    MINS_IMULQ_WIDE,    // one operand form: %rdx:%rax = %rax * src
     MINS_IDIVQ,
     MINS_CQTO,
+    MINS_SALQ,
+    MINS_SHRQ,
+    MINS_SARQ,
+    MINS_ANDQ,
+    MINS_PUSHQ,
+    MINS_POPQ,
+    MINS_TAIL_JMP,      // jmp to another function, ending this one (a tail call)
 };
 
 class PrintX86_64InstructionSequence : public PrintInstructionSequence {